@@ -36,6 +36,8 @@ argParser.add_argument(
     '--stage2', help="Run only Stage 2 tests.", action='store_true', dest='stage2')
 argParser.add_argument('--bytes', help="Display bytes of expected and received output.",
                        action='store_true', dest='showBytes')
+argParser.add_argument('--jit', help="Run rv32sim with its JIT enabled (-j).",
+                       action='store_true', dest='useJit')
 arguments = argParser.parse_args()
 
 if (arguments.beSilent and arguments.beNoisy):
@@ -190,6 +192,9 @@ for testCategory in testCategories:
         if arguments.beVerbose:
             rvsimArgsList.append('-v')
 
+        if arguments.useJit:
+            rvsimArgsList.append('-j')
+
         if testCategory.name == 'stage_2_tests':
             rvsimArgsList.append('-s2')
 
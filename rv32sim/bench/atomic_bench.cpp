@@ -0,0 +1,132 @@
+/*
+   Contention benchmark for the A extension: N harts all incrementing one
+   shared counter, either with AMOADD.W or with an LR.W/SC.W retry loop, under
+   both hart schedules. Reports millions of increments per second, and checks
+   that none were lost.
+
+   Free-running harts only contend for real with more than one host core.
+
+   Build with `make bench` and run ./bench/atomic_bench.
+*/
+
+#include <chrono>
+#include <cstdio>
+
+#include "bench.h"
+#include "harts.h"
+#include "memory.h"
+#include "processor.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static constexpr uint32_t JAL_To_Self = 0x0000006F; // jal x0, 0
+
+static constexpr uint32_t Code_Start = 0x00001000;
+static constexpr uint32_t Counter    = 0x00008000;
+
+/// x10 holds the counter's address and x11 how many increments are left.
+/// Both loops finish by spinning at Done_Offset.
+static const uint32_t AMO_Loop[] = {
+   I_Type( 0x13, 0, 12, 0, 1 ),   // addi     x12, x0, 1
+   A_Type( 0x00, 0, 10, 12 ),     // amoadd.w x0, x12, (x10)
+   I_Type( 0x13, 0, 11, 11, -1 ), // addi     x11, x11, -1
+   B_Type( 1, 11, 0, -12 ),       // bne      x11, x0, loop
+   JAL_To_Self,
+};
+
+static const uint32_t LR_SC_Loop[] = {
+   A_Type( 0x02, 13, 10, 0 ),     // lr.w x13, (x10)
+   I_Type( 0x13, 0, 13, 13, 1 ),  // addi x13, x13, 1
+   A_Type( 0x03, 14, 10, 13 ),    // sc.w x14, x13, (x10)
+   B_Type( 1, 14, 0, -12 ),       // bne  x14, x0, loop
+   I_Type( 0x13, 0, 11, 11, -1 ), // addi x11, x11, -1
+   B_Type( 1, 11, 0, -20 ),       // bne  x11, x0, loop
+   JAL_To_Self,
+};
+
+// ----------------------------------------------------------------------------
+
+struct result {
+   double Millions_Per_Second;
+   bool Correct;
+};
+
+template <size_t N>
+static result Run( const uint32_t ( &Program )[N],
+                   unsigned Num_Harts,
+                   harts::schedule Schedule,
+                   bool JIT ) {
+   constexpr uint32_t Increments = 2 * 1000 * 1000; // Per hart.
+   constexpr unsigned Chunk      = 100 * 1000;
+
+   memory Memory( false );
+   harts Harts( &Memory, Num_Harts, false, true, JIT, Schedule );
+
+   for ( size_t I = 0; I < N; ++I ) {
+      Memory.write_word( Code_Start + 4 * uint32_t( I ), Program[I] );
+   }
+
+   const uint32_t Done = Code_Start + 4 * uint32_t( N - 1 );
+
+   for ( unsigned H = 0; H < Num_Harts; ++H ) {
+      Harts[H].set_pc( Code_Start );
+      Harts[H].set_reg( 10, Counter );
+      Harts[H].set_reg( 11, Increments );
+   }
+
+   const auto All_Done = [&] {
+      for ( unsigned H = 0; H < Num_Harts; ++H ) {
+         if ( Harts[H].get_pc() != Done ) {
+            return false;
+         }
+      }
+      return true;
+   };
+
+   const auto Start = chrono::steady_clock::now();
+   while ( not All_Done() ) {
+      Harts.execute_all( Chunk, false );
+   }
+   const auto End = chrono::steady_clock::now();
+
+   const chrono::duration<double> Elapsed = ( End - Start );
+   const uint32_t Expected                = ( Increments * Num_Harts );
+
+   return { Expected / Elapsed.count() / 1e6,
+            Memory.load32( Counter ) == Expected };
+}
+
+// ----------------------------------------------------------------------------
+
+int main( void ) {
+   bool All_Correct = true;
+
+   printf( "%-8s %-6s %-6s %-4s %12s\n",
+           "loop", "harts", "sched", "jit", "M incr/s" );
+
+   for ( const bool JIT : { false, true } ) {
+      for ( const auto Schedule :
+            { harts::schedule::QUANTUM, harts::schedule::FREE_RUNNING } ) {
+         for ( const unsigned Num_Harts : { 1u, 2u, 4u } ) {
+            const result AMO    = Run( AMO_Loop, Num_Harts, Schedule, JIT );
+            const result LR_SC  = Run( LR_SC_Loop, Num_Harts, Schedule, JIT );
+            const char *Sched   = ( Schedule == harts::schedule::QUANTUM
+                                      ? "quant"
+                                      : "free" );
+
+            printf( "%-8s %-6u %-6s %-4s %12.1f%s\n",
+                    "amoadd", Num_Harts, Sched, JIT ? "yes" : "no",
+                    AMO.Millions_Per_Second, AMO.Correct ? "" : "  LOST" );
+            printf( "%-8s %-6u %-6s %-4s %12.1f%s\n",
+                    "lr/sc", Num_Harts, Sched, JIT ? "yes" : "no",
+                    LR_SC.Millions_Per_Second, LR_SC.Correct ? "" : "  LOST" );
+
+            All_Correct = ( All_Correct and AMO.Correct and LR_SC.Correct );
+         }
+      }
+   }
+
+   return ( All_Correct ? 0 : 1 );
+}
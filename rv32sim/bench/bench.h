@@ -0,0 +1,75 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   What the benchmarks in bench/ share, with each other and with the
+   checks in check/
+
+**************************************************************** */
+
+#include <cstdint>
+#include <streambuf>
+
+// ----------------------------------------------------------------------------
+
+// Just enough of an assembler for the guest loops the benchmarks and checks
+// run. Each takes the fields its format has, with immediates as byte offsets,
+// and masks them to size.
+
+static inline uint32_t I_Type( uint32_t Op, uint32_t F3, uint32_t RD,
+                               uint32_t RS1, int32_t Imm ) {
+   return ( uint32_t( Imm & 0xFFF ) << 20 | RS1 << 15 | F3 << 12 | RD << 7 |
+            Op );
+}
+
+static inline uint32_t R_Type( uint32_t F7, uint32_t F3, uint32_t RD,
+                               uint32_t RS1, uint32_t RS2 ) {
+   return ( F7 << 25 | RS2 << 20 | RS1 << 15 | F3 << 12 | RD << 7 | 0x33 );
+}
+
+static inline uint32_t S_Type( uint32_t F3, uint32_t RS1, uint32_t RS2,
+                               int32_t Imm ) {
+   const uint32_t U = uint32_t( Imm & 0xFFF );
+   return ( ( U >> 5 ) << 25 | RS2 << 20 | RS1 << 15 | F3 << 12 |
+            ( U & 31 ) << 7 | 0x23 );
+}
+
+static inline uint32_t B_Type( uint32_t F3, uint32_t RS1, uint32_t RS2,
+                               int32_t Imm ) {
+   const uint32_t U = uint32_t( Imm & 0x1FFF );
+   return ( ( U >> 12 & 1 ) << 31 | ( U >> 5 & 0x3F ) << 25 | RS2 << 20 |
+            RS1 << 15 | F3 << 12 | ( U >> 1 & 0xF ) << 8 |
+            ( U >> 11 & 1 ) << 7 | 0x63 );
+}
+
+static inline uint32_t J_Type( uint32_t RD, int32_t Imm ) {
+   const uint32_t U = uint32_t( Imm & 0x1FFFFF );
+   return ( ( U >> 20 & 1 ) << 31 | ( U >> 1 & 0x3FF ) << 21 |
+            ( U >> 11 & 1 ) << 20 | ( U >> 12 & 0xFF ) << 12 | RD << 7 |
+            0x6F );
+}
+
+/// The A extension's word-sized ones, with aq and rl clear.
+static inline uint32_t A_Type( uint32_t F5, uint32_t RD, uint32_t RS1,
+                               uint32_t RS2 ) {
+   return ( F5 << 27 | RS2 << 20 | RS1 << 15 | 2 << 12 | RD << 7 | 0x2F );
+}
+
+// ----------------------------------------------------------------------------
+
+/// Throws away whatever's written to it, for the simulator's messages while
+/// it's being timed.
+class null_buffer : public std::streambuf {
+protected:
+   int overflow( int C ) override {
+      return C;
+   }
+
+   std::streamsize xsputn( const char *, std::streamsize Count ) override {
+      return Count;
+   }
+};
+
+#endif
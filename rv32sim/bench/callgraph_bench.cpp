@@ -0,0 +1,163 @@
+/*
+   What call_graph_profile costs, as a share of interpreted throughput.
+
+   Two guest loops, each calling two small functions over and over: one
+   calling or returning every 3 instructions, about as often as real code
+   ever does, and one every 4.25. Each is run with no profiler, with one that
+   does nothing (what any profiler costs the execute loop), and with the call
+   graph. The three take turns, a short run each, many times over, since the
+   numbers move about a lot from run to run: the MIPS are the best of each,
+   and the costs the median of each round's, taken against the run without
+   a profiler just before.
+
+   Build with `make bench` and run ./bench/callgraph_bench.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "bench.h"
+#include "memory.h"
+#include "processor.h"
+#include "profile.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static constexpr uint32_t Code_Start = 0x00001000;
+
+/// main calls f then g, forever.
+static const uint32_t Every_3[] = {
+   // main:
+   J_Type( 1, 0x10 ),             // jal  ra, f
+   J_Type( 1, 0x1C ),             // jal  ra, g
+   I_Type( 0x13, 0, 8, 8, 1 ),    // addi x8, x8, 1
+   J_Type( 0, -12 ),              // j    main
+   // f:
+   I_Type( 0x13, 0, 2, 2, 1 ),    // addi x2, x2, 1
+   R_Type( 0, 4, 4, 4, 2 ),       // xor  x4, x4, x2
+   I_Type( 0x13, 7, 5, 4, 7 ),    // andi x5, x4, 7
+   I_Type( 0x67, 0, 0, 1, 0 ),    // ret
+   // g:
+   I_Type( 0x13, 0, 3, 3, 1 ),    // addi x3, x3, 1
+   R_Type( 0, 0, 6, 6, 3 ),       // add  x6, x6, x3
+   I_Type( 0x13, 1, 7, 6, 1 ),    // slli x7, x6, 1
+   I_Type( 0x67, 0, 0, 1, 0 ),    // ret
+};
+
+/// The same, with more done between calls.
+static const uint32_t Every_4[] = {
+   // main:
+   I_Type( 0x13, 0, 8, 8, 1 ),    // addi x8, x8, 1
+   J_Type( 1, 0x1C ),             // jal  ra, f
+   I_Type( 0x13, 0, 9, 9, 1 ),    // addi x9, x9, 1
+   R_Type( 0, 4, 10, 10, 9 ),     // xor  x10, x10, x9
+   J_Type( 1, 0x30 ),             // jal  ra, g
+   I_Type( 0x13, 0, 20, 20, -1 ), // addi x20, x20, -1
+   J_Type( 0, -24 ),              // j    main
+   0x00000013,                    // nop
+   // f:
+   I_Type( 0x13, 0, 2, 2, 1 ),    // addi x2, x2, 1
+   R_Type( 0, 4, 4, 4, 2 ),       // xor  x4, x4, x2
+   I_Type( 0x13, 7, 5, 4, 7 ),    // andi x5, x4, 7
+   R_Type( 0, 6, 11, 11, 5 ),     // or   x11, x11, x5
+   I_Type( 0x67, 0, 0, 1, 0 ),    // ret
+   0x00000013,                    // nop
+   0x00000013,                    // nop
+   0x00000013,                    // nop
+   // g:
+   I_Type( 0x13, 0, 3, 3, 1 ),    // addi x3, x3, 1
+   R_Type( 0, 0, 6, 6, 3 ),       // add  x6, x6, x3
+   I_Type( 0x13, 1, 7, 6, 1 ),    // slli x7, x6, 1
+   R_Type( 0, 6, 12, 12, 7 ),     // or   x12, x12, x7
+   I_Type( 0x67, 0, 0, 1, 0 ),    // ret
+};
+
+// ----------------------------------------------------------------------------
+
+/// Costs the execute loop what handing blocks to any profiler does.
+class null_profile : public profiler {
+public:
+   void ran( const block_run *, size_t ) override {}
+   void report( ostream &, uint64_t ) const override {}
+};
+
+enum watcher { NOTHING, NULL_PROFILE, CALL_GRAPH, NUM_WATCHERS };
+
+static const symbol_table No_Symbols;
+
+/// Millions of guest instructions per second.
+template <size_t Length>
+static double Run( const uint32_t ( &Program )[Length], watcher Watcher ) {
+   constexpr unsigned Instructions = 5 * 1000 * 1000;
+
+   memory Memory( false );
+   processor CPU( &Memory, false, true, false );
+
+   uint32_t Address = Code_Start;
+   for ( const auto Word : Program ) {
+      Memory.write_word( Address, Word );
+      Address += 4;
+   }
+   CPU.set_pc( Code_Start );
+
+   if ( Watcher == NULL_PROFILE ) {
+      CPU.add_profiler( new null_profile );
+   } else if ( Watcher == CALL_GRAPH ) {
+      CPU.add_profiler( new call_graph_profile( No_Symbols, "/dev/null" ) );
+   }
+
+   const auto Start = chrono::steady_clock::now();
+   CPU.execute( Instructions, false );
+   const auto End = chrono::steady_clock::now();
+
+   const chrono::duration<double> Elapsed = ( End - Start );
+   return ( CPU.get_instruction_count() / Elapsed.count() / 1e6 );
+}
+
+template <size_t Length>
+static void Compare( const char *Name, const uint32_t ( &Program )[Length] ) {
+   constexpr unsigned Rounds = 25;
+
+   double Best[NUM_WATCHERS] = { 0 };
+   vector<double> Costs[NUM_WATCHERS];
+
+   for ( unsigned Round = 0; Round < Rounds; ++Round ) {
+      double MIPS[NUM_WATCHERS];
+      for ( unsigned W = 0; W < NUM_WATCHERS; ++W ) {
+         MIPS[W] = Run( Program, watcher( W ) );
+         Best[W] = max( Best[W], MIPS[W] );
+         Costs[W].push_back( 100 * ( MIPS[NOTHING] / MIPS[W] - 1 ) );
+      }
+   }
+
+   for ( vector<double> &Cost : Costs ) {
+      sort( Cost.begin(), Cost.end() );
+   }
+
+   printf( "%-24s %10.1f %10.1f %9.1f%% %10.1f %9.1f%%\n",
+           Name,
+           Best[NOTHING],
+           Best[NULL_PROFILE],
+           Costs[NULL_PROFILE][Rounds / 2],
+           Best[CALL_GRAPH],
+           Costs[CALL_GRAPH][Rounds / 2] );
+}
+
+// ----------------------------------------------------------------------------
+
+int main( void ) {
+   printf( "%-24s %10s %10s %10s %10s %10s\n",
+           "call or return every",
+           "MIPS",
+           "empty",
+           "cost",
+           "call graph",
+           "cost" );
+   Compare( "3 instructions", Every_3 );
+   Compare( "4.25 instructions", Every_4 );
+   return 0;
+}
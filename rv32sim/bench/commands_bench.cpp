@@ -0,0 +1,100 @@
+/*
+   Command interpreter throughput, on a generated script of 10 million lines
+   (or as many million as given): memory and register writes and reads in
+   the proportions the generated test scripts have them, comments, and
+   every thousandth line a `.` running one instruction.
+
+   The script is handed to interpret_commands() as a string stream, and the
+   answers go nowhere, so what's measured is the interpreter rather than the
+   disk or the terminal. Reports lines and megabytes a second.
+
+   Build with `make bench` and run ./bench/commands_bench [Millions].
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+#include "bench.h"
+#include "commands.h"
+#include "harts.h"
+#include "memory.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static string Script( unsigned long Lines ) {
+   string Text;
+   Text.reserve( Lines * 16 );
+
+   // Something for the dots to run: jal x0, 0, forever.
+   Text += "m 1000 = 0000006f\npc = 1000\n";
+
+   char Line[64];
+   for ( unsigned long I = 0; I < Lines; ++I ) {
+      const unsigned long Address = ( 0x20000 + ( I * 4 & 0xFFFF ) );
+
+      switch ( I % 10 ) {
+         case 0:
+         case 1:
+         case 2:
+         case 3:
+            snprintf( Line, sizeof( Line ), "m %lx = %08lx\n", Address, I );
+            break;
+         case 4:
+         case 5: snprintf( Line, sizeof( Line ), "m %lx\n", Address ); break;
+         case 6:
+         case 7:
+            snprintf( Line,
+                      sizeof( Line ),
+                      "x%lu = %lx\n",
+                      1 + I % 31,
+                      I * 2654435761u & 0xFFFFFFFF );
+            break;
+         case 8: snprintf( Line, sizeof( Line ), "x%lu\n", 1 + I % 31 ); break;
+         default:
+            snprintf( Line,
+                      sizeof( Line ),
+                      I % 1000 == 999 ? ".\n" : "# line %lu\n",
+                      I );
+            break;
+      }
+      Text += Line;
+   }
+
+   return Text;
+}
+
+// ----------------------------------------------------------------------------
+
+int main( int argc, char *argv[] ) {
+   const unsigned long Millions =
+     ( argc > 1 ? strtoul( argv[1], nullptr, 10 ) : 10 );
+   const unsigned long Lines = ( Millions * 1000000 );
+
+   const string Text = Script( Lines );
+   istringstream Input( Text );
+
+   null_buffer Nowhere;
+   ostream Output( &Nowhere );
+
+   memory Memory( false );
+   harts CPU( &Memory, 1, false, true, false );
+   Memory.set_output( Output );
+   CPU[0].set_output( Output );
+
+   const auto Start = chrono::steady_clock::now();
+   interpret_commands( &Memory, &CPU, false, Input, Output );
+   const auto End = chrono::steady_clock::now();
+
+   const chrono::duration<double> Elapsed = ( End - Start );
+   printf( "%lu lines, %.1f MB in %.3f s: %.2f M lines/s, %.1f MB/s\n",
+           Lines,
+           Text.size() / 1e6,
+           Elapsed.count(),
+           Lines / Elapsed.count() / 1e6,
+           Text.size() / Elapsed.count() / 1e6 );
+   return 0;
+}
@@ -0,0 +1,82 @@
+/*
+   Decode throughput: the table-driven Determine_Instruction_ID() against the
+   linear search over Unique_Mask it replaced, special cases and all. That's
+   in linear_decoder.h, where decoder_check gets the same one from.
+
+   Two inputs: words drawn from real RV32I encodings with random register and
+   immediate fields, and completely random words (mostly illegal, which was
+   the linear decoder's worst case since it had to try everything).
+
+   Build with `make bench` and run ./bench/decode_bench.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "linear_decoder.h"
+#include "rv32i.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static volatile uint32_t Sink;
+
+template <typename decoder>
+static double Run( decoder Decode, const vector<uint32_t> &Words ) {
+   constexpr int Repetitions = 20;
+
+   const auto Start = chrono::steady_clock::now();
+
+   uint32_t Sum = 0;
+   for ( int R = 0; R < Repetitions; ++R ) {
+      for ( const auto Word : Words ) {
+         Sum += Decode( Word );
+      }
+   }
+   Sink = Sum;
+
+   const auto End = chrono::steady_clock::now();
+   const chrono::duration<double> Elapsed = ( End - Start );
+
+   // Millions of decodes per second.
+   return ( Repetitions * Words.size() ) / Elapsed.count() / 1e6;
+}
+
+// ----------------------------------------------------------------------------
+
+int main( void ) {
+   constexpr size_t Num_Words = ( 1 << 20 );
+   mt19937 Generator( 2019 );
+
+   vector<uint32_t> Random_Words( Num_Words );
+   for ( auto &Word : Random_Words ) {
+      Word = Generator();
+   }
+
+   // Take an implemented instruction's unique bits and fill in everything its
+   // type mask doesn't care about at random.
+   vector<uint32_t> Real_Words( Num_Words );
+   uniform_int_distribution<int> Pick_ID( LUI, AND );
+   for ( auto &Word : Real_Words ) {
+      const auto ID   = instr_id( Pick_ID( Generator ) );
+      const auto Mask = Instr_Type_Mask[Instr_Type_Mapping[ID]];
+      Word            = ( Unique_Mask[ID] | ( Generator() & ~Mask ) );
+   }
+
+   const auto Table = []( uint32_t W ) { return Determine_Instruction_ID( W ); };
+
+   printf( "%-8s %16s %16s\n", "input", "linear Mdec/s", "table Mdec/s" );
+   printf( "%-8s %16.1f %16.1f\n",
+           "rv32i",
+           Run( Linear_Determine_Instruction_ID, Real_Words ),
+           Run( Table, Real_Words ) );
+   printf( "%-8s %16.1f %16.1f\n",
+           "random",
+           Run( Linear_Determine_Instruction_ID, Random_Words ),
+           Run( Table, Random_Words ) );
+
+   return 0;
+}
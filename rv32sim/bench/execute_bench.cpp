@@ -0,0 +1,98 @@
+/*
+   Execute loop throughput, in millions of guest instructions per second.
+
+   One fixed guest loop (loads, stores, ALU ops and a branch) is run through
+   processor::execute() in each mode the loop can be in: stage 1, stage 2,
+   stage 2 with a breakpoint set (somewhere it'll never be hit), and stage 2
+   with the JIT. Verbose isn't measured -- it's dominated by the logging.
+
+   Build with `make bench` and run ./bench/execute_bench.
+
+   The "before" numbers for the execute loop's specialisation on verbose,
+   stage 2 and breakpoints come from the commit before it, e39e173, which
+   has no unspecialised loop left to time here. This file and bench.h only
+   use what processor had then, so they build there as they are:
+
+      git worktree add /tmp/before e39e173
+      cp bench/execute_bench.cpp bench/bench.h /tmp/before/rv32sim/bench/
+      make -C /tmp/before/rv32sim bench
+      /tmp/before/rv32sim/bench/execute_bench
+
+   and the two tables can be put side by side, run on the same machine one
+   after the other, since the numbers move about a lot from run to run.
+*/
+
+#include <chrono>
+#include <cstdio>
+
+#include "bench.h"
+#include "memory.h"
+#include "processor.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static constexpr uint32_t Code_Start = 0x00001000;
+static constexpr uint32_t Data_Start = 0x00008000;
+
+/// Loop forever, summing a counter into memory.
+static void Load_Guest_Loop( memory &Memory ) {
+   const uint32_t Program[] = {
+      0x00008537,                     // lui  x10, 0x8
+      I_Type( 0x13, 0, 1, 0, 0 ),     // addi x1, x0, 0
+      I_Type( 0x13, 0, 2, 0, 0 ),     // addi x2, x0, 0
+      // loop:
+      I_Type( 0x03, 2, 3, 10, 0 ),    // lw   x3, 0(x10)
+      R_Type( 0, 0, 2, 2, 1 ),        // add  x2, x2, x1
+      R_Type( 0, 4, 3, 3, 2 ),        // xor  x3, x3, x2
+      S_Type( 2, 10, 3, 0 ),          // sw   x3, 0(x10)
+      I_Type( 0x13, 1, 4, 1, 2 ),     // slli x4, x1, 2
+      I_Type( 0x13, 7, 4, 4, 0x3FC ), // andi x4, x4, 0x3fc
+      R_Type( 0, 0, 5, 10, 4 ),       // add  x5, x10, x4
+      S_Type( 2, 5, 2, 4 ),           // sw   x2, 4(x5)
+      I_Type( 0x13, 0, 1, 1, 1 ),     // addi x1, x1, 1
+      B_Type( 1, 10, 0, -36 ),        // bne  x10, x0, loop
+   };
+
+   uint32_t Address = Code_Start;
+   for ( const auto Word : Program ) {
+      Memory.write_word( Address, Word );
+      Address += 4;
+   }
+
+   static_assert( Data_Start == 0x8000, "The lui above loads Data_Start." );
+}
+
+// ----------------------------------------------------------------------------
+
+static double Run( bool Stage2, bool Breakpoint, bool JIT ) {
+   constexpr unsigned Instructions = 50 * 1000 * 1000;
+
+   memory Memory( false );
+   processor CPU( &Memory, false, Stage2, JIT );
+   Load_Guest_Loop( Memory );
+   CPU.set_pc( Code_Start );
+
+   if ( Breakpoint ) {
+      CPU.set_breakpoint( 0x00F00000 );
+   }
+
+   const auto Start = chrono::steady_clock::now();
+   CPU.execute( Instructions, true );
+   const auto End = chrono::steady_clock::now();
+
+   const chrono::duration<double> Elapsed = ( End - Start );
+   return ( CPU.get_instruction_count() / Elapsed.count() / 1e6 );
+}
+
+// ----------------------------------------------------------------------------
+
+int main( void ) {
+   printf( "%-20s %10s\n", "mode", "MIPS" );
+   printf( "%-20s %10.1f\n", "stage 1", Run( false, false, false ) );
+   printf( "%-20s %10.1f\n", "stage 2", Run( true, false, false ) );
+   printf( "%-20s %10.1f\n", "stage 2, breakpoint", Run( true, true, false ) );
+   printf( "%-20s %10.1f\n", "stage 2, JIT", Run( true, false, true ) );
+   return 0;
+}
@@ -0,0 +1,231 @@
+/*
+   Hex image loading throughput.
+
+   Writes a synthetic Intel HEX image (about 100 MB by default, or the number
+   of megabytes given as the first argument) of 32-byte data records with an
+   extended linear address record every 64 KiB, then times memory::load_file()
+   on it. The provided ifstream/sscanf loader is copied below so the two can be
+   compared on the same machine; pass --no-old to skip it, as it's slow.
+
+   Build with `make bench` and run ./bench/hex_load_bench.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include "bench.h"
+#include "memory.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+/// The provided memory::load_file(), for comparison. Its messages are dropped.
+static bool Old_Load_File( memory &Memory,
+                           const string &file_name,
+                           uint32_t &start_address ) {
+   ifstream input_file( file_name );
+   unsigned int byte_count = 0;
+   char record_start;
+   char byte_string[3];
+   char halfword_string[5];
+   unsigned int record_length;
+   unsigned int record_address;
+   unsigned int record_type;
+   unsigned int record_data;
+   unsigned int record_checksum;
+   bool end_of_file_record = false;
+   uint32_t load_address;
+   uint32_t load_base_address = 0;
+   start_address              = 0;
+   if ( not input_file.is_open() ) {
+      return false;
+   }
+   while ( true ) {
+      input_file >> record_start;
+      if ( record_start != ':' ) {
+         return false;
+      }
+      input_file.get( byte_string, 3 );
+      sscanf( byte_string, "%x", &record_length );
+      input_file.get( halfword_string, 5 );
+      sscanf( halfword_string, "%x", &record_address );
+      input_file.get( byte_string, 3 );
+      sscanf( byte_string, "%x", &record_type );
+      switch ( record_type ) {
+         case 0x00:
+            for ( unsigned int i = 0; i < record_length; i++ ) {
+               input_file.get( byte_string, 3 );
+               sscanf( byte_string, "%x", &record_data );
+               load_address = ( load_base_address | record_address ) + i;
+               Memory.write_word( load_address & ~3u,
+                                  record_data << ( ( load_address % 4 ) * 8 ),
+                                  0xFFu << ( ( load_address % 4 ) * 8 ) );
+               byte_count++;
+            }
+            break;
+         case 0x01: end_of_file_record = true; break;
+         case 0x04:
+            load_base_address = 0;
+            for ( unsigned int i = 0; i < record_length; i++ ) {
+               input_file.get( byte_string, 3 );
+               sscanf( byte_string, "%x", &record_data );
+               load_base_address =
+                 ( load_base_address << 8 ) | ( record_data << 16 );
+            }
+            break;
+         case 0x05:
+            start_address = 0;
+            for ( unsigned int i = 0; i < record_length; i++ ) {
+               input_file.get( byte_string, 3 );
+               sscanf( byte_string, "%x", &record_data );
+               start_address = ( start_address << 8 ) | record_data;
+            }
+            break;
+         default:
+            for ( unsigned int i = 0; i < record_length; i++ ) {
+               input_file.get( byte_string, 3 );
+            }
+            break;
+      }
+      input_file.get( byte_string, 3 );
+      sscanf( byte_string, "%x", &record_checksum );
+      input_file.ignore();
+      if ( end_of_file_record ) {
+         break;
+      }
+   }
+   return byte_count > 0;
+}
+
+// ----------------------------------------------------------------------------
+
+/// Write one record, checksum and all.
+static void Put_Record( FILE *File,
+                        unsigned Type,
+                        unsigned Address,
+                        const uint8_t *Data,
+                        unsigned Length ) {
+   unsigned Sum = Length + ( Address >> 8 ) + ( Address & 0xFF ) + Type;
+   fprintf( File, ":%02X%04X%02X", Length, Address, Type );
+   for ( unsigned I = 0; I < Length; ++I ) {
+      fprintf( File, "%02X", Data[I] );
+      Sum += Data[I];
+   }
+   fprintf( File, "%02X\n", ( 0x100 - ( Sum & 0xFF ) ) & 0xFF );
+}
+
+/// Write an image of at least the given size, and return how many data bytes
+/// it holds.
+static size_t Write_Image( const char *File_Name, size_t Megabytes ) {
+   FILE *File = fopen( File_Name, "w" );
+   if ( not File ) {
+      perror( File_Name );
+      exit( 1 );
+   }
+
+   // Each 32-byte record takes 76 characters.
+   constexpr unsigned Record_Length = 32;
+   const size_t Records = ( Megabytes << 20 ) / 76 + 1;
+
+   uint8_t Data[Record_Length];
+   uint32_t Seed = 12345;
+
+   for ( size_t R = 0; R < Records; ++R ) {
+      const uint32_t Address = uint32_t( R * Record_Length );
+
+      if ( ( Address & 0xFFFF ) == 0 ) {
+         const uint8_t Upper[2] = { uint8_t( Address >> 24 ),
+                                    uint8_t( Address >> 16 ) };
+         Put_Record( File, 0x04, 0, Upper, 2 );
+      }
+
+      for ( auto &Byte : Data ) {
+         Seed = Seed * 1103515245 + 12345;
+         Byte = uint8_t( Seed >> 16 );
+      }
+      Put_Record( File, 0x00, Address & 0xFFFF, Data, Record_Length );
+   }
+
+   const uint8_t Start[4] = { 0, 0, 0x10, 0 };
+   Put_Record( File, 0x05, 0, Start, 4 );
+   Put_Record( File, 0x01, 0, nullptr, 0 );
+   fclose( File );
+
+   return Records * Record_Length;
+}
+
+// ----------------------------------------------------------------------------
+
+template <typename function> static double Time( function Function ) {
+   const auto Start = chrono::steady_clock::now();
+   Function();
+   const auto End = chrono::steady_clock::now();
+
+   const chrono::duration<double> Elapsed = ( End - Start );
+   return Elapsed.count();
+}
+
+int main( int argc, char **argv ) {
+   size_t Megabytes = 100;
+   bool Run_Old     = true;
+
+   for ( int I = 1; I < argc; ++I ) {
+      if ( strcmp( argv[I], "--no-old" ) == 0 ) {
+         Run_Old = false;
+      } else {
+         Megabytes = size_t( atoi( argv[I] ) );
+      }
+   }
+
+   char File_Name[] = "/tmp/hex_load_bench_XXXXXX";
+   const int Descriptor = mkstemp( File_Name );
+   if ( Descriptor < 0 ) {
+      perror( "mkstemp" );
+      return 1;
+   }
+   close( Descriptor );
+
+   const size_t Bytes = Write_Image( File_Name, Megabytes );
+   printf( "%zu MB image, %zu data bytes\n", Megabytes, Bytes );
+   printf( "%-20s %10s %10s\n", "loader", "seconds", "MB/s" );
+
+   // The new loader's "bytes loaded" line would land in the middle of the
+   // table, and the old one's messages are dropped anyway.
+   null_buffer Nowhere;
+   ostream Quiet( &Nowhere );
+
+   uint32_t New_Start = 0;
+   {
+      memory Memory( false );
+      Memory.set_output( Quiet );
+      const double Seconds =
+        Time( [&]() { Memory.load_file( File_Name, New_Start ); } );
+      printf( "%-20s %10.3f %10.1f\n", "mmap + table", Seconds,
+              double( Megabytes ) / Seconds );
+   }
+
+   if ( Run_Old ) {
+      memory Memory( false );
+      uint32_t Old_Start = 0;
+      const double Seconds =
+        Time( [&]() { Old_Load_File( Memory, File_Name, Old_Start ); } );
+      printf( "%-20s %10.3f %10.1f\n", "ifstream + sscanf", Seconds,
+              double( Megabytes ) / Seconds );
+
+      if ( Old_Start != New_Start ) {
+         printf( "start addresses differ: %08x vs %08x\n", Old_Start,
+                 New_Start );
+      }
+   }
+
+   unlink( File_Name );
+   return 0;
+}
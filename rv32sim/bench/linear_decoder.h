@@ -0,0 +1,89 @@
+#ifndef LINEAR_DECODER_H
+#define LINEAR_DECODER_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   The linear decoder, which decode_bench and decoder_check share
+
+**************************************************************** */
+
+#include <cstdint>
+
+#include "rv32i.h"
+
+// ----------------------------------------------------------------------------
+
+/// The old decoder, copied from rv32i.h before it went table-driven: a
+/// search over Unique_Mask, then the special cases. decoder_check holds the
+/// table up against it, and decode_bench times the two. The one thing it's
+/// been taught since is that LR.W needs its rs2 field to be 0.
+static inline instr_id Linear_Determine_Instruction_ID( uint32_t Integer ) {
+   for ( int I = FIRST_INSTR; I <= LAST_INSTR; ++I ) {
+      const auto ID   = instr_id( I );
+      const auto Type = Instr_Type_Mapping[ID];
+
+      if ( Type == INSTR_TYPE_UNIMPLEMENTED ) {
+         break;
+      }
+
+      // Zero out the unimportant fields
+      const auto Masked = ( Integer & Instr_Type_Mask[size_t( Type )] );
+
+      if ( Masked == Unique_Mask[ID] ) {
+         return ( ID == LR_W and instr( Integer ).A_Type.RS2 != 0
+                    ? UNKNOWN_INSTR
+                    : ID );
+      }
+   }
+
+   // At this point, it might still be FENCE or ECALL, EBREAK, etc.
+
+   constexpr uint32_t ECALL_Integer  = 0b00000000000000000000000001110011;
+   constexpr uint32_t EBREAK_Integer = 0b00000000000100000000000001110011;
+   constexpr uint32_t MRET_Integer   = 0b00110000001000000000000001110011;
+
+   if ( Integer == ECALL_Integer ) {
+      return ECALL;
+   }
+
+   if ( Integer == EBREAK_Integer ) {
+      return EBREAK;
+   }
+
+   if ( Integer == MRET_Integer ) {
+      return MRET;
+   }
+
+   // Check if it's a CSR instruction
+
+   {
+      const auto Instr = instr( Integer ).CSR_Type;
+
+      if ( Instr.Opcode == 0b1110011 and Instr.Funct3 != 0b100 ) {
+         switch ( Instr.Funct3 ) {
+            case 0b001: return CSRRW;
+            case 0b010: return CSRRS;
+            case 0b011: return CSRRC;
+            case 0b101: return CSRRWI;
+            case 0b110: return CSRRSI;
+            case 0b111: return CSRRCI;
+
+            // The old code asserted here. SYSTEM with funct3 = 0 that isn't
+            // ECALL/EBREAK/MRET fell through to the FENCE check below with
+            // assertions off, and came out as UNKNOWN_INSTR.
+            default: break;
+         }
+      }
+   }
+
+   // Check if it's FENCE
+
+   if ( ( ( Integer & Unique_Mask[FENCE] ) == Unique_Mask[FENCE] ) ) {
+      return FENCE;
+   }
+
+   return UNKNOWN_INSTR;
+}
+
+#endif
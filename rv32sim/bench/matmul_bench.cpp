@@ -0,0 +1,174 @@
+/*
+   What the M extension buys guest code: one integer matrix multiply, built
+   twice. For rv32i, each multiply is a call to a shift-and-add routine like
+   libgcc's __mulsi3; for rv32im, it's a MUL. Reports guest instructions and
+   wall time for each, interpreted and with the JIT, and checks the product
+   against the host's.
+
+   Build with `make bench` and run ./bench/matmul_bench.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "bench.h"
+#include "memory.h"
+#include "processor.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static constexpr uint32_t N          = 64; // C = A * B, all N x N words.
+static constexpr uint32_t Code_Start = 0x00001000;
+static constexpr uint32_t A_Start    = 0x00010000;
+static constexpr uint32_t B_Start    = ( A_Start + 4 * N * N );
+static constexpr uint32_t C_Start    = ( B_Start + 4 * N * N );
+
+static_assert( 4 * N < 2048, "Row strides are addi immediates." );
+
+/// The kernel's x10, x11 and x12 point at A, B and C. It finishes by spinning
+/// at Done_Offset.
+static vector<uint32_t> Kernel( bool Has_M ) {
+   const int32_t Row = int32_t( 4 * N );
+
+   vector<uint32_t> Program = {
+      I_Type( 0x13, 0, 19, 12, 0 ),    //  0: addi x19, x12, 0   C pointer
+      I_Type( 0x13, 0, 20, 10, 0 ),    //  1: addi x20, x10, 0   row of A
+      I_Type( 0x13, 0, 5, 0, N ),      //  2: addi x5, x0, N
+      // rows:
+      I_Type( 0x13, 0, 21, 11, 0 ),    //  3: addi x21, x11, 0   column of B
+      I_Type( 0x13, 0, 6, 0, N ),      //  4: addi x6, x0, N
+      // columns:
+      I_Type( 0x13, 0, 14, 20, 0 ),    //  5: addi x14, x20, 0
+      I_Type( 0x13, 0, 15, 21, 0 ),    //  6: addi x15, x21, 0
+      I_Type( 0x13, 0, 7, 0, N ),      //  7: addi x7, x0, N
+      I_Type( 0x13, 0, 28, 0, 0 ),     //  8: addi x28, x0, 0
+      // dot product:
+      I_Type( 0x03, 2, 16, 14, 0 ),    //  9: lw   x16, 0(x14)
+      I_Type( 0x03, 2, 17, 15, 0 ),    // 10: lw   x17, 0(x15)
+      ( Has_M ? R_Type( 1, 0, 18, 16, 17 ) // 11: mul x18, x16, x17
+              : J_Type( 1, 60 ) ),         //     jal x1, mulsi3
+      R_Type( 0, 0, 28, 28, 18 ),      // 12: add  x28, x28, x18
+      I_Type( 0x13, 0, 14, 14, 4 ),    // 13: addi x14, x14, 4
+      I_Type( 0x13, 0, 15, 15, Row ),  // 14: addi x15, x15, 4N
+      I_Type( 0x13, 0, 7, 7, -1 ),     // 15: addi x7, x7, -1
+      B_Type( 1, 7, 0, -28 ),          // 16: bne  x7, x0, dot product
+      S_Type( 2, 19, 28, 0 ),          // 17: sw   x28, 0(x19)
+      I_Type( 0x13, 0, 19, 19, 4 ),    // 18: addi x19, x19, 4
+      I_Type( 0x13, 0, 21, 21, 4 ),    // 19: addi x21, x21, 4
+      I_Type( 0x13, 0, 6, 6, -1 ),     // 20: addi x6, x6, -1
+      B_Type( 1, 6, 0, -64 ),          // 21: bne  x6, x0, columns
+      I_Type( 0x13, 0, 20, 20, Row ),  // 22: addi x20, x20, 4N
+      I_Type( 0x13, 0, 5, 5, -1 ),     // 23: addi x5, x5, -1
+      B_Type( 1, 5, 0, -84 ),          // 24: bne  x5, x0, rows
+      J_Type( 0, 0 ),                  // 25: jal  x0, 0         done
+      // mulsi3: x18 = x16 * x17, one bit of x17 at a time.
+      I_Type( 0x13, 0, 18, 0, 0 ),     // 26: addi x18, x0, 0
+      I_Type( 0x13, 7, 29, 17, 1 ),    // 27: andi x29, x17, 1
+      B_Type( 0, 29, 0, 8 ),           // 28: beq  x29, x0, 30
+      R_Type( 0, 0, 18, 18, 16 ),      // 29: add  x18, x18, x16
+      I_Type( 0x13, 5, 17, 17, 1 ),    // 30: srli x17, x17, 1
+      I_Type( 0x13, 1, 16, 16, 1 ),    // 31: slli x16, x16, 1
+      B_Type( 1, 17, 0, -20 ),         // 32: bne  x17, x0, 27
+      I_Type( 0x67, 0, 0, 1, 0 ),      // 33: jalr x0, x1, 0
+   };
+
+   return Program;
+}
+
+static constexpr uint32_t Done_Offset = ( 25 * 4 );
+
+// ----------------------------------------------------------------------------
+
+struct result {
+   uint32_t Instructions;
+   double Milliseconds;
+   bool Correct;
+};
+
+static result Run( bool Has_M,
+                   bool JIT,
+                   const vector<uint32_t> &A,
+                   const vector<uint32_t> &B,
+                   const vector<uint32_t> &Expected ) {
+   memory Memory( false );
+   processor CPU( &Memory, false, true, JIT );
+
+   const vector<uint32_t> Program = Kernel( Has_M );
+   for ( size_t I = 0; I < Program.size(); ++I ) {
+      Memory.write_word( Code_Start + 4 * uint32_t( I ), Program[I] );
+   }
+   for ( uint32_t I = 0; I < N * N; ++I ) {
+      Memory.write_word( A_Start + 4 * I, A[I] );
+      Memory.write_word( B_Start + 4 * I, B[I] );
+   }
+
+   CPU.set_pc( Code_Start );
+   CPU.set_reg( 10, A_Start );
+   CPU.set_reg( 11, B_Start );
+   CPU.set_reg( 12, C_Start );
+
+   // Stopping at the spin loop keeps it out of the count. Hitting the
+   // breakpoint says so, which isn't wanted here.
+   ostringstream Quiet;
+   CPU.set_output( Quiet );
+   CPU.set_breakpoint( Code_Start + Done_Offset );
+
+   const auto Start = chrono::steady_clock::now();
+   while ( CPU.get_pc() != Code_Start + Done_Offset ) {
+      CPU.execute( 1000 * 1000, true );
+   }
+   const auto End = chrono::steady_clock::now();
+
+   bool Correct = true;
+   for ( uint32_t I = 0; I < N * N; ++I ) {
+      Correct = ( Correct and Memory.load32( C_Start + 4 * I ) == Expected[I] );
+   }
+
+   const chrono::duration<double, milli> Elapsed = ( End - Start );
+   return { CPU.get_instruction_count(), Elapsed.count(), Correct };
+}
+
+// ----------------------------------------------------------------------------
+
+int main( void ) {
+   // Small enough that mulsi3 takes a typical dozen or so trips round.
+   mt19937 Random( 1 );
+   uniform_int_distribution<uint32_t> Element( 0, 4095 );
+
+   vector<uint32_t> A( N * N ), B( N * N ), Expected( N * N, 0 );
+   for ( uint32_t I = 0; I < N * N; ++I ) {
+      A[I] = Element( Random );
+      B[I] = Element( Random );
+   }
+   for ( uint32_t Row = 0; Row < N; ++Row ) {
+      for ( uint32_t Column = 0; Column < N; ++Column ) {
+         for ( uint32_t K = 0; K < N; ++K ) {
+            Expected[Row * N + Column] += A[Row * N + K] * B[K * N + Column];
+         }
+      }
+   }
+
+   bool All_Correct = true;
+
+   printf( "%ux%u matrix multiply\n", N, N );
+   printf( "%-8s %-4s %14s %12s\n", "isa", "jit", "instructions", "ms" );
+
+   for ( const bool JIT : { false, true } ) {
+      for ( const bool Has_M : { false, true } ) {
+         const result R = Run( Has_M, JIT, A, B, Expected );
+
+         printf( "%-8s %-4s %14u %12.1f%s\n",
+                 Has_M ? "rv32im" : "rv32i", JIT ? "yes" : "no",
+                 R.Instructions, R.Milliseconds, R.Correct ? "" : "  WRONG" );
+
+         All_Correct = ( All_Correct and R.Correct );
+      }
+   }
+
+   return ( All_Correct ? 0 : 1 );
+}
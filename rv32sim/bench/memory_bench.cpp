@@ -0,0 +1,104 @@
+/*
+   Microbenchmark: paged memory vs. the old unordered_map memory.
+
+   The map version is a copy of what memory used to be, kept here so the two
+   can be compared on the same machine. Both are driven with sequential and
+   random word accesses over the same address range.
+
+   Build with `make bench` and run ./bench/memory_bench.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "memory.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+/// The old memory::Memory_Map implementation, for comparison.
+class map_memory {
+private:
+   unordered_map<uint32_t, uint32_t> Memory_Map;
+
+public:
+   uint32_t read_word( uint32_t Address ) {
+      return this->Memory_Map[Address & ~3u];
+   }
+
+   void write_word( uint32_t Address, uint32_t Data, uint32_t Mask = ~0 ) {
+      Address                  = ( Address & ~3u );
+      uint32_t const Old_Value = this->Memory_Map[Address];
+      this->Memory_Map[Address] = ( Data | ( Old_Value & ~Mask ) );
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+/// Sum of everything read, so the reads can't be optimised away.
+static volatile uint32_t Sink;
+
+template <typename mem>
+static double Run( mem &Memory, const vector<uint32_t> &Addresses ) {
+   const auto Start = chrono::steady_clock::now();
+
+   for ( const auto Address : Addresses ) {
+      Memory.write_word( Address, Address, 0x00FF00FF );
+   }
+
+   uint32_t Sum = 0;
+   for ( const auto Address : Addresses ) {
+      Sum += Memory.read_word( Address );
+   }
+   Sink = Sum;
+
+   const auto End = chrono::steady_clock::now();
+   const chrono::duration<double, nano> Elapsed = ( End - Start );
+
+   // Each address is written once and read once.
+   return Elapsed.count() / ( 2.0 * Addresses.size() );
+}
+
+// ----------------------------------------------------------------------------
+
+int main( void ) {
+   constexpr uint32_t Base        = 0x00010000;
+   constexpr uint32_t Range_Bytes = ( 16 << 20 );
+   constexpr size_t Num_Accesses  = ( Range_Bytes / 4 );
+
+   vector<uint32_t> Sequential( Num_Accesses );
+   for ( size_t I = 0; I < Num_Accesses; ++I ) {
+      Sequential[I] = uint32_t( Base + 4 * I );
+   }
+
+   vector<uint32_t> Random( Num_Accesses );
+   mt19937 Generator( 2019 );
+   uniform_int_distribution<uint32_t> Offset( 0, Range_Bytes / 4 - 1 );
+   for ( auto &Address : Random ) {
+      Address = ( Base + 4 * Offset( Generator ) );
+   }
+
+   printf( "%-12s %12s %12s\n", "pattern", "map ns/op", "paged ns/op" );
+
+   {
+      map_memory Map;
+      memory Paged( false );
+      const double Map_Time   = Run( Map, Sequential );
+      const double Paged_Time = Run( Paged, Sequential );
+      printf( "%-12s %12.2f %12.2f\n", "sequential", Map_Time, Paged_Time );
+   }
+
+   {
+      map_memory Map;
+      memory Paged( false );
+      const double Map_Time   = Run( Map, Random );
+      const double Paged_Time = Run( Paged, Random );
+      printf( "%-12s %12.2f %12.2f\n", "random", Map_Time, Paged_Time );
+   }
+
+   return 0;
+}
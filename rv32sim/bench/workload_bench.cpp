@@ -0,0 +1,294 @@
+/*
+   Interpreter throughput on a fixed set of guest workloads, as JSON, for
+   keeping track of the execute loop from one change to the next.
+
+   Each workload is a hand-assembled loop that runs forever, picked to lean
+   on one part of the simulator:
+
+      alu      register-register ALU ops, nothing else
+      chase    loads that depend on the one before, round a ring of 16k
+               nodes 64 bytes apart, in shuffled order
+      memcpy   4 KiB copied a word at a time, over and over
+      sort     insertion sort of 64 fresh pseudo-random words each round,
+               whose branches go whichever way the data says
+      ecall    an ECALL a loop, taken as a trap to a handler that MRETs back
+      csr      reads and writes of machine CSRs
+
+   Each is run Repetitions times (5 unless given), each time for Millions
+   million instructions (20 unless given), on a fresh stage 2 processor
+   without the JIT. A trapping ECALL doesn't retire, so the ecall loop runs
+   fewer instructions than the others. For each, the output has the mean
+   MIPS and ns per instruction, and how much they varied between
+   repetitions.
+
+   Build with `make bench` and run ./bench/workload_bench [Repetitions
+   [Millions]].
+*/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "memory.h"
+#include "processor.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static constexpr uint32_t Code_Start = 0x00001000;
+
+/// The pointer chase's ring, which its lui loads.
+static constexpr uint32_t Ring_Start = 0x00100000;
+static constexpr uint32_t Ring_Nodes = 16 * 1024;
+static constexpr uint32_t Ring_Step  = 64;
+
+struct workload {
+   const char *Name;
+   vector<uint32_t> Program;
+
+   /// Data to set up in memory first, if there's any.
+   void ( *Prepare )( memory &Memory );
+};
+
+/// Link the nodes of the ring in an order that's no use to a prefetcher.
+static void Prepare_Ring( memory &Memory ) {
+   vector<uint32_t> Order( Ring_Nodes );
+   for ( uint32_t I = 0; I < Ring_Nodes; ++I ) {
+      Order[I] = I;
+   }
+
+   // Fisher-Yates, with xorshift32 so every run chases the same ring. Node 0
+   // stays first, where the chase starts.
+   uint32_t Random = 2463534242u;
+   for ( uint32_t I = Ring_Nodes - 1; I > 1; --I ) {
+      Random ^= Random << 13;
+      Random ^= Random >> 17;
+      Random ^= Random << 5;
+      swap( Order[I], Order[1 + Random % I] );
+   }
+
+   for ( uint32_t I = 0; I < Ring_Nodes; ++I ) {
+      const uint32_t Next = Order[( I + 1 ) % Ring_Nodes];
+      Memory.write_word( Ring_Start + Order[I] * Ring_Step,
+                         Ring_Start + Next * Ring_Step );
+   }
+}
+
+static const workload Workloads[] = {
+   { "alu",
+     {
+       0x00100513, //    li    a0, 1
+       0x000125b7, //    lui   a1, 0x12
+       0x34558593, //    addi  a1, a1, 0x345
+       0x00700613, //    li    a2, 7
+       0x00b506b3, // 1: add   a3, a0, a1
+       0x40c58733, //    sub   a4, a1, a2
+       0x00e6c7b3, //    xor   a5, a3, a4
+       0x00c79833, //    sll   a6, a5, a2
+       0x00a858b3, //    srl   a7, a6, a0
+       0x40a7d2b3, //    sra   t0, a5, a0
+       0x0058e333, //    or    t1, a7, t0
+       0x00d373b3, //    and   t2, t1, a3
+       0x00e3ae33, //    slt   t3, t2, a4
+       0x00773eb3, //    sltu  t4, a4, t2
+       0x01c585b3, //    add   a1, a1, t3
+       0x00150513, //    addi  a0, a0, 1
+       0x00f57613, //    andi  a2, a0, 15
+       0xfcdff06f, //    j     1b
+     },
+     nullptr },
+
+   { "chase",
+     {
+       0x00100537, //    lui   a0, 0x100
+       0x00052503, // 1: lw    a0, 0(a0)
+       0x00052503, //    lw    a0, 0(a0)
+       0x00052503, //    lw    a0, 0(a0)
+       0x00052503, //    lw    a0, 0(a0)
+       0xff1ff06f, //    j     1b
+     },
+     Prepare_Ring },
+
+   { "memcpy",
+     {
+       0x00020537, // 2: lui   a0, 0x20
+       0x000305b7, //    lui   a1, 0x30
+       0x00021637, //    lui   a2, 0x21
+       0x00052283, // 1: lw    t0, 0(a0)
+       0x00452303, //    lw    t1, 4(a0)
+       0x00852383, //    lw    t2, 8(a0)
+       0x00c52e03, //    lw    t3, 12(a0)
+       0x0055a023, //    sw    t0, 0(a1)
+       0x0065a223, //    sw    t1, 4(a1)
+       0x0075a423, //    sw    t2, 8(a1)
+       0x01c5a623, //    sw    t3, 12(a1)
+       0x01050513, //    addi  a0, a0, 16
+       0x01058593, //    addi  a1, a1, 16
+       0xfcc51ce3, //    bne   a0, a2, 1b
+       0xfc9ff06f, //    j     2b
+     },
+     nullptr },
+
+   { "sort",
+     {
+       0x92d694b7, //        lui   s1, 0x92d69
+       0xca248493, //        addi  s1, s1, -862   -- xorshift32 state
+       0x00040937, //        lui   s2, 0x40       -- the 64 words
+       0x10090993, //        addi  s3, s2, 256    -- and their end
+       0x00090293, // round: mv    t0, s2
+       0x00d49f13, // fill:  slli  t5, s1, 13
+       0x01e4c4b3, //        xor   s1, s1, t5
+       0x0114df13, //        srli  t5, s1, 17
+       0x01e4c4b3, //        xor   s1, s1, t5
+       0x00549f13, //        slli  t5, s1, 5
+       0x01e4c4b3, //        xor   s1, s1, t5
+       0x0092a023, //        sw    s1, 0(t0)
+       0x00428293, //        addi  t0, t0, 4
+       0xff3290e3, //        bne   t0, s3, fill
+       0x00490293, //        addi  t0, s2, 4
+       0x0002a383, // next:  lw    t2, 0(t0)
+       0x00028e13, //        mv    t3, t0
+       0x012e0c63, // shift: beq   t3, s2, place
+       0xffce2e83, //        lw    t4, -4(t3)
+       0x01d3d863, //        bge   t2, t4, place
+       0x01de2023, //        sw    t4, 0(t3)
+       0xffce0e13, //        addi  t3, t3, -4
+       0xfedff06f, //        j     shift
+       0x007e2023, // place: sw    t2, 0(t3)
+       0x00428293, //        addi  t0, t0, 4
+       0xfd329ce3, //        bne   t0, s3, next
+       0xfa9ff06f, //        j     round
+     },
+     nullptr },
+
+   { "ecall",
+     {
+       0x00000297, //    auipc t0, 0
+       0x01828293, //    addi  t0, t0, 24
+       0x30529073, //    csrw  mtvec, t0      -- the handler below
+       0x00000073, // 1: ecall
+       0x00150513, //    addi  a0, a0, 1
+       0xff9ff06f, //    j     1b
+       0x34102373, //    csrr  t1, mepc
+       0x00430313, //    addi  t1, t1, 4
+       0x34131073, //    csrw  mepc, t1
+       0x30200073, //    mret
+     },
+     nullptr },
+
+   { "csr",
+     {
+       0x340512f3, // 1: csrrw t0, mscratch, a0
+       0x3402a373, //    csrrs t1, mscratch, t0
+       0x340333f3, //    csrrc t2, mscratch, t1
+       0x30002e73, //    csrr  t3, mstatus
+       0x3402e073, //    csrsi mscratch, 5
+       0x34102ef3, //    csrr  t4, mepc
+       0x34339073, //    csrw  mtval, t2
+       0x00150513, //    addi  a0, a0, 1
+       0xfe1ff06f, //    j     1b
+     },
+     nullptr },
+};
+
+// ----------------------------------------------------------------------------
+
+/// Seconds taken, and instructions retired, by one repetition.
+struct timing {
+   double Seconds;
+   uint64_t Instructions;
+};
+
+static timing Run( const workload &Workload, unsigned Instructions ) {
+   memory Memory( false );
+   processor CPU( &Memory, false, true, false );
+
+   uint32_t Address = Code_Start;
+   for ( const auto Word : Workload.Program ) {
+      Memory.write_word( Address, Word );
+      Address += 4;
+   }
+   if ( Workload.Prepare != nullptr ) {
+      Workload.Prepare( Memory );
+   }
+   CPU.set_pc( Code_Start );
+
+   const auto Start = chrono::steady_clock::now();
+   CPU.execute( Instructions, false );
+   const auto End = chrono::steady_clock::now();
+
+   const chrono::duration<double> Elapsed = ( End - Start );
+   return timing{ Elapsed.count(), CPU.get_instruction_count() };
+}
+
+/// Mean and sample variance.
+static void Summarise( const vector<double> &Values,
+                       double &Mean,
+                       double &Variance ) {
+   Mean = 0;
+   for ( const double V : Values ) {
+      Mean += V;
+   }
+   Mean /= Values.size();
+
+   Variance = 0;
+   for ( const double V : Values ) {
+      Variance += ( V - Mean ) * ( V - Mean );
+   }
+   Variance = ( Values.size() > 1 ? Variance / ( Values.size() - 1 ) : 0 );
+}
+
+// ----------------------------------------------------------------------------
+
+int main( int argc, char *argv[] ) {
+   const unsigned long Repetitions =
+     ( argc > 1 ? strtoul( argv[1], nullptr, 10 ) : 5 );
+   const unsigned long Millions =
+     ( argc > 2 ? strtoul( argv[2], nullptr, 10 ) : 20 );
+
+   if ( Repetitions == 0 or Millions == 0 or Millions > 4000 ) {
+      fprintf( stderr, "Usage: %s [repetitions [millions]]\n", argv[0] );
+      return 1;
+   }
+
+   printf( "{\n  \"benchmarks\": [\n" );
+
+   const size_t Num_Workloads = sizeof( Workloads ) / sizeof( Workloads[0] );
+   for ( size_t W = 0; W < Num_Workloads; ++W ) {
+      vector<double> MIPS, Nanoseconds;
+      uint64_t Instructions = 0;
+
+      for ( unsigned R = 0; R < Repetitions; ++R ) {
+         const timing T = Run( Workloads[W], unsigned( Millions * 1000000 ) );
+         MIPS.push_back( T.Instructions / T.Seconds / 1e6 );
+         Nanoseconds.push_back( T.Seconds * 1e9 / T.Instructions );
+         Instructions = T.Instructions;
+      }
+
+      double MIPS_Mean, MIPS_Variance, NS_Mean, NS_Variance;
+      Summarise( MIPS, MIPS_Mean, MIPS_Variance );
+      Summarise( Nanoseconds, NS_Mean, NS_Variance );
+
+      printf( "    {\"name\": \"%s\", \"instructions\": %llu, "
+              "\"repetitions\": %lu,\n"
+              "     \"mips\": %.2f, \"mips_stddev\": %.3f, "
+              "\"mips_variance\": %.4f,\n"
+              "     \"ns_per_instruction\": %.4f, "
+              "\"ns_per_instruction_variance\": %.6f}%s\n",
+              Workloads[W].Name,
+              (unsigned long long) Instructions,
+              Repetitions,
+              MIPS_Mean,
+              sqrt( MIPS_Variance ),
+              MIPS_Variance,
+              NS_Mean,
+              NS_Variance,
+              W + 1 < Num_Workloads ? "," : "" );
+   }
+
+   printf( "  ]\n}\n" );
+   return 0;
+}
@@ -0,0 +1,159 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Basic-block translation cache
+
+**************************************************************** */
+
+#include <algorithm>
+#include <cassert>
+
+#include "block_cache.h"
+#include "memory.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+block_cache::~block_cache() {
+   for ( auto &Entry : this->Blocks ) {
+      delete Entry.second;
+   }
+
+   this->free_retired();
+}
+
+// ----------------------------------------------------------------------------
+
+void block_cache::insert( basic_block *Block ) {
+   assert( Block );
+   assert( not Block->Instructions.empty() );
+   assert( this->find( Block->Start_PC ) == nullptr );
+
+   this->Blocks[Block->Start_PC] = Block;
+
+   const uint32_t First_Page = ( Block->Start_PC >> memory::PAGE_SIZE_BITS );
+   const uint32_t Last_Page =
+     ( ( Block->End_PC() - 1 ) >> memory::PAGE_SIZE_BITS );
+
+   this->Blocks_By_Page[First_Page].push_back( Block );
+   if ( Last_Page != First_Page ) {
+      this->Blocks_By_Page[Last_Page].push_back( Block );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+/// Remove one occurrence of Block from the given list, if it's there.
+static void Remove_From( vector<basic_block *> &List, basic_block *Block ) {
+   const auto It = find( List.begin(), List.end(), Block );
+   if ( It != List.end() ) {
+      *It = List.back();
+      List.pop_back();
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void block_cache::chain( basic_block *From, basic_block *To ) {
+   assert( From and From->Valid );
+   assert( To and To->Valid );
+
+   // Fill an empty slot if there is one. Otherwise the second slot gets
+   // replaced -- the first is usually the fall-through, which doesn't move.
+   size_t Slot = 1;
+   if ( From->Next[0] == nullptr ) {
+      Slot = 0;
+   } else if ( From->Next[1] != nullptr ) {
+      Remove_From( From->Next[1]->Incoming, From );
+   }
+
+   From->Next[Slot] = To;
+   To->Incoming.push_back( From );
+}
+
+// ----------------------------------------------------------------------------
+
+void block_cache::Retire( basic_block *Block ) {
+   Block->Valid = false;
+   this->Blocks.erase( Block->Start_PC );
+
+   for ( auto Predecessor : Block->Incoming ) {
+      for ( auto &Next : Predecessor->Next ) {
+         if ( Next == Block ) {
+            Next = nullptr;
+         }
+      }
+   }
+   Block->Incoming.clear();
+
+   for ( auto &Next : Block->Next ) {
+      if ( Next != nullptr ) {
+         Remove_From( Next->Incoming, Block );
+         Next = nullptr;
+      }
+   }
+
+   this->Retired.push_back( Block );
+}
+
+// ----------------------------------------------------------------------------
+
+void block_cache::invalidate_page( uint32_t Page_Number ) {
+   const auto It = this->Blocks_By_Page.find( Page_Number );
+   if ( It == this->Blocks_By_Page.end() ) {
+      return;
+   }
+
+   for ( auto Block : It->second ) {
+      // Take it off the other page's list too, if it's on one.
+      for ( const uint32_t Address : { Block->Start_PC, Block->End_PC() - 1 } ) {
+         const uint32_t Other = ( Address >> memory::PAGE_SIZE_BITS );
+         const auto Other_It  = this->Blocks_By_Page.find( Other );
+
+         if ( Other != Page_Number and
+              Other_It != this->Blocks_By_Page.end() ) {
+            Remove_From( Other_It->second, Block );
+         }
+      }
+
+      this->Retire( Block );
+   }
+
+   this->Blocks_By_Page.erase( It );
+}
+
+// ----------------------------------------------------------------------------
+
+void block_cache::clear( void ) {
+   for ( auto &Entry : this->Blocks ) {
+      this->Retired.push_back( Entry.second );
+   }
+
+   for ( auto Block : this->Retired ) {
+      Block->Valid = false;
+      Block->Incoming.clear();
+      Block->Next[0] = Block->Next[1] = nullptr;
+   }
+
+   this->Blocks.clear();
+   this->Blocks_By_Page.clear();
+}
+
+// ----------------------------------------------------------------------------
+
+void block_cache::free_retired( void ) {
+   for ( auto Block : this->Retired ) {
+      delete Block;
+   }
+   this->Retired.clear();
+}
+
+// ----------------------------------------------------------------------------
+
+void block_cache::forget_native_code( void ) {
+   for ( auto &Entry : this->Blocks ) {
+      Entry.second->Native = nullptr;
+      Entry.second->Heat   = 0;
+   }
+}
@@ -0,0 +1,157 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Basic-block translation cache
+
+**************************************************************** */
+
+/*
+   The processor decodes instructions into decoded_instrs, and strings runs of
+   them together into basic blocks: straight-line code ending at the first
+   branch, jump, trap-raising instruction or CSR access, or at the end of a
+   page. Running a block is just walking an array, and each block remembers up
+   to two blocks that ran after it (its "chain"), so following a loop or an if
+   never has to go back to the lookup table.
+
+   Blocks are thrown out a page at a time, when memory says a page they were
+   decoded from was written. (A block whose last, 32-bit, instruction starts
+   2 bytes before the end of a page is decoded from both.) Anything chained to
+   a thrown-out block is unchained. The blocks themselves aren't freed until
+   free_retired() is called, because the processor may be partway through
+   running one when a store to its own page retires it.
+
+   Nothing here knows about interrupts or instruction counts; the processor
+   deals with those between blocks. Breakpoints are only marks the processor
+   puts on the instructions and blocks it builds, and it throws out a page's
+   blocks when they change, as though it had been written.
+*/
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+/// Defined in rv32i.h.
+enum instr_id : uint8_t;
+
+/// An instruction that has been decoded once, with its register numbers pulled
+/// out of the bitfields and its immediate sign-extended, so it can be executed
+/// again and again without decoding. Built by Decode_Instruction() in rv32i.h.
+struct decoded_instr {
+   uint32_t PC;   // Where it was decoded from. Doubles as the cache tag.
+   uint32_t Word; // The instruction as it appears in memory. 16 bits for a
+                  // compressed one, whose fields come from its expansion.
+   uint32_t Imm;  // Sign-extended. Byte offset for branches and JAL, already
+                  // shifted up for U-type, and the CSR number for CSR type.
+   instr_id ID;
+   uint8_t RD;
+   uint8_t RS1;    // Or zimm, for CSRR*I.
+   uint8_t RS2;    // Or shamt, for SLLI, SRLI, SRAI.
+   uint8_t Length; // In bytes: 2 if compressed, else 4.
+   bool Breakpoint; // Whether the processor had a breakpoint here when it
+                    // was decoded.
+};
+
+// ----------------------------------------------------------------------------
+
+struct basic_block {
+   /// Address of the first instruction. The rest follow on, each at the PC
+   /// of the one before plus its Length.
+   uint32_t Start_PC = 0;
+
+   /// Cleared when the block's page is written. The processor stops running a
+   /// block as soon as it notices.
+   bool Valid = true;
+
+   /// The block's instructions, in order. Only the last can change the PC.
+   vector<decoded_instr> Instructions;
+
+   /// Blocks that have run straight after this one. Checked by Start_PC, so a
+   /// stale guess (say, the last target of a JALR) is just a miss.
+   basic_block *Next[2] = { nullptr, nullptr };
+
+   /// Blocks with this one in their Next, so they can be unchained from it.
+   vector<basic_block *> Incoming;
+
+   /// Whether any of its instructions has Breakpoint set.
+   bool Has_Breakpoint = false;
+
+   /// Whether its last instruction is a call or a return, by Is_Call() and
+   /// Is_Return() in rv32i.h, so profilers needn't look at every block's.
+   bool Calls   = false;
+   bool Returns = false;
+
+   /// How many times the block has been run, until it's handed to the JIT.
+   uint32_t Heat = 0;
+
+   /// The block compiled by the JIT, if it has been. See jit.h.
+   using native_block = uint32_t ( * )( void );
+   native_block Native = nullptr;
+
+   /// Just past the last instruction. With compressed instructions, a block
+   /// may end 2 bytes into the next page.
+   uint32_t End_PC( void ) const {
+      const decoded_instr &Last = this->Instructions.back();
+      return ( Last.PC + Last.Length );
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+class block_cache {
+private:
+   unordered_map<uint32_t, basic_block *> Blocks;
+
+   /// Every live block, by the page it was decoded from.
+   unordered_map<uint32_t, vector<basic_block *>> Blocks_By_Page;
+
+   /// Blocks that have been invalidated but not yet freed.
+   vector<basic_block *> Retired;
+
+   /// Remove the given block from the cache and unchain it from everything.
+   void Retire( basic_block *Block );
+
+public:
+   block_cache() = default;
+   ~block_cache();
+
+   block_cache( const block_cache & ) = delete;
+   block_cache &operator=( const block_cache & ) = delete;
+
+   /// The block starting at the given PC, or null if there isn't one.
+   basic_block *find( uint32_t PC ) const {
+      const auto It = this->Blocks.find( PC );
+      return ( It == this->Blocks.end() ? nullptr : It->second );
+   }
+
+   /// Add a newly built block. The cache owns it from now on.
+   void insert( basic_block *Block );
+
+   /// Note that To ran straight after From, so that next time From finishes
+   /// at To's Start_PC we can go straight there.
+   void chain( basic_block *From, basic_block *To );
+
+   /// Invalidate and retire every block decoded from the given page.
+   void invalidate_page( uint32_t Page_Number );
+
+   /// Invalidate and retire every block.
+   void clear( void );
+
+   /// Forget every block's compiled code, and let them get hot again. For
+   /// when the JIT's buffer is full.
+   void forget_native_code( void );
+
+   /// True if there are blocks waiting for free_retired().
+   bool has_retired( void ) const {
+      return not this->Retired.empty();
+   }
+
+   /// Free retired blocks. Only safe when no block is being run.
+   void free_retired( void );
+};
+
+#endif
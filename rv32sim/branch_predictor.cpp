@@ -0,0 +1,488 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Branch predictors
+
+**************************************************************** */
+
+#include <algorithm>
+
+#include "branch_predictor.h"
+#include "rv32i.h"
+#include "util.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+// PCs are only ever 2-byte aligned, so bit 0 tells branches nothing, and
+// without RVC they're 4-byte aligned, so bit 1 doesn't either. Folding bit 2
+// down onto bit 1 uses every counter in a table either way.
+static uint32_t Hash_PC( uint32_t PC ) {
+   return ( PC >> 1 ^ PC >> 2 );
+}
+
+/// A two-bit saturating counter: 0 and 1 say not taken, 2 and 3 taken.
+static void Count( uint8_t &Counter, bool Taken ) {
+   if ( Taken and Counter < 3 ) {
+      ++Counter;
+   } else if ( not Taken and Counter > 0 ) {
+      --Counter;
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+class static_predictor : public branch_predictor {
+public:
+   bool predict( uint32_t PC, uint32_t Target ) override {
+      return ( Target <= PC );
+   }
+
+   void update( uint32_t, bool ) override {}
+
+   void describe( ostream &Output ) const override {
+      Output << "static (backward taken)";
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+class bimodal_predictor : public branch_predictor {
+   vector<uint8_t> Counters;
+   uint32_t Mask;
+
+   uint8_t &Counter( uint32_t PC ) {
+      return this->Counters[Hash_PC( PC ) & this->Mask];
+   }
+
+public:
+   explicit bimodal_predictor( unsigned Bits )
+     : Counters( size_t( 1 ) << Bits, 1 ), Mask( ( 1u << Bits ) - 1 ) {}
+
+   bool predict( uint32_t PC, uint32_t ) override {
+      return ( this->Counter( PC ) >= 2 );
+   }
+
+   void update( uint32_t PC, bool Taken ) override {
+      Count( this->Counter( PC ), Taken );
+   }
+
+   void describe( ostream &Output ) const override {
+      util::Print( Output, "bimodal (%zu counters)", this->Counters.size() );
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+class gshare_predictor : public branch_predictor {
+   vector<uint8_t> Counters;
+   uint32_t Mask;
+   uint32_t History = 0; // Newest branch in bit 0, taken as 1.
+
+   uint8_t &Counter( uint32_t PC ) {
+      return this->Counters[( Hash_PC( PC ) ^ this->History ) & this->Mask];
+   }
+
+public:
+   explicit gshare_predictor( unsigned Bits )
+     : Counters( size_t( 1 ) << Bits, 1 ), Mask( ( 1u << Bits ) - 1 ) {}
+
+   bool predict( uint32_t PC, uint32_t ) override {
+      return ( this->Counter( PC ) >= 2 );
+   }
+
+   void update( uint32_t PC, bool Taken ) override {
+      Count( this->Counter( PC ), Taken );
+      this->History = ( ( this->History << 1 ) | Taken ) & this->Mask;
+   }
+
+   void describe( ostream &Output ) const override {
+      util::Print( Output,
+                   "gshare (%zu counters, %d-bit history)",
+                   this->Counters.size(),
+                   __builtin_popcount( this->Mask ) );
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+/// After Seznec and Michaud's TAGE, without the refinements: no path history,
+/// no alternate prediction for newly allocated entries, and usefulness aged by
+/// halving rather than a gradual reset.
+class tage_predictor : public branch_predictor {
+   static constexpr unsigned TABLES   = 4;
+   static constexpr unsigned TAG_BITS = 10;
+   static constexpr uint16_t NO_TAG   = 0xFFFF; // Wider than any tag.
+
+   /// How many of the latest branches each table is indexed by.
+   static constexpr unsigned History_Lengths[TABLES] = { 5, 15, 44, 130 };
+
+   /// The last (up to) 256 branches, newest at Head, taken as 1.
+   uint8_t History[256] = { 0 };
+   uint8_t Head         = 0;
+
+   /// A history of Length branches folded down to Width bits by xoring Width
+   /// bits at a time, kept up to date as branches come and go rather than
+   /// worked out again from the whole history.
+   struct folded_history {
+      uint32_t Value = 0;
+      unsigned Length;
+      unsigned Width;
+
+      void update( bool Newest, bool Oldest ) {
+         const unsigned Width = this->Width;
+
+         this->Value = ( this->Value << 1 ) | Newest;
+         this->Value ^= ( uint32_t( Oldest ) << ( this->Length % Width ) );
+         this->Value ^= ( this->Value >> Width );
+         this->Value &= ( ( 1u << Width ) - 1 );
+      }
+   };
+
+   struct entry {
+      uint16_t Tag;
+      int8_t Counter; // Three bits, signed: -4 to 3. Taken if positive or 0.
+      uint8_t Useful; // Two bits.
+   };
+
+   vector<uint8_t> Base; // Two-bit counters, as bimodal.
+   uint32_t Base_Mask;
+
+   vector<entry> Tables[TABLES];
+   unsigned Table_Bits;
+
+   folded_history Index_Folds[TABLES];
+   folded_history Tag_Folds[TABLES][2]; // Two widths, so they don't cancel.
+
+   uint64_t Updates = 0;
+
+   // What predict() found, for update().
+   uint32_t Indices[TABLES];
+   uint16_t Tags[TABLES];
+   int Provider; // Longest table that matched, or -1 for the base.
+   int Alternate; // Next longest, likewise.
+   bool Prediction;
+   bool Alternate_Prediction;
+
+   entry &Entry( int Table ) {
+      return this->Tables[Table][this->Indices[Table]];
+   }
+
+public:
+   explicit tage_predictor( unsigned Bits )
+     : Base( size_t( 1 ) << Bits, 1 ), Base_Mask( ( 1u << Bits ) - 1 ) {
+      this->Table_Bits = ( Bits > 2 ? Bits - 2 : 1 );
+
+      for ( unsigned T = 0; T < TABLES; ++T ) {
+         this->Tables[T].assign( size_t( 1 ) << this->Table_Bits,
+                                 entry{ NO_TAG, 0, 0 } );
+
+         this->Index_Folds[T].Length  = History_Lengths[T];
+         this->Index_Folds[T].Width   = this->Table_Bits;
+         this->Tag_Folds[T][0].Length = History_Lengths[T];
+         this->Tag_Folds[T][0].Width  = TAG_BITS;
+         this->Tag_Folds[T][1].Length = History_Lengths[T];
+         this->Tag_Folds[T][1].Width  = TAG_BITS - 1;
+      }
+   }
+
+   bool predict( uint32_t PC, uint32_t ) override {
+      const uint32_t Hash       = Hash_PC( PC );
+      const uint32_t Index_Mask = ( ( 1u << this->Table_Bits ) - 1 );
+
+      this->Provider  = -1;
+      this->Alternate = -1;
+
+      for ( int T = TABLES - 1; T >= 0; --T ) {
+         this->Indices[T] = ( Hash ^ ( Hash >> this->Table_Bits ) ^
+                              this->Index_Folds[T].Value ) &
+                            Index_Mask;
+         this->Tags[T] = ( Hash ^ this->Tag_Folds[T][0].Value ^
+                           ( this->Tag_Folds[T][1].Value << 1 ) ) &
+                         ( ( 1u << TAG_BITS ) - 1 );
+
+         if ( this->Entry( T ).Tag == this->Tags[T] ) {
+            if ( this->Provider < 0 ) {
+               this->Provider = T;
+            } else if ( this->Alternate < 0 ) {
+               this->Alternate = T;
+            }
+         }
+      }
+
+      const bool Base_Prediction = ( this->Base[Hash & this->Base_Mask] >= 2 );
+
+      this->Alternate_Prediction =
+        ( this->Alternate < 0 ? Base_Prediction
+                              : this->Entry( this->Alternate ).Counter >= 0 );
+      this->Prediction =
+        ( this->Provider < 0 ? Base_Prediction
+                             : this->Entry( this->Provider ).Counter >= 0 );
+
+      return this->Prediction;
+   }
+
+   void update( uint32_t PC, bool Taken ) override {
+      if ( this->Provider < 0 ) {
+         Count( this->Base[Hash_PC( PC ) & this->Base_Mask], Taken );
+      } else {
+         entry &E = this->Entry( this->Provider );
+
+         if ( Taken and E.Counter < 3 ) {
+            ++E.Counter;
+         } else if ( not Taken and E.Counter > -4 ) {
+            --E.Counter;
+         }
+
+         // Only worth keeping if it knows better than the shorter history.
+         if ( this->Prediction != this->Alternate_Prediction ) {
+            if ( this->Prediction == Taken and E.Useful < 3 ) {
+               ++E.Useful;
+            } else if ( this->Prediction != Taken and E.Useful > 0 ) {
+               --E.Useful;
+            }
+         }
+      }
+
+      // Wrong, so try a longer history next time: take the first entry that
+      // isn't useful, or wear them all down towards being taken next time.
+      if ( this->Prediction != Taken ) {
+         bool Allocated = false;
+
+         for ( int T = this->Provider + 1; T < int( TABLES ); ++T ) {
+            entry &E = this->Entry( T );
+            if ( E.Useful == 0 ) {
+               E         = entry{ this->Tags[T], int8_t( Taken ? 0 : -1 ), 0 };
+               Allocated = true;
+               break;
+            }
+         }
+
+         if ( not Allocated ) {
+            for ( int T = this->Provider + 1; T < int( TABLES ); ++T ) {
+               this->Entry( T ).Useful -= 1;
+            }
+         }
+      }
+
+      if ( ( ++this->Updates & 0x3FFFF ) == 0 ) {
+         for ( vector<entry> &Table : this->Tables ) {
+            for ( entry &E : Table ) {
+               E.Useful >>= 1;
+            }
+         }
+      }
+
+      for ( unsigned T = 0; T < TABLES; ++T ) {
+         const bool Oldest =
+           this->History[uint8_t( this->Head - History_Lengths[T] + 1 )];
+         this->Index_Folds[T].update( Taken, Oldest );
+         this->Tag_Folds[T][0].update( Taken, Oldest );
+         this->Tag_Folds[T][1].update( Taken, Oldest );
+      }
+
+      this->History[++this->Head] = Taken;
+   }
+
+   void describe( ostream &Output ) const override {
+      util::Print( Output,
+                   "TAGE (%zu counters, %u x %zu tagged, histories %u-%u)",
+                   this->Base.size(),
+                   TABLES,
+                   this->Tables[0].size(),
+                   History_Lengths[0],
+                   History_Lengths[TABLES - 1] );
+   }
+};
+
+constexpr unsigned tage_predictor::History_Lengths[];
+
+// ----------------------------------------------------------------------------
+
+branch_predictor *branch_predictor::create( const string &Name,
+                                            unsigned Bits,
+                                            string &Error ) {
+   if ( Bits > 24 ) {
+      Error = Name + " can have at most 2^24 counters";
+      return nullptr;
+   }
+
+   const unsigned Table_Bits = ( Bits == 0 ? 12 : Bits );
+
+   if ( Name == "static" ) {
+      return new static_predictor();
+   } else if ( Name == "bimodal" ) {
+      return new bimodal_predictor( Table_Bits );
+   } else if ( Name == "gshare" ) {
+      return new gshare_predictor( Table_Bits );
+   } else if ( Name == "tage" ) {
+      if ( Table_Bits < 4 ) {
+         Error = "tage needs at least 2^4 counters";
+         return nullptr;
+      }
+      return new tage_predictor( Table_Bits );
+   }
+
+   Error = "no branch predictor " + Name;
+   return nullptr;
+}
+
+// ----------------------------------------------------------------------------
+
+void return_stack::push( uint32_t Address ) {
+   this->Top                = ( this->Top + 1 ) % this->Entries.size();
+   this->Entries[this->Top] = Address;
+   this->Count              = min<uint32_t>( this->Count + 1, this->depth() );
+}
+
+bool return_stack::pop( uint32_t &Address ) {
+   if ( this->Count == 0 ) {
+      return false;
+   }
+
+   Address   = this->Entries[this->Top];
+   this->Top = ( this->Top + this->depth() - 1 ) % this->depth();
+   this->Count -= 1;
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+
+bool branch_unit::config::parse( const string &Spec, string &Error ) {
+   this->Predictors.clear();
+
+   const bool Parsed = util::Parse_Settings(
+     Spec,
+     Error,
+     [this]( const string &Key, const string &Value, string &Why ) {
+        uint32_t Number = 0;
+        if ( not Value.empty() and not util::Parse_Size( Value, Number ) ) {
+           Why = "bad number for " + Key + ": \"" + Value + "\"";
+           return false;
+        }
+
+        if ( Key == "ras" ) {
+           if ( Value.empty() ) {
+              Why = "ras needs a depth";
+              return false;
+           }
+           this->Return_Stack_Depth = Number;
+           return true;
+        }
+
+        // Make one to see that it can be.
+        unique_ptr<branch_predictor> Trial(
+          branch_predictor::create( Key, Number, Why ) );
+        if ( not Trial ) {
+           return false;
+        }
+
+        this->Predictors.emplace_back( Key, Number );
+        return true;
+     } );
+
+   return Parsed;
+}
+
+branch_unit::branch_unit( const config &Config ) {
+   for ( const auto &Predictor : Config.Predictors ) {
+      string Error;
+      this->Predictors.emplace_back(
+        branch_predictor::create( Predictor.first, Predictor.second, Error ) );
+   }
+
+   this->Mispredicts.assign( this->Predictors.size(), 0 );
+
+   if ( Config.Return_Stack_Depth != 0 ) {
+      this->Returns.reset( new return_stack( Config.Return_Stack_Depth ) );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+branch_unit::verdict branch_unit::observe( const decoded_instr &Instruction,
+                                           uint32_t Next_PC ) {
+   const uint32_t PC          = Instruction.PC;
+   const uint32_t Return_Addr = ( PC + Instruction.Length );
+
+   if ( Instr_Type_Mapping[Instruction.ID] == INSTR_TYPE_B ) {
+      const bool Taken = ( Next_PC != Return_Addr );
+      verdict Verdict  = UNPREDICTED;
+
+      this->Branches += 1;
+      this->Taken_Branches += Taken;
+
+      for ( size_t P = 0; P < this->Predictors.size(); ++P ) {
+         branch_predictor &Predictor = *this->Predictors[P];
+         const bool Right =
+           ( Predictor.predict( PC, PC + Instruction.Imm ) == Taken );
+         Predictor.update( PC, Taken );
+
+         this->Mispredicts[P] += not Right;
+         if ( P == 0 ) {
+            Verdict = ( Right ? RIGHT : WRONG );
+         }
+      }
+
+      return Verdict;
+   }
+
+   if ( not this->Returns ) {
+      return UNPREDICTED;
+   }
+
+   verdict Verdict = UNPREDICTED;
+
+   if ( Is_Return( Instruction ) ) {
+      uint32_t Predicted;
+      const bool Right = ( this->Returns->pop( Predicted ) and
+                           Predicted == Next_PC );
+
+      this->Return_Count += 1;
+      this->Return_Mispredicts += not Right;
+      Verdict = ( Right ? RIGHT : WRONG );
+   }
+
+   if ( Is_Call( Instruction ) ) {
+      this->Returns->push( Return_Addr );
+   }
+
+   return Verdict;
+}
+
+// ----------------------------------------------------------------------------
+
+void branch_unit::report( ostream &Output, uint64_t Instructions ) const {
+   const auto Percent = []( uint64_t Part, uint64_t Whole ) {
+      return ( Whole == 0 ? 0.0 : 100.0 * double( Part ) / double( Whole ) );
+   };
+   const auto MPKI = [Instructions]( uint64_t Mispredicts ) {
+      return ( Instructions == 0
+                 ? 0.0
+                 : 1000.0 * double( Mispredicts ) / double( Instructions ) );
+   };
+
+   util::Print( Output,
+                "Branches: %llu (%.2f%% taken), %llu returns\n",
+                (unsigned long long) this->Branches,
+                Percent( this->Taken_Branches, this->Branches ),
+                (unsigned long long) this->Return_Count );
+
+   for ( size_t P = 0; P < this->Predictors.size(); ++P ) {
+      this->Predictors[P]->describe( Output );
+      util::Print( Output,
+                   ": %.2f%% right, %.3f MPKI\n",
+                   100.0 - Percent( this->Mispredicts[P], this->Branches ),
+                   MPKI( this->Mispredicts[P] ) );
+   }
+
+   if ( this->Returns ) {
+      util::Print( Output,
+                   "Return address stack (%u deep): %.2f%% right, %.3f MPKI\n",
+                   this->Returns->depth(),
+                   100.0 - Percent( this->Return_Mispredicts,
+                                    this->Return_Count ),
+                   MPKI( this->Return_Mispredicts ) );
+   }
+}
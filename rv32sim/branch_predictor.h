@@ -0,0 +1,132 @@
+#ifndef BRANCH_PREDICTOR_H
+#define BRANCH_PREDICTOR_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Branch predictors
+
+**************************************************************** */
+
+/*
+   Any number of branch predictors can watch the same run side by side, each
+   guessing every conditional branch before being told which way it went, so
+   one run says how they'd all have done. Returns are predicted by a return
+   address stack, the same for all of them. The list is given to rv32sim as
+   -bpred name[=size],... (which implies -c):
+
+   static        Backward branches taken, forward ones not -- loops, mostly.
+   bimodal=12    A table of 2^12 two-bit counters, indexed by the PC.
+   gshare=12     Likewise, indexed by the PC xor the last 12 branches.
+   tage=12       A bimodal table of 2^12 counters behind four tagged tables of
+                 2^10 entries each, indexed by the last 5, 15, 44 and 130
+                 branches. The longest history that matches decides.
+   ras=16        Depth of the return address stack, or 0 for none.
+
+   Calls and returns are told apart by the registers, as the ISA manual
+   suggests: JAL or JALR linking to ra or t0 is a call, and a JALR through
+   one of them that doesn't link to it is a return -- `jalr x0, 0(ra)`. JAL
+   and other JALRs aren't predicted.
+
+   Normally the predictors only watch, and the pipeline (see timing.h) still
+   takes every branch as not taken. With -pipeline predict=1, the first one
+   listed steers fetch, along with the stack.
+*/
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "block_cache.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+class branch_predictor {
+public:
+   virtual ~branch_predictor() {}
+
+   /// Which way the branch at PC, to Target, will go.
+   virtual bool predict( uint32_t PC, uint32_t Target ) = 0;
+
+   /// Which way it went. Always straight after predict() for the same branch.
+   virtual void update( uint32_t PC, bool Taken ) = 0;
+
+   /// Say what it is, and how big, for the report.
+   virtual void describe( ostream &Output ) const = 0;
+
+   /// One of those named at the top of the file, with its table size in
+   /// Bits, or the default if Bits is 0. Null, saying why in Error, for one
+   /// that doesn't exist or won't fit.
+   static branch_predictor *create( const string &Name,
+                                    unsigned Bits,
+                                    string &Error );
+};
+
+// ----------------------------------------------------------------------------
+
+class return_stack {
+   /// A ring, so a call too deep pushes out the oldest return address.
+   vector<uint32_t> Entries;
+   uint32_t Top   = 0;
+   uint32_t Count = 0;
+
+public:
+   explicit return_stack( uint32_t Depth ) : Entries( Depth ) {}
+
+   uint32_t depth( void ) const {
+      return uint32_t( this->Entries.size() );
+   }
+
+   void push( uint32_t Address );
+
+   /// The most recent address pushed and not yet popped, or false if there's
+   /// none left.
+   bool pop( uint32_t &Address );
+};
+
+// ----------------------------------------------------------------------------
+
+class branch_unit {
+public:
+   struct config {
+      /// Each predictor's name, and table size in bits (0 for the default),
+      /// in the order given.
+      vector<pair<string, unsigned>> Predictors;
+      uint32_t Return_Stack_Depth = 16;
+
+      /// Set from the list at the top of the file. False, saying why in
+      /// Error, if it doesn't make sense.
+      bool parse( const string &Spec, string &Error );
+   };
+
+   /// What observe() makes of a control transfer, going by the first
+   /// predictor (for a branch) or the stack (for a return).
+   enum verdict { UNPREDICTED, RIGHT, WRONG };
+
+private:
+   vector<unique_ptr<branch_predictor>> Predictors;
+   vector<uint64_t> Mispredicts; // One for each predictor.
+   unique_ptr<return_stack> Returns;
+
+   uint64_t Branches           = 0;
+   uint64_t Taken_Branches     = 0;
+   uint64_t Return_Count       = 0;
+   uint64_t Return_Mispredicts = 0;
+
+public:
+   /// Config has to have parsed.
+   explicit branch_unit( const config &Config );
+
+   /// Show the predictors an instruction that retired, and went on to
+   /// Next_PC. Anything but a branch, JAL or JALR is UNPREDICTED.
+   verdict observe( const decoded_instr &Instruction, uint32_t Next_PC );
+
+   /// How they all did over Instructions retired.
+   void report( ostream &Output, uint64_t Instructions ) const;
+};
+
+#endif
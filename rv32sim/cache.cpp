@@ -0,0 +1,265 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Set-associative cache model
+
+**************************************************************** */
+
+#include "cache.h"
+#include "util.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static bool Is_Power_Of_Two( uint32_t Value ) {
+   return ( Value != 0 and ( Value & ( Value - 1 ) ) == 0 );
+}
+
+bool cache::config::parse( const string &Spec, string &Error ) {
+   const bool Parsed = util::Parse_Settings(
+     Spec,
+     Error,
+     [this]( const string &Key, const string &Value, string &Why ) {
+        if ( Key == "policy" ) {
+           if ( Value == "lru" ) {
+              this->Replacement = policy::LRU;
+           } else if ( Value == "plru" ) {
+              this->Replacement = policy::PLRU;
+           } else if ( Value == "random" ) {
+              this->Replacement = policy::RANDOM;
+           } else {
+              Why = "policy is lru, plru or random, not " + Value;
+              return false;
+           }
+           return true;
+        }
+
+        if ( Key == "write" ) {
+           if ( Value != "back" and Value != "through" ) {
+              Why = "write is back or through, not " + Value;
+              return false;
+           }
+           this->Write_Back = ( Value == "back" );
+           return true;
+        }
+
+        uint32_t Number;
+        if ( not util::Parse_Size( Value, Number ) ) {
+           Why = "bad number for " + Key + ": \"" + Value + "\"";
+           return false;
+        }
+
+        if ( Key == "size" ) {
+           this->Size = Number;
+        } else if ( Key == "ways" ) {
+           this->Ways = Number;
+        } else if ( Key == "line" ) {
+           this->Line_Size = Number;
+        } else if ( Key == "miss" ) {
+           this->Miss_Penalty = Number;
+        } else {
+           Why = "no cache setting " + Key;
+           return false;
+        }
+
+        return true;
+     } );
+
+   if ( not Parsed ) {
+      return false;
+   }
+
+   if ( not Is_Power_Of_Two( this->Size ) or
+        not Is_Power_Of_Two( this->Ways ) or
+        not Is_Power_Of_Two( this->Line_Size ) ) {
+      Error = "size, ways and line all have to be powers of two";
+   } else if ( this->Line_Size < 4 ) {
+      Error = "lines have to be at least 4 bytes";
+   } else if ( uint64_t( this->Ways ) * this->Line_Size > this->Size ) {
+      Error = "not enough room for even one set";
+   } else if ( this->Replacement == policy::PLRU and this->Ways > 32 ) {
+      Error = "plru only goes up to 32 ways";
+   } else {
+      return true;
+   }
+
+   return false;
+}
+
+// ----------------------------------------------------------------------------
+
+cache::cache( const config &Config ) {
+   this->Config = Config;
+
+   const uint32_t Lines = ( Config.Size / Config.Line_Size );
+   const uint32_t Sets  = ( Lines / Config.Ways );
+
+   this->Line_Bits = 0;
+   while ( ( 1u << this->Line_Bits ) < Config.Line_Size ) {
+      ++this->Line_Bits;
+   }
+   this->Set_Mask = ( Sets - 1 );
+
+   this->Tags.assign( Lines, NO_LINE );
+   this->Dirty.assign( Lines, 0 );
+   this->Recent_Ways.assign( Sets, 0 );
+
+   switch ( Config.Replacement ) {
+      case policy::LRU: this->Last_Used.assign( Lines, 0 ); break;
+      case policy::PLRU: this->Trees.assign( Sets, 0 ); break;
+      case policy::RANDOM: break;
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void cache::Touch( uint32_t Set, uint32_t Way ) {
+   this->Recent_Ways[Set] = Way;
+
+   switch ( this->Config.Replacement ) {
+      case policy::LRU: {
+         this->Last_Used[Set * this->Config.Ways + Way] = ++this->Clock;
+         break;
+      }
+      case policy::PLRU: {
+         // Point every node on the way down away from this way.
+         uint32_t &Tree = this->Trees[Set];
+         uint32_t Node  = 1;
+         for ( uint32_t Half = this->Config.Ways / 2; Half != 0; Half /= 2 ) {
+            const bool Upper = ( ( Way & Half ) != 0 );
+            Tree = ( Upper ? Tree & ~( 1u << Node ) : Tree | ( 1u << Node ) );
+            Node = ( 2 * Node + Upper );
+         }
+         break;
+      }
+      case policy::RANDOM: break;
+   }
+}
+
+uint32_t cache::Victim( uint32_t Set ) {
+   const uint32_t Ways  = this->Config.Ways;
+   const uint32_t First = ( Set * Ways );
+
+   for ( uint32_t Way = 0; Way < Ways; ++Way ) {
+      if ( this->Tags[First + Way] == NO_LINE ) {
+         return Way;
+      }
+   }
+
+   switch ( this->Config.Replacement ) {
+      case policy::LRU: {
+         uint32_t Oldest = 0;
+         for ( uint32_t Way = 1; Way < Ways; ++Way ) {
+            if ( this->Last_Used[First + Way] <
+                 this->Last_Used[First + Oldest] ) {
+               Oldest = Way;
+            }
+         }
+         return Oldest;
+      }
+      case policy::PLRU: {
+         const uint32_t Tree = this->Trees[Set];
+         uint32_t Node       = 1;
+         uint32_t Way        = 0;
+         for ( uint32_t Half = Ways / 2; Half != 0; Half /= 2 ) {
+            const bool Upper = ( ( Tree >> Node ) & 1 );
+            Way |= ( Upper ? Half : 0 );
+            Node = ( 2 * Node + Upper );
+         }
+         return Way;
+      }
+      case policy::RANDOM: {
+         uint32_t &X = this->Random_State;
+         X ^= X << 13;
+         X ^= X >> 17;
+         X ^= X << 5;
+         return ( X & ( Ways - 1 ) );
+      }
+   }
+
+   return 0;
+}
+
+// ----------------------------------------------------------------------------
+
+bool cache::Access_Line( uint32_t Line, bool Write ) {
+   const uint32_t Set   = ( Line & this->Set_Mask );
+   const uint32_t Ways  = this->Config.Ways;
+   const uint32_t First = ( Set * Ways );
+   const uint32_t *Tags = &this->Tags[First];
+
+   const uint32_t Recent_Way = this->Recent_Ways[Set];
+   if ( Tags[Recent_Way] == Line ) {
+      this->Stats.Hits += 1;
+      if ( Write and this->Config.Write_Back ) {
+         this->Dirty[First + Recent_Way] = 1;
+      }
+      this->Recent_Line  = Line;
+      this->Recent_Index = ( First + Recent_Way );
+      return true;
+   }
+
+   for ( uint32_t Way = 0; Way < Ways; ++Way ) {
+      if ( Tags[Way] == Line ) {
+         this->Stats.Hits += 1;
+         if ( Write and this->Config.Write_Back ) {
+            this->Dirty[First + Way] = 1;
+         }
+         this->Touch( Set, Way );
+         this->Recent_Line  = Line;
+         this->Recent_Index = ( First + Way );
+         return true;
+      }
+   }
+
+   this->Stats.Misses += 1;
+
+   // Write-through caches don't allocate on a store.
+   if ( Write and not this->Config.Write_Back ) {
+      this->Recent_Line = NO_LINE;
+      return false;
+   }
+
+   const uint32_t Way = this->Victim( Set );
+
+   if ( Tags[Way] != NO_LINE ) {
+      this->Stats.Evictions += 1;
+      this->Stats.Writebacks += this->Dirty[First + Way];
+   }
+
+   this->Tags[First + Way]  = Line;
+   this->Dirty[First + Way] = Write;
+   this->Touch( Set, Way );
+   this->Recent_Line  = Line;
+   this->Recent_Index = ( First + Way );
+
+   return false;
+}
+
+// ----------------------------------------------------------------------------
+
+void cache::report( ostream &Output, const char *Name ) const {
+   static const char *const Policy_Names[] = { "LRU", "PLRU", "random" };
+
+   const config &C       = this->Config;
+   const statistics &S   = this->Stats;
+   const uint64_t Total  = ( S.Hits + S.Misses );
+   const double Miss_Pct = ( Total == 0 ? 0.0 : 100.0 * S.Misses / Total );
+
+   util::Print( Output,
+                "%s: %u %s, %u-way, %u-byte lines, %s, write-%s: %llu hits, "
+                "%llu misses (%.2f%%), %llu evictions, %llu writebacks\n",
+                Name,
+                C.Size >= 1024 ? C.Size / 1024 : C.Size,
+                C.Size >= 1024 ? "KiB" : "bytes",
+                C.Ways,
+                C.Line_Size,
+                Policy_Names[int( C.Replacement )],
+                C.Write_Back ? "back" : "through",
+                (unsigned long long) S.Hits,
+                (unsigned long long) S.Misses,
+                Miss_Pct,
+                (unsigned long long) S.Evictions,
+                (unsigned long long) S.Writebacks );
+}
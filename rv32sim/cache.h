@@ -0,0 +1,145 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Set-associative cache model
+
+**************************************************************** */
+
+/*
+   Only the timing of a cache is modelled: which lines it holds, and so
+   whether each access hits. The data always comes from memory as usual.
+
+   Lines are kept in flat arrays, one element per way, with each set's ways
+   next to each other -- so a lookup is a scan of a few adjacent tags, and
+   the replacement state is only touched on the way out. The settings, given
+   to rv32sim as -icache or -dcache key=value,... (see timing.h):
+
+   size=16k      Total size in bytes. A power of two, as are ways and line.
+   ways=4        Associativity.
+   line=32       Line size in bytes.
+   policy=lru    What to evict from a full set: lru, plru (tree pseudo-LRU)
+                 or random.
+   write=back    back: stores allocate a line on a miss and dirty it, and a
+                 dirty line is written back when it's evicted. through:
+                 stores go straight to memory, and only update a line that's
+                 already there.
+   miss=10       Cycles a miss holds up the pipeline.
+
+   Harts each have their own caches, which don't snoop on each other.
+*/
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class cache {
+public:
+   enum class policy { LRU, PLRU, RANDOM };
+
+   struct config {
+      uint32_t Size         = 16 * 1024;
+      uint32_t Ways         = 4;
+      uint32_t Line_Size    = 32;
+      policy Replacement    = policy::LRU;
+      bool Write_Back       = true;
+      uint32_t Miss_Penalty = 10;
+
+      /// Set whichever of the above are given as key=value,..., and check
+      /// they all fit together. False, saying why in Error, if they don't.
+      bool parse( const string &Spec, string &Error );
+   };
+
+   struct statistics {
+      uint64_t Hits       = 0;
+      uint64_t Misses     = 0;
+      uint64_t Evictions  = 0; // Valid lines thrown out for another.
+      uint64_t Writebacks = 0; // Dirty ones among them.
+   };
+
+private:
+   config Config;
+   statistics Stats;
+
+   uint32_t Line_Bits;
+   uint32_t Set_Mask;
+
+   /// The address of each line held divided by the line size, or NO_LINE.
+   /// Set S's ways are [S * Ways, (S + 1) * Ways).
+   vector<uint32_t> Tags;
+   vector<uint8_t> Dirty;
+
+   /// For LRU: when each way was last touched, by Clock.
+   vector<uint64_t> Last_Used;
+   uint64_t Clock = 0;
+
+   /// For PLRU: one tree of Ways - 1 bits per set. Each bit points at the
+   /// half of its subtree to evict from next.
+   vector<uint32_t> Trees;
+
+   /// For random replacement. xorshift32, so runs are repeatable.
+   uint32_t Random_State = 2463534242u;
+
+   enum : uint32_t { NO_LINE = 0xFFFFFFFF };
+
+   /// The line last looked up, if it's there, and where. Most accesses are
+   /// to it again, and looking it up again can't change what's replaced next.
+   uint32_t Recent_Line  = NO_LINE;
+   uint32_t Recent_Index = 0;
+
+   /// The way each set last touched. Likewise, a hit on it again leaves the
+   /// replacement state as it is, which catches loops across a few lines.
+   vector<uint32_t> Recent_Ways;
+
+   void Touch( uint32_t Set, uint32_t Way );
+   uint32_t Victim( uint32_t Set );
+
+   /// Look up a line, by its address divided by the line size. True on a
+   /// hit. Misses fill the line, except for stores to a write-through cache.
+   bool Access_Line( uint32_t Line, bool Write );
+
+public:
+   explicit cache( const config &Config );
+
+   /// Look up the Length bytes at Address, as a load or instruction fetch, or
+   /// as a store if Write. Returns how many lines missed: 0, or 2 if they
+   /// straddle lines and both missed.
+   uint32_t access( uint32_t Address, uint32_t Length, bool Write ) {
+      const uint32_t Line_Bits  = this->Line_Bits;
+      const uint32_t First_Line = ( Address >> Line_Bits );
+      const uint32_t Last_Line  = ( ( Address + Length - 1 ) >> Line_Bits );
+
+      if ( First_Line == this->Recent_Line and Last_Line == First_Line ) {
+         this->Stats.Hits += 1;
+         if ( Write and this->Config.Write_Back ) {
+            this->Dirty[this->Recent_Index] = 1;
+         }
+         return 0;
+      }
+
+      uint32_t Misses = ( this->Access_Line( First_Line, Write ) ? 0 : 1 );
+      if ( Last_Line != First_Line ) {
+         Misses += ( this->Access_Line( Last_Line, Write ) ? 0 : 1 );
+      }
+
+      return Misses;
+   }
+
+   const config &get_config( void ) const {
+      return this->Config;
+   }
+
+   const statistics &get_statistics( void ) const {
+      return this->Stats;
+   }
+
+   /// Write a line describing the cache and what happened to it.
+   void report( ostream &Output, const char *Name ) const;
+};
+
+#endif
@@ -0,0 +1,243 @@
+/*
+   Check of the A extension. AMOMIN and AMOMAX have to compare signed, and
+   AMOMINU and AMOMAXU unsigned. SC.W has to fail once the hart has taken a
+   trap since its LR.W, or once another hart has stored to the word, and
+   succeed otherwise. A misaligned LR.W, SC.W or AMO has to trap without
+   touching memory, with MTVAL holding just rs1. LR.W with a nonzero rs2 is
+   illegal. Done with and without the JIT.
+
+   Build and run with `make check`.
+*/
+
+#include <cstdio>
+
+#include "check.h"
+#include "harts.h"
+#include "memory.h"
+#include "processor.h"
+#include "rv32i.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static constexpr uint32_t Handler    = 0x00001100;
+static constexpr uint32_t Data       = 0x00008000;
+
+/// ID with rd = x3, rs1 = x1 and, but for LR.W, rs2 = x2.
+static uint32_t Atomic( instr_id ID ) {
+   return ( Unique_Mask[ID] | ( ID == LR_W ? 0 : 2 << 20 ) | 1 << 15 |
+            3 << 7 );
+}
+
+static const uint32_t Spin = 0x0000006f; // j .
+
+/// Steps past the instruction that trapped, and goes back.
+static const uint32_t Skip_Handler[] = {
+   0x341022f3, // csrr  t0, mepc
+   0x00428293, // addi  t0, t0, 4
+   0x34129073, // csrw  mepc, t0
+   0x30200073, // mret
+};
+
+/// A machine with the word at Data holding Value, x1 pointing at it, and x2
+/// holding B, about to run Program. Traps skip the instruction that trapped.
+struct atomic_machine : machine {
+   template <size_t Length>
+   atomic_machine( bool JIT, const uint32_t ( &Program )[Length],
+                   uint32_t Value, uint32_t B )
+     : machine( JIT, Program ) {
+      Load_Program( this->Memory, Handler, Skip_Handler );
+      this->Memory.store32( Data, Value );
+
+      this->CPU.set_csr( CSR_MTVEC, Handler );
+      this->CPU.set_reg( 1, Data );
+      this->CPU.set_reg( 2, B );
+   }
+
+   uint32_t word( void ) {
+      return this->Memory.read_word( Data );
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+struct min_max {
+   instr_id ID;
+   uint32_t Value, B;
+   uint32_t Expected;
+   const char *What;
+};
+
+static const min_max Min_Max[] = {
+   { AMOMIN_W, 0xffffffff, 1, 0xffffffff, "amomin.w compared unsigned" },
+   { AMOMAX_W, 0xffffffff, 1, 1, "amomax.w compared unsigned" },
+   { AMOMINU_W, 0xffffffff, 1, 1, "amominu.w compared signed" },
+   { AMOMAXU_W, 0xffffffff, 1, 0xffffffff, "amomaxu.w compared signed" },
+   { AMOMIN_W, 0x80000000, 0x7fffffff, 0x80000000,
+     "amomin.w compared INT32_MIN unsigned" },
+   { AMOMAX_W, 0x80000000, 0x7fffffff, 0x7fffffff,
+     "amomax.w compared INT32_MIN unsigned" },
+   { AMOMINU_W, 0x80000000, 0x7fffffff, 0x7fffffff,
+     "amominu.w compared 0x80000000 signed" },
+   { AMOMAXU_W, 0x80000000, 0x7fffffff, 0x80000000,
+     "amomaxu.w compared 0x80000000 signed" },
+};
+
+static void Check_Min_Max( bool JIT ) {
+   for ( const auto &C : Min_Max ) {
+      const uint32_t Program[] = { Atomic( C.ID ), Spin };
+      atomic_machine M( JIT, Program, C.Value, C.B );
+      M.CPU.execute( 2, false );
+
+      Expect( M.word() == C.Expected, C.What, JIT );
+      Expect( M.CPU.get_reg( 3 ) == C.Value,
+              "an AMO didn't return the old value", JIT );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+static void Check_Reservations( bool JIT ) {
+   const uint32_t LR = Atomic( LR_W );
+   const uint32_t SC = ( Atomic( SC_W ) & ~( 0b11111u << 7 ) ) | 4 << 7;
+
+   // On its own, the pair stores.
+   {
+      const uint32_t Program[] = { LR, SC, Spin };
+      atomic_machine M( JIT, Program, 5, 6 );
+      M.CPU.execute( 3, false );
+
+      Expect( M.CPU.get_reg( 3 ) == 5 and M.CPU.get_reg( 4 ) == 0 and
+                M.word() == 6,
+              "SC.W failed straight after LR.W", JIT );
+   }
+
+   // With a trap in between, it doesn't, even though the handler leaves the
+   // word be.
+   {
+      const uint32_t Program[] = { LR, 0x00000073 /* ecall */, SC, Spin };
+      atomic_machine M( JIT, Program, 5, 6 );
+      M.CPU.execute( 8, false );
+
+      Expect( M.CPU.get_pc() == Code_Start + 12, "the handler didn't return",
+              JIT );
+      Expect( M.CPU.get_reg( 4 ) == 1 and M.word() == 5,
+              "SC.W stored after a trap", JIT );
+   }
+
+   // Nor once another hart has stored to the word, or done an AMO on it, but
+   // a store to the next word along doesn't get in the way.
+   struct other_hart {
+      uint32_t Instruction;
+      bool Fails;
+      const char *What;
+   };
+
+   const other_hart Others[] = {
+      { 0x0050a023, true, "SC.W stored after another hart's sw" },
+      { Atomic( AMOADD_W ) & ~( 0b11111u << 7 ), true,
+        "SC.W stored after another hart's amoadd.w" },
+      { 0x0050a223, false, "SC.W failed after a store to the next word" },
+   };
+
+   for ( const auto &Other : Others ) {
+      memory Memory( false );
+      harts Harts( &Memory, 2, false, true, JIT );
+
+      const uint32_t Program[]       = { LR, SC, Spin };
+      const uint32_t Other_Program[] = { Other.Instruction, Spin };
+      Load_Program( Memory, Code_Start, Program );
+      Load_Program( Memory, Code_Start + 0x40, Other_Program );
+      Memory.store32( Data, 5 );
+
+      for ( unsigned Hart = 0; Hart < 2; ++Hart ) {
+         Harts[Hart].set_reg( 1, Data );
+         Harts[Hart].set_reg( 2, ( Hart == 0 ? 6 : 2 ) );
+         Harts[Hart].set_reg( 5, 7 );
+      }
+      Harts[0].set_pc( Code_Start );
+      Harts[1].set_pc( Code_Start + 0x40 );
+
+      Harts.execute( 0, 1, false );
+      Harts.execute( 1, 1, false );
+      Harts.execute( 0, 1, false );
+
+      Expect( Harts[0].get_reg( 4 ) == ( Other.Fails ? 1u : 0u ), Other.What,
+              JIT );
+      Expect( Memory.read_word( Data ) != 6 or not Other.Fails,
+              "SC.W stored anyway", JIT );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+struct misaligned {
+   instr_id ID;
+   uint32_t Cause;
+};
+
+static const misaligned Misaligned[] = {
+   { LR_W, 4 },     { SC_W, 6 },      { AMOSWAP_W, 6 },
+   { AMOADD_W, 6 }, { AMOMAXU_W, 6 },
+};
+
+/// Each with x1 two bytes past Data.
+static void Check_Misaligned( bool JIT ) {
+   for ( const auto &C : Misaligned ) {
+      const uint32_t Program[] = { Atomic( C.ID ), Spin };
+      atomic_machine M( JIT, Program, 5, 6 );
+      M.CPU.set_reg( 1, Data + 2 );
+      M.CPU.set_reg( 3, 0x33 );
+      M.CPU.execute( 1, false );
+
+      const char *const Name = Instr_String_Mapping[C.ID];
+      char What[80];
+
+      snprintf( What, sizeof( What ), "misaligned %s didn't trap right", Name );
+      Expect( M.CPU.get_pc() == Handler and
+                M.CPU.get_csr( CSR_MCAUSE ) == C.Cause and
+                M.CPU.get_csr( CSR_MEPC ) == Code_Start,
+              What, JIT );
+
+      snprintf( What, sizeof( What ), "misaligned %s's MTVAL isn't rs1", Name );
+      Expect( M.CPU.get_csr( CSR_MTVAL ) == Data + 2, What, JIT );
+
+      snprintf( What, sizeof( What ), "misaligned %s changed something", Name );
+      Expect( M.word() == 5 and M.Memory.read_word( Data + 4 ) == 0 and
+                M.CPU.get_reg( 3 ) == 0x33,
+              What, JIT );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+/// lr.w x3, (x1) with rs2 = x2 isn't an instruction.
+static void Check_LR_With_RS2( bool JIT ) {
+   const uint32_t Bad_LR    = ( Atomic( LR_W ) | 2 << 20 );
+   const uint32_t Program[] = { Bad_LR, Spin };
+   atomic_machine M( JIT, Program, 5, 6 );
+   M.CPU.execute( 1, false );
+
+   Expect( M.CPU.get_pc() == Handler and M.CPU.get_csr( CSR_MCAUSE ) == 2 and
+             M.CPU.get_csr( CSR_MTVAL ) == Bad_LR and M.CPU.get_reg( 3 ) == 0,
+           "lr.w with rs2 set isn't illegal", JIT );
+}
+
+// ----------------------------------------------------------------------------
+
+int main( void ) {
+   for ( const bool JIT : { false, true } ) {
+      Check_Min_Max( JIT );
+      Check_Reservations( JIT );
+      Check_Misaligned( JIT );
+      Check_LR_With_RS2( JIT );
+   }
+
+   if ( Num_Failures != 0 ) {
+      return 1;
+   }
+
+   printf( GREEN( "PASS" ) ": atomics compare, reserve and trap right.\n" );
+   return 0;
+}
@@ -0,0 +1,160 @@
+/*
+   Check of the branch predictors, on branch patterns whose outcome is plain:
+   a loop, which everything but the static predictor learns; a branch that
+   alternates, which needs history; and calls nested deeper than the return
+   address stack.
+
+   Build and run with `make check`.
+*/
+
+#include <cstdio>
+
+#include "branch_predictor.h"
+#include "check.h"
+#include "rv32i.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+/// A branch unit set up as -bpred Spec would.
+static branch_unit *Unit( const char *Spec ) {
+   branch_unit::config Config;
+   string Error;
+   const bool Parsed = Config.parse( Spec, Error );
+
+   char Message[120];
+   snprintf( Message, sizeof( Message ), "%s: %s", Spec, Error.c_str() );
+   Expect( Parsed, Message );
+
+   return new branch_unit( Config );
+}
+
+static decoded_instr Instruction( instr_id ID,
+                                  uint32_t PC,
+                                  uint8_t RD,
+                                  uint8_t RS1,
+                                  uint32_t Imm = 0 ) {
+   decoded_instr D;
+   D.PC     = PC;
+   D.Word   = 0;
+   D.Imm    = Imm;
+   D.ID     = ID;
+   D.RD     = RD;
+   D.RS1    = RS1;
+   D.RS2    = 0;
+   D.Length = 4;
+   return D;
+}
+
+/// How many of the last Scored branches the unit's predictor gets wrong, out
+/// of Count from the branch at 0x1000 to 0x1000 - 8, going whichever way
+/// Taken says.
+template <typename pattern>
+static unsigned Wrong( const char *Spec,
+                       unsigned Count,
+                       unsigned Scored,
+                       pattern Taken ) {
+   unique_ptr<branch_unit> Branches( Unit( Spec ) );
+   const decoded_instr Branch = Instruction( BNE, 0x1000, 0, 10, -8 );
+
+   unsigned Wrong = 0;
+   for ( unsigned I = 0; I < Count; ++I ) {
+      const bool Right =
+        ( Branches->observe( Branch, Taken( I ) ? 0x1000 - 8 : 0x1004 ) ==
+          branch_unit::RIGHT );
+      Wrong += ( I >= Count - Scored and not Right );
+   }
+   return Wrong;
+}
+
+// ----------------------------------------------------------------------------
+
+int main( void ) {
+   const auto Loop = []( unsigned I ) {
+      return ( I % 10 != 9 );
+   };
+   const auto Alternating = []( unsigned I ) {
+      return ( I % 2 == 0 );
+   };
+
+   // A loop of 10: the exit is the only miss for those without history, and
+   // those with it see the exit coming.
+   Expect( Wrong( "static", 1000, 100, Loop ) == 10, "static, loop" );
+   Expect( Wrong( "bimodal", 1000, 100, Loop ) == 10, "bimodal, loop" );
+   Expect( Wrong( "gshare", 1000, 100, Loop ) == 0, "gshare, loop" );
+   Expect( Wrong( "tage", 1000, 100, Loop ) == 0, "TAGE, loop" );
+
+   // Backwards branches always taken by static, and bimodal flips between
+   // weakly taken and weakly not taken, wrong every time.
+   Expect( Wrong( "static", 1000, 100, Alternating ) == 50,
+           "static, alternating" );
+   Expect( Wrong( "bimodal", 1000, 100, Alternating ) == 100,
+           "bimodal, alternating" );
+   Expect( Wrong( "gshare", 1000, 100, Alternating ) == 0,
+           "gshare, alternating" );
+   Expect( Wrong( "tage", 1000, 100, Alternating ) == 0, "TAGE, alternating" );
+
+   {
+      // Four branches side by side, in a table of four counters, two going
+      // one way and two the other. Each needs a counter of its own, which
+      // it only gets if bit 1 of their PCs, always 0 here, isn't the index.
+      unique_ptr<branch_unit> Branches( Unit( "bimodal=2" ) );
+      unsigned Misses = 0;
+
+      for ( unsigned I = 0; I < 100; ++I ) {
+         for ( uint32_t Slot = 0; Slot < 4; ++Slot ) {
+            const uint32_t PC  = ( 0x1000 + 4 * Slot );
+            const bool Taken   = ( Slot == 0 or Slot == 3 );
+            const auto Outcome = Branches->observe(
+              Instruction( BNE, PC, 0, 10, -8 ), Taken ? PC - 8 : PC + 4 );
+            Misses += ( I >= 90 and Outcome != branch_unit::RIGHT );
+         }
+      }
+
+      Expect( Misses == 0, "neighbouring branches share a counter" );
+   }
+
+   {
+      // Calls six deep from 0x1000, 0x1100, ..., then the returns.
+      unique_ptr<branch_unit> Branches( Unit( "ras=4" ) );
+      unsigned Right = 0;
+
+      for ( uint32_t Depth = 0; Depth < 6; ++Depth ) {
+         const uint32_t PC = ( 0x1000 + 0x100 * Depth );
+         Branches->observe( Instruction( JAL, PC, 1, 0 ), PC + 0x100 );
+      }
+      for ( uint32_t Depth = 6; Depth-- > 0; ) {
+         const uint32_t PC = ( 0x1000 + 0x100 * Depth );
+         Right += ( Branches->observe( Instruction( JALR, PC + 0x180, 0, 1 ),
+                                       PC + 4 ) == branch_unit::RIGHT );
+      }
+
+      Expect( Right == 4, "return stack keeps the innermost four" );
+      Expect( Branches->observe( Instruction( JALR, 0x1000, 0, 6 ), 0x2000 ) ==
+                  branch_unit::UNPREDICTED and
+                Branches->observe( Instruction( JAL, 0x1000, 0, 0 ),
+                                   0x2000 ) == branch_unit::UNPREDICTED,
+              "other jumps aren't predicted" );
+   }
+
+   branch_unit::config Parsed;
+   string Error;
+   Expect( Parsed.parse( "tage=14,static,ras=8", Error ) and
+             Parsed.Predictors.size() == 2 and
+             Parsed.Predictors[0].first == "tage" and
+             Parsed.Predictors[0].second == 14 and
+             Parsed.Return_Stack_Depth == 8,
+           "-bpred settings" );
+   Expect( not Parsed.parse( "perceptron", Error ) and
+             not Parsed.parse( "gshare=30", Error ) and
+             not Parsed.parse( "bimodal=x", Error ),
+           "bad -bpred settings" );
+
+   if ( Num_Failures != 0 ) {
+      return 1;
+   }
+
+   printf( GREEN( "PASS" ) ": branch predictors learn what they should.\n" );
+   return 0;
+}
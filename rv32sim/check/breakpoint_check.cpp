@@ -0,0 +1,199 @@
+/*
+   Check of breakpoints. A guest loop of four instructions is run with
+   breakpoints added and taken away: two in one block, one with a hit count,
+   ones with conditions on a register, and one put on a block that's already
+   hot. Each has to stop the processor exactly where it says, with the
+   registers as they were just before that instruction. Done with and
+   without the JIT.
+
+   Build and run with `make check`.
+*/
+
+#include <cstdio>
+#include <sstream>
+
+#include "check.h"
+#include "memory.h"
+#include "processor.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static constexpr uint32_t Loop       = ( Code_Start + 4 );  // addi x1, x1, 1
+static constexpr uint32_t Add_3      = ( Code_Start + 8 );  // addi x2, x2, 3
+static constexpr uint32_t Add_5      = ( Code_Start + 12 ); // addi x3, x3, 5
+
+/// Long enough to go round the loop thousands of times.
+static constexpr unsigned Steps = 100000;
+
+/// A machine running the guest, printing to a string.
+struct loop_machine : machine {
+   ostringstream Output;
+
+   explicit loop_machine( bool JIT ) : machine( JIT ) {
+      const uint32_t Program[] = {
+         0x00000093, //    li   x1, 0
+         0x00108093, // 1: addi x1, x1, 1
+         0x00310113, //    addi x2, x2, 3
+         0x00518193, //    addi x3, x3, 5
+         0xff5ff06f, //    j    1b
+      };
+
+      Load_Program( this->Memory, Code_Start, Program );
+      this->CPU.set_output( this->Output );
+   }
+};
+
+static breakpoint Conditional( uint32_t Address,
+                               unsigned Reg,
+                               breakpoint::condition Condition,
+                               uint32_t Value ) {
+   breakpoint Breakpoint;
+   Breakpoint.Address   = Address;
+   Breakpoint.Reg       = uint8_t( Reg );
+   Breakpoint.Condition = Condition;
+   Breakpoint.Value     = Value;
+   return Breakpoint;
+}
+
+// ----------------------------------------------------------------------------
+
+static void Check( bool JIT ) {
+   {
+      loop_machine M( JIT );
+      Expect( M.CPU.execute( Steps, true ), "stopped with no breakpoints",
+              JIT );
+      Expect( M.CPU.get_instruction_count() == Steps,
+              "didn't run every instruction", JIT );
+   }
+
+   // Two in one block, the first one at the top of it.
+   {
+      loop_machine M( JIT );
+      M.CPU.set_breakpoint( Add_5 );
+      M.CPU.set_breakpoint( Loop );
+
+      Expect( not M.CPU.execute( Steps, true ) and M.CPU.get_pc() == Loop and
+                M.CPU.get_reg( 1 ) == 0,
+              "didn't stop at the first breakpoint", JIT );
+      Expect( not M.CPU.execute( Steps, true ) and M.CPU.get_pc() == Loop,
+              "didn't stay at the first breakpoint", JIT );
+
+      M.CPU.execute( 1, false );
+      Expect( not M.CPU.execute( Steps, true ) and M.CPU.get_pc() == Add_5 and
+                M.CPU.get_reg( 2 ) == 3 and M.CPU.get_reg( 3 ) == 0,
+              "didn't stop at the second breakpoint in the block", JIT );
+
+      M.CPU.execute( 1, false );
+      Expect( not M.CPU.execute( Steps, true ) and M.CPU.get_pc() == Loop and
+                M.CPU.get_reg( 1 ) == 1,
+              "didn't stop at the first breakpoint the second time", JIT );
+      Expect( M.Output.str() == "Breakpoint reached at 00001004\n"
+                                "Breakpoint reached at 00001004\n"
+                                "Breakpoint reached at 0000100c\n"
+                                "Breakpoint reached at 00001004\n",
+              "wrong messages", JIT );
+
+      Expect( M.CPU.execute( 4, false ) and M.CPU.get_pc() == Loop,
+              "stopped at a breakpoint when not checking", JIT );
+   }
+
+   // A hit count, high enough for the block to have got hot first.
+   {
+      loop_machine M( JIT );
+      breakpoint Breakpoint;
+      Breakpoint.Address = Add_3;
+      Breakpoint.Stop_At = 100;
+      M.CPU.set_breakpoint( Breakpoint );
+
+      Expect( not M.CPU.execute( Steps, true ) and M.CPU.get_pc() == Add_3 and
+                M.CPU.get_reg( 1 ) == 100 and M.CPU.get_reg( 2 ) == 99 * 3,
+              "didn't stop on the 100th hit", JIT );
+      Expect( M.CPU.get_breakpoints().at( Add_3 ).Hits == 100,
+              "wrong hit count", JIT );
+
+      // It stays stopped, from then on.
+      M.CPU.execute( 1, false );
+      Expect( not M.CPU.execute( Steps, true ) and
+                M.CPU.get_reg( 1 ) == 101,
+              "didn't stop after the 100th hit", JIT );
+   }
+
+   // Conditions, unsigned, with one in the same block that never holds.
+   {
+      loop_machine M( JIT );
+      M.CPU.set_breakpoint(
+        Conditional( Loop, 1, breakpoint::GREATER_OR_EQUAL, 0x300 ) );
+      M.CPU.set_breakpoint( Conditional( Add_5, 0, breakpoint::NOT_EQUAL, 0 ) );
+
+      Expect( not M.CPU.execute( Steps, true ) and M.CPU.get_pc() == Loop and
+                M.CPU.get_reg( 1 ) == 0x300,
+              "didn't stop when x1 >= 0x300", JIT );
+
+      M.CPU.set_breakpoint( Conditional( Loop, 3, breakpoint::EQUAL, 5000 ) );
+      M.CPU.execute( 1, false );
+      Expect( not M.CPU.execute( Steps, true ) and M.CPU.get_pc() == Loop and
+                M.CPU.get_reg( 3 ) == 5000 and M.CPU.get_reg( 1 ) == 1000,
+              "didn't stop when x3 == 5000", JIT );
+
+      M.CPU.set_breakpoint(
+        Conditional( Loop, 2, breakpoint::LESS, 0x80000000 ) );
+      M.CPU.set_reg( 2, 0x90000000 );
+      Expect( M.CPU.execute( 4000, true ),
+              "compared a register as signed", JIT );
+   }
+
+   // Added and taken away once the blocks are hot, and compiled if there's
+   // a JIT.
+   {
+      loop_machine M( JIT );
+      M.CPU.execute( Steps, true );
+
+      M.CPU.set_breakpoint( Add_5 );
+      Expect( not M.CPU.execute( Steps, true ) and M.CPU.get_pc() == Add_5,
+              "didn't stop at a breakpoint in a hot block", JIT );
+
+      Expect( not M.CPU.clear_breakpoint( Add_3 ),
+              "cleared a breakpoint that isn't there", JIT );
+      Expect( M.CPU.clear_breakpoint( Add_5 ), "couldn't clear a breakpoint",
+              JIT );
+      Expect( M.CPU.execute( Steps, true ), "stopped at a cleared breakpoint",
+              JIT );
+
+      M.CPU.set_breakpoint( Loop );
+      M.CPU.set_breakpoint( Add_3 );
+      M.CPU.clear_breakpoint();
+      Expect( M.CPU.get_breakpoints().empty() and
+                M.CPU.execute( Steps, true ),
+              "stopped after clearing every breakpoint", JIT );
+   }
+
+   {
+      loop_machine M( JIT );
+      M.CPU.show_breakpoints();
+      M.CPU.set_breakpoint( Add_5 );
+      breakpoint Breakpoint =
+        Conditional( Loop, 3, breakpoint::LESS_OR_EQUAL, 0x10 );
+      Breakpoint.Stop_At = 2;
+      M.CPU.set_breakpoint( Breakpoint );
+      M.CPU.show_breakpoints();
+      Expect( M.Output.str() ==
+                "No breakpoints\n"
+                "00001004 if x3 <= 00000010 hits 2, hit count 0\n"
+                "0000100c, hit count 0\n",
+              "wrong list of breakpoints", JIT );
+   }
+}
+
+int main( void ) {
+   Check( false );
+   Check( true );
+
+   if ( Num_Failures != 0 ) {
+      return 1;
+   }
+
+   printf( GREEN( "PASS" ) ": breakpoints stop where they should.\n" );
+   return 0;
+}
@@ -0,0 +1,126 @@
+/*
+   Check of the cache model, on access sequences small enough to follow by
+   hand: one or two sets, so which line each policy throws out is plain.
+
+   Build and run with `make check`.
+*/
+
+#include <cstdio>
+
+#include "cache.h"
+#include "check.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+/// A cache of one set with the given ways, of 32-byte lines.
+static cache::config One_Set( uint32_t Ways, cache::policy Replacement ) {
+   cache::config Config;
+   Config.Size        = ( Ways * 32 );
+   Config.Ways        = Ways;
+   Config.Line_Size   = 32;
+   Config.Replacement = Replacement;
+   return Config;
+}
+
+/// Load each line in turn (by number, not address), and say which missed:
+/// a string with a 1 for each miss and a 0 for each hit.
+static string Loads( cache &Cache, initializer_list<uint32_t> Lines ) {
+   string Missed;
+   for ( uint32_t Line : Lines ) {
+      Missed += ( Cache.access( Line * 32, 4, false ) ? '1' : '0' );
+   }
+   return Missed;
+}
+
+// ----------------------------------------------------------------------------
+
+int main( void ) {
+   {
+      cache LRU( One_Set( 2, cache::policy::LRU ) );
+      Expect( Loads( LRU, { 0, 1, 0, 2, 0, 1 } ) == "110101",
+              "LRU keeps the line used last" );
+      Expect( LRU.get_statistics().Hits == 2 and
+                LRU.get_statistics().Misses == 4 and
+                LRU.get_statistics().Evictions == 2,
+              "LRU statistics" );
+   }
+
+   {
+      // Two sets, with hits to and fro between them, which don't go through
+      // the set's ways again when it's the set's last line.
+      cache::config Config = One_Set( 2, cache::policy::LRU );
+      Config.Size          = 128;
+      cache LRU( Config );
+      Expect( Loads( LRU, { 0, 2, 1, 0, 1, 0, 4, 0, 2 } ) == "111000101",
+              "LRU keeps the line used last, across sets" );
+   }
+
+   {
+      // After 0 1 2 3 0, the tree points away from 0's half, then away from 3.
+      cache PLRU( One_Set( 4, cache::policy::PLRU ) );
+      Expect( Loads( PLRU, { 0, 1, 2, 3, 0, 4, 0, 1, 3, 2 } ) == "1111010001",
+              "PLRU evicts down the tree" );
+   }
+
+   {
+      cache Random( One_Set( 4, cache::policy::RANDOM ) );
+      Loads( Random, { 0, 1, 2, 3, 4, 5, 6, 7 } );
+      Expect( Random.get_statistics().Evictions == 4,
+              "random replacement only evicts from a full set" );
+   }
+
+   {
+      cache Back( One_Set( 1, cache::policy::LRU ) );
+      Back.access( 0, 4, true );
+      Expect( Loads( Back, { 0 } ) == "0", "write-back allocates on a store" );
+      Loads( Back, { 1, 2 } );
+      Expect( Back.get_statistics().Writebacks == 1,
+              "only dirty lines are written back" );
+   }
+
+   {
+      cache::config Config = One_Set( 1, cache::policy::LRU );
+      Config.Write_Back    = false;
+      cache Through( Config );
+      Through.access( 0, 4, true );
+      Expect( Loads( Through, { 0, 0 } ) == "10" and
+                Through.get_statistics().Writebacks == 0,
+              "write-through doesn't allocate on a store" );
+   }
+
+   {
+      cache::config Config = One_Set( 1, cache::policy::LRU );
+      Config.Size          = 64; // Two sets.
+      cache Straddle( Config );
+      Expect( Straddle.access( 30, 4, false ) == 2 and
+                Straddle.access( 28, 4, false ) == 0 and
+                Straddle.access( 32, 2, false ) == 0,
+              "an access across two lines looks up both" );
+   }
+
+   cache::config Parsed;
+   string Error;
+   Expect( Parsed.parse( "size=1k,ways=2,line=16,policy=plru,write=through,"
+                         "miss=20",
+                         Error ) and
+             Parsed.Size == 1024 and Parsed.Ways == 2 and
+             Parsed.Line_Size == 16 and
+             Parsed.Replacement == cache::policy::PLRU and
+             not Parsed.Write_Back and Parsed.Miss_Penalty == 20,
+           "-icache/-dcache settings" );
+   Expect( not Parsed.parse( "size=1000", Error ) and
+             not cache::config().parse( "ways=64,size=1k", Error ) and
+             not cache::config().parse( "line=2", Error ) and
+             not cache::config().parse( "policy=fifo", Error ) and
+             not cache::config().parse( "colour=blue", Error ),
+           "bad -icache/-dcache settings" );
+
+   if ( Num_Failures != 0 ) {
+      return 1;
+   }
+
+   printf( GREEN( "PASS" ) ": the cache model hits and misses right.\n" );
+   return 0;
+}
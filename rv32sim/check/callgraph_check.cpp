@@ -0,0 +1,74 @@
+/*
+   Check of the call graph profile: a guest that calls, recurses and returns,
+   run interpreted and compiled, has to come out as the same folded stacks,
+   with every instruction counted once.
+
+   Build and run with `make check`.
+*/
+
+#include <cstdio>
+#include <sstream>
+
+#include "check.h"
+#include "memory.h"
+#include "processor.h"
+#include "profile.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static void Check( bool JIT ) {
+   machine M( JIT, Call_Guest );
+
+   // g goes unnamed, to be reported by address.
+   symbol_table Symbols;
+   Add_Call_Guest_Symbols( Symbols );
+
+   call_graph_profile *Profile =
+     new call_graph_profile( Symbols, "/dev/null", 3 );
+   M.CPU.add_profiler( Profile );
+
+   // All 1641 instructions of the calls, then main's j 9 times. Run in bits
+   // so blocks get cut short too.
+   for ( unsigned I = 0; I < 10; ++I ) {
+      M.CPU.execute( 165, false );
+   }
+
+   ostringstream Folded;
+   Profile->write_folded( Folded );
+   Expect( Folded.str() == "main 170\n"
+                           "main;f 400\n"
+                           "main;f;0x00001040 80\n"
+                           "main;f;r 360\n"
+                           "main;f;r;r 360\n"
+                           "main;f;r;r;r 280\n",
+           "folded stacks",
+           JIT );
+
+   ostringstream Output;
+   Profile->report( Output, M.CPU.get_instruction_count() );
+   const string Report = Output.str();
+
+   // r's inclusive count isn't r's subtree counted again for each level.
+   Expect( Report.find( "Call graph: 200 calls, 4 functions, 6 call paths" ) ==
+               0 and
+             Report.find( "  main\n" ) != string::npos and
+             Report.find( "            1000  60.61%           1000  60.61%"
+                          "        120  r\n" ) != string::npos and
+             Report.find( "0x00001040" ) == string::npos,
+           "report",
+           JIT );
+}
+
+int main( void ) {
+   Check( false );
+   Check( true );
+
+   if ( Num_Failures != 0 ) {
+      return 1;
+   }
+
+   printf( GREEN( "PASS" ) ": the call graph follows calls and returns.\n" );
+   return 0;
+}
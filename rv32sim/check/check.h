@@ -0,0 +1,116 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   What the checks in check/ have in common
+
+**************************************************************** */
+
+/*
+   Each check is its own program, so these are static: every one gets its
+   own failure count. A check calls Expect() as it goes, and main() returns
+   1 if Num_Failures isn't 0 at the end.
+*/
+
+#include <cstddef>
+#include <cstdio>
+
+#include "memory.h"
+#include "processor.h"
+#include "util.h"
+
+// ----------------------------------------------------------------------------
+
+static unsigned Num_Failures = 0;
+
+/// Count a failure, and say what it was, unless Condition holds. JIT is
+/// whether it was run compiled, for checks that run everything both ways.
+static inline void
+Expect( bool Condition, const char *What, bool JIT = false ) {
+   if ( not Condition ) {
+      printf( RED( "FAIL" ) ": %s%s\n", What, JIT ? " (JIT)" : "" );
+      Num_Failures += 1;
+   }
+}
+
+/// Store a program's words one after the other from the given address.
+template <size_t Length>
+static inline void Load_Program( memory &Memory,
+                                 uint32_t Address,
+                                 const uint32_t ( &Program )[Length] ) {
+   for ( const auto Word : Program ) {
+      Memory.store32( Address, Word );
+      Address += 4;
+   }
+}
+
+/// Where the checks put their guest programs.
+static constexpr uint32_t Code_Start = 0x00001000;
+
+/// A memory, and a processor on it at Code_Start in stage 2, with or without
+/// the JIT. Given a program, it's loaded there.
+struct machine {
+   memory Memory{ false };
+   processor CPU;
+
+   explicit machine( bool JIT ) : CPU( &Memory, false, true, JIT ) {
+      this->CPU.set_pc( Code_Start );
+   }
+
+   template <size_t Length>
+   machine( bool JIT, const uint32_t ( &Program )[Length] ) : machine( JIT ) {
+      Load_Program( this->Memory, Code_Start, Program );
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+/// A guest that calls, recurses and returns, for the profilers' checks.
+/// main, at 0x1000, calls f 40 times and then spins; f calls g, and then r,
+/// which calls itself three deep. g has no symbol. 1641 instructions get it
+/// to main's spin.
+static const uint32_t Call_Guest[] = {
+   // main, at 0x1000: 40 calls to f, then spin.
+   0x02800413, //    li    s0, 40
+   0x00000097, // 1: auipc ra, 0
+   0x014080e7, //    jalr  20(ra)      -- call f
+   0xfff40413, //    addi  s0, s0, -1
+   0xfe041ae3, //    bnez  s0, 1b
+   0x0000006f, // 2: j     2b
+   // f, at 0x1018: calls g, then r(3).
+   0xff010113, //    addi  sp, sp, -16
+   0x00112023, //    sw    ra, 0(sp)
+   0x00000097, //    auipc ra, 0
+   0x020080e7, //    jalr  32(ra)      -- call g
+   0x00300513, //    li    a0, 3
+   0x00000097, //    auipc ra, 0
+   0x01c080e7, //    jalr  28(ra)      -- call r
+   0x00012083, //    lw    ra, 0(sp)
+   0x01010113, //    addi  sp, sp, 16
+   0x00008067, //    ret
+   // g, at 0x1040.
+   0x00150513, //    addi  a0, a0, 1
+   0x00008067, //    ret
+   // r, at 0x1048: calls itself until a0 gets to 0.
+   0xff010113, //    addi  sp, sp, -16
+   0x00112023, //    sw    ra, 0(sp)
+   0xfff50513, //    addi  a0, a0, -1
+   0x00050663, //    beqz  a0, 3f
+   0x00000097, //    auipc ra, 0
+   0xff0080e7, //    jalr  -16(ra)     -- call r
+   0x00012083, // 3: lw    ra, 0(sp)
+   0x01010113, //    addi  sp, sp, 16
+   0x00008067, //    ret
+};
+
+/// Call_Guest's functions, all but g.
+static inline void Add_Call_Guest_Symbols( symbol_table &Symbols ) {
+   Symbols.add( 0x1000, 0x18, "main" );
+   Symbols.add( 0x1018, 0x28, "f" );
+   Symbols.add( 0x1048, 0x24, "r" );
+   Symbols.finish();
+}
+
+#endif
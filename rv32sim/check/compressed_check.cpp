@@ -0,0 +1,163 @@
+/*
+   Check of the C extension. Every kind of 16-bit instruction is expanded and
+   compared with the 32-bit one llvm-mc says it stands for, and reserved
+   encodings must come out illegal. Then a little compressed code is run,
+   interpreted and with the JIT: a loop whose 32-bit instruction straddles
+   a page boundary and gets rewritten as it goes, and a trap from an
+   instruction that's only halfword aligned.
+
+   Build and run with `make check`.
+*/
+
+#include <cstdio>
+
+#include "check.h"
+#include "memory.h"
+#include "processor.h"
+#include "rv32c.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+struct expansion {
+   uint16_t Parcel;
+   uint32_t Expected;
+   const char *Assembly;
+};
+
+static const expansion Expansions[] = {
+   { 0x1fe0, 0x3fc10413, "c.addi4spn s0, sp, 1020" },
+   { 0x5d7c, 0x07c52783, "c.lw a5, 124(a0)" },
+   { 0xc2a4, 0x0496a023, "c.sw s1, 64(a3)" },
+   { 0x0001, 0x00000013, "c.nop" },
+   { 0x1501, 0xfe050513, "c.addi a0, -32" },
+   { 0x3001, 0x801ff0ef, "c.jal -2048" },
+   { 0x42fd, 0x01f00293, "c.li t0, 31" },
+   { 0x7101, 0xe0010113, "c.addi16sp sp, -512" },
+   { 0x7901, 0xfffe0937, "c.lui s2, 0xfffe0" },
+   { 0x81fd, 0x01f5d593, "c.srli a1, 31" },
+   { 0x8605, 0x40165613, "c.srai a2, 1" },
+   { 0x9afd, 0xfff6f693, "c.andi a3, -1" },
+   { 0x8c05, 0x40940433, "c.sub s0, s1" },
+   { 0x8f3d, 0x00f74733, "c.xor a4, a5" },
+   { 0x8d4d, 0x00b56533, "c.or a0, a1" },
+   { 0x8cf1, 0x00c4f4b3, "c.and s1, a2" },
+   { 0xaffd, 0x7fe0006f, "c.j 2046" },
+   { 0xd101, 0xf00500e3, "c.beqz a0, -256" },
+   { 0xecfd, 0x0e049f63, "c.bnez s1, 254" },
+   { 0x00c6, 0x01109093, "c.slli ra, 17" },
+   { 0x5ffe, 0x0fc12f83, "c.lwsp t6, 252(sp)" },
+   { 0x8082, 0x00008067, "c.jr ra" },
+   { 0x8572, 0x01c00533, "c.mv a0, t3" },
+   { 0x9002, 0x00100073, "c.ebreak" },
+   { 0x9282, 0x000280e7, "c.jalr t0" },
+   { 0x910e, 0x00310133, "c.add sp, gp" },
+   { 0xc26e, 0x01b12223, "c.swsp s11, 4(sp)" },
+};
+
+static const uint16_t Reserved[] = {
+   0x0000, // All zeroes: defined illegal.
+   0x6101, // c.addi16sp with a zero immediate.
+   0x6081, // c.lui with a zero immediate.
+   0x9001, // c.srli with shamt[5] set.
+   0x9c01, // c.subw is RV64.
+   0x4002, // c.lwsp into x0.
+   0x8002, // c.jr x0.
+   0x2002, // c.fldsp needs D.
+};
+
+static void Check_Expansions( void ) {
+   for ( const auto &E : Expansions ) {
+      Expect( Is_Compressed( E.Parcel ), E.Assembly, false );
+      Expect( Expand_Compressed( E.Parcel ) == E.Expected, E.Assembly, false );
+   }
+
+   for ( const uint16_t Parcel : Reserved ) {
+      const decoded_instr D = Decode_Compressed( Parcel, 0 );
+      Expect( D.ID == UNKNOWN_INSTR and D.Length == 2,
+              "a reserved encoding isn't illegal", false );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+static void Store( memory &Memory, uint32_t Address,
+                   const uint16_t *Parcels, size_t Count ) {
+   for ( size_t I = 0; I < Count; ++I ) {
+      Memory.store16( Address + 2 * uint32_t( I ), Parcels[I] );
+   }
+}
+
+/// Loops twice from the last halfword before 0x2000. The addi there straddles
+/// the boundary, and the loop rewrites its upper half to add 0x105 instead.
+static void Check_Page_Straddle( bool JIT ) {
+   static const uint16_t Program[] = {
+      0x0001,                // c.nop
+      0x0513, 0x0055,        // addi   a0, a0, 5
+      0x6285,                // c.lui  t0, 1
+      0x8293, 0x0552,        // addi   t0, t0, 0x55
+      0x1023, 0x0056,        // sh     t0, 0(a2)
+      0x15fd,                // c.addi a1, -1
+      0xf5fd,                // c.bnez a1, the start
+      0xa001,                // c.j    .
+   };
+
+   memory Memory( false );
+   processor CPU( &Memory, false, true, JIT );
+   CPU.set_compressed( true );
+
+   Store( Memory, 0x1ffc, Program, sizeof( Program ) / 2 );
+   CPU.set_pc( 0x1ffc );
+   CPU.set_reg( 11, 2 );
+   CPU.set_reg( 12, 0x2000 );
+   CPU.execute( 100, false );
+
+   Expect( CPU.get_reg( 10 ) == 5 + 0x105,
+           "the straddling instruction wasn't decoded again", JIT );
+   Expect( CPU.get_pc() == 0x2010, "the loop didn't finish", JIT );
+}
+
+/// An illegal instruction 2 bytes into the page traps with MEPC pointing at
+/// it, and MTVAL holding just its 16 bits.
+static void Check_Trap( bool JIT ) {
+   static const uint16_t Program[] = {
+      0x0001, // c.nop
+      0x0000, // illegal
+      0x0505, // c.addi a0, 1
+   };
+
+   memory Memory( false );
+   processor CPU( &Memory, false, true, JIT );
+   CPU.set_compressed( true );
+
+   Store( Memory, 0x1000, Program, 3 );
+   Memory.store32( 0x1100, 0x0000006f ); // jal x0, 0
+   CPU.set_csr( CSR_MTVEC, 0x1100 );
+   CPU.set_pc( 0x1000 );
+   CPU.execute( 10, false );
+
+   Expect( CPU.get_pc() == 0x1100, "didn't reach the handler", JIT );
+   Expect( CPU.get_csr( CSR_MEPC ) == 0x1002, "MEPC is wrong", JIT );
+   Expect( CPU.get_csr( CSR_MCAUSE ) == 2, "MCAUSE is wrong", JIT );
+   Expect( CPU.get_csr( CSR_MTVAL ) == 0, "MTVAL is wrong", JIT );
+   Expect( CPU.get_reg( 10 ) == 0, "ran past the illegal instruction", JIT );
+}
+
+// ----------------------------------------------------------------------------
+
+int main( void ) {
+   Check_Expansions();
+
+   for ( const bool JIT : { false, true } ) {
+      Check_Page_Straddle( JIT );
+      Check_Trap( JIT );
+   }
+
+   if ( Num_Failures != 0 ) {
+      return 1;
+   }
+
+   printf( GREEN( "PASS" ) ": 16-bit instructions expand and run.\n" );
+   return 0;
+}
@@ -0,0 +1,73 @@
+/*
+   Exhaustive check of Determine_Instruction_ID() against the linear decoder it
+   replaced. Every one of the 2^32 possible instruction words is decoded both
+   ways, split across however many threads the machine has. The linear
+   decoder is in bench/linear_decoder.h, which decode_bench times it from.
+
+   Build and run with `make check`. Takes a minute or two.
+*/
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "bench/linear_decoder.h"
+#include "rv32i.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static atomic<uint64_t> Num_Mismatches( 0 );
+
+static const char *Name( instr_id ID ) {
+   return ( ID == UNKNOWN_INSTR ? "[unknown]" : Instr_String_Mapping[ID] );
+}
+
+static void Check_Range( uint64_t First, uint64_t Last ) {
+   for ( uint64_t I = First; I < Last; ++I ) {
+      const auto Integer  = uint32_t( I );
+      const auto Expected = Linear_Determine_Instruction_ID( Integer );
+      const auto Got      = Determine_Instruction_ID( Integer );
+
+      if ( Got != Expected ) {
+         // Only report the first few, or we'd be here all day.
+         if ( Num_Mismatches++ < 16 ) {
+            printf( "%08x: expected %s, got %s\n",
+                    Integer,
+                    Name( Expected ),
+                    Name( Got ) );
+         }
+      }
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+int main( void ) {
+   const unsigned Num_Threads = max( 1u, thread::hardware_concurrency() );
+   const uint64_t Total       = ( uint64_t( 1 ) << 32 );
+   const uint64_t Chunk       = ( Total / Num_Threads );
+
+   vector<thread> Threads;
+   for ( unsigned T = 0; T < Num_Threads; ++T ) {
+      const uint64_t First = ( T * Chunk );
+      const uint64_t Last  = ( T + 1 == Num_Threads ? Total : First + Chunk );
+      Threads.emplace_back( Check_Range, First, Last );
+   }
+
+   for ( auto &Thread : Threads ) {
+      Thread.join();
+   }
+
+   if ( Num_Mismatches != 0 ) {
+      printf( RED( "FAIL" ) ": %" PRIu64 " encodings decode differently.\n",
+              uint64_t( Num_Mismatches ) );
+      return 1;
+   }
+
+   printf( GREEN( "PASS" ) ": all 2^32 encodings decode the same.\n" );
+   return 0;
+}
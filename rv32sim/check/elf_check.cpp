@@ -0,0 +1,171 @@
+/*
+   Check of the ELF loader. A small RV32 executable is put together by hand --
+   one PT_LOAD segment with a .bss tail, and a symbol table -- written to a
+   temporary file, and loaded over memory that already has junk where the
+   .bss goes.
+
+   Build and run with `make check`.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <elf.h>
+#include <unistd.h>
+#include <vector>
+
+#include "check.h"
+#include "memory.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+template <typename thing>
+static void Put( vector<uint8_t> &File, size_t Offset, const thing &Thing ) {
+   if ( File.size() < Offset + sizeof( Thing ) ) {
+      File.resize( Offset + sizeof( Thing ) );
+   }
+   memcpy( &File[Offset], &Thing, sizeof( Thing ) );
+}
+
+// ----------------------------------------------------------------------------
+
+static constexpr uint32_t Load_Address = 0x00001000;
+static constexpr uint32_t File_Bytes   = 16;
+static constexpr uint32_t Memory_Bytes = 0x2000;
+static constexpr uint32_t Entry        = 0x00001004;
+
+static vector<uint8_t> Make_Executable( void ) {
+   vector<uint8_t> File;
+
+   enum : uint32_t {
+      PHDR_OFFSET   = sizeof( Elf32_Ehdr ),
+      CODE_OFFSET   = 0x100,
+      STRTAB_OFFSET = 0x200,
+      SYMTAB_OFFSET = 0x300,
+      SHDR_OFFSET   = 0x400,
+   };
+
+   Elf32_Ehdr Header = {};
+   memcpy( Header.e_ident, ELFMAG, SELFMAG );
+   Header.e_ident[EI_CLASS]   = ELFCLASS32;
+   Header.e_ident[EI_DATA]    = ELFDATA2LSB;
+   Header.e_ident[EI_VERSION] = EV_CURRENT;
+   Header.e_type              = ET_EXEC;
+   Header.e_machine           = EM_RISCV;
+   Header.e_version           = EV_CURRENT;
+   Header.e_entry             = Entry;
+   Header.e_phoff             = PHDR_OFFSET;
+   Header.e_shoff             = SHDR_OFFSET;
+   Header.e_ehsize            = sizeof( Elf32_Ehdr );
+   Header.e_phentsize         = sizeof( Elf32_Phdr );
+   Header.e_phnum             = 1;
+   Header.e_shentsize         = sizeof( Elf32_Shdr );
+   Header.e_shnum             = 3;
+   Put( File, 0, Header );
+
+   Elf32_Phdr Segment = {};
+   Segment.p_type     = PT_LOAD;
+   Segment.p_offset   = CODE_OFFSET;
+   Segment.p_vaddr    = Load_Address;
+   Segment.p_paddr    = Load_Address;
+   Segment.p_filesz   = File_Bytes;
+   Segment.p_memsz    = Memory_Bytes;
+   Put( File, PHDR_OFFSET, Segment );
+
+   for ( uint32_t I = 0; I < File_Bytes; ++I ) {
+      Put( File, CODE_OFFSET + I, uint8_t( 0xA0 + I ) );
+   }
+
+   const char Names[] = "\0main\0$x\0helper\0data";
+   Put( File, STRTAB_OFFSET, Names );
+
+   const auto Symbol = []( uint32_t Name, uint32_t Value, uint32_t Size,
+                           unsigned Type, uint16_t Section ) {
+      Elf32_Sym S = {};
+      S.st_name   = Name;
+      S.st_value  = Value;
+      S.st_size   = Size;
+      S.st_info   = ELF32_ST_INFO( STB_GLOBAL, Type );
+      S.st_shndx  = Section;
+      return S;
+   };
+
+   const Elf32_Sym Symbols[] = {
+      Symbol( 0, 0, 0, STT_NOTYPE, SHN_UNDEF ),
+      Symbol( 1, 0x1000, 8, STT_FUNC, 1 ),     // main
+      Symbol( 6, 0x1000, 0, STT_NOTYPE, 1 ),   // $x
+      Symbol( 9, 0x1008, 0, STT_NOTYPE, 1 ),   // helper
+      Symbol( 16, 0x1010, 4, STT_OBJECT, 1 ),  // data
+      Symbol( 9, 0x5000, 0, STT_FUNC, SHN_UNDEF ),
+   };
+   Put( File, SYMTAB_OFFSET, Symbols );
+
+   Elf32_Shdr Sections[3] = {};
+   Sections[1].sh_type    = SHT_SYMTAB;
+   Sections[1].sh_offset  = SYMTAB_OFFSET;
+   Sections[1].sh_size    = sizeof( Symbols );
+   Sections[1].sh_link    = 2;
+   Sections[2].sh_type    = SHT_STRTAB;
+   Sections[2].sh_offset  = STRTAB_OFFSET;
+   Sections[2].sh_size    = sizeof( Names );
+   Put( File, SHDR_OFFSET, Sections );
+
+   return File;
+}
+
+// ----------------------------------------------------------------------------
+
+int main( void ) {
+   char File_Name[] = "/tmp/elf_check_XXXXXX";
+   const int Descriptor = mkstemp( File_Name );
+   if ( Descriptor < 0 ) {
+      perror( "mkstemp" );
+      return 1;
+   }
+
+   const auto Executable = Make_Executable();
+   const ssize_t Size    = ssize_t( Executable.size() );
+   const bool Written =
+     ( write( Descriptor, Executable.data(), Executable.size() ) == Size );
+   close( Descriptor );
+   Expect( Written, "couldn't write the test executable" );
+
+   memory Memory( false );
+
+   // Junk where the .bss goes, on both of its pages.
+   Memory.write_word( Load_Address + File_Bytes, 0xDEADBEEF );
+   Memory.write_word( Load_Address + Memory_Bytes - 4, 0xDEADBEEF );
+
+   uint32_t Start = 0;
+   Expect( Memory.load_file( File_Name, Start ), "load_file() failed" );
+   unlink( File_Name );
+
+   Expect( Start == Entry, "start address isn't the entry point" );
+
+   bool Contents_Match = true;
+   for ( uint32_t I = 0; I < File_Bytes; ++I ) {
+      Contents_Match &= ( Memory.load8( Load_Address + I ) == 0xA0 + I );
+   }
+   Expect( Contents_Match, "segment contents differ" );
+
+   Expect( Memory.read_word( Load_Address + File_Bytes ) == 0 and
+             Memory.read_word( Load_Address + Memory_Bytes - 4 ) == 0,
+           ".bss wasn't zeroed" );
+
+   const symbol *Main   = Memory.Symbols.find( 0x1004 );
+   const symbol *Helper = Memory.Symbols.find( 0x100C );
+
+   Expect( Memory.Symbols.size() == 2, "expected just main and helper" );
+   Expect( Main and Main->Name == "main", "0x1004 isn't in main" );
+   Expect( Helper and Helper->Name == "helper", "0x100c isn't in helper" );
+   Expect( Memory.Symbols.find( 0x0FFC ) == nullptr,
+           "0x0ffc shouldn't be in anything" );
+
+   if ( Num_Failures != 0 ) {
+      return 1;
+   }
+
+   printf( GREEN( "PASS" ) ": ELF segments, .bss and symbols load.\n" );
+   return 0;
+}
@@ -0,0 +1,173 @@
+/*
+   Check of the M extension. Each multiply and divide is run in a loop, with
+   and without the JIT, first on the cases the ISA manual spells out --
+   division by zero, INT32_MIN / -1, and the high half of the product for
+   each mix of signs -- and then on every pair from a set of awkward values,
+   against the same sums done in 64 bits here.
+
+   Build and run with `make check`.
+*/
+
+#include <cstdio>
+
+#include "check.h"
+#include "memory.h"
+#include "processor.h"
+#include "rv32i.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static constexpr uint32_t Int32_Min  = 0x80000000;
+
+/// Enough times round the loop for the JIT to have compiled it.
+static constexpr uint32_t Warm_Up = 100;
+
+/// A machine running `op x3, x1, x2` in a loop of x4 times round.
+struct op_machine : machine {
+   op_machine( instr_id Op, bool JIT ) : machine( JIT ) {
+      // The JIT leaves division to the interpreter, so the addi comes first
+      // for it to have something to compile ahead of it.
+      const uint32_t Program[] = {
+         0xfff20213, //    addi x4, x4, -1
+         Unique_Mask[Op] | 2 << 20 | 1 << 15 | 3 << 7,
+         0xfe021ce3, //    bnez x4, the start
+         0x0000006f, // 1: j    1b
+      };
+      Load_Program( this->Memory, Code_Start, Program );
+
+      this->run( 0, 0, Warm_Up );
+   }
+
+   uint32_t run( uint32_t A, uint32_t B, uint32_t Times = 1 ) {
+      this->CPU.set_reg( 1, A );
+      this->CPU.set_reg( 2, B );
+      this->CPU.set_reg( 4, Times );
+      this->CPU.set_pc( Code_Start );
+      this->CPU.execute( 3 * Times, false );
+      return this->CPU.get_reg( 3 );
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+struct spelled_out {
+   instr_id Op;
+   uint32_t A, B;
+   uint32_t Expected;
+   const char *Assembly;
+};
+
+static const spelled_out Spelled_Out[] = {
+   // Division by zero: all ones, or the dividend.
+   { DIV, 7, 0, 0xffffffff, "div 7, 0" },
+   { DIV, Int32_Min, 0, 0xffffffff, "div INT32_MIN, 0" },
+   { DIVU, 7, 0, 0xffffffff, "divu 7, 0" },
+   { DIVU, 0, 0, 0xffffffff, "divu 0, 0" },
+   { REM, 7, 0, 7, "rem 7, 0" },
+   { REM, uint32_t( -7 ), 0, uint32_t( -7 ), "rem -7, 0" },
+   { REMU, 0xfffffff9, 0, 0xfffffff9, "remu 0xfffffff9, 0" },
+   // Signed overflow.
+   { DIV, Int32_Min, uint32_t( -1 ), Int32_Min, "div INT32_MIN, -1" },
+   { REM, Int32_Min, uint32_t( -1 ), 0, "rem INT32_MIN, -1" },
+   { DIVU, Int32_Min, uint32_t( -1 ), 0, "divu 0x80000000, 0xffffffff" },
+   { REMU, Int32_Min, uint32_t( -1 ), Int32_Min,
+     "remu 0x80000000, 0xffffffff" },
+   { MUL, Int32_Min, uint32_t( -1 ), Int32_Min, "mul INT32_MIN, -1" },
+   // Rounding towards zero, with the remainder taking the dividend's sign.
+   { DIV, uint32_t( -7 ), 2, uint32_t( -3 ), "div -7, 2" },
+   { DIV, 7, uint32_t( -2 ), uint32_t( -3 ), "div 7, -2" },
+   { REM, uint32_t( -7 ), 2, uint32_t( -1 ), "rem -7, 2" },
+   { REM, 7, uint32_t( -2 ), 1, "rem 7, -2" },
+   // The high half, for each mix of signs.
+   { MULH, 2, 3, 0, "mulh 2, 3" },
+   { MULH, uint32_t( -2 ), 3, 0xffffffff, "mulh -2, 3" },
+   { MULH, 2, uint32_t( -3 ), 0xffffffff, "mulh 2, -3" },
+   { MULH, uint32_t( -1 ), uint32_t( -1 ), 0, "mulh -1, -1" },
+   { MULH, Int32_Min, Int32_Min, 0x40000000, "mulh INT32_MIN, INT32_MIN" },
+   { MULH, Int32_Min, 0x7fffffff, 0xc0000000, "mulh INT32_MIN, INT32_MAX" },
+   { MULHSU, 1, 0xffffffff, 0, "mulhsu 1, 0xffffffff" },
+   { MULHSU, uint32_t( -1 ), 0xffffffff, 0xffffffff,
+     "mulhsu -1, 0xffffffff" },
+   { MULHSU, Int32_Min, 0xffffffff, 0x80000000,
+     "mulhsu INT32_MIN, 0xffffffff" },
+   { MULHSU, 0x7fffffff, 0xffffffff, 0x7ffffffe,
+     "mulhsu INT32_MAX, 0xffffffff" },
+   { MULHSU, uint32_t( -2 ), 2, 0xffffffff, "mulhsu -2, 2" },
+   { MULHU, 0xffffffff, 0xffffffff, 0xfffffffe,
+     "mulhu 0xffffffff, 0xffffffff" },
+   { MULHU, 0x80000000, 2, 1, "mulhu 0x80000000, 2" },
+   { MULHU, 0x80000000, 0x80000000, 0x40000000,
+     "mulhu 0x80000000, 0x80000000" },
+};
+
+static void Check_Spelled_Out( bool JIT ) {
+   for ( const auto &S : Spelled_Out ) {
+      op_machine M( S.Op, JIT );
+      Expect( M.run( S.A, S.B ) == S.Expected, S.Assembly, JIT );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+/// What Op gives, done in 64 bits.
+static uint32_t Reference( instr_id Op, uint32_t A, uint32_t B ) {
+   const int64_t A_Signed = int32_t( A );
+   const int64_t B_Signed = int32_t( B );
+
+   switch ( Op ) {
+      case MUL: return uint32_t( uint64_t( A ) * B );
+      case MULH: return uint32_t( uint64_t( A_Signed * B_Signed ) >> 32 );
+      case MULHSU:
+         return uint32_t( uint64_t( A_Signed * int64_t( B ) ) >> 32 );
+      case MULHU: return uint32_t( ( uint64_t( A ) * B ) >> 32 );
+      case DIV:
+         return ( B == 0 ? 0xffffffff : uint32_t( A_Signed / B_Signed ) );
+      case DIVU: return ( B == 0 ? 0xffffffff : A / B );
+      case REM: return ( B == 0 ? A : uint32_t( A_Signed % B_Signed ) );
+      default: return ( B == 0 ? A : A % B );
+   }
+}
+
+static const uint32_t Awkward[] = {
+   0,          1,          0xffffffff, 2,          0xfffffffe, 7,
+   0xfffffff9, Int32_Min,  0x7fffffff, 0x80000001, 0x12345678, 0x9abcdef0,
+};
+
+static void Check_Against_Reference( bool JIT ) {
+   for ( unsigned Op = MUL; Op <= REMU; ++Op ) {
+      op_machine M( instr_id( Op ), JIT );
+
+      for ( const uint32_t A : Awkward ) {
+         for ( const uint32_t B : Awkward ) {
+            const uint32_t Result   = M.run( A, B );
+            const uint32_t Expected = Reference( instr_id( Op ), A, B );
+
+            if ( Result != Expected ) {
+               char What[80];
+               snprintf( What, sizeof( What ),
+                         "%s 0x%08x, 0x%08x gave 0x%08x, not 0x%08x",
+                         Instr_String_Mapping[Op], A, B, Result, Expected );
+               Expect( false, What, JIT );
+            }
+         }
+      }
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+int main( void ) {
+   for ( const bool JIT : { false, true } ) {
+      Check_Spelled_Out( JIT );
+      Check_Against_Reference( JIT );
+   }
+
+   if ( Num_Failures != 0 ) {
+      return 1;
+   }
+
+   printf( GREEN( "PASS" ) ": multiplies and divides come out right.\n" );
+   return 0;
+}
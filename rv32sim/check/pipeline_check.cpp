@@ -0,0 +1,108 @@
+/*
+   Check of the pipeline timing model, on short instruction sequences whose
+   cycle counts are easy to work out by hand: five stages, so n independent
+   instructions take n + 4 cycles, plus whatever holds them up.
+
+   Build and run with `make check`.
+*/
+
+#include <cstdio>
+
+#include "check.h"
+#include "rv32i.h"
+#include "timing.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+/// Where each instruction goes next: along, or Target if that's set.
+struct step {
+   uint32_t Word;
+   uint32_t Target;
+};
+
+static void Expect_Cycles( const char *What,
+                           const pipeline::config &Config,
+                           initializer_list<step> Steps,
+                           uint64_t Expected ) {
+   pipeline Pipeline( Config );
+
+   uint32_t PC = Code_Start;
+   for ( const step &Step : Steps ) {
+      if ( Step.Word == 0 ) {
+         Pipeline.trap();
+         continue;
+      }
+
+      const decoded_instr D = Decode_Instruction( Step.Word, PC );
+      PC                    = ( Step.Target ? Step.Target : PC + 4 );
+      Pipeline.retire( D, PC, 0 );
+   }
+
+   const uint64_t Cycles = Pipeline.get_cycle_count();
+   char Message[120];
+   snprintf( Message, sizeof( Message ), "%s: %llu cycles, not %llu", What,
+             (unsigned long long) Cycles, (unsigned long long) Expected );
+   Expect( Cycles == Expected, Message );
+}
+
+// ----------------------------------------------------------------------------
+
+static constexpr uint32_t Addi_A0   = 0x00150513; // addi a0, a0, 1
+static constexpr uint32_t Addi_A1   = 0x00158593; // addi a1, a1, 1
+static constexpr uint32_t Lw_A0     = 0x00012503; // lw   a0, 0(sp)
+static constexpr uint32_t Add_A1_A0 = 0x00a505b3; // add  a1, a0, a0
+static constexpr uint32_t Slli_A1   = 0x00159593; // slli a1, a1, 1
+static constexpr uint32_t Bnez_A0   = 0xfe051ee3; // bnez a0, -4
+static constexpr uint32_t Jal_8     = 0x0080006f; // jal  x0, 8
+static constexpr uint32_t Div_A1_A0 = 0x02a545b3; // div  a1, a0, a0
+static constexpr uint32_t Trap      = 0;          // Not an instruction.
+
+int main( void ) {
+   const pipeline::config Defaults;
+
+   pipeline::config No_Forwarding;
+   No_Forwarding.Forwarding = false;
+
+   Expect_Cycles( "nothing", Defaults, {}, 0 );
+   Expect_Cycles( "independent", Defaults,
+                  { { Addi_A0, 0 }, { Addi_A1, 0 }, { Addi_A0, 0 } }, 7 );
+   Expect_Cycles( "ALU result forwarded", Defaults,
+                  { { Addi_A0, 0 }, { Add_A1_A0, 0 } }, 6 );
+   Expect_Cycles( "load-use stall", Defaults,
+                  { { Lw_A0, 0 }, { Add_A1_A0, 0 } }, 7 );
+   Expect_Cycles( "load with something in between", Defaults,
+                  { { Lw_A0, 0 }, { Addi_A1, 0 }, { Add_A1_A0, 0 } }, 7 );
+   Expect_Cycles( "shift amount isn't a register", Defaults,
+                  { { Lw_A0, 0 }, { Slli_A1, 0 } }, 6 );
+   Expect_Cycles( "no forwarding", No_Forwarding,
+                  { { Addi_A0, 0 }, { Add_A1_A0, 0 } }, 8 );
+   Expect_Cycles( "no forwarding, one in between", No_Forwarding,
+                  { { Addi_A0, 0 }, { Addi_A1, 0 }, { Add_A1_A0, 0 } }, 8 );
+   Expect_Cycles( "branch not taken", Defaults,
+                  { { Bnez_A0, 0 }, { Addi_A0, 0 } }, 6 );
+   Expect_Cycles( "branch taken", Defaults,
+                  { { Bnez_A0, 0xffc }, { Addi_A0, 0 } }, 8 );
+   Expect_Cycles( "jump", Defaults, { { Jal_8, 0x1008 }, { Addi_A0, 0 } }, 7 );
+   Expect_Cycles( "divide", Defaults,
+                  { { Div_A1_A0, 0 }, { Addi_A0, 0 } }, 6 + 31 );
+   Expect_Cycles( "trap", Defaults,
+                  { { Addi_A0, 0 }, { Trap, 0 }, { Addi_A1, 0 } }, 6 + 3 );
+
+   pipeline::config Parsed;
+   string Error;
+   Expect( Parsed.parse( "forwarding=0,branch=3,div=4", Error ) and
+             not Parsed.Forwarding and Parsed.Branch_Penalty == 3 and
+             Parsed.Div_Cycles == 4 and not Parsed.parse( "branch", Error ) and
+             not Parsed.parse( "fetch=2", Error ) and
+             not Parsed.parse( "mul=0", Error ),
+           "-pipeline settings" );
+
+   if ( Num_Failures != 0 ) {
+      return 1;
+   }
+
+   printf( GREEN( "PASS" ) ": the pipeline model counts stalls right.\n" );
+   return 0;
+}
@@ -0,0 +1,106 @@
+/*
+   Check of the instruction profile: a guest loop of known shape is run,
+   interpreted and compiled, and stopped partway through an iteration, and
+   the report has to count every instruction it ran. So does one that writes
+   over its own code every time round, so the blocks the profile's told about
+   are thrown out under it.
+
+   Build and run with `make check`.
+*/
+
+#include <cstdio>
+#include <sstream>
+
+#include "bench/bench.h"
+#include "check.h"
+#include "memory.h"
+#include "processor.h"
+#include "profile.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static bool Has( const string &Report, const char *Line ) {
+   return ( Report.find( Line ) != string::npos );
+}
+
+// ----------------------------------------------------------------------------
+
+static void Check( bool JIT ) {
+   const uint32_t Program[] = {
+      0x00000093, // addi x1, x0, 0
+      // loop:
+      0x00108093, // addi x1, x1, 1
+      0x00209113, // slli x2, x1, 2
+      0x002081b3, // add  x3, x1, x2
+      0xfe009ae3, // bnez x1, loop
+   };
+
+   machine M( JIT, Program );
+
+   instruction_profile *Profile = new instruction_profile( 3 );
+   M.CPU.add_profiler( Profile );
+
+   // The first addi, then 1000 times round, then half way round again.
+   M.CPU.execute( 1 + 4 * 1000 + 2, false );
+
+   ostringstream Output;
+   Profile->report( Output, M.CPU.get_instruction_count() );
+   const string Report = Output.str();
+
+   Expect( Has( Report, "  addi                 1002   25.03%\n" ) and
+             Has( Report, "  slli                 1001   25.01%\n" ) and
+             Has( Report, "  add                  1000   24.98%\n" ) and
+             Has( Report, "  bne                  1000   24.98%\n" ),
+           "instruction mix", JIT );
+   Expect( Has( Report, "  00001004           1001   25.01%  addi" ) and
+             Has( Report, "  00001008           1001   25.01%  slli" ) and
+             Has( Report, "  0000100c           1000   24.98%  add" ) and
+             not Has( Report, "  00001000" ),
+           "hottest instructions", JIT );
+}
+
+static void Check_Self_Modifying( bool JIT ) {
+   const uint32_t Program[] = {
+      0x00000297,                  // auipc x5, 0
+      I_Type( 0x13, 0, 1, 0, 0 ),  // addi  x1, x0, 0
+      // loop:
+      I_Type( 0x13, 0, 1, 1, 1 ),  // addi  x1, x1, 1
+      I_Type( 0x03, 2, 6, 5, 0 ),  // lw    x6, 0(x5)
+      S_Type( 2, 5, 6, 0 ),        // sw    x6, 0(x5)
+      B_Type( 1, 1, 0, -12 ),      // bnez  x1, loop
+   };
+
+   machine M( JIT, Program );
+
+   instruction_profile *Profile = new instruction_profile( 3 );
+   M.CPU.add_profiler( Profile );
+
+   M.CPU.execute( 2 + 4 * 1000, false );
+
+   ostringstream Output;
+   Profile->report( Output, M.CPU.get_instruction_count() );
+   const string Report = Output.str();
+
+   Expect( Has( Report, "  addi                 1001" ) and
+             Has( Report, "  lw                   1000" ) and
+             Has( Report, "  sw                   1000" ) and
+             Has( Report, "  bne                  1000" ) and
+             Has( Report, "  auipc                   1" ),
+           "instruction mix, code overwritten", JIT );
+}
+
+int main( void ) {
+   Check( false );
+   Check( true );
+   Check_Self_Modifying( false );
+   Check_Self_Modifying( true );
+
+   if ( Num_Failures != 0 ) {
+      return 1;
+   }
+
+   printf( GREEN( "PASS" ) ": profiles count every instruction.\n" );
+   return 0;
+}
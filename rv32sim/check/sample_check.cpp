@@ -0,0 +1,89 @@
+/*
+   Check of the sampling profile: a guest that calls and returns is run,
+   interpreted and compiled, with a sample every 7 instructions, and each
+   sample has to land on the right instruction, under the right calls.
+
+   Build and run with `make check`.
+*/
+
+#include <cstdio>
+#include <sstream>
+
+#include "check.h"
+#include "memory.h"
+#include "processor.h"
+#include "profile.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static void Check( bool JIT ) {
+   machine M( JIT, Call_Guest );
+
+   symbol_table Symbols;
+   Add_Call_Guest_Symbols( Symbols );
+
+   sampling_profile::config Config, Bad;
+   string Error;
+   Expect( Config.parse( "period=7,stacks,file=/dev/null", Error ) and
+             Config.Period == 7 and Config.Stacks and
+             not Bad.parse( "period=0", Error ) and
+             not Bad.parse( "stacks=yes", Error ),
+           "-sample settings",
+           JIT );
+
+   sampling_profile *Profile = new sampling_profile( Config, Symbols );
+   M.CPU.add_profiler( Profile );
+
+   for ( unsigned I = 0; I < 10; ++I ) {
+      M.CPU.execute( 165, false );
+   }
+
+   ostringstream Script;
+   Profile->write_script( Script );
+   const string Samples = Script.str();
+
+   // The 7th instruction is f's call of g, the 14th r's sw, and the 21st
+   // the addi in the r that r called.
+   Expect( Samples.find( "rv32sim 1 [000] 0.000007: 7 instructions:\n"
+                         "\t            1024 f+0xc (guest)\n"
+                         "\t            100c main+0xc (guest)\n"
+                         "\n"
+                         "rv32sim 1 [000] 0.000014: 7 instructions:\n"
+                         "\t            104c r+0x4 (guest)\n"
+                         "\t            1034 f+0x1c (guest)\n"
+                         "\t            100c main+0xc (guest)\n"
+                         "\n"
+                         "rv32sim 1 [000] 0.000021: 7 instructions:\n"
+                         "\t            1050 r+0x8 (guest)\n"
+                         "\t            1060 r+0x18 (guest)\n"
+                         "\t            1034 f+0x1c (guest)\n"
+                         "\t            100c main+0xc (guest)\n"
+                         "\n" ) == 0,
+           "first samples",
+           JIT );
+
+   // 1650 / 7, the last at 1645, in main's spin.
+   const string Last = "0.001645: 7 instructions:\n"
+                       "\t            1014 main+0x14 (guest)\n\n";
+   ostringstream Output;
+   Profile->report( Output, M.CPU.get_instruction_count() );
+   Expect( Output.str().find( "Samples: 235," ) == 0 and
+             Samples.size() > Last.size() and
+             Samples.substr( Samples.size() - Last.size() ) == Last,
+           "last sample",
+           JIT );
+}
+
+int main( void ) {
+   Check( false );
+   Check( true );
+
+   if ( Num_Failures != 0 ) {
+      return 1;
+   }
+
+   printf( GREEN( "PASS" ) ": samples land where they should.\n" );
+   return 0;
+}
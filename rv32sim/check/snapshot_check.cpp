@@ -0,0 +1,129 @@
+/*
+   Check of snapshots. A guest loop that writes a word every 64 bytes (so it
+   dirties a new page every 64 iterations) is run from a snapshot, and has to
+   do exactly the same thing again after the snapshot is restored: after
+   running for a while, after its own code is patched, and from a snapshot
+   file loaded into a fresh machine. Done with and without the JIT.
+
+   Build and run with `make check`.
+*/
+
+#include <cstdio>
+#include <unistd.h>
+
+#include "bench/bench.h"
+#include "check.h"
+#include "memory.h"
+#include "processor.h"
+#include "snapshot.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+static constexpr uint32_t Data_Start = 0x00008000;
+static constexpr uint32_t Increment  = ( Code_Start + 16 ); // addi x1, x1, 1
+static constexpr unsigned Steps      = 6000;
+
+static const uint32_t Guest_Loop[] = {
+   0x00008537,                 // lui  x10, 0x8
+   I_Type( 0x13, 0, 1, 0, 0 ), // addi x1, x0, 0
+   // loop:
+   I_Type( 0x13, 1, 4, 1, 6 ), // slli x4, x1, 6
+   R_Type( 0, 0, 5, 10, 4 ),   // add  x5, x10, x4
+   I_Type( 0x13, 0, 1, 1, 1 ), // addi x1, x1, 1
+   S_Type( 2, 5, 1, 0 ),       // sw   x1, 0(x5)
+   B_Type( 1, 10, 0, -16 ),    // bne  x10, x0, loop
+};
+
+static_assert( Data_Start == 0x8000, "The lui above loads Data_Start." );
+
+/// What the guest has done so far, boiled down.
+struct outcome {
+   uint32_t PC, X1, Count, Sum;
+
+   bool operator==( const outcome &Other ) const {
+      return PC == Other.PC and X1 == Other.X1 and Count == Other.Count and
+             Sum == Other.Sum;
+   }
+};
+
+static outcome Run( machine &M ) {
+   M.CPU.execute( Steps, false );
+
+   outcome Result = { M.CPU.get_pc(), M.CPU.get_reg( 1 ),
+                      M.CPU.get_instruction_count(), 0 };
+
+   // Includes a little past where it got to.
+   for ( uint32_t I = 0; I < Steps; ++I ) {
+      Result.Sum = Result.Sum * 31 + M.Memory.load32( Data_Start + 64 * I );
+   }
+
+   return Result;
+}
+
+// ----------------------------------------------------------------------------
+
+static void Check( bool JIT ) {
+   char File_Name[] = "/tmp/snapshot_check_XXXXXX";
+   const int Descriptor = mkstemp( File_Name );
+   Expect( Descriptor >= 0, "couldn't make a temporary file", JIT );
+   close( Descriptor );
+
+   machine M( JIT, Guest_Loop );
+
+   snapshot Start;
+   Start.take( M.Memory, M.CPU );
+   Expect( Start.save( File_Name ), "couldn't save the snapshot", JIT );
+
+   const outcome Expected = Run( M );
+   Expect( Expected.X1 > 1000, "the guest didn't get far", JIT );
+
+   Start.restore( M.Memory, M.CPU );
+   Expect( M.CPU.get_instruction_count() == 0 and M.CPU.get_reg( 1 ) == 0 and
+             M.Memory.load32( Data_Start ) == 0,
+           "restoring didn't undo the run", JIT );
+   Expect( Run( M ) == Expected, "second run differs", JIT );
+
+   // Change addi x1, x1, 1 to add 2. The blocks decoded from the original
+   // have to go when the snapshot puts it back.
+   Start.restore( M.Memory, M.CPU );
+   M.Memory.store32( Increment, I_Type( 0x13, 0, 1, 1, 2 ) );
+   Expect( not( Run( M ) == Expected ), "patching the guest didn't change it",
+           JIT );
+
+   Start.restore( M.Memory, M.CPU );
+   Expect( Run( M ) == Expected, "run after unpatching differs", JIT );
+
+   // Snapshots taken later still restore properly, and the first one still
+   // works after them.
+   snapshot Middle;
+   Middle.take( M.Memory, M.CPU );
+   const outcome Twice = Run( M );
+   Middle.restore( M.Memory, M.CPU );
+   Expect( Run( M ) == Twice, "run from second snapshot differs", JIT );
+   Start.restore( M.Memory, M.CPU );
+   Expect( Run( M ) == Expected, "run from first snapshot differs", JIT );
+
+   // From a file, into a new machine.
+   machine Fresh( JIT );
+   snapshot Loaded;
+   Expect( Loaded.load( File_Name ), "couldn't load the snapshot", JIT );
+   Loaded.restore( Fresh.Memory, Fresh.CPU );
+   Expect( Run( Fresh ) == Expected, "run from the snapshot file differs",
+           JIT );
+
+   unlink( File_Name );
+}
+
+int main( void ) {
+   Check( false );
+   Check( true );
+
+   if ( Num_Failures != 0 ) {
+      return 1;
+   }
+
+   printf( GREEN( "PASS" ) ": snapshots restore memory and registers.\n" );
+   return 0;
+}
@@ -6,25 +6,165 @@
 
 **************************************************************** */
 
+#include <algorithm>
 #include <ctype.h>
+#include <errno.h>
 #include <iomanip>
 #include <iostream>
-#include <sstream>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
 
 #include "commands.h"
+#include "harts.h"
 #include "memory.h"
 #include "processor.h"
+#include "snapshot.h"
 
 using namespace std;
 
-void command_skip_optional_whitespace( string &command, unsigned int &i ) {
+// Scripts can run to millions of lines, so they aren't read a line at a time
+// into a string and picked apart with stringstreams. command_reader hands out
+// each line where it lies in a big buffer (or in the script itself, when
+// that's a file on stdin and can be mapped), and the matchers below read
+// numbers straight out of it.
+
+// A line of input, without its newline. Enough of string's interface for
+// the matchers.
+struct command_line {
+   const char *text;
+   unsigned int size;
+
+   unsigned int length() const { return size; }
+
+   char operator[]( unsigned int i ) const { return text[i]; }
+
+   // As string::compare() for the n characters at i, but only says whether
+   // they're the same.
+   int compare( unsigned int i, size_t n, const string &s ) const {
+      n = min<size_t>( n, size - i );
+      return n == s.length() && memcmp( text + i, s.data(), n ) == 0 ? 0 : 1;
+   }
+
+   string substr( unsigned int i, unsigned int n ) const {
+      return string( text + i, n );
+   }
+};
+
+class command_reader {
+private:
+   istream &input;
+
+   // A file on stdin, mapped whole.
+   const char *mapped = nullptr;
+   size_t mapped_size = 0;
+
+   // Otherwise what's been read of it. Lines yet to be handed out are from
+   // begin to end.
+   vector<char> buffer;
+   size_t begin = 0, end = 0;
+   bool at_end = false;
+
+   enum : size_t { CHUNK = 1 << 20 };
+
+   // Read what's there, up to count bytes. 0 at the end of the input.
+   size_t read( char *to, size_t count ) {
+      if ( &input == &cin ) {
+         // read() rather than cin, so a terminal gets its answer a line at a
+         // time without waiting for the rest of the chunk.
+         ssize_t got;
+         do
+            got = ::read( STDIN_FILENO, to, count );
+         while ( got < 0 && errno == EINTR );
+         return got > 0 ? size_t( got ) : 0;
+      }
+      const streamsize got = input.rdbuf()->sgetn( to, streamsize( count ) );
+      return got > 0 ? size_t( got ) : 0;
+   }
+
+public:
+   explicit command_reader( istream &input ) : input( input ) {
+      struct stat info;
+      if ( &input == &cin && fstat( STDIN_FILENO, &info ) == 0 &&
+           S_ISREG( info.st_mode ) && info.st_size > 0 ) {
+         void *data = mmap( nullptr,
+                            size_t( info.st_size ),
+                            PROT_READ,
+                            MAP_PRIVATE,
+                            STDIN_FILENO,
+                            0 );
+         if ( data != MAP_FAILED ) {
+            mapped      = static_cast<const char *>( data );
+            mapped_size = size_t( info.st_size );
+
+            // Start wherever stdin had got to.
+            const off_t offset = lseek( STDIN_FILENO, 0, SEEK_CUR );
+            begin = offset > 0 ? min( size_t( offset ), mapped_size ) : 0;
+            end   = mapped_size;
+            return;
+         }
+      }
+      buffer.resize( CHUNK );
+   }
+
+   ~command_reader() {
+      if ( mapped )
+         munmap( const_cast<char *>( mapped ), mapped_size );
+   }
+
+   command_reader( const command_reader & ) = delete;
+   command_reader &operator=( const command_reader & ) = delete;
+
+   // The next line, or false at the end of the input. A last line with no
+   // newline still counts, as it does for getline().
+   bool next( command_line &line ) {
+      const char *base = mapped ? mapped : buffer.data();
+      const char *newline =
+        static_cast<const char *>( memchr( base + begin, '\n', end - begin ) );
+
+      while ( !newline && !mapped && !at_end ) {
+         // Move the partial line to the front, and read more after it.
+         const size_t scanned = end - begin;
+         memmove( buffer.data(), buffer.data() + begin, scanned );
+         begin = 0;
+         end   = scanned;
+         if ( buffer.size() - end < CHUNK / 2 )
+            buffer.resize( buffer.size() * 2 );
+
+         const size_t got = read( buffer.data() + end, buffer.size() - end );
+         at_end = ( got == 0 );
+         end += got;
+
+         base    = buffer.data();
+         newline = static_cast<const char *>(
+           memchr( base + scanned, '\n', end - scanned ) );
+      }
+
+      if ( !newline ) {
+         if ( begin == end )
+            return false;
+         newline = base + end; // The last line, unterminated.
+      }
+
+      line.text = base + begin;
+      line.size = unsigned( newline - line.text );
+      begin     = min( size_t( newline - base ) + 1, end );
+      return true;
+   }
+};
+
+void command_skip_optional_whitespace( const command_line &command,
+                                       unsigned int &i ) {
    while ( i < command.length() && isspace( command[i] ) )
       i++;
 }
 
-bool command_skip_required_whitespace( string &command, unsigned int &i ) {
+bool command_skip_required_whitespace( const command_line &command,
+                                       unsigned int &i ) {
    if ( i == command.length() || !isspace( command[i] ) )
       return false;
    i++;
@@ -33,37 +173,47 @@ bool command_skip_required_whitespace( string &command, unsigned int &i ) {
    return true;
 }
 
-bool command_match_decimal_number( string &command,
+bool command_match_decimal_number( const command_line &command,
                                    unsigned int &i,
                                    unsigned int &num ) {
+   // Too big for num comes out as the biggest there is, as it did when this
+   // went through a stringstream.
+   uint64_t value = 0;
    unsigned int j = i;
-   while ( j < command.length() && isdigit( command[j] ) )
+   while ( j < command.length() && isdigit( command[j] ) ) {
+      value = min<uint64_t>( value * 10 + ( command[j] - '0' ), 0xffffffffU );
       j++;
+   }
    if ( j == i )
       return false;
-   stringstream( command.substr( i, j - i ) ) >> num;
-   i = j;
+   num = unsigned( value );
+   i   = j;
    return true;
 }
 
-bool command_match_hex_number( string &command,
+bool command_match_hex_number( const command_line &command,
                                unsigned int &i,
                                uint32_t &num ) {
+   uint64_t value = 0;
    unsigned int j = i;
-   while ( j < command.length() && isxdigit( command[j] ) )
+   while ( j < command.length() && isxdigit( command[j] ) ) {
+      const char c = command[j];
+      const unsigned digit = isdigit( c ) ? c - '0' : ( c | 0x20 ) - 'a' + 10;
+      value = min<uint64_t>( value * 16 + digit, 0xffffffffU );
       j++;
+   }
    if ( j == i )
       return false;
-   stringstream( command.substr( i, j - i ) ) >> hex >> num;
-   i = j;
+   num = uint32_t( value );
+   i   = j;
    return true;
 }
 
-bool command_match_blank( string &command, unsigned int i ) {
+bool command_match_blank( const command_line &command, unsigned int i ) {
    return i == command.length() || command[i] == '#';
 }
 
-bool command_match_x( string &command,
+bool command_match_x( const command_line &command,
                       unsigned int i,
                       bool &data_present,
                       unsigned int &num,
@@ -86,7 +236,7 @@ bool command_match_x( string &command,
    return i == command.length() || command[i] == '#';
 }
 
-bool command_match_pc( string &command,
+bool command_match_pc( const command_line &command,
                        unsigned int i,
                        bool &address_present,
                        uint32_t &address ) {
@@ -109,7 +259,7 @@ bool command_match_pc( string &command,
    return i == command.length() || command[i] == '#';
 }
 
-bool command_match_m( string &command,
+bool command_match_m( const command_line &command,
                       unsigned int i,
                       bool &data_present,
                       uint32_t &address,
@@ -134,7 +284,7 @@ bool command_match_m( string &command,
    return i == command.length() || command[i] == '#';
 }
 
-bool command_match_dot( string &command,
+bool command_match_dot( const command_line &command,
                         unsigned int i,
                         bool &num_present,
                         unsigned int &num ) {
@@ -153,14 +303,98 @@ bool command_match_dot( string &command,
    return i == command.length() || command[i] == '#';
 }
 
-bool command_match_b( string &command,
+// Matches a comparison for a breakpoint's condition. Longest first, so that
+// `<=` isn't taken for `<`.
+bool command_match_condition( const command_line &command,
+                              unsigned int &i,
+                              breakpoint::condition &condition ) {
+   static const struct {
+      const char *text;
+      breakpoint::condition condition;
+   } conditions[] = {
+      { "==", breakpoint::EQUAL },   { "!=", breakpoint::NOT_EQUAL },
+      { "<=", breakpoint::LESS_OR_EQUAL },
+      { ">=", breakpoint::GREATER_OR_EQUAL },
+      { "<", breakpoint::LESS },     { ">", breakpoint::GREATER },
+   };
+   for ( const auto &c : conditions ) {
+      const unsigned int n = unsigned( strlen( c.text ) );
+      if ( command.compare( i, n, c.text ) == 0 ) {
+         i += n;
+         condition = c.condition;
+         return true;
+      }
+   }
+   return false;
+}
+
+// Matches `b`, or `b` and an address, optionally followed by
+// `if x<reg> <op> <value>` and then `hits <n>`. The register number is left
+// in reg, unchecked.
+bool command_match_b( const command_line &command,
                       unsigned int i,
                       bool &address_present,
-                      uint32_t &address ) {
+                      breakpoint &bp,
+                      unsigned int &reg ) {
    address_present = false;
+   bp              = breakpoint();
+   reg             = 0;
    if ( i == command.length() || command[i] != 'b' )
       return false;
    i++;
+   if ( i == command.length() || command[i] == '#' )
+      return true;
+   if ( !command_skip_required_whitespace( command, i ) )
+      return false;
+   if ( command_match_hex_number( command, i, bp.Address ) ) {
+      address_present = true;
+      command_skip_optional_whitespace( command, i );
+   } else {
+      return i == command.length() || command[i] == '#';
+   }
+   if ( command.compare( i, 2, "if" ) == 0 ) {
+      i += 2;
+      if ( !command_skip_required_whitespace( command, i ) )
+         return false;
+      if ( i == command.length() || command[i] != 'x' )
+         return false;
+      i++;
+      if ( !command_match_decimal_number( command, i, reg ) )
+         return false;
+      command_skip_optional_whitespace( command, i );
+      if ( !command_match_condition( command, i, bp.Condition ) )
+         return false;
+      command_skip_optional_whitespace( command, i );
+      if ( !command_match_hex_number( command, i, bp.Value ) )
+         return false;
+      command_skip_optional_whitespace( command, i );
+   }
+   if ( command.compare( i, 4, "hits" ) == 0 ) {
+      i += 4;
+      if ( !command_skip_required_whitespace( command, i ) )
+         return false;
+      if ( !command_match_decimal_number( command, i, bp.Stop_At ) )
+         return false;
+      command_skip_optional_whitespace( command, i );
+   }
+   return i == command.length() || command[i] == '#';
+}
+
+// Matches `b list`, or `b delete` and an address.
+bool command_match_b_keyword( const command_line &command,
+                              unsigned int i,
+                              const string &keyword,
+                              bool &address_present,
+                              uint32_t &address ) {
+   address_present = false;
+   if ( i == command.length() || command[i] != 'b' )
+      return false;
+   i++;
+   if ( !command_skip_required_whitespace( command, i ) )
+      return false;
+   if ( command.compare( i, keyword.length(), keyword ) != 0 )
+      return false;
+   i += keyword.length();
    if ( i == command.length() || command[i] == '#' )
       return true;
    if ( !command_skip_required_whitespace( command, i ) )
@@ -172,7 +406,9 @@ bool command_match_b( string &command,
    return i == command.length() || command[i] == '#';
 }
 
-bool command_match_l( string &command, unsigned int i, string &filename ) {
+bool command_match_l( const command_line &command,
+                      unsigned int i,
+                      string &filename ) {
    unsigned int j;
    if ( i == command.length() || command[i] != 'l' )
       return false;
@@ -194,7 +430,7 @@ bool command_match_l( string &command, unsigned int i, string &filename ) {
    return i == command.length() || command[i] == '#';
 }
 
-bool command_match_prv( string &command,
+bool command_match_prv( const command_line &command,
                         unsigned int i,
                         bool &num_present,
                         unsigned int &num ) {
@@ -220,7 +456,7 @@ bool command_match_prv( string &command,
    return i == command.length() || command[i] == '#';
 }
 
-bool command_match_csr( string &command,
+bool command_match_csr( const command_line &command,
                         unsigned int i,
                         bool &data_present,
                         uint32_t &address,
@@ -251,20 +487,101 @@ bool command_match_csr( string &command,
    return i == command.length() || command[i] == '#';
 }
 
+// Matches `snapshot` or `restore` (whichever is given as keyword), with an
+// optional file name in quotes.
+bool command_match_snapshot( const command_line &command,
+                             unsigned int i,
+                             const string &keyword,
+                             bool &filename_present,
+                             string &filename ) {
+   unsigned int j;
+   filename_present = false;
+   if ( command.compare( i, keyword.length(), keyword ) != 0 )
+      return false;
+   i += keyword.length();
+   if ( i == command.length() || command[i] == '#' )
+      return true;
+   if ( !command_skip_required_whitespace( command, i ) )
+      return false;
+   if ( i < command.length() && command[i] == '"' ) {
+      i++;
+      j = i;
+      while ( j < command.length() && command[j] != '"' )
+         j++;
+      filename = command.substr( i, j - i );
+      i = j;
+      if ( i == command.length() || command[i] != '"' )
+         return false;
+      i++;
+      filename_present = true;
+      command_skip_optional_whitespace( command, i );
+   }
+   return i == command.length() || command[i] == '#';
+}
+
+// Matches `hart`, `hart all`, or `hart` and a hart number.
+bool command_match_hart( const command_line &command,
+                         unsigned int i,
+                         bool &num_present,
+                         bool &all_present,
+                         unsigned int &num ) {
+   num_present = false;
+   all_present = false;
+   if ( command.compare( i, 4, "hart" ) != 0 )
+      return false;
+   i += 4;
+   if ( i == command.length() || command[i] == '#' )
+      return true;
+   if ( !command_skip_required_whitespace( command, i ) )
+      return false;
+   if ( command_match_decimal_number( command, i, num ) ) {
+      num_present = true;
+   } else if ( command.compare( i, 3, "all" ) == 0 ) {
+      i += 3;
+      all_present = true;
+   }
+   command_skip_optional_whitespace( command, i );
+   return i == command.length() || command[i] == '#';
+}
+
+// Relative file names are relative to the directory the commands came from.
+string command_resolve_filename( const string &filename,
+                                 const string &directory ) {
+   if ( directory.empty() || filename.empty() || filename[0] == '/' )
+      return filename;
+   return directory + "/" + filename;
+}
+
 // Command interpreter function
-void interpret_commands( memory *main_memory, processor *cpu, bool verbose ) {
+void interpret_commands( memory *main_memory,
+                         harts *all_harts,
+                         bool verbose,
+                         istream &input,
+                         ostream &output,
+                         const string &directory ) {
    (void) verbose;
 
-   string command;
+   command_reader reader( input );
+   command_line command;
    unsigned int i;
-   bool address_present, data_present, num_present;
+   bool address_present, data_present, num_present, all_present;
    uint32_t address, data;
    unsigned int num;
    string filename;
+   bool filename_present;
+   breakpoint bp;
+
+   // Taken by `snapshot`, put back by `restore`.
+   snapshot saved;
+
+   // The hart that x, pc, b, prv and csr act on, and . too unless
+   // `hart all` was given, in which case . runs every hart.
+   unsigned int hart = 0;
+   bool run_all_harts = false;
+   processor *cpu = &( *all_harts )[hart];
 
    while ( true ) {
-      getline( cin, command ); // Read the next line of input
-      if ( !cin )
+      if ( !reader.next( command ) )
          break; // Exit if end of input file
       i = 0;
       command_skip_optional_whitespace( command, i );
@@ -276,7 +593,7 @@ void interpret_commands( memory *main_memory, processor *cpu, bool verbose ) {
                                    num,
                                    data ) ) { // Check for x command
          if ( num > 31 ) {
-            cout << "Incorrect register number" << endl;
+            output << "Incorrect register number" << '\n';
          } else if ( !data_present ) { // No new value
             cpu->show_reg( num );      // so just show register value
          } else {
@@ -298,35 +615,70 @@ void interpret_commands( memory *main_memory, processor *cpu, bool verbose ) {
                                    data ) ) { // Check for m command
          if ( !data_present ) { // No new value, so just show memory word value
             data = main_memory->read_word( address );
-            cout << setw( 8 ) << setfill( '0' ) << hex << data << endl;
+            char digits[9];
+            for ( int d = 7; d >= 0; d-- ) {
+               digits[d] = "0123456789abcdef"[data & 0xf];
+               data >>= 4;
+            }
+            digits[8] = '\n';
+            output.write( digits, 9 );
          } else { // Update memory word
             main_memory->write_word( address, data, 0xffffffffUL );
          }
       } else if ( command_match_dot(
                     command, i, num_present, num ) ) { // Check for . command
-         if ( !num_present ) {        // No instruction count value
-            cpu->execute( 1, false ); // so just execute one instruction without
-                                      // breakpoint check
+         if ( !num_present ) { // No instruction count value, so just execute
+                               // one instruction without breakpoint check
+            num = 1;
+         }
+         // Answers are only flushed here, so a long run doesn't hold back
+         // what came before it.
+         output.flush();
+         if ( run_all_harts ) {
+            all_harts->execute_all( num, num_present );
          } else {
-            cpu->execute( num, true ); // Execute specified number of
-                                       // instructions with breakpoint check
+            all_harts->execute( hart, num, num_present );
+         }
+      } else if ( command_match_b_keyword( command,
+                                           i,
+                                           "list",
+                                           address_present,
+                                           address ) &&
+                  !address_present ) { // Check for b list command
+         cpu->show_breakpoints();
+      } else if ( command_match_b_keyword( command,
+                                           i,
+                                           "delete",
+                                           address_present,
+                                           address ) ) { // b delete command
+         if ( !address_present ) {
+            cpu->clear_breakpoint(); // Same as plain b
+         } else if ( !cpu->clear_breakpoint( address ) ) {
+            output << "No breakpoint at that address" << '\n';
          }
       } else if ( command_match_b( command,
                                    i,
                                    address_present,
-                                   address ) ) { // Check for b command
-         if ( !address_present ) {               // No address value
-            cpu->clear_breakpoint();             // so just clear breakpoint
+                                   bp,
+                                   num ) ) { // Check for b command
+         if ( !address_present ) {           // No address value
+            cpu->clear_breakpoint();         // so just clear breakpoints
+         } else if ( num > 31 ) {
+            output << "Incorrect register number" << '\n';
          } else {
-            cpu->set_breakpoint( address ); // Set breakpoint at the address
+            bp.Reg = uint8_t( num );
+            cpu->set_breakpoint( bp ); // Add one at the address
          }
       } else if ( command_match_l(
                     command, i, filename ) ) { // Check for l command
+         filename = command_resolve_filename( filename, directory );
          uint32_t start_address;
          if ( main_memory->load_file(
                 filename,
                 start_address ) ) { // Load using the specified file name
-            cpu->set_pc( start_address );
+            // Every hart starts there, and can tell itself apart by MHARTID.
+            for ( unsigned int h = 0; h < all_harts->size(); h++ )
+               ( *all_harts )[h].set_pc( start_address );
          }
       } else if ( command_match_prv(
                     command, i, num_present, num ) ) { // Check for prv command
@@ -335,7 +687,7 @@ void interpret_commands( memory *main_memory, processor *cpu, bool verbose ) {
          } else if ( num == 0 || num == 3 ) {
             cpu->set_prv( num ); // Set the current privilege level
          } else {
-            cout << "Incorrect privilege level" << endl;
+            output << "Incorrect privilege level" << '\n';
          }
       } else if ( command_match_csr( command,
                                      i,
@@ -343,14 +695,56 @@ void interpret_commands( memory *main_memory, processor *cpu, bool verbose ) {
                                      address,
                                      data ) ) { // Check for csr command
          if ( address > 0xfffU ) {
-            cout << "Incorrect CSR number" << endl;
+            output << "Incorrect CSR number" << '\n';
          } else if ( !data_present ) { // No new value
             cpu->show_csr( address );  // so just show memory word value
          } else {
             cpu->set_csr( address, data ); // Update memory word
          }
+      } else if ( command_match_snapshot( command,
+                                          i,
+                                          "snapshot",
+                                          filename_present,
+                                          filename ) ) { // Check for snapshot
+         filename = command_resolve_filename( filename, directory );
+         saved.take( *main_memory, *all_harts );
+         if ( filename_present && !saved.save( filename ) ) {
+            output << "Failed to write snapshot" << '\n';
+         }
+      } else if ( command_match_snapshot( command,
+                                          i,
+                                          "restore",
+                                          filename_present,
+                                          filename ) ) { // Check for restore
+         filename = command_resolve_filename( filename, directory );
+         if ( filename_present && !saved.load( filename ) ) {
+            output << "Failed to read snapshot" << '\n';
+         } else if ( saved.empty() ) {
+            output << "No snapshot to restore" << '\n';
+         } else if ( saved.hart_count() != all_harts->size() ) {
+            output << "Snapshot has a different number of harts" << '\n';
+         } else {
+            saved.restore( *main_memory, *all_harts );
+         }
+      } else if ( command_match_hart( command,
+                                      i,
+                                      num_present,
+                                      all_present,
+                                      num ) ) { // Check for hart command
+         if ( all_present ) {
+            run_all_harts = true;
+         } else if ( !num_present ) { // No hart number, so show the selection
+            output << "hart " << dec << hart
+                   << ( run_all_harts ? ", . runs all harts" : "" ) << '\n';
+         } else if ( num >= all_harts->size() ) {
+            output << "Incorrect hart number" << '\n';
+         } else {
+            hart          = num;
+            run_all_harts = false;
+            cpu           = &( *all_harts )[hart];
+         }
       } else {
-         cout << "Unrecognized command" << endl;
+         output << "Unrecognized command" << '\n';
       }
    }
 }
@@ -9,9 +9,24 @@
 
 **************************************************************** */
 
+#include <iostream>
+#include <string>
+
+#include "harts.h"
 #include "memory.h"
-#include "processor.h"
 
-void interpret_commands(memory* main_memory, processor* cpu, bool verbose);
+// Read commands from input until it runs out, writing their output to output.
+// Relative file names in commands are taken from directory, if one's given.
+// `hart` picks which of the harts the other commands act on.
+// `b <address>` adds a breakpoint, optionally followed by a condition,
+// `if x<n> <op> <value>` with op one of == != < <= > >= (unsigned), and then
+// `hits <n>` to stop only from the nth time the condition holds there.
+// `b list` shows them, `b delete <address>` removes one, and `b` on its own
+// removes them all.
+// Answers aren't flushed as they're written, only before each `.` runs, so
+// flushing after the last one is up to the caller.
+void interpret_commands(memory* main_memory, harts* all_harts, bool verbose,
+                        istream& input = cin, ostream& output = cout,
+                        const string& directory = "");
 
 #endif
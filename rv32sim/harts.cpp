@@ -0,0 +1,189 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Several harts sharing one memory
+
+**************************************************************** */
+
+#include <algorithm>
+
+#include "harts.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+harts::harts( memory *Memory,
+              unsigned Count,
+              bool Verbose,
+              bool Stage2,
+              bool Use_JIT,
+              schedule Schedule,
+              uint32_t Quantum ) {
+   assert( Count >= 1 and Count <= MAX_HARTS and Quantum >= 1 );
+
+   this->Schedule = Schedule;
+   this->Quantum  = Quantum;
+
+   for ( unsigned Hart_ID = 0; Hart_ID < Count; ++Hart_ID ) {
+      unique_ptr<hart> Hart( new hart );
+      Hart->CPU.reset(
+        new processor( Memory, Verbose, Stage2, Use_JIT, Hart_ID ) );
+      this->Harts.push_back( move( Hart ) );
+   }
+
+   // One hart just runs on whichever thread asks it to.
+   if ( Count == 1 ) {
+      return;
+   }
+
+   unique_lock<mutex> Hold( this->Lock );
+
+   for ( auto &Hart : this->Harts ) {
+      Hart->Busy = true;
+      ++this->Running;
+      Hart->Thread = thread( &harts::Serve, this, ref( *Hart ) );
+   }
+
+   // Each thread claims its processor before anything else can happen.
+   this->Wait( Hold );
+}
+
+// ----------------------------------------------------------------------------
+
+harts::~harts() {
+   {
+      const lock_guard<mutex> Hold( this->Lock );
+      this->Quitting = true;
+   }
+
+   for ( auto &Hart : this->Harts ) {
+      if ( Hart->Thread.joinable() ) {
+         Hart->Wake.notify_one();
+         Hart->Thread.join();
+      }
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void harts::Serve( hart &Hart ) {
+   unique_lock<mutex> Hold( this->Lock );
+
+   Hart.CPU->set_owner_thread();
+
+   while ( true ) {
+      Hart.Busy = false;
+      if ( --this->Running == 0 ) {
+         this->Idle.notify_one();
+      }
+
+      Hart.Wake.wait( Hold, [&] { return Hart.Busy or this->Quitting; } );
+
+      if ( this->Quitting ) {
+         return;
+      }
+
+      Hold.unlock();
+
+      const bool Completed =
+        Hart.CPU->execute( Hart.Num, Hart.Check_For_Breakpoints );
+
+      if ( not Completed and this->Schedule == schedule::FREE_RUNNING ) {
+         for ( auto &Other : this->Harts ) {
+            Other->CPU->request_stop();
+         }
+      }
+
+      Hold.lock();
+      Hart.Completed = Completed;
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void harts::Start( hart &Hart, unsigned Num, bool Check_For_Breakpoints ) {
+   Hart.Busy                  = true;
+   Hart.Num                   = Num;
+   Hart.Check_For_Breakpoints = Check_For_Breakpoints;
+   ++this->Running;
+   Hart.Wake.notify_one();
+}
+
+void harts::Wait( unique_lock<mutex> &Hold ) {
+   this->Idle.wait( Hold, [&] { return this->Running == 0; } );
+
+   // A stop that was asked for after its hart had finished anyway mustn't
+   // carry over to the next run.
+   for ( auto &Hart : this->Harts ) {
+      Hart->CPU->cancel_stop();
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+bool harts::execute( unsigned Hart_ID,
+                     unsigned Num,
+                     bool Check_For_Breakpoints ) {
+   hart &Hart = *this->Harts[Hart_ID];
+
+   if ( not Hart.Thread.joinable() ) {
+      return Hart.CPU->execute( Num, Check_For_Breakpoints );
+   }
+
+   unique_lock<mutex> Hold( this->Lock );
+   this->Start( Hart, Num, Check_For_Breakpoints );
+   this->Wait( Hold );
+   return Hart.Completed;
+}
+
+// ----------------------------------------------------------------------------
+
+bool harts::execute_all( unsigned Num, bool Check_For_Breakpoints ) {
+   if ( this->size() == 1 ) {
+      return this->execute( 0, Num, Check_For_Breakpoints );
+   }
+
+   unique_lock<mutex> Hold( this->Lock );
+
+   if ( this->Schedule == schedule::FREE_RUNNING ) {
+      for ( auto &Hart : this->Harts ) {
+         this->Start( *Hart, Num, Check_For_Breakpoints );
+      }
+      this->Wait( Hold );
+
+      return all_of( this->Harts.begin(),
+                     this->Harts.end(),
+                     []( const unique_ptr<hart> &Hart ) {
+                        return Hart->Completed;
+                     } );
+   }
+
+   // Round after round, until every hart has run Num instructions.
+   for ( unsigned Done = 0; Done < Num; ) {
+      const unsigned Step = min<unsigned>( this->Quantum, Num - Done );
+
+      for ( auto &Hart : this->Harts ) {
+         this->Start( *Hart, Step, Check_For_Breakpoints );
+         this->Wait( Hold );
+
+         if ( not Hart->Completed ) {
+            return false;
+         }
+      }
+
+      Done += Step;
+   }
+
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+
+uint64_t harts::get_instruction_count( void ) const {
+   uint64_t Count = 0;
+   for ( const auto &Hart : this->Harts ) {
+      Count += Hart->CPU->get_instruction_count();
+   }
+   return Count;
+}
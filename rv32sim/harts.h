@@ -0,0 +1,130 @@
+#ifndef HARTS_H
+#define HARTS_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Several harts sharing one memory
+
+**************************************************************** */
+
+/*
+   Each hart is a processor of its own, with its own registers, CSRs, decoded
+   blocks and MHARTID, and all of them share the one memory. With more than
+   one hart, each gets a host thread that runs it whenever it's told to; with
+   just one, it's run on the calling thread like before.
+
+   Running them all can be scheduled two ways:
+
+   QUANTUM       The harts take turns, in hart order, each running up to a
+                 quantum of instructions on its own thread while the rest
+                 wait. Only one runs at a time, so the result is the same
+                 every time, whatever the host does.
+
+   FREE_RUNNING  Every hart runs flat out on its own thread, all at once.
+                 Faster, but the order in which harts see each other's stores
+                 is up to the host.
+
+   Either way, a hart that stops at a breakpoint stops the rest: straight
+   away under QUANTUM, and at the end of their current block otherwise.
+
+   Writes to code pages are safe from any hart: see
+   processor::code_page_written().
+*/
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "memory.h"
+#include "processor.h"
+
+using namespace std;
+
+class harts {
+public:
+   enum class schedule {
+      QUANTUM,
+      FREE_RUNNING,
+   };
+
+   enum : uint32_t {
+      DEFAULT_QUANTUM = 10000,
+
+      /// Each hart is a host thread, so there's no point having lots.
+      MAX_HARTS = 256,
+   };
+
+private:
+   struct hart {
+      unique_ptr<processor> CPU;
+      thread Thread;
+
+      /// What the hart's thread has been asked to do. Guarded by Lock.
+      condition_variable Wake;
+      bool Busy                  = false;
+      unsigned Num               = 0;
+      bool Check_For_Breakpoints = false;
+      bool Completed             = true;
+   };
+
+   vector<unique_ptr<hart>> Harts;
+
+   schedule Schedule;
+   uint32_t Quantum;
+
+   mutex Lock;
+   condition_variable Idle;
+   unsigned Running = 0;
+   bool Quitting    = false;
+
+   /// The body of each hart's thread.
+   void Serve( hart &Hart );
+
+   /// Have the given hart run, on its thread, and return straight away.
+   /// Needs Lock.
+   void Start( hart &Hart, unsigned Num, bool Check_For_Breakpoints );
+
+   /// Wait for every started hart to finish.
+   void Wait( unique_lock<mutex> &Hold );
+
+public:
+   harts( memory *Memory,
+          unsigned Count,
+          bool Verbose,
+          bool Stage2,
+          bool Use_JIT,
+          schedule Schedule = schedule::QUANTUM,
+          uint32_t Quantum  = DEFAULT_QUANTUM );
+
+   ~harts();
+
+   harts( const harts & ) = delete;
+   harts &operator=( const harts & ) = delete;
+
+   unsigned size( void ) const {
+      return unsigned( this->Harts.size() );
+   }
+
+   processor &operator[]( unsigned Hart_ID ) {
+      return *this->Harts[Hart_ID]->CPU;
+   }
+
+   const processor &operator[]( unsigned Hart_ID ) const {
+      return *this->Harts[Hart_ID]->CPU;
+   }
+
+   /// Run just the given hart, as processor::execute() does.
+   bool execute( unsigned Hart_ID, unsigned Num, bool Check_For_Breakpoints );
+
+   /// Run every hart for Num instructions each, scheduled as above. Returns
+   /// false if any of them stopped early.
+   bool execute_all( unsigned Num, bool Check_For_Breakpoints );
+
+   /// Instructions executed by all the harts together.
+   uint64_t get_instruction_count( void ) const;
+};
+
+#endif
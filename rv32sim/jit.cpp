@@ -0,0 +1,976 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   x86-64 translation of hot basic blocks
+
+**************************************************************** */
+
+#include "jit.h"
+#include "memory.h"
+#include "rv32i.h"
+
+#include <cassert>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include <sys/mman.h>
+
+using namespace std;
+
+#if defined( __x86_64__ )
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+enum host_reg : uint8_t {
+   RAX = 0,
+   RCX,
+   RDX,
+   RBX,
+   RSP,
+   RBP,
+   RSI,
+   RDI,
+   R8,
+   R9,
+   R10,
+   R11,
+   R12,
+   R13,
+   R14,
+   R15,
+};
+
+/// Condition codes, as they appear in the low nibble of Jcc and SETcc.
+enum condition : uint8_t {
+   CC_B  = 0x2, // Unsigned <
+   CC_AE = 0x3, // Unsigned >=
+   CC_E  = 0x4,
+   CC_NE = 0x5,
+   CC_L  = 0xC, // Signed <
+   CC_GE = 0xD, // Signed >=
+};
+
+/// The /digit in the ModRM byte of the group 1 (81 /digit) ALU instructions.
+enum alu_op : uint8_t {
+   ALU_ADD = 0,
+   ALU_OR  = 1,
+   ALU_AND = 4,
+   ALU_SUB = 5,
+   ALU_XOR = 6,
+   ALU_CMP = 7,
+};
+
+/// The /digit for the group 2 (C1 and D3) shift instructions.
+enum shift_op : uint8_t {
+   SHIFT_SHL = 4,
+   SHIFT_SHR = 5,
+   SHIFT_SAR = 7,
+};
+
+/// A memory operand, [Base + Index * (1 << Scale_Bits) + Disp]. An Index of
+/// RSP means there isn't one.
+struct mem {
+   host_reg Base;
+   host_reg Index;
+   uint8_t Scale_Bits;
+   int32_t Disp;
+};
+
+mem At( host_reg Base, int32_t Disp = 0 ) {
+   return mem{ Base, RSP, 0, Disp };
+}
+
+mem At( host_reg Base, host_reg Index, uint8_t Scale_Bits ) {
+   return mem{ Base, Index, Scale_Bits, 0 };
+}
+
+// ----------------------------------------------------------------------------
+
+/// Writes out x86-64 instructions. Only the handful of forms the JIT needs,
+/// and always the longest displacement, since nobody reads this code.
+class x86_emitter {
+private:
+   uint8_t *Cursor;
+
+   void Rex( bool W, unsigned Reg, unsigned Index, unsigned Base, bool Force ) {
+      const uint8_t Prefix = uint8_t( 0x40 | ( W << 3 ) | ( ( Reg >> 3 ) << 2 ) |
+                                      ( ( Index >> 3 ) << 1 ) | ( Base >> 3 ) );
+      if ( Prefix != 0x40 or Force ) {
+         this->byte( Prefix );
+      }
+   }
+
+public:
+   explicit x86_emitter( uint8_t *Start ) : Cursor( Start ) {}
+
+   uint8_t *here( void ) const {
+      return this->Cursor;
+   }
+
+   void byte( uint8_t Byte ) {
+      *this->Cursor++ = Byte;
+   }
+
+   void dword( uint32_t Dword ) {
+      memcpy( this->Cursor, &Dword, sizeof( Dword ) );
+      this->Cursor += sizeof( Dword );
+   }
+
+   void qword( uint64_t Qword ) {
+      memcpy( this->Cursor, &Qword, sizeof( Qword ) );
+      this->Cursor += sizeof( Qword );
+   }
+
+   /// Register-direct ModRM form: Opcode Reg, RM.
+   void rr( initializer_list<uint8_t> Opcode,
+            unsigned Reg,
+            unsigned RM,
+            bool W          = false,
+            bool Force_Rex  = false ) {
+      this->Rex( W, Reg, 0, RM, Force_Rex );
+      for ( auto Byte : Opcode ) {
+         this->byte( Byte );
+      }
+      this->byte( uint8_t( 0xC0 | ( ( Reg & 7 ) << 3 ) | ( RM & 7 ) ) );
+   }
+
+   /// Memory ModRM form: Opcode Reg, [M].
+   void rm( initializer_list<uint8_t> Opcode,
+            unsigned Reg,
+            mem M,
+            bool W          = false,
+            bool Force_Rex  = false,
+            uint8_t Prefix  = 0 ) {
+      if ( Prefix ) {
+         this->byte( Prefix );
+      }
+      this->Rex( W, Reg, ( M.Index == RSP ? 0 : M.Index ), M.Base, Force_Rex );
+      for ( auto Byte : Opcode ) {
+         this->byte( Byte );
+      }
+
+      if ( M.Index == RSP and ( M.Base & 7 ) != RSP ) {
+         this->byte( uint8_t( 0x80 | ( ( Reg & 7 ) << 3 ) | ( M.Base & 7 ) ) );
+      } else {
+         this->byte( uint8_t( 0x80 | ( ( Reg & 7 ) << 3 ) | 4 ) );
+         this->byte( uint8_t( ( M.Scale_Bits << 6 ) | ( ( M.Index & 7 ) << 3 ) |
+                              ( M.Base & 7 ) ) );
+      }
+      this->dword( uint32_t( M.Disp ) );
+   }
+
+   void mov( host_reg Dst, host_reg Src ) {
+      this->rr( { 0x89 }, Src, Dst );
+   }
+
+   void mov( host_reg Dst, mem Src ) {
+      this->rm( { 0x8B }, Dst, Src );
+   }
+
+   void mov( mem Dst, host_reg Src ) {
+      this->rm( { 0x89 }, Src, Dst );
+   }
+
+   void mov64( host_reg Dst, mem Src ) {
+      this->rm( { 0x8B }, Dst, Src, true );
+   }
+
+   void mov_imm( host_reg Dst, uint32_t Imm ) {
+      this->Rex( false, 0, 0, Dst, false );
+      this->byte( uint8_t( 0xB8 + ( Dst & 7 ) ) );
+      this->dword( Imm );
+   }
+
+   void mov_imm( mem Dst, uint32_t Imm ) {
+      this->rm( { 0xC7 }, 0, Dst );
+      this->dword( Imm );
+   }
+
+   void mov_imm64( host_reg Dst, const void *Pointer ) {
+      this->Rex( true, 0, 0, Dst, false );
+      this->byte( uint8_t( 0xB8 + ( Dst & 7 ) ) );
+      this->qword( uint64_t( Pointer ) );
+   }
+
+   /// Opcode is the r/m32, r32 form: 01 add, 09 or, 21 and, 29 sub, 31 xor,
+   /// 39 cmp.
+   void alu( uint8_t Opcode, host_reg Dst, host_reg Src, bool W = false ) {
+      this->rr( { Opcode }, Src, Dst, W );
+   }
+
+   void alu_imm( alu_op Op, host_reg Dst, uint32_t Imm ) {
+      this->rr( { 0x81 }, Op, Dst );
+      this->dword( Imm );
+   }
+
+   void shift_cl( shift_op Op, host_reg Dst ) {
+      this->rr( { 0xD3 }, Op, Dst );
+   }
+
+   void shift_imm( shift_op Op, host_reg Dst, uint8_t Amount, bool W = false ) {
+      this->rr( { 0xC1 }, Op, Dst, W );
+      this->byte( Amount );
+   }
+
+   /// Dst = Dst * Src, signed, keeping the low 32 (or with W, 64) bits.
+   void imul( host_reg Dst, host_reg Src, bool W = false ) {
+      this->rr( { 0x0F, 0xAF }, Dst, Src, W );
+   }
+
+   /// Sign-extend the low 32 bits of Src into all 64 of Dst.
+   void movsxd( host_reg Dst, host_reg Src ) {
+      this->rr( { 0x63 }, Dst, Src, true );
+   }
+
+   void test_imm( host_reg Dst, uint32_t Imm ) {
+      this->rr( { 0xF7 }, 0, Dst );
+      this->dword( Imm );
+   }
+
+   /// Dst = ( condition ? 1 : 0 ). Dst must be one of RAX to RBX.
+   void set( condition CC, host_reg Dst ) {
+      this->rr( { 0x0F, uint8_t( 0x90 | CC ) }, 0, Dst );
+      this->rr( { 0x0F, 0xB6 }, Dst, Dst ); // movzx
+   }
+
+   void push( host_reg Reg ) {
+      this->Rex( false, 0, 0, Reg, false );
+      this->byte( uint8_t( 0x50 + ( Reg & 7 ) ) );
+   }
+
+   void pop( host_reg Reg ) {
+      this->Rex( false, 0, 0, Reg, false );
+      this->byte( uint8_t( 0x58 + ( Reg & 7 ) ) );
+   }
+
+   void call( host_reg Target ) {
+      this->rr( { 0xFF }, 2, Target );
+   }
+
+   void ret( void ) {
+      this->byte( 0xC3 );
+   }
+
+   /// Jcc with a 32-bit displacement. Returns where the displacement goes, for
+   /// patch() once the target is known.
+   uint8_t *jcc( condition CC ) {
+      this->byte( 0x0F );
+      this->byte( uint8_t( 0x80 | CC ) );
+      this->dword( 0 );
+      return ( this->Cursor - 4 );
+   }
+
+   uint8_t *jmp( void ) {
+      this->byte( 0xE9 );
+      this->dword( 0 );
+      return ( this->Cursor - 4 );
+   }
+
+   /// Point the jump whose displacement is at Patch at Target.
+   static void patch( uint8_t *Patch, const uint8_t *Target ) {
+      const int32_t Displacement = int32_t( Target - ( Patch + 4 ) );
+      memcpy( Patch, &Displacement, sizeof( Displacement ) );
+   }
+
+   void align( size_t Alignment ) {
+      while ( uintptr_t( this->Cursor ) % Alignment != 0 ) {
+         this->byte( 0x90 ); // nop
+      }
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+/// Where compiled code calls out to for stores it can't do itself.
+void Jit_Store( memory *Memory,
+                uint32_t Address,
+                uint32_t Value,
+                uint32_t Bytes ) {
+   switch ( Bytes ) {
+      case 1: Memory->store8( Address, uint8_t( Value ) ); break;
+      case 2: Memory->store16( Address, uint16_t( Value ) ); break;
+      default: Memory->store32( Address, Value ); break;
+   }
+}
+
+/// True if the JIT can compile this instruction. Everything else is left for
+/// the interpreter.
+bool Can_Compile( instr_id ID ) {
+   switch ( Instr_Type_Mapping[ID] ) {
+      // Division's corner cases would need branches of their own, and it's
+      // rare enough to leave to the interpreter.
+      case INSTR_TYPE_R:
+         return ( ID != DIV and ID != DIVU and ID != REM and ID != REMU );
+      case INSTR_TYPE_S:
+      case INSTR_TYPE_B:
+      case INSTR_TYPE_U:
+      case INSTR_TYPE_J: return true;
+      case INSTR_TYPE_I: return ( ID != ECALL and ID != EBREAK );
+      default: return ( ID == FENCE );
+   }
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+
+/// Everything compiled code needs the address of. The memory parts are
+/// private, and jit is memory's friend, so it fills them in.
+struct guest_addresses {
+   uint32_t *Registers;
+   uint32_t *PC;
+   memory *Memory;
+   const void *Directory;
+   const void *Watched_Page_Bits;
+   const void *Zero_Page;
+};
+
+// ----------------------------------------------------------------------------
+
+/// Compiles one block. Guest registers live in Register_X, addressed off R15,
+/// except for the few cached in host registers. RBP holds memory's page
+/// directory. RAX, RCX, RDX, RSI and RDI are scratch.
+class block_compiler {
+private:
+   /// Host registers guest registers can be cached in. The first four survive
+   /// calls; the rest are saved around the one call compiled code makes.
+   static constexpr host_reg Cache_Regs[] = { RBX, R12, R13, R14,
+                                              R8,  R9,  R10, R11 };
+
+   enum : unsigned {
+      NUM_CACHE_REGS = ( sizeof( Cache_Regs ) / sizeof( Cache_Regs[0] ) ),
+      NOT_CACHED     = 0xFF,
+   };
+
+   x86_emitter E;
+   const basic_block &Block;
+   const guest_addresses &Guest;
+
+   /// Offset of the guest PC from Register_X, so it can be reached off R15.
+   int32_t PC_Disp;
+
+   /// How many instructions, from the start of the block, are compiled.
+   size_t Length;
+
+   /// Which host register (index into Cache_Regs) each guest register is in.
+   uint8_t Cache_Slot[32];
+   bool Written[32] = {};
+
+   struct pending_exit {
+      uint8_t *Patch;
+      uint32_t PC;
+      uint32_t Count;
+   };
+
+   /// A store that found its page watched or unallocated, and has to
+   /// call out to memory's typed stores.
+   struct pending_store {
+      uint8_t *Is_Watched;
+      uint8_t *Is_Unallocated;
+      uint8_t *Resume;
+      uint32_t Bytes;
+      uint32_t Index;
+   };
+
+   vector<pending_exit> Exits;
+   vector<pending_store> Slow_Stores;
+
+   uint8_t *Epilogue = nullptr;
+
+   host_reg Cache_Reg( unsigned Guest ) const {
+      return Cache_Regs[this->Cache_Slot[Guest]];
+   }
+
+   void Load_Guest( host_reg Dst, unsigned Guest ) {
+      if ( Guest == 0 ) {
+         this->E.alu( 0x31, Dst, Dst ); // xor
+      } else if ( this->Cache_Slot[Guest] != NOT_CACHED ) {
+         this->E.mov( Dst, this->Cache_Reg( Guest ) );
+      } else {
+         this->E.mov( Dst, At( R15, 4 * Guest ) );
+      }
+   }
+
+   void Store_Guest( unsigned Guest, host_reg Src ) {
+      assert( Guest != 0 );
+      if ( this->Cache_Slot[Guest] != NOT_CACHED ) {
+         this->E.mov( this->Cache_Reg( Guest ), Src );
+      } else {
+         this->E.mov( At( R15, 4 * Guest ), Src );
+      }
+   }
+
+   /// Leave the block with the PC at the given address, having run Count
+   /// instructions.
+   void Exit_Here( uint32_t PC, uint32_t Count ) {
+      this->E.mov_imm( At( R15, this->PC_Disp ), PC );
+      this->E.mov_imm( RAX, Count );
+   }
+
+   /// Leave the block, with a jump whose displacement is at Patch.
+   void Exit_From( uint8_t *Patch, uint32_t PC, uint32_t Count ) {
+      this->Exits.push_back( pending_exit{ Patch, PC, Count } );
+   }
+
+   /// RDX <- the page holding the address in EAX, ECX <- the offset in it.
+   void Walk_Page_Table( void ) {
+      this->E.mov( RDX, RAX );
+      this->E.shift_imm( SHIFT_SHR, RDX, 22 );
+      this->E.mov64( RDX, At( RBP, RDX, 3 ) );
+      this->E.mov( RCX, RAX );
+      this->E.shift_imm( SHIFT_SHR, RCX, memory::PAGE_SIZE_BITS );
+      this->E.alu_imm( ALU_AND, RCX, memory::ENTRIES_PER_TABLE - 1 );
+      this->E.mov64( RDX, At( RDX, RCX, 3 ) );
+      this->E.mov( RCX, RAX );
+      this->E.alu_imm( ALU_AND, RCX, memory::PAGE_SIZE - 1 );
+   }
+
+   void Choose_Cached_Registers( void );
+   void Prologue( void );
+   void Emit_Epilogue( void );
+   void Emit_Slow_Stores( void );
+   void Emit_Exits( void );
+
+   void Compile_Load( const decoded_instr &D, uint32_t Index );
+   void Compile_Store( const decoded_instr &D, uint32_t Index );
+
+   /// Returns false if the instruction ended the block.
+   bool Compile( const decoded_instr &D, uint32_t Index );
+
+public:
+   block_compiler( uint8_t *Start,
+                   const basic_block &Block,
+                   const guest_addresses &Guest )
+       : E( Start ), Block( Block ), Guest( Guest ) {
+      const ptrdiff_t PC_Disp =
+        ( reinterpret_cast<uint8_t *>( Guest.PC ) -
+          reinterpret_cast<uint8_t *>( Guest.Registers ) );
+      assert( PC_Disp == int32_t( PC_Disp ) );
+      this->PC_Disp = int32_t( PC_Disp );
+
+      this->Length = 0;
+      while ( this->Length < Block.Instructions.size() and
+              Can_Compile( Block.Instructions[this->Length].ID ) ) {
+         this->Length += 1;
+      }
+   }
+
+   size_t length( void ) const {
+      return this->Length;
+   }
+
+   /// Compile the block, returning the end of the code.
+   uint8_t *run( void );
+};
+
+constexpr host_reg block_compiler::Cache_Regs[];
+
+// ----------------------------------------------------------------------------
+
+void block_compiler::Choose_Cached_Registers( void ) {
+   unsigned Uses[32] = {};
+
+   for ( size_t I = 0; I < this->Length; ++I ) {
+      const auto &D = this->Block.Instructions[I];
+      Uses[D.RD] += 1;
+      Uses[D.RS1] += 1;
+      Uses[D.RS2] += 1;
+   }
+   Uses[0] = 0;
+
+   memset( this->Cache_Slot, NOT_CACHED, sizeof( this->Cache_Slot ) );
+
+   // Most-used first. A register used once isn't worth loading and storing.
+   for ( unsigned Slot = 0; Slot < NUM_CACHE_REGS; ++Slot ) {
+      unsigned Best = 0;
+      for ( unsigned Guest = 1; Guest < 32; ++Guest ) {
+         if ( this->Cache_Slot[Guest] == NOT_CACHED and
+              Uses[Guest] > Uses[Best] ) {
+            Best = Guest;
+         }
+      }
+
+      if ( Uses[Best] < 2 ) {
+         break;
+      }
+
+      this->Cache_Slot[Best] = uint8_t( Slot );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void block_compiler::Prologue( void ) {
+   for ( auto Reg : { RBX, RBP, R12, R13, R14, R15 } ) {
+      this->E.push( Reg );
+   }
+   // Six pushes and the return address leave the stack 8 off 16-aligned.
+   this->E.rr( { 0x83 }, ALU_SUB, RSP, true );
+   this->E.byte( 8 );
+
+   this->E.mov_imm64( R15, this->Guest.Registers );
+   this->E.mov_imm64( RBP, this->Guest.Directory );
+
+   for ( unsigned Guest = 1; Guest < 32; ++Guest ) {
+      if ( this->Cache_Slot[Guest] != NOT_CACHED ) {
+         this->E.mov( this->Cache_Reg( Guest ), At( R15, 4 * Guest ) );
+      }
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void block_compiler::Emit_Epilogue( void ) {
+   this->Epilogue = this->E.here();
+
+   for ( unsigned Guest = 1; Guest < 32; ++Guest ) {
+      if ( this->Cache_Slot[Guest] != NOT_CACHED and this->Written[Guest] ) {
+         this->E.mov( At( R15, 4 * Guest ), this->Cache_Reg( Guest ) );
+      }
+   }
+
+   this->E.rr( { 0x83 }, ALU_ADD, RSP, true );
+   this->E.byte( 8 );
+   for ( auto Reg : { R15, R14, R13, R12, RBP, RBX } ) {
+      this->E.pop( Reg );
+   }
+   this->E.ret();
+}
+
+// ----------------------------------------------------------------------------
+
+void block_compiler::Emit_Slow_Stores( void ) {
+   for ( const auto &Store : this->Slow_Stores ) {
+      x86_emitter::patch( Store.Is_Watched, this->E.here() );
+      x86_emitter::patch( Store.Is_Unallocated, this->E.here() );
+
+      // EAX has the address and ESI the data.
+      for ( auto Reg : { R8, R9, R10, R11 } ) {
+         this->E.push( Reg );
+      }
+      this->E.mov( RDX, RSI );
+      this->E.mov( RSI, RAX );
+      this->E.mov_imm( RCX, Store.Bytes );
+      this->E.mov_imm64( RDI, this->Guest.Memory );
+      this->E.mov_imm64( RAX, reinterpret_cast<void *>( &Jit_Store ) );
+      this->E.call( RAX );
+      for ( auto Reg : { R11, R10, R9, R8 } ) {
+         this->E.pop( Reg );
+      }
+
+      // The store may have been to this block's own code.
+      const decoded_instr &D = this->Block.Instructions[Store.Index];
+      this->E.mov_imm64( RAX, &this->Block.Valid );
+      this->E.rm( { 0x80 }, ALU_CMP, At( RAX ) );
+      this->E.byte( 0 );
+      this->Exit_From(
+        this->E.jcc( CC_E ), D.PC + D.Length, Store.Index + 1 );
+
+      x86_emitter::patch( this->E.jmp(), Store.Resume );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void block_compiler::Emit_Exits( void ) {
+   for ( const auto &Exit : this->Exits ) {
+      x86_emitter::patch( Exit.Patch, this->E.here() );
+      this->Exit_Here( Exit.PC, Exit.Count );
+      x86_emitter::patch( this->E.jmp(), this->Epilogue );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void block_compiler::Compile_Load( const decoded_instr &D, uint32_t Index ) {
+   this->Load_Guest( RAX, D.RS1 );
+   this->E.alu_imm( ALU_ADD, RAX, D.Imm );
+
+   // Misaligned loads are left to the interpreter, which raises the exception.
+   if ( D.ID == LW or D.ID == LH or D.ID == LHU ) {
+      this->E.test_imm( RAX, ( D.ID == LW ? 3 : 1 ) );
+      this->Exit_From( this->E.jcc( CC_NE ), D.PC, Index );
+   }
+
+   if ( D.RD == 0 ) {
+      return;
+   }
+
+   this->Walk_Page_Table();
+
+   // Pages are little-endian bytes, same as the host.
+   const mem Data = At( RDX, RCX, 0 );
+   switch ( D.ID ) {
+      case LB: this->E.rm( { 0x0F, 0xBE }, RAX, Data ); break;
+      case LBU: this->E.rm( { 0x0F, 0xB6 }, RAX, Data ); break;
+      case LH: this->E.rm( { 0x0F, 0xBF }, RAX, Data ); break;
+      case LHU: this->E.rm( { 0x0F, 0xB7 }, RAX, Data ); break;
+      default: this->E.mov( RAX, Data ); break;
+   }
+
+   this->Store_Guest( D.RD, RAX );
+}
+
+// ----------------------------------------------------------------------------
+
+void block_compiler::Compile_Store( const decoded_instr &D, uint32_t Index ) {
+   this->Load_Guest( RAX, D.RS1 );
+   this->E.alu_imm( ALU_ADD, RAX, D.Imm );
+   this->Load_Guest( RSI, D.RS2 );
+
+   if ( D.ID == SW or D.ID == SH ) {
+      this->E.test_imm( RAX, ( D.ID == SW ? 3 : 1 ) );
+      this->Exit_From( this->E.jcc( CC_NE ), D.PC, Index );
+   }
+
+   pending_store Slow;
+   Slow.Bytes = ( D.ID == SW ? 4 : D.ID == SH ? 2 : 1 );
+   Slow.Index = Index;
+
+   // Watched pages -- holding code, or shared with a snapshot -- have to go
+   // through memory's stores, so blocks decoded from them get thrown out and
+   // shared pages get copied.
+   this->E.mov( RCX, RAX );
+   this->E.shift_imm( SHIFT_SHR, RCX, memory::PAGE_SIZE_BITS );
+   this->E.mov_imm64( RDI, this->Guest.Watched_Page_Bits );
+   this->E.rm( { 0x0F, 0xA3 }, RCX, At( RDI ) ); // bt
+   Slow.Is_Watched = this->E.jcc( CC_B );        // CF set
+
+   // So do pages that haven't been allocated yet.
+   this->Walk_Page_Table();
+   this->E.mov_imm64( RDI, this->Guest.Zero_Page );
+   this->E.alu( 0x39, RDX, RDI, true ); // cmp
+   Slow.Is_Unallocated = this->E.jcc( CC_E );
+
+   const mem Data = At( RDX, RCX, 0 );
+   switch ( Slow.Bytes ) {
+      case 1: this->E.rm( { 0x88 }, RSI, Data, false, true ); break;
+      case 2: this->E.rm( { 0x89 }, RSI, Data, false, false, 0x66 ); break;
+      default: this->E.mov( Data, RSI ); break;
+   }
+
+   Slow.Resume = this->E.here();
+   this->Slow_Stores.push_back( Slow );
+}
+
+// ----------------------------------------------------------------------------
+
+bool block_compiler::Compile( const decoded_instr &D, uint32_t Index ) {
+   const instr_id ID = D.ID;
+
+   if ( D.RD != 0 ) {
+      switch ( Instr_Type_Mapping[ID] ) {
+         case INSTR_TYPE_R:
+         case INSTR_TYPE_I:
+         case INSTR_TYPE_U:
+         case INSTR_TYPE_J: this->Written[D.RD] = true; break;
+         default: break;
+      }
+   }
+
+   switch ( ID ) {
+      case ADD:
+      case SUB:
+      case XOR:
+      case OR:
+      case AND:
+      case SLT:
+      case SLTU:
+      case SLL:
+      case SRL:
+      case SRA: {
+         if ( D.RD == 0 ) {
+            return true;
+         }
+
+         this->Load_Guest( RAX, D.RS1 );
+         this->Load_Guest( RCX, D.RS2 );
+
+         switch ( ID ) {
+            case ADD: this->E.alu( 0x01, RAX, RCX ); break;
+            case SUB: this->E.alu( 0x29, RAX, RCX ); break;
+            case XOR: this->E.alu( 0x31, RAX, RCX ); break;
+            case OR: this->E.alu( 0x09, RAX, RCX ); break;
+            case AND: this->E.alu( 0x21, RAX, RCX ); break;
+            case SLT:
+               this->E.alu( 0x39, RAX, RCX );
+               this->E.set( CC_L, RAX );
+               break;
+            case SLTU:
+               this->E.alu( 0x39, RAX, RCX );
+               this->E.set( CC_B, RAX );
+               break;
+            // x86 masks the shift amount in CL to 5 bits, same as RISC-V.
+            case SLL: this->E.shift_cl( SHIFT_SHL, RAX ); break;
+            case SRL: this->E.shift_cl( SHIFT_SHR, RAX ); break;
+            default: this->E.shift_cl( SHIFT_SAR, RAX ); break;
+         }
+
+         this->Store_Guest( D.RD, RAX );
+         return true;
+      }
+
+      // 32-bit guest registers load zero-extended, so the high halves are a
+      // 64-bit multiply after sign-extending whichever sides are signed.
+      case MUL:
+      case MULH:
+      case MULHSU:
+      case MULHU: {
+         if ( D.RD == 0 ) {
+            return true;
+         }
+
+         this->Load_Guest( RAX, D.RS1 );
+         this->Load_Guest( RCX, D.RS2 );
+
+         if ( ID == MUL ) {
+            this->E.imul( RAX, RCX );
+         } else {
+            if ( ID != MULHU ) {
+               this->E.movsxd( RAX, RAX );
+            }
+            if ( ID == MULH ) {
+               this->E.movsxd( RCX, RCX );
+            }
+            this->E.imul( RAX, RCX, true );
+            this->E.shift_imm( SHIFT_SHR, RAX, 32, true );
+         }
+
+         this->Store_Guest( D.RD, RAX );
+         return true;
+      }
+
+      case SLLI:
+      case SRLI:
+      case SRAI: {
+         if ( D.RD == 0 ) {
+            return true;
+         }
+
+         this->Load_Guest( RAX, D.RS1 );
+         const shift_op Op =
+           ( ID == SLLI ? SHIFT_SHL : ID == SRLI ? SHIFT_SHR : SHIFT_SAR );
+         this->E.shift_imm( Op, RAX, D.RS2 );
+         this->Store_Guest( D.RD, RAX );
+         return true;
+      }
+
+      case ADDI:
+      case XORI:
+      case ORI:
+      case ANDI:
+      case SLTI:
+      case SLTIU: {
+         if ( D.RD == 0 ) {
+            return true;
+         }
+
+         this->Load_Guest( RAX, D.RS1 );
+
+         switch ( ID ) {
+            case ADDI: this->E.alu_imm( ALU_ADD, RAX, D.Imm ); break;
+            case XORI: this->E.alu_imm( ALU_XOR, RAX, D.Imm ); break;
+            case ORI: this->E.alu_imm( ALU_OR, RAX, D.Imm ); break;
+            case ANDI: this->E.alu_imm( ALU_AND, RAX, D.Imm ); break;
+            case SLTI:
+               this->E.alu_imm( ALU_CMP, RAX, D.Imm );
+               this->E.set( CC_L, RAX );
+               break;
+            default:
+               this->E.alu_imm( ALU_CMP, RAX, D.Imm );
+               this->E.set( CC_B, RAX );
+               break;
+         }
+
+         this->Store_Guest( D.RD, RAX );
+         return true;
+      }
+
+      case LB:
+      case LH:
+      case LW:
+      case LBU:
+      case LHU: this->Compile_Load( D, Index ); return true;
+
+      case SB:
+      case SH:
+      case SW: this->Compile_Store( D, Index ); return true;
+
+      case LUI:
+      case AUIPC: {
+         if ( D.RD != 0 ) {
+            const uint32_t Value = ( ID == LUI ? D.Imm : D.Imm + D.PC );
+            this->E.mov_imm( RAX, Value );
+            this->Store_Guest( D.RD, RAX );
+         }
+         return true;
+      }
+
+      case FENCE: return true;
+
+      case JAL: {
+         if ( D.RD != 0 ) {
+            this->E.mov_imm( RAX, D.PC + D.Length );
+            this->Store_Guest( D.RD, RAX );
+         }
+         this->Exit_Here( D.PC + D.Imm, Index + 1 );
+         return false;
+      }
+
+      case JALR: {
+         this->Load_Guest( RAX, D.RS1 );
+         this->E.alu_imm( ALU_ADD, RAX, D.Imm );
+         this->E.alu_imm( ALU_AND, RAX, ~1u );
+         if ( D.RD != 0 ) {
+            this->E.mov_imm( RCX, D.PC + D.Length );
+            this->Store_Guest( D.RD, RCX );
+         }
+         this->E.mov( At( R15, this->PC_Disp ), RAX );
+         this->E.mov_imm( RAX, Index + 1 );
+         return false;
+      }
+
+      case BEQ:
+      case BNE:
+      case BLT:
+      case BGE:
+      case BLTU:
+      case BGEU: {
+         this->Load_Guest( RAX, D.RS1 );
+         this->Load_Guest( RCX, D.RS2 );
+         this->E.alu( 0x39, RAX, RCX );
+
+         condition Taken = CC_E;
+         switch ( ID ) {
+            case BEQ: Taken = CC_E; break;
+            case BNE: Taken = CC_NE; break;
+            case BLT: Taken = CC_L; break;
+            case BGE: Taken = CC_GE; break;
+            case BLTU: Taken = CC_B; break;
+            default: Taken = CC_AE; break;
+         }
+
+         this->Exit_From( this->E.jcc( Taken ), D.PC + D.Imm, Index + 1 );
+         this->Exit_Here( D.PC + D.Length, Index + 1 );
+         return false;
+      }
+
+      default: assert( util::Unreachable ); return false;
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+uint8_t *block_compiler::run( void ) {
+   this->Choose_Cached_Registers();
+   this->Prologue();
+
+   bool Fell_Off_End = true;
+   for ( uint32_t I = 0; I < this->Length; ++I ) {
+      if ( not this->Compile( this->Block.Instructions[I], I ) ) {
+         Fell_Off_End = false;
+         break;
+      }
+   }
+
+   if ( Fell_Off_End ) {
+      // Either the block ran out, or the next instruction is one for the
+      // interpreter.
+      const uint32_t Count     = uint32_t( this->Length );
+      const decoded_instr &Last = this->Block.Instructions[Count - 1];
+      this->Exit_Here( Last.PC + Last.Length, Count );
+   }
+
+   this->Emit_Epilogue();
+   this->Emit_Slow_Stores();
+   this->Emit_Exits();
+
+   return this->E.here();
+}
+
+// ----------------------------------------------------------------------------
+
+jit::jit( uint32_t *Registers, uint32_t *PC, memory *Memory )
+    : Registers( Registers ), PC( PC ), Memory( Memory ) {
+   void *Buffer = mmap( nullptr,
+                        BUFFER_SIZE,
+                        PROT_READ | PROT_WRITE | PROT_EXEC,
+                        MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1,
+                        0 );
+
+   if ( Buffer != MAP_FAILED ) {
+      this->Buffer = static_cast<uint8_t *>( Buffer );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+jit::~jit() {
+   if ( this->Buffer ) {
+      munmap( this->Buffer, BUFFER_SIZE );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+bool jit::has_room_for( const basic_block &Block ) const {
+   // Comfortably more than the longest instruction (a store, with its slow
+   // path), plus the prologue, epilogue and alignment.
+   constexpr size_t Max_Bytes_Per_Instruction = 256;
+   constexpr size_t Max_Overhead              = 512;
+
+   const size_t Needed =
+     ( Block.Instructions.size() * Max_Bytes_Per_Instruction + Max_Overhead );
+   return ( this->Used + Needed <= BUFFER_SIZE );
+}
+
+// ----------------------------------------------------------------------------
+
+jit::native_block jit::compile( const basic_block &Block ) {
+   assert( this->usable() );
+   assert( this->has_room_for( Block ) );
+
+   x86_emitter Aligner( this->Buffer + this->Used );
+   Aligner.align( 16 );
+   uint8_t *Start = Aligner.here();
+
+   guest_addresses Guest;
+   Guest.Registers         = this->Registers;
+   Guest.PC                = this->PC;
+   Guest.Memory            = this->Memory;
+   Guest.Directory         = this->Memory->Directory;
+   Guest.Watched_Page_Bits = this->Memory->Watched_Page_Bits;
+   Guest.Zero_Page         = &memory::Zero_Page;
+
+   block_compiler Compiler( Start, Block, Guest );
+
+   if ( Compiler.length() == 0 ) {
+      return nullptr;
+   }
+
+   uint8_t *End = Compiler.run();
+   this->Used   = size_t( End - this->Buffer );
+
+   return reinterpret_cast<native_block>( Start );
+}
+
+#else // not x86-64
+
+jit::jit( uint32_t *Registers, uint32_t *PC, memory *Memory )
+    : Registers( Registers ), PC( PC ), Memory( Memory ) {}
+
+jit::~jit() {}
+
+bool jit::has_room_for( const basic_block & ) const {
+   return false;
+}
+
+jit::native_block jit::compile( const basic_block & ) {
+   return nullptr;
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef JIT_H
+#define JIT_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   x86-64 translation of hot basic blocks
+
+**************************************************************** */
+
+/*
+   Once a basic block has run often enough, the processor hands it to the JIT,
+   which writes it out as x86-64 machine code in an executable buffer. Running
+   the block is then a single call.
+
+   The guest's Register_X stays the register file: a few of the registers a
+   block uses most are kept in host registers while it runs, and written back
+   whenever it leaves. Loads and stores walk memory's page table inline and
+   touch its pages directly. Anything unusual -- a store to a page that isn't
+   allocated yet, holds code or is shared with a snapshot -- goes through
+   memory's typed stores.
+
+   Compiled code never raises an exception itself. Before an instruction that
+   would trap (a misaligned load or store), or one the JIT doesn't handle at
+   all (CSR instructions, ECALL, EBREAK, MRET, anything illegal), it stops and
+   says how many instructions it ran. The processor carries on interpreting
+   from there, so Handle_Exception() sees exactly what it would have anyway.
+
+   Only built for x86-64. Elsewhere, usable() is false and the processor just
+   interprets.
+*/
+
+#include <cstddef>
+#include <cstdint>
+
+#include "block_cache.h"
+
+using namespace std;
+
+class memory;
+
+// ----------------------------------------------------------------------------
+
+class jit {
+private:
+   /// Size of the executable buffer. When it fills up, everything in it is
+   /// thrown away and blocks are compiled again as they get hot.
+   enum : size_t {
+      BUFFER_SIZE = ( 16 << 20 ),
+   };
+
+   uint8_t *Buffer = nullptr;
+   size_t Used     = 0;
+
+   /// The processor's Register_X and PC, and its memory. Compiled code has
+   /// their addresses baked in, so they mustn't move.
+   uint32_t *Registers;
+   uint32_t *PC;
+   memory *Memory;
+
+public:
+   /// Runs a compiled block. Returns how many of its instructions were run,
+   /// having left the PC at the next one.
+   using native_block = basic_block::native_block;
+
+   jit( uint32_t *Registers, uint32_t *PC, memory *Memory );
+   ~jit();
+
+   jit( const jit & ) = delete;
+   jit &operator=( const jit & ) = delete;
+
+   /// False if there's no executable buffer: mmap() failed, or this isn't an
+   /// x86-64 build.
+   bool usable( void ) const {
+      return this->Buffer != nullptr;
+   }
+
+   /// True if there's definitely room left to compile the given block.
+   bool has_room_for( const basic_block &Block ) const;
+
+   /// Throw away all compiled code. Whatever points into it must be
+   /// forgotten first -- see block_cache::forget_native_code().
+   void reset( void ) {
+      this->Used = 0;
+   }
+
+   /// Compile as much of the given block as possible, from the start. Returns
+   /// null if not even the first instruction can be compiled.
+   native_block compile( const basic_block &Block );
+};
+
+#endif
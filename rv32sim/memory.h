@@ -10,50 +10,423 @@
 **************************************************************** */
 
 #include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "symbols.h"
 #include "util.h"
 
 using namespace std;
 
+/// Something that keeps decoded copies of instructions from memory, and so
+/// needs to hear when the pages they came from are written.
+class code_observer {
+public:
+   virtual ~code_observer() {}
+
+   /// The given page, which was marked with mark_code_page(), was written.
+   virtual void code_page_written( uint32_t Page_Number ) = 0;
+};
+
+// ----------------------------------------------------------------------------
+
 class memory {
+   // Compiled code walks the page table and checks Watched_Page_Bits itself.
+   friend class jit;
+
+public:
+   /// Main memory is split into 4 KiB pages. An address is broken up as:
+   ///
+   ///    31         22 21         12 11          0
+   ///   [  directory  ][    table    ][   offset   ]
+   ///
+   /// The directory entry picks a page table, the table entry picks a page,
+   /// and the offset picks a byte within that page.
+   enum : uint32_t {
+      PAGE_SIZE_BITS    = 12,
+      PAGE_SIZE         = ( 1u << PAGE_SIZE_BITS ),
+      WORDS_PER_PAGE    = ( PAGE_SIZE / 4 ),
+      TABLE_INDEX_BITS  = 10,
+      ENTRIES_PER_TABLE = ( 1u << TABLE_INDEX_BITS ),
+      NUM_PAGES         = ( 1u << ( 32 - PAGE_SIZE_BITS ) ),
+   };
+
 private:
    bool Be_Verbose = false;
 
+   /// Where the loaders' messages go.
+   ostream *Output = &cout;
+
    /// Round the given address down to a word-aligned address. Tests indicate
    /// this function will be optimised out, so use it for readability.
    static constexpr uint32_t Round_Down_To_Word_Aligned( uint32_t Address );
 
-   /// An address->word map representing the main memory available to the CPU.
-   unordered_map<uint32_t, uint32_t> Memory_Map;
+   /// Guest memory is little-endian, like the host, so a page is just bytes
+   /// and the typed accessors below are single host loads and stores. It's
+   /// word-aligned so the A extension can use host atomics on it.
+   struct alignas( 4 ) page {
+      uint8_t Bytes[PAGE_SIZE];
+   };
+
+   struct page_table {
+      page *Pages[ENTRIES_PER_TABLE];
+   };
+
+   /// Every slot that hasn't been written yet points at these. They are never
+   /// written to, so reading unwritten memory gives zero without the read path
+   /// having to check for null.
+   static page Zero_Page;
+   static page_table Zero_Table;
+   static page_table Make_Zero_Table( void );
+
+   /// The top level of the page table. Never null -- unused entries point at
+   /// Zero_Table. Harts on other threads read it without locking, so new
+   /// tables and pages are filled in before they're stored into it.
+   page_table *Directory[ENTRIES_PER_TABLE];
+
+   /// Find the page holding the given address, for reading. May be Zero_Page.
+   const page *Page_For_Reading( uint32_t Address ) const {
+      const page_table *Table = this->Directory[Address >> 22];
+      return Table->Pages[( Address >> PAGE_SIZE_BITS ) &
+                          ( ENTRIES_PER_TABLE - 1 )];
+   }
+
+   /// Write to the page holding the given address: Do( Bytes ) with the
+   /// page's bytes, whatever it does to them. Pages that don't exist yet are
+   /// allocated (zero-filled) first, along with their table, and watched
+   /// pages (below) are copied if they're shared. Both of those, and the
+   /// write itself, happen under Lock, and the code observers are only told
+   /// once it's done, so a hart decoding the page -- which marks it under
+   /// Lock before fetching -- either sees the new bytes or hears about them.
+   template <typename Write>
+   void Write_To_Page( uint32_t Address, Write &&Do ) {
+      const uint32_t Page_Number = ( Address >> PAGE_SIZE_BITS );
+
+      // The bit before the page. Watched_Page_Written() clears it only after
+      // a shared page's copy is in the table, so seeing it clear means seeing
+      // the copy, never the snapshot's page.
+      if ( not Test_Page_Bit(
+             this->Watched_Page_Bits, Page_Number, __ATOMIC_ACQUIRE ) ) {
+         const page_table *Table =
+           __atomic_load_n( &this->Directory[Address >> 22], __ATOMIC_ACQUIRE );
+         page *Page = __atomic_load_n(
+           &Table->Pages[Page_Number & ( ENTRIES_PER_TABLE - 1 )],
+           __ATOMIC_ACQUIRE );
+
+         if ( Page != &Zero_Page ) {
+            Do( Page->Bytes );
+            return;
+         }
+      }
+
+      const lock_guard<mutex> Hold( this->Lock );
+      Do( this->Writable_Page( Page_Number )->Bytes );
+      this->Watched_Page_Written( Page_Number );
+   }
+
+   /// Slow path of Write_To_Page(), with Lock held. Allocates the page if it
+   /// doesn't exist, and gives it a private copy if it's shared.
+   page *Writable_Page( uint32_t Page_Number );
+
+   /// Held by the slow paths of Write_To_Page(), which harts on different
+   /// threads can reach for the same page at once, and by mark_code_page().
+   mutex Lock;
+
+   /// Bitmaps with one bit per page. Kept apart from the pages so that
+   /// executing unwritten (zero) memory can be tracked too.
+   using page_bits = uint8_t[NUM_PAGES / 8];
+
+   /// Bits for different pages share bytes, and different harts may be
+   /// setting them, so they're set and cleared atomically.
+   static bool Test_Page_Bit( const page_bits &Bits,
+                              uint32_t Page_Number,
+                              int Order = __ATOMIC_RELAXED ) {
+      return ( __atomic_load_n( &Bits[Page_Number / 8], Order ) >>
+               ( Page_Number % 8 ) ) &
+             1;
+   }
+
+   static void Set_Page_Bit( page_bits &Bits,
+                             uint32_t Page_Number,
+                             bool Value,
+                             int Order = __ATOMIC_RELAXED ) {
+      const uint8_t Mask = uint8_t( 1 << ( Page_Number % 8 ) );
+      if ( Value ) {
+         __atomic_fetch_or( &Bits[Page_Number / 8], Mask, Order );
+      } else {
+         __atomic_fetch_and( &Bits[Page_Number / 8], uint8_t( ~Mask ), Order );
+      }
+   }
+
+   /// Set if instructions have been decoded from the page since it was last
+   /// written.
+   page_bits Code_Page_Bits;
+
+   /// Set if the page is shared with a snapshot, and has to be copied before
+   /// it's written.
+   page_bits Shared_Page_Bits;
+
+   /// Set if the page's next write has to take the slow path: it holds code,
+   /// or is shared, or both. This is the only bitmap the store paths check.
+   page_bits Watched_Page_Bits;
+
+   /// Told whenever a page with its bit set in Code_Page_Bits is written.
+   vector<code_observer *> Code_Observers;
+
+   /// The end of Write_To_Page()'s slow path, after the write, with Lock
+   /// held. Tells the code observers if the page holds code, and stops
+   /// watching it.
+   void Watched_Page_Written( uint32_t Page_Number );
+
+   /// Clear the page's code bit and tell the code observers it has changed.
+   void Code_Page_Changed( uint32_t Page_Number );
+
+   /// References to the pages shared with snapshots, which own them. The page
+   /// table points at these, so they aren't deleted along with private pages.
+   unordered_map<uint32_t, shared_ptr<page>> Shared_Pages;
+
+   /// Pages allocated or copied since the last snapshot was taken or
+   /// restored -- so every page that differs from it. See restore().
+   vector<uint32_t> Dirty_Pages;
+
+   /// The snapshot those are relative to, or 0 for none.
+   uint64_t Base_Snapshot = 0;
+
+   /// Slot in the page table for the given page number. Allocates the table.
+   page *&Page_Table_Entry( uint32_t Page_Number );
+
+   /// Load the ELF file mapped between Begin and End. See load_file().
+   bool Load_ELF( const char *Begin, const char *End, uint32_t &Entry );
 
 public:
+   /// Functions in the last ELF file loaded. Empty after loading a hex image.
+   symbol_table Symbols;
+
+   /// The contents of memory at some point. Taking one shares every page with
+   /// it rather than copying, and either side copies a page when it first
+   /// writes it, so snapshots are cheap to take and keep. See snapshot.h for
+   /// the processor's half.
+   class snapshot {
+   private:
+      friend class memory;
+
+      /// Every page memory had allocated, by page number.
+      unordered_map<uint32_t, shared_ptr<page>> Pages;
+
+      /// Tells restore() whether it can just undo the dirty pages. Copies of
+      /// a snapshot have the same contents, so they share the ID.
+      uint64_t ID = 0;
+
+   public:
+      bool empty( void ) const {
+         return this->ID == 0;
+      }
+
+      /// Append the pages to a file, or read them back. The format is a page
+      /// count and then each page's number and bytes, all little-endian.
+      bool write( FILE *File ) const;
+      bool read( FILE *File );
+   };
+
+   /// Take a snapshot of memory. Neither this nor restore() may be called
+   /// while a hart is running.
+   void take_snapshot( snapshot &Snapshot );
+
+   /// Put memory back the way it was when the snapshot was taken. If it was
+   /// also the last one taken or restored, this only touches pages written
+   /// since; otherwise every page is replaced.
+   void restore( const snapshot &Snapshot );
+
    // Constructor
    memory( bool Verbose );
 
+   ~memory();
+
+   // Pages are owned by the memory, so don't let it be copied.
+   memory( const memory & ) = delete;
+   memory &operator=( const memory & ) = delete;
+
+   /// Send the loaders' messages somewhere other than stdout. Added.
+   void set_output( ostream &Output ) {
+      this->Output = &Output;
+   }
+
    /// Read a word of data from a word-aligned address. If the address is not a
    /// multiple of 4, it is rounded down to a multiple of 4.
-   uint32_t read_word( uint32_t Address );
+   uint32_t read_word( uint32_t Address ) const;
 
    /// Read a word of data from a non-word-aligned address. This is slow. Added.
    uint32_t read_word_unaligned( uint32_t Address );
 
-   /// Read a byte from the given address. This is slow. Added.
-   uint8_t read_byte( uint32_t Address );
+   /// Read a byte from the given address. Same as load8(). Added.
+   uint8_t read_byte( uint32_t Address ) const;
+
+   /// Typed loads, as the guest sees them: little-endian, zero-extended. The
+   /// address must be aligned to the size of the load -- the instructions that
+   /// use these trap on misaligned addresses before getting here. Added.
+   uint8_t load8( uint32_t Address ) const;
+   uint16_t load16( uint32_t Address ) const;
+   uint32_t load32( uint32_t Address ) const;
+
+   /// Typed stores. The address must be aligned, as above. Added.
+   void store8( uint32_t Address, uint8_t Data );
+   void store16( uint32_t Address, uint16_t Data );
+   void store32( uint32_t Address, uint32_t Data );
 
    // void test_read_byte( void );
 
    /// Write a word of data to a word-aligned address. If the address is not a
    /// multiple of 4, it is rounded down to a multiple of 4. The mask contains
    /// 1s for bytes to be updated and 0s for bytes that are to be unchanged.
+   /// Instructions use the typed stores; this is kept for the `m`
+   /// command.
    void write_word( uint32_t Address, uint32_t Data, uint32_t Mask = ~0 );
 
+   /// The word at an aligned address, for the A extension to use host atomics
+   /// on. Added.
+   const uint32_t *word_for_reading( uint32_t Address ) const {
+      return reinterpret_cast<const uint32_t *>(
+        &this->Page_For_Reading( Address )->Bytes[Address % PAGE_SIZE] );
+   }
+
+   /// Call Do( Word ) with a pointer to the word at an aligned address, for
+   /// it to update with host atomics. It goes the same way as a store, so
+   /// watched pages are dealt with around it. Added.
+   template <typename Update>
+   void update_word( uint32_t Address, Update &&Do ) {
+      this->Write_To_Page( Address, [&]( uint8_t *Bytes ) {
+         Do( reinterpret_cast<uint32_t *>( &Bytes[Address % PAGE_SIZE] ) );
+      } );
+   }
+
+   /// Copy a run of bytes into memory, a page at a time. Added.
+   void write_bytes( uint32_t Address, const uint8_t *Data, size_t Length );
+
+   /// Zero a run of bytes. Pages that were never written are already zero, so
+   /// they're left unallocated. Added.
+   void fill_zero( uint32_t Address, size_t Length );
+
+   /// Note that instructions at this address are being decoded, so the code
+   /// observers need to be told when its page is written. Done before
+   /// fetching them, so that a write landing in between is still heard of.
+   void mark_code_page( uint32_t Address ) {
+      const lock_guard<mutex> Hold( this->Lock );
+      const uint32_t Page_Number = ( Address >> PAGE_SIZE_BITS );
+      Set_Page_Bit( this->Code_Page_Bits, Page_Number, true );
+      Set_Page_Bit( this->Watched_Page_Bits, Page_Number, true );
+   }
+
+   /// True if the page holding this address has been marked as holding code.
+   bool page_holds_code( uint32_t Address ) const {
+      return Test_Page_Bit( this->Code_Page_Bits, Address >> PAGE_SIZE_BITS );
+   }
+
+   /// Register something to be told about writes to code pages.
+   void add_code_observer( code_observer *Observer );
+
    /// Load a hex image file and provide the start address for execution from
    /// the file in start_address. Return true if the file was read without
-   /// error, or false otherwise.
+   /// error, or false otherwise. RV32 ELF executables are recognised and loaded
+   /// too, with their entry point as the start address.
    bool load_file( string File_Name, uint32_t &Start_Address );
 };
 
+// ----------------------------------------------------------------------------
+
+/*
+   The accessors below are on the hot path of every instruction, so they live
+   in the header where processor.cpp can inline them.
+*/
+
+static_assert( __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+               "Pages are accessed with host loads and stores, so the host "
+               "has to be little-endian like the guest." );
+
+inline uint8_t memory::load8( uint32_t Address ) const {
+   return this->Page_For_Reading( Address )->Bytes[Address % PAGE_SIZE];
+}
+
+inline uint16_t memory::load16( uint32_t Address ) const {
+   uint16_t Value;
+   memcpy( &Value,
+           &this->Page_For_Reading( Address )->Bytes[Address % PAGE_SIZE],
+           sizeof( Value ) );
+   return Value;
+}
+
+inline uint32_t memory::load32( uint32_t Address ) const {
+   uint32_t Value;
+   memcpy( &Value,
+           &this->Page_For_Reading( Address )->Bytes[Address % PAGE_SIZE],
+           sizeof( Value ) );
+   return Value;
+}
+
+// ----------------------------------------------------------------------------
+
+inline void memory::store8( uint32_t Address, uint8_t Data ) {
+   this->Write_To_Page( Address, [=]( uint8_t *Bytes ) {
+      Bytes[Address % PAGE_SIZE] = Data;
+   } );
+
+   DEBUG_LOG( "memory %08x <- byte %02x", Address, Data );
+}
+
+inline void memory::store16( uint32_t Address, uint16_t Data ) {
+   this->Write_To_Page( Address, [=]( uint8_t *Bytes ) {
+      memcpy( &Bytes[Address % PAGE_SIZE], &Data, sizeof( Data ) );
+   } );
+
+   DEBUG_LOG( "memory %08x <- halfword %04x", Address, Data );
+}
+
+inline void memory::store32( uint32_t Address, uint32_t Data ) {
+   this->Write_To_Page( Address, [=]( uint8_t *Bytes ) {
+      memcpy( &Bytes[Address % PAGE_SIZE], &Data, sizeof( Data ) );
+   } );
+
+   DEBUG_LOG( "memory %08x <- word %08x", Address, Data );
+}
+
+// ----------------------------------------------------------------------------
+
+inline uint32_t memory::read_word( uint32_t Address ) const {
+   return this->load32( util::Round_Down_To_Word_Aligned( Address ) );
+}
+
+// ----------------------------------------------------------------------------
+
+inline uint8_t memory::read_byte( uint32_t Address ) const {
+   return this->load8( Address );
+}
+
+// ----------------------------------------------------------------------------
+
+inline void memory::write_word( uint32_t Address,
+                                uint32_t Data,
+                                uint32_t Mask ) {
+   Address = util::Round_Down_To_Word_Aligned( Address );
+
+   uint32_t Old_Value, New_Value;
+   this->Write_To_Page( Address, [&]( uint8_t *Page_Bytes ) {
+      uint8_t *const Bytes = &Page_Bytes[Address % PAGE_SIZE];
+      memcpy( &Old_Value, Bytes, sizeof( Old_Value ) );
+
+      // Zero out the bits to be changed, then set them to whatever Data has
+      // set.
+      New_Value = ( Data | ( Old_Value & ~Mask ) );
+
+      memcpy( Bytes, &New_Value, sizeof( New_Value ) );
+   } );
+
+   DEBUG_LOG(
+     "memory %08x <- word %08x (was %08x)", Address, New_Value, Old_Value );
+}
+
 #endif
@@ -1,29 +1,62 @@
 #include "processor.h"
 #include "memory.h"
+#include "rv32c.h"
 #include "rv32i.h"
 #include "util.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
+#include <cstring>
 
 using namespace std;
 
 // ----------------------------------------------------------------------------
 
-processor::processor( memory *Main_Memory, bool Verbose, bool Stage2 ) {
-   this->Main_Memory = Main_Memory;
-   this->Be_Verbose  = Verbose;
-   this->Stage2      = Stage2;
+processor::processor( memory *Main_Memory,
+                      bool Verbose,
+                      bool Stage2,
+                      bool Use_JIT,
+                      uint32_t Hart_ID ) {
+   this->Main_Memory  = Main_Memory;
+   this->Be_Verbose   = Verbose;
+   this->Stage2       = Stage2;
+   this->Hart_ID      = Hart_ID;
+   this->Owner_Thread = this_thread::get_id();
 
    this->set_prv( PRIV_MACHINE );
 
-   Set_RV32I_Verbosity( Verbose );
+   Main_Memory->add_code_observer( this );
+
+   if ( Use_JIT and not Verbose ) {
+      this->Jit = new jit( this->Register_X, &this->PC, Main_Memory );
+
+      if ( not this->Jit->usable() ) {
+         delete this->Jit;
+         this->Jit = nullptr;
+      }
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+processor::~processor() {
+   delete this->Jit;
+}
+// ----------------------------------------------------------------------------
+
+void processor::print( const char *Format, ... ) const {
+   va_list Arguments;
+   va_start( Arguments, Format );
+   util::VPrint( *this->Output, Format, Arguments );
+   va_end( Arguments );
 }
+
 // ----------------------------------------------------------------------------
 
 void processor::show_pc( void ) const {
    DEBUG_LOG( "Displaying PC (%08x)", this->PC );
-   printf( "%08x\n", this->PC );
+   this->print( "%08x\n", this->PC );
 }
 
 // ----------------------------------------------------------------------------
@@ -41,18 +74,11 @@ uint32_t processor::get_pc( void ) const {
 
 // ----------------------------------------------------------------------------
 
-uint32_t processor::get_reg( unsigned int Reg_Num ) const {
-   assert( Reg_Num <= 31 );
-   return ( Reg_Num == 0 ? 0 : this->Register_X[Reg_Num] );
-}
-
-// ----------------------------------------------------------------------------
-
 void processor::show_reg( unsigned int Reg_Num ) const {
    assert( Reg_Num <= 31 );
    const auto Value = this->Register_X[Reg_Num];
    DEBUG_LOG( "Displaying register x%u (%08x)", Reg_Num, Value );
-   printf( "%08x\n", Value );
+   this->print( "%08x\n", Value );
 }
 
 // ----------------------------------------------------------------------------
@@ -70,6 +96,13 @@ void processor::set_reg( unsigned int Reg_Num, uint32_t New_Value ) {
    }
 }
 
+void processor::Update_Interrupt_Pending( void ) {
+   this->Interrupt_Possibly_Pending =
+     ( this->Check_For_Pending_Interrupts() != execution_result::SUCCESS );
+}
+
+// ----------------------------------------------------------------------------
+
 execution_result processor::Check_For_Pending_Interrupts( void ) {
    using ex = execution_result;
 
@@ -117,77 +150,493 @@ execution_result processor::Check_For_Pending_Interrupts( void ) {
 
 // ----------------------------------------------------------------------------
 
+decoded_instr processor::Fetch( uint32_t Address ) const {
+   if ( not this->Compressed ) {
+      return Decode_Instruction( Main_Memory->read_word( Address ), Address );
+   }
+
+   // Only halfword-aligned, so a 32-bit instruction is read in halves: it may
+   // straddle two pages.
+   const uint32_t Low = Main_Memory->load16( Address );
+   if ( Is_Compressed( Low ) ) {
+      return Decode_Compressed( Low, Address );
+   }
+
+   const uint32_t High = Main_Memory->load16( Address + 2 );
+   return Decode_Instruction( High << 16 | Low, Address );
+}
+
+// ----------------------------------------------------------------------------
+
+basic_block *processor::Build_Block( uint32_t Address ) {
+   auto Block      = new basic_block;
+   Block->Start_PC = Address;
+
+   // Blocks never cross a page, so that a write to one page only has to throw
+   // out the blocks decoded from it -- except that a 32-bit instruction in the
+   // last halfword of a page ends its block 2 bytes into the next one.
+   const uint32_t Bytes_Left_In_Page =
+     ( memory::PAGE_SIZE - Address % memory::PAGE_SIZE );
+
+   auto &Instructions = Block->Instructions;
+   Instructions.reserve(
+     min<uint32_t>( Bytes_Left_In_Page / 4, MAX_BLOCK_LENGTH ) );
+
+   // Pages are marked before they're fetched from, so that a write from
+   // another hart either lands before the fetch or is heard about after it.
+   // See memory::Write_To_Page().
+   Main_Memory->mark_code_page( Address );
+
+   uint32_t Bytes = 0;
+   do {
+      // Perhaps the start of a 32-bit instruction that ends on the next page.
+      if ( Bytes + 2 == Bytes_Left_In_Page ) {
+         Main_Memory->mark_code_page( Address + Bytes + 2 );
+      }
+
+      Instructions.push_back( this->Fetch( Address + Bytes ) );
+      Bytes += Instructions.back().Length;
+   } while ( not Ends_Basic_Block( Instructions.back().ID ) and
+             Instructions.size() < MAX_BLOCK_LENGTH and
+             Bytes < Bytes_Left_In_Page );
+
+   Block->Calls   = Is_Call( Instructions.back() );
+   Block->Returns = Is_Return( Instructions.back() );
+
+   // Every instruction's on the page the block starts on, even one that ends
+   // on the next.
+   if ( this->Breakpoint_Pages.count( Address >> memory::PAGE_SIZE_BITS ) ) {
+      for ( decoded_instr &Instruction : Instructions ) {
+         Instruction.Breakpoint =
+           ( this->Breakpoints_By_Address.count( Instruction.PC ) != 0 );
+         Block->Has_Breakpoint |= Instruction.Breakpoint;
+      }
+   }
+
+   return Block;
+}
+
+// ----------------------------------------------------------------------------
+
+basic_block *processor::Find_Block( uint32_t Address, basic_block *Previous ) {
+   if ( Previous ) {
+      for ( const auto Next : Previous->Next ) {
+         if ( Next and Next->Start_PC == Address ) {
+            return Next;
+         }
+      }
+   }
+
+   basic_block *Block = this->Blocks.find( Address );
+
+   if ( not Block ) {
+      Block = this->Build_Block( Address );
+      this->Blocks.insert( Block );
+   }
+
+   if ( Previous ) {
+      this->Blocks.chain( Previous, Block );
+   }
+
+   return Block;
+}
+
+// ----------------------------------------------------------------------------
+
+void processor::Compile_Block( basic_block *Block ) {
+   if ( not this->Jit->has_room_for( *Block ) ) {
+      this->Blocks.forget_native_code();
+      this->Jit->reset();
+   }
+
+   Block->Native = this->Jit->compile( *Block );
+}
+
+// ----------------------------------------------------------------------------
+
+void processor::code_page_written( uint32_t Page_Number ) {
+   if ( this_thread::get_id() == this->Owner_Thread ) {
+      this->Blocks.invalidate_page( Page_Number );
+      return;
+   }
+
+   const lock_guard<mutex> Hold( this->Pending_Lock );
+   this->Pending_Invalidations.push_back( Page_Number );
+   this->Attention = true;
+}
+
+// ----------------------------------------------------------------------------
+
+void processor::request_stop( void ) {
+   this->Stop_Requested = true;
+   this->Attention      = true;
+}
+
+void processor::cancel_stop( void ) {
+   this->Stop_Requested = false;
+}
+
+// ----------------------------------------------------------------------------
+
+bool processor::Handle_Attention( void ) {
+   this->Attention = false;
+
+   vector<uint32_t> Pages;
+   {
+      const lock_guard<mutex> Hold( this->Pending_Lock );
+      Pages.swap( this->Pending_Invalidations );
+   }
+
+   for ( const uint32_t Page_Number : Pages ) {
+      this->Blocks.invalidate_page( Page_Number );
+   }
+
+   return this->Stop_Requested;
+}
+
+// ----------------------------------------------------------------------------
+
 // Execute a number of instructions.
-void processor::execute( unsigned int Num, bool Check_For_Breakpoints ) {
-   while ( Num-- ) {
-      execution_result Result = this->Check_For_Pending_Interrupts();
+bool processor::execute( unsigned int Num, bool Check_For_Breakpoints ) {
+   using loop = bool ( processor::* )( unsigned int );
+
+   // [Verbose][Stage2][Breakpoints][Timed]
+   static constexpr loop Loops[2][2][2][2] = {
+     { { { &processor::Execute_Blocks<false, false, false, false>,
+           &processor::Execute_Blocks<false, false, false, true> },
+         { &processor::Execute_Blocks<false, false, true, false>,
+           &processor::Execute_Blocks<false, false, true, true> } },
+       { { &processor::Execute_Blocks<false, true, false, false>,
+           &processor::Execute_Blocks<false, true, false, true> },
+         { &processor::Execute_Blocks<false, true, true, false>,
+           &processor::Execute_Blocks<false, true, true, true> } } },
+     { { { &processor::Execute_Blocks<true, false, false, false>,
+           &processor::Execute_Blocks<true, false, false, true> },
+         { &processor::Execute_Blocks<true, false, true, false>,
+           &processor::Execute_Blocks<true, false, true, true> } },
+       { { &processor::Execute_Blocks<true, true, false, false>,
+           &processor::Execute_Blocks<true, true, false, true> },
+         { &processor::Execute_Blocks<true, true, true, false>,
+           &processor::Execute_Blocks<true, true, true, true> } } },
+   };
+
+   const bool Breakpoints = ( Check_For_Breakpoints and
+                              not this->Breakpoints_By_Address.empty() );
+   const bool Timed = ( this->Timing != nullptr );
+
+   const loop Loop = Loops[this->Be_Verbose][this->Stage2][Breakpoints][Timed];
+   const bool Finished = ( this->*Loop )( Num );
+
+   this->Flush_Block_Runs();
+   return Finished;
+}
+
+void processor::Flush_Block_Runs( void ) {
+   if ( this->Num_Block_Runs == 0 ) {
+      return;
+   }
+
+   for ( const unique_ptr<profiler> &Profiler : this->Profilers ) {
+      Profiler->ran( this->Block_Runs, this->Num_Block_Runs );
+   }
 
-      if ( Is_Interrupt( Result ) ) {
-         this->Handle_Exception( Result );
+   this->Num_Block_Runs = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+// Instructions are run a basic block at a time. Interrupts can only become
+// pending through a CSR instruction or MRET, both of which end a block, so
+// checking for them between blocks catches them at the same instruction as
+// checking before every instruction would. The PC only steps from one
+// instruction to the next within a block, so it only needs checking for
+// alignment at the start of one. Other harts' threads are heard from between
+// blocks too, through Attention.
+//
+// Each instruction runs with the PC already pointing at the next one, so
+// jumps, branches and MRET just overwrite it with their target, and a trap
+// puts it back for MEPC.
+template <bool Verbose, bool Stage2, bool Breakpoints, bool Timed>
+bool processor::Execute_Blocks( unsigned int Num ) {
+   constexpr bool Be_Verbose = Verbose; // For DEBUG_LOG().
+
+   /// The block that just ran to the end, if there is one, so that the next
+   /// block can be chained to it.
+   basic_block *Previous = nullptr;
+
+   const uint32_t Misaligned_Bits = ( this->Compressed ? 0b01 : 0b11 );
+
+   while ( Num > 0 ) {
+      execution_result Result = execution_result::SUCCESS;
+
+      if ( this->Attention.load( memory_order_relaxed ) ) {
+         Previous = nullptr;
+
+         if ( this->Handle_Attention() ) {
+            return false;
+         }
       }
 
-      uint32_t Word = 0;
+      if ( this->Interrupt_Possibly_Pending ) {
+         Result = this->Check_For_Pending_Interrupts();
+
+         if ( Is_Interrupt( Result ) ) {
+            this->Handle_Exception( Result );
+            Previous = nullptr;
 
-      if ( not util::Address_Is_Word_Aligned( this->PC ) ) {
+            if ( Timed ) {
+               this->Timing->trap();
+            }
+         }
+      }
+
+      if ( this->PC & Misaligned_Bits ) {
          DEBUG_LOG( RED( "PC is misaligned. Not even calling Execute()." ) );
-         Result = execution_result::EXC_INSTRUCTION_ADDRESS_MISALIGNED;
-      } else {
-         Word = Main_Memory->read_word( PC );
+         this->Handle_Exception(
+           execution_result::EXC_INSTRUCTION_ADDRESS_MISALIGNED );
+         --Num;
+         Previous = nullptr;
+
+         if ( Timed ) {
+            this->Timing->trap();
+         }
+         continue;
+      }
+
+      basic_block *Block = this->Find_Block( this->PC, Previous );
+      Previous           = nullptr;
+
+      const auto &Instructions = Block->Instructions;
+      uint32_t Count = min<uint32_t>( Num, uint32_t( Instructions.size() ) );
 
-         if ( Check_For_Breakpoints and Breakpoint_Is_Active and
-              ( PC == Breakpoint_Address ) ) {
+      // Only blocks built with breakpoints in them are looked at, so
+      // everything else runs as fast as it does without any.
+      if ( Breakpoints and Block->Has_Breakpoint ) {
+         if ( Instructions[0].Breakpoint and this->Breakpoint_Hit() ) {
             // @Required
-            printf( "Breakpoint reached at %08x\n", PC );
-            return;
+            this->print( "Breakpoint reached at %08x\n", this->PC );
+            return false;
          }
 
-         instr Instruction;
-         instr_id ID;
-         std::tie( Instruction, ID ) = Integer_To_Instruction( Word );
+         // Stop just short of the next one, and catch it at the top of the
+         // next go.
+         for ( uint32_t Index = 1; Index < Count; ++Index ) {
+            if ( Instructions[Index].Breakpoint ) {
+               Count = Index;
+               break;
+            }
+         }
+      }
+
+      uint32_t Executed = 0;
+      bool Left_Early   = false;
+
+      const uint32_t Retired_Before = this->Executed_Instruction_Count;
+
+      // Compiled code runs the whole block (or stops early and leaves the rest
+      // to the loop below), so it's only used when all of it should run. It
+      // can't say what it ran, so it isn't used when that's being timed.
+      if ( not Verbose and not Timed and this->Jit and
+           Count == Instructions.size() ) {
+         if ( not Block->Native and Block->Heat < JIT_THRESHOLD and
+              ++Block->Heat == JIT_THRESHOLD ) {
+            this->Compile_Block( Block );
+         }
+
+         if ( Block->Native ) {
+            Executed = Block->Native();
+            this->Executed_Instruction_Count += Executed;
+            Left_Early = not Block->Valid;
+         }
+      }
+
+      while ( not Left_Early and Executed < Count ) {
+         const decoded_instr &Instruction = Instructions[Executed++];
 
          DEBUG_LOG( "pc %08x -> memory %08x -> %s",
-                    PC,
-                    Instruction.As_Integer,
-                    Instruction_To_Assembly( Instruction.As_Integer ).c_str() );
+                    this->PC,
+                    Instruction.Word,
+                    Instruction_To_Assembly(
+                      Instruction.Length == 2
+                        ? Expand_Compressed( Instruction.Word )
+                        : Instruction.Word )
+                      .c_str() );
+
+         this->PC = ( Instruction.PC + Instruction.Length );
+
+         // Where a load or store goes, for a cache to look up, has to be
+         // worked out before it can overwrite its own base register.
+         const uint32_t Data_Address =
+           ( Timed ? this->get_reg( Instruction.RS1 ) + Instruction.Imm : 0 );
+
+         Result = Execute_Instruction<Verbose, Stage2>( this, Instruction );
+
+         if ( Result == Successful_Execution ) {
+            this->Executed_Instruction_Count += 1;
+
+            if ( Timed ) {
+               this->Timing->retire( Instruction, this->PC, Data_Address );
+            }
+         } else {
+            this->PC = Instruction.PC;
+            this->Handle_Exception( Result, Instruction.Word );
+
+            if ( Timed ) {
+               this->Timing->trap();
+            }
+         }
 
-         Result = Instruction.Execute( this, ID );
+         // Trapped, or wrote over its own code.
+         if ( Result != Successful_Execution or not Block->Valid ) {
+            Left_Early = true;
+         }
       }
 
-      this->Handle_Exception( Result, Word );
+      Num -= Executed;
+
+      // Those that retired are the first so many, whichever way they ran.
+      if ( not this->Profilers.empty() ) {
+         const uint32_t Retired =
+           ( this->Executed_Instruction_Count - Retired_Before );
+
+         if ( Retired != 0 ) {
+            this->Block_Runs[this->Num_Block_Runs++] =
+              block_run{ Block, Retired, this->PC };
+
+            if ( this->Num_Block_Runs == BLOCK_RUN_BATCH ) {
+               this->Flush_Block_Runs();
+            }
+         }
+      }
+
+      if ( not Left_Early and Executed == Instructions.size() ) {
+         Previous = Block;
+      }
 
-      this->PC += 4;
-      // Branch instructions and similar account for this PC+=4 by subtracting 4
-      // from their target addresses. This is a bit hacky.
+      if ( this->Blocks.has_retired() ) {
+         this->Flush_Block_Runs();
+         this->Blocks.free_retired();
+      }
+   }
+
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+
+bool processor::Breakpoint_Hit( void ) {
+   breakpoint &Breakpoint = this->Breakpoints_By_Address.at( this->PC );
+
+   if ( not Breakpoint.holds( this->get_reg( Breakpoint.Reg ) ) ) {
+      return false;
    }
+
+   Breakpoint.Hits += 1;
+   return ( Breakpoint.Hits >= Breakpoint.Stop_At );
 }
 
 // ----------------------------------------------------------------------------
 
-// Clear breakpoint
+// Clear breakpoint. The blocks on each page with breakpoints are thrown out,
+// as if the page had been written, so they're built again without the marks.
 void processor::clear_breakpoint( void ) {
-   this->Breakpoint_Is_Active = false;
+   for ( const auto &Entry : this->Breakpoint_Pages ) {
+      this->code_page_written( Entry.first );
+   }
+
+   this->Breakpoints_By_Address.clear();
+   this->Breakpoint_Pages.clear();
+}
+
+bool processor::clear_breakpoint( uint32_t Address ) {
+   if ( this->Breakpoints_By_Address.erase( Address ) == 0 ) {
+      return false;
+   }
+
+   const uint32_t Page_Number = ( Address >> memory::PAGE_SIZE_BITS );
+   if ( --this->Breakpoint_Pages[Page_Number] == 0 ) {
+      this->Breakpoint_Pages.erase( Page_Number );
+   }
+
+   this->code_page_written( Page_Number );
+   DEBUG_LOG( "Breakpoint at address %08x cleared", Address );
+   return true;
 }
 
 // ----------------------------------------------------------------------------
 
 // Set breakpoint at an address
 void processor::set_breakpoint( uint32_t Address ) {
-   this->Breakpoint_Is_Active = true;
-   this->Breakpoint_Address   = Address;
-   DEBUG_LOG( "Breakpoint set to address %08x", Address );
+   breakpoint Breakpoint;
+   Breakpoint.Address = Address;
+   this->set_breakpoint( Breakpoint );
+}
+
+void processor::set_breakpoint( const breakpoint &Breakpoint ) {
+   const auto Inserted = this->Breakpoints_By_Address.insert(
+     make_pair( Breakpoint.Address, Breakpoint ) );
+
+   if ( Inserted.second ) {
+      const uint32_t Page_Number =
+        ( Breakpoint.Address >> memory::PAGE_SIZE_BITS );
+      this->Breakpoint_Pages[Page_Number] += 1;
+      this->code_page_written( Page_Number );
+   } else {
+      // Already marked.
+      Inserted.first->second = Breakpoint;
+   }
+
+   Inserted.first->second.Hits = 0;
+   DEBUG_LOG( "Breakpoint set to address %08x", Breakpoint.Address );
+}
+
+// ----------------------------------------------------------------------------
+
+void processor::show_breakpoints( void ) const {
+   if ( this->Breakpoints_By_Address.empty() ) {
+      this->print( "No breakpoints\n" );
+      return;
+   }
+
+   for ( const auto &Entry : this->Breakpoints_By_Address ) {
+      const breakpoint &Breakpoint = Entry.second;
+      this->print( "%08x", Breakpoint.Address );
+
+      if ( Breakpoint.Condition != breakpoint::ALWAYS ) {
+         this->print( " if x%u %s %08x",
+                      unsigned( Breakpoint.Reg ),
+                      Breakpoint_Condition_To_String( Breakpoint.Condition ),
+                      Breakpoint.Value );
+      }
+      if ( Breakpoint.Stop_At > 1 ) {
+         this->print( " hits %u", Breakpoint.Stop_At );
+      }
+
+      this->print( ", hit count %u\n", Breakpoint.Hits );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void processor::set_compressed( bool Enabled ) {
+   this->Compressed = Enabled;
+
+   // Whatever was decoded was decoded the other way.
+   this->Blocks.clear();
+   this->Blocks.free_retired();
 }
 
 // ----------------------------------------------------------------------------
 
 void processor::show_csr( unsigned CSR_Number ) const {
    if ( not CSR_Is_Valid( CSR_Number ) ) {
-      puts( "Illegal CSR number" ); // @Required
+      this->print( "Illegal CSR number\n" ); // @Required
       return;
    }
 
    const auto Value = this->get_csr( CSR_Number );
    DEBUG_LOG( "Displaying CSR 0x%x (%08x)", CSR_Number, Value );
-   printf( "%08x\n", Value );
+   this->print( "%08x\n", Value );
 }
 
 // ----------------------------------------------------------------------------
@@ -207,7 +656,7 @@ void processor::set_csr( unsigned CSR_Number,
    }
 
    if ( not CSR_Is_Writeable( CSR_Number ) ) {
-      puts( "Illegal write to read-only CSR" ); // @Required
+      this->print( "Illegal write to read-only CSR\n" ); // @Required
       DEBUG_LOG( "Not assigining %s -- it's hard-coded.", Name );
       return;
    }
@@ -237,7 +686,7 @@ void processor::set_csr( unsigned CSR_Number,
          break;
       }
 
-      case CSR_MISA: To_Assign = 0x40100100; break;
+      case CSR_MISA: To_Assign = 0x40101101; break;
 
       case CSR_MIE: {
          // Machine interrupt enable register. Only the following bits are
@@ -291,7 +740,10 @@ void processor::set_csr( unsigned CSR_Number,
       }
 
       case CSR_MEPC: {
-         To_Assign = util::Set_Bits( New_Value, 1, 2, false );
+         // Bit 0 is always 0, and bit 1 is too unless 16-bit instructions
+         // can put an instruction there.
+         To_Assign = util::Set_Bits( New_Value, 1, ( this->Compressed ? 1 : 2 ),
+                                     false );
          break;
       }
 
@@ -322,6 +774,13 @@ void processor::set_csr( unsigned CSR_Number,
 
    DEBUG_LOG( "%s <- %08x (was given %08x).", Name, To_Assign, New_Value );
    this->CSR[CSR_To_Index( CSR_Number )] = To_Assign;
+
+   switch ( CSR_Number ) {
+      case CSR_MSTATUS:
+      case CSR_MIE:
+      case CSR_MIP: this->Update_Interrupt_Pending(); break;
+      default: break;
+   }
 }
 
 // ----------------------------------------------------------------------------
@@ -334,14 +793,41 @@ uint32_t processor::get_csr( unsigned CSR_Number ) const {
       case CSR_MVENDORID: return 0;
       case CSR_MARCHID: return 0;
       case CSR_MIMPID: return 0x20190200;
-      case CSR_MHARTID: return 0;
-      case CSR_MISA: return 0x40100100;
+      case CSR_MHARTID: return this->Hart_ID;
+      case CSR_MISA: // RV32IMA, and C if it's on, with user mode.
+         return ( 0x40101101 | ( this->Compressed ? 0b100 : 0 ) );
       default: return this->CSR[CSR_To_Index( CSR_Number )];
    }
 }
 
 // ----------------------------------------------------------------------------
 
+processor::state processor::get_state( void ) const {
+   state State;
+   State.PC = this->PC;
+   memcpy( State.Register_X, this->Register_X, sizeof( State.Register_X ) );
+   memcpy( State.CSR, this->CSR, sizeof( State.CSR ) );
+   State.Privelige_Level            = this->Privelige_Level;
+   State.Executed_Instruction_Count = this->Executed_Instruction_Count;
+   return State;
+}
+
+// ----------------------------------------------------------------------------
+
+void processor::set_state( const state &State ) {
+   this->PC = State.PC;
+   memcpy( this->Register_X, State.Register_X, sizeof( this->Register_X ) );
+   this->Register_X[0] = 0;
+   memcpy( this->CSR, State.CSR, sizeof( this->CSR ) );
+   this->Executed_Instruction_Count = State.Executed_Instruction_Count;
+   this->Reservation_Valid          = false;
+
+   // Also works out whether an interrupt might be pending.
+   this->set_prv( State.Privelige_Level == PRIV_USER ? PRIV_USER
+                                                     : PRIV_MACHINE );
+}
+// ----------------------------------------------------------------------------
+
 unsigned processor::get_prv( void ) const {
    return this->Privelige_Level;
 }
@@ -360,13 +846,14 @@ void processor::set_prv( unsigned Privelige_Level ) {
    // CSR.MSTATUS.MPP = Privelige_Level;
    // this->set_csr( CSR_MSTATUS, CSR );
    this->Privelige_Level = privelige_level( Privelige_Level );
+   this->Update_Interrupt_Pending();
 }
 
 // ----------------------------------------------------------------------------
 
 void processor::show_prv( void ) const {
    const auto Priv = this->get_prv();
-   printf( "%u %s\n",
+   this->print( "%u %s\n",
            Priv,
            Priv == PRIV_MACHINE
              ? "(machine)"
@@ -389,6 +876,9 @@ void processor::Handle_Exception( execution_result Result,
 
    DEBUG_LOG( YELLOW( "trapped: %s" ), Exec_Result_To_String( Result ) );
 
+   // A trap handler's stores mustn't let an interrupted LR/SC pair succeed.
+   this->Reservation_Valid = false;
+
    // Update Mstatus privelige stack
    {
       csr Mstatus          = this->get_csr( CSR_MSTATUS );
@@ -409,20 +899,34 @@ void processor::Handle_Exception( execution_result Result,
 
    // Handle exceptions
    if ( Exception_Occurred ) {
+      // A compressed load or store is picked apart as what it expands to.
+      const uint32_t Full_Instruction =
+        ( this->Compressed and Is_Compressed( Instruction )
+            ? Expand_Compressed( Instruction )
+            : Instruction );
+
+      // An atomic's address is rs1 alone. Its other fields aren't an offset.
+      const bool Atomic =
+        ( instr( Full_Instruction ).A_Type.Opcode == decode::OPCODE_AMO );
+
       switch ( Result ) {
          case ex::EXC_ILLEGAL_INSTRUCTION: {
-            const auto Instr =
-              this->Main_Memory->read_word_unaligned( this->PC );
+            auto Instr = this->Main_Memory->read_word_unaligned( this->PC );
+            if ( this->Compressed and Is_Compressed( Instr ) ) {
+               Instr &= 0xFFFF;
+            }
 
             DEBUG_LOG( "Illegal instruction. Setting MTVAL <- %08x", Instr );
             this->set_csr( CSR_MTVAL, Instr );
             break;
          }
          case ex::EXC_LOAD_ADDRESS_MISALIGNED: {
-            const auto Instr = instr( Instruction );
+            const auto Instr = instr( Full_Instruction );
             const auto Base  = this->get_reg( Instr.I_Type.RS1 );
             const auto Imm =
-              util::Sign_Extend( Instr.I_Type.Immediate_11_To_0, 12 );
+              ( Atomic ? 0
+                       : util::Sign_Extend( Instr.I_Type.Immediate_11_To_0,
+                                            12 ) );
             const auto Bad_Address = ( Imm + Base );
 
             DEBUG_LOG( "Misaligned load. Setting MTVAL <- %08x", Bad_Address );
@@ -430,9 +934,11 @@ void processor::Handle_Exception( execution_result Result,
             break;
          }
          case ex::EXC_STORE_ADDRESS_MISALIGNED: {
-            const auto Instr = instr( Instruction );
+            const auto Instr = instr( Full_Instruction );
             const auto Imm =
-              util::Sign_Extend( Instr.S_Type.Decipher_Immediate(), 12 );
+              ( Atomic ? 0
+                       : util::Sign_Extend( Instr.S_Type.Decipher_Immediate(),
+                                            12 ) );
             const auto Base        = this->get_reg( Instr.S_Type.RS1 );
             const auto Bad_Address = ( Base + Imm );
 
@@ -459,8 +965,8 @@ void processor::Handle_Exception( execution_result Result,
 
    if ( Is_Exception( Result ) ) {
       DEBUG_LOG( "Ignoring MTVEC mode since we got here from an exception." );
-      DEBUG_LOG( "Jumping to %08x.", Handler_Address - 4 );
-      this->set_pc( Handler_Address - 4 );
+      DEBUG_LOG( "Jumping to %08x.", Handler_Address );
+      this->set_pc( Handler_Address );
       return;
    }
 
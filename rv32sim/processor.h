@@ -9,10 +9,22 @@
 
 **************************************************************** */
 
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
+#include "block_cache.h"
 #include "csr.h"
+#include "jit.h"
 #include "memory.h"
+#include "profile.h"
+#include "timing.h"
 
 using namespace std;
 
@@ -29,7 +41,7 @@ enum execution_result : uint32_t {
    SUCCESS = (uint32_t) -1,
 
    // Exceptions and interrupts
-   EXC_INSTRUCTION_ADDRESS_MISALIGNED = 0x00000000, // PC % 4 != 0
+   EXC_INSTRUCTION_ADDRESS_MISALIGNED = 0x00000000, // PC % 4 (or 2) != 0
    EXC_ILLEGAL_INSTRUCTION            = 0x00000002,
    EXC_BREAKPOINT                     = 0x00000003, // ebreak
    EXC_LOAD_ADDRESS_MISALIGNED        = 0x00000004, // addr%load_size != 0
@@ -97,10 +109,68 @@ using from_instr = bool;
 
 // -----------------------------------------------------------------------------
 
-class processor {
+/// A place for execute() to stop: when it gets to Address, if the condition
+/// on a register holds, for the Stop_At'th time or any time after. Only the
+/// times the condition holds are counted. -- Added
+struct breakpoint {
+   /// How a register compares with Value. Unsigned.
+   enum condition : uint8_t {
+      ALWAYS,
+      EQUAL,
+      NOT_EQUAL,
+      LESS,
+      LESS_OR_EQUAL,
+      GREATER,
+      GREATER_OR_EQUAL,
+   };
+
+   uint32_t Address    = 0;
+   condition Condition = ALWAYS;
+   uint8_t Reg         = 0;
+   uint32_t Value      = 0;
+   uint32_t Stop_At    = 1;
+
+   /// How many times it's been reached with the condition holding.
+   uint32_t Hits = 0;
+
+   /// Whether the condition holds with the given register value.
+   bool holds( uint32_t Reg_Value ) const {
+      switch ( this->Condition ) {
+         case EQUAL: return Reg_Value == this->Value;
+         case NOT_EQUAL: return Reg_Value != this->Value;
+         case LESS: return Reg_Value < this->Value;
+         case LESS_OR_EQUAL: return Reg_Value <= this->Value;
+         case GREATER: return Reg_Value > this->Value;
+         case GREATER_OR_EQUAL: return Reg_Value >= this->Value;
+         default: return true;
+      }
+   }
+};
+
+/// The condition's operator, as the b command takes it.
+inline const char *Breakpoint_Condition_To_String(
+  breakpoint::condition Condition ) {
+   switch ( Condition ) {
+      case breakpoint::EQUAL: return "==";
+      case breakpoint::NOT_EQUAL: return "!=";
+      case breakpoint::LESS: return "<";
+      case breakpoint::LESS_OR_EQUAL: return "<=";
+      case breakpoint::GREATER: return ">";
+      case breakpoint::GREATER_OR_EQUAL: return ">=";
+      default: return "";
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+class processor : public code_observer {
 private:
    bool Be_Verbose = false;
 
+   /// Where the processor's output goes (not the verbose logging, which is
+   /// always stderr).
+   ostream *Output = &cout;
+
    /// How many instructions the CPU has executed.
    uint32_t Executed_Instruction_Count = 0;
 
@@ -112,8 +182,18 @@ private:
    /// only be accessed or modified via the get_reg() and set_reg() procedures.
    uint32_t Register_X[32] = {0};
 
-   bool Breakpoint_Is_Active   = false;
-   uint32_t Breakpoint_Address = 0;
+   /// Every breakpoint, by address. Their instructions are marked when
+   /// they're decoded, and so are the blocks holding them, so only marked
+   /// blocks are looked at when running with breakpoints.
+   map<uint32_t, breakpoint> Breakpoints_By_Address;
+
+   /// How many breakpoints are on each page that has any, so that building a
+   /// block only has to look for them when there might be some.
+   unordered_map<uint32_t, uint32_t> Breakpoint_Pages;
+
+   /// Note that the breakpoint at the PC has been reached. True if it should
+   /// stop there.
+   bool Breakpoint_Hit( void );
 
    //
    // Stage 2:
@@ -133,6 +213,96 @@ private:
 
    execution_result Check_For_Pending_Interrupts( void );
 
+   /// Whether Check_For_Pending_Interrupts() might find anything. That can
+   /// only change when MSTATUS, MIE or MIP is written, or the privelige level
+   /// changes -- and MIP's pending bits, external ones included, are only ever
+   /// raised through set_csr() -- so it's worked out then rather than before
+   /// every block.
+   bool Interrupt_Possibly_Pending = false;
+
+   /// Recompute Interrupt_Possibly_Pending.
+   void Update_Interrupt_Pending( void );
+
+   /// Basic blocks of decoded instructions, chained together. See
+   /// block_cache.h.
+   block_cache Blocks;
+
+   enum : uint32_t {
+      /// Longest basic block we'll build. Straight-line code longer than this
+      /// is just split into several blocks.
+      MAX_BLOCK_LENGTH = 64,
+
+      /// How many times a block runs before the JIT compiles it.
+      JIT_THRESHOLD = 16,
+   };
+
+   /// Compiles hot blocks to native code. Null unless it was asked for (and
+   /// works here).
+   jit *Jit = nullptr;
+
+   /// Hand a hot block to the JIT.
+   void Compile_Block( basic_block *Block );
+
+   /// Told about every instruction, if there is one. See timing.h.
+   unique_ptr<timing_model> Timing;
+
+   /// Told about every block that runs. See profile.h.
+   vector<unique_ptr<profiler>> Profilers;
+
+   /// Blocks that have run since the profilers were last told, so they can be
+   /// told a batch at a time.
+   enum : uint32_t { BLOCK_RUN_BATCH = 256 };
+   block_run Block_Runs[BLOCK_RUN_BATCH];
+   uint32_t Num_Block_Runs = 0;
+
+   /// Hand Block_Runs to the profilers, and empty it. Done before any block
+   /// in it can be freed, and before execute() returns.
+   void Flush_Block_Runs( void );
+
+   /// The body of execute(), specialised on everything that can't change
+   /// during a `.` command, so the usual case checks none of it.
+   template <bool Verbose, bool Stage2, bool Breakpoints, bool Timed>
+   bool Execute_Blocks( unsigned int Num );
+
+   /// This hart's number, as MHARTID reads it. See harts.h.
+   uint32_t Hart_ID = 0;
+
+   /// The thread that runs this processor. Blocks can't be thrown out from
+   /// under it by other threads' writes to code pages, so those are queued
+   /// in Pending_Invalidations, to be dealt with between blocks.
+   thread::id Owner_Thread;
+   mutex Pending_Lock;
+   vector<uint32_t> Pending_Invalidations;
+
+   /// Set when there's something to do between blocks: queued invalidations,
+   /// or a request_stop(). The only thing from other threads that the loop
+   /// checks.
+   atomic<bool> Attention{ false };
+   atomic<bool> Stop_Requested{ false };
+
+   /// Deal with Attention. Returns true if execution should stop.
+   bool Handle_Attention( void );
+
+   /// The reservation made by LR.W, for SC.W: the address, and the value
+   /// loaded from it. See a_type in rv32i.h.
+   bool Reservation_Valid       = false;
+   uint32_t Reservation_Address = 0;
+   uint32_t Reservation_Value   = 0;
+
+   /// Find the basic block starting at the given PC, decoding it if it isn't
+   /// in the cache already. Previous is the block that ran just before, if it
+   /// ran to the end; the two are chained so the next lookup is quicker.
+   basic_block *Find_Block( uint32_t Address, basic_block *Previous );
+
+   /// Decode a new basic block starting at the given PC.
+   basic_block *Build_Block( uint32_t Address );
+
+   /// Whether 16-bit instructions are allowed. See rv32c.h.
+   bool Compressed = false;
+
+   /// Fetch and decode the instruction at the given PC.
+   decoded_instr Fetch( uint32_t Address ) const;
+
 public:
    // Memory is public so the Execute() functions in my instruction types in
    // rv32i.h can access it. Isn't object-oriented programming fun!
@@ -141,8 +311,51 @@ public:
    // Are we in stage 2?
    bool Stage2 = false;
 
-   // Consructor
-   processor( memory *Main_Memory, bool Verbose, bool Stage2 );
+   // Consructor. Use_JIT asks for hot blocks to be compiled to native code,
+   // which is ignored when verbose, since compiled code doesn't log. The
+   // constructing thread is taken to be the one that will run it.
+   processor( memory *Main_Memory,
+              bool Verbose,
+              bool Stage2,
+              bool Use_JIT     = false,
+              uint32_t Hart_ID = 0 );
+
+   ~processor();
+
+   // The JIT has this processor's registers' addresses baked in.
+   processor( const processor & ) = delete;
+   processor &operator=( const processor & ) = delete;
+
+   /// Send output somewhere other than stdout. -- Added
+   void set_output( ostream &Output ) {
+      this->Output = &Output;
+   }
+
+   ostream &output( void ) const {
+      return *this->Output;
+   }
+
+   /// printf() to the processor's output. -- Added
+   void print( const char *Format, ... ) const
+     __attribute__( ( format( printf, 2, 3 ) ) );
+
+   // Throw out basic blocks from a page that's been written.
+   void code_page_written( uint32_t Page_Number ) override;
+
+   /// Make the calling thread the one that runs this processor. Only while
+   /// nothing else is using it. -- Added
+   void set_owner_thread( void ) {
+      this->Owner_Thread = this_thread::get_id();
+   }
+
+   uint32_t get_hart_id( void ) const {
+      return this->Hart_ID;
+   }
+
+   /// Ask execute(), from another thread, to stop at the end of the current
+   /// block. The request stands until cancel_stop(). -- Added
+   void request_stop( void );
+   void cancel_stop( void );
 
    // Display PC value
    void show_pc( void ) const;
@@ -150,6 +363,15 @@ public:
    // Set PC to new value
    void set_pc( uint32_t New_Value );
 
+   // Set PC to new value, from an instruction. Verbosity is known when the
+   // instruction handlers are compiled, so this doesn't check it. -- Added
+   template <bool Verbose>
+   void set_pc( uint32_t New_Value ) {
+      constexpr bool Be_Verbose = Verbose; // For DEBUG_LOG().
+      this->PC                  = New_Value;
+      DEBUG_LOG( "PC <- %08x", New_Value );
+   }
+
    // Get the current PC
    uint32_t get_pc( void ) const;
 
@@ -159,18 +381,82 @@ public:
    // Set register to new value
    void set_reg( unsigned int Reg_Num, uint32_t New_Value );
 
+   // Set register to new value, from an instruction. See set_pc<>(). -- Added
+   template <bool Verbose>
+   void set_reg( unsigned int Reg_Num, uint32_t New_Value ) {
+      constexpr bool Be_Verbose = Verbose; // For DEBUG_LOG().
+      assert( Reg_Num <= 31 );
+      if ( Reg_Num == 0 ) {
+         // Can't set x0.
+         DEBUG_LOG( "Not setting register x0." );
+      } else {
+         this->Register_X[Reg_Num] = New_Value;
+         DEBUG_LOG( "x%u <- %08x", Reg_Num, New_Value );
+      }
+   }
+
    // Get register value -- Added
-   uint32_t get_reg( unsigned int Reg_Num ) const;
+   uint32_t get_reg( unsigned int Reg_Num ) const {
+      assert( Reg_Num <= 31 );
+      return ( Reg_Num == 0 ? 0 : this->Register_X[Reg_Num] );
+   }
 
-   // Execute a number of instructions
-   void execute( unsigned int Num, bool Check_For_Breakpoints );
+   // Execute a number of instructions. Returns false if it stopped early, at
+   // a breakpoint or because of request_stop().
+   bool execute( unsigned int Num, bool Check_For_Breakpoints );
 
-   // Clear breakpoint
+   // Clear breakpoint. All of them. -- Changed
    void clear_breakpoint( void );
 
-   // Set breakpoint at an address
+   /// Clear the breakpoint at the given address. False if there isn't one.
+   /// -- Added
+   bool clear_breakpoint( uint32_t Address );
+
+   // Set breakpoint at an address. Any others stay. -- Changed
    void set_breakpoint( uint32_t Address );
 
+   /// Set a breakpoint, replacing any at the same address, with its hit
+   /// count started again. Neither this nor clear_breakpoint() while the
+   /// processor's running. -- Added
+   void set_breakpoint( const breakpoint &Breakpoint );
+
+   /// Print every breakpoint, a line each, in address order. -- Added
+   void show_breakpoints( void ) const;
+
+   const map<uint32_t, breakpoint> &get_breakpoints( void ) const {
+      return this->Breakpoints_By_Address;
+   }
+
+   /// Allow the C extension's 16-bit instructions, which lets the PC be any
+   /// even address. Off, they're illegal, and the PC must be a multiple of 4.
+   /// Everything decoded so far is thrown away. -- Added
+   void set_compressed( bool Enabled );
+
+   bool get_compressed( void ) const {
+      return this->Compressed;
+   }
+
+   /// Have the given model time everything from now on, or nothing if it's
+   /// null. The processor owns it. Timed processors don't use the JIT.
+   /// -- Added
+   void set_timing_model( timing_model *Model ) {
+      this->Timing.reset( Model );
+   }
+
+   const timing_model *get_timing_model( void ) const {
+      return this->Timing.get();
+   }
+
+   /// Have the given profiler watch everything from now on, along with any
+   /// others. The processor owns it.
+   void add_profiler( profiler *Profiler ) {
+      this->Profilers.emplace_back( Profiler );
+   }
+
+   const vector<unique_ptr<profiler>> &get_profilers( void ) const {
+      return this->Profilers;
+   }
+
    // Show privilege level
    void show_prv() const;
 
@@ -194,6 +480,39 @@ public:
    // Get the value of the given CSR -- Added
    uint32_t get_csr( unsigned CSR_Number ) const;
 
+   /// Reserve a word for SC.W, having loaded the given value from it. -- Added
+   void set_reservation( uint32_t Address, uint32_t Value ) {
+      this->Reservation_Valid   = true;
+      this->Reservation_Address = Address;
+      this->Reservation_Value   = Value;
+   }
+
+   /// Give up the reservation. True, with the value LR.W loaded, if it was
+   /// for the given address. -- Added
+   bool take_reservation( uint32_t Address, uint32_t &Value ) {
+      const bool Held = ( this->Reservation_Valid and
+                          this->Reservation_Address == Address );
+      this->Reservation_Valid = false;
+      Value                   = this->Reservation_Value;
+      return Held;
+   }
+
+   /// Everything architectural about the processor, for snapshots. Plain
+   /// 32-bit fields only, so it can be written to a file as it is. -- Added
+   struct state {
+      uint32_t PC;
+      uint32_t Register_X[32];
+      uint32_t CSR[NUM_CSR_CODES];
+      uint32_t Privelige_Level;
+      uint32_t Executed_Instruction_Count;
+   };
+
+   state get_state( void ) const;
+
+   /// Put the processor back into a saved state. Decoded blocks are left
+   /// alone; they only depend on memory. -- Added
+   void set_state( const state &State );
+
    // Get the number of instructions executed. Excludes instructions that
    // were interrupted or raised an exception.
    uint32_t get_instruction_count() const {
@@ -201,9 +520,9 @@ public:
    };
 
    // Used for Postgraduate assignment. Undergraduate assignment can return
-   // 0.
-   uint32_t get_cycle_count() const {
-      return 0;
+   // 0, which is what it is without a timing model.
+   uint64_t get_cycle_count() const {
+      return ( this->Timing ? this->Timing->get_cycle_count() : 0 );
    }
 };
 
@@ -0,0 +1,527 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Guest profiling
+
+**************************************************************** */
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include "profile.h"
+#include "rv32c.h"
+#include "util.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+instruction_profile::page_counts &instruction_profile::Page( uint32_t PC ) {
+   unique_ptr<unique_ptr<page_counts>[]> &Table = this->Tables[PC >> 22];
+   if ( not Table ) {
+      Table.reset( new unique_ptr<page_counts>[1024] );
+   }
+
+   unique_ptr<page_counts> &Page = Table[( PC >> 12 ) & 1023];
+   if ( not Page ) {
+      Page.reset( new page_counts() );
+   }
+
+   return *Page;
+}
+
+void instruction_profile::ran( const block_run *Runs, size_t Count ) {
+   for ( const block_run *Run = Runs; Run != Runs + Count; ++Run ) {
+      const decoded_instr *Instructions = Run->Block->Instructions.data();
+
+      // Only a block's last instruction can be on the next page.
+      uint32_t Page_Number = ( Instructions[0].PC >> 12 );
+      page_counts *Page    = &this->Page( Instructions[0].PC );
+
+      for ( uint32_t I = 0; I < Run->Retired; ++I ) {
+         const decoded_instr &D = Instructions[I];
+
+         if ( ( D.PC >> 12 ) != Page_Number ) {
+            Page_Number = ( D.PC >> 12 );
+            Page        = &this->Page( D.PC );
+         }
+
+         const uint32_t Index = ( ( D.PC & 0xFFF ) >> 1 );
+         if ( Page->Counts[Index]++ == 0 ) {
+            Page->Words[Index] = D.Word;
+         }
+         this->Mix[D.ID] += 1;
+      }
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void instruction_profile::report( ostream &Output,
+                                  uint64_t Instructions ) const {
+   const auto Percent = [Instructions]( uint64_t Count ) {
+      return ( Instructions == 0
+                 ? 0.0
+                 : 100.0 * double( Count ) / double( Instructions ) );
+   };
+
+   vector<pair<uint64_t, unsigned>> Mix;
+   for ( unsigned ID = FIRST_INSTR; ID < NUM_RV32I_INSTRUCTIONS; ++ID ) {
+      if ( this->Mix[ID] != 0 ) {
+         Mix.emplace_back( this->Mix[ID], ID );
+      }
+   }
+   sort( Mix.rbegin(), Mix.rend() );
+
+   util::Print( Output, "Instruction mix:\n" );
+   for ( const auto &Kind : Mix ) {
+      util::Print( Output,
+                   "  %-10s %14llu %7.2f%%\n",
+                   Instr_String_Mapping[Kind.second],
+                   (unsigned long long) Kind.first,
+                   Percent( Kind.first ) );
+   }
+
+   // Every instruction that ran, as (count, PC, word), hottest first.
+   struct hot_pc {
+      uint64_t Count;
+      uint32_t PC;
+      uint32_t Word;
+
+      bool operator<( const hot_pc &Other ) const {
+         return ( this->Count != Other.Count ? this->Count > Other.Count
+                                             : this->PC < Other.PC );
+      }
+   };
+
+   vector<hot_pc> Hot;
+   for ( uint32_t T = 0; T < 1024; ++T ) {
+      if ( not this->Tables[T] ) {
+         continue;
+      }
+      for ( uint32_t P = 0; P < 1024; ++P ) {
+         const page_counts *Page = this->Tables[T][P].get();
+         if ( Page == nullptr ) {
+            continue;
+         }
+         for ( uint32_t I = 0; I < 2048; ++I ) {
+            if ( Page->Counts[I] != 0 ) {
+               Hot.push_back( hot_pc{ Page->Counts[I],
+                                      ( T << 22 ) | ( P << 12 ) | ( I << 1 ),
+                                      Page->Words[I] } );
+            }
+         }
+      }
+   }
+
+   const size_t Shown = min<size_t>( this->Hot_Count, Hot.size() );
+   partial_sort( Hot.begin(), Hot.begin() + Shown, Hot.end() );
+
+   util::Print( Output, "Hottest instructions:\n" );
+   for ( size_t I = 0; I < Shown; ++I ) {
+      const hot_pc &H = Hot[I];
+
+      // A 32-bit instruction always has its bottom two bits set.
+      const bool Compressed = ( ( H.Word & 0b11 ) != 0b11 );
+      util::Print( Output,
+                   "  %08x %14llu %7.2f%%  %s%s\n",
+                   H.PC,
+                   (unsigned long long) H.Count,
+                   Percent( H.Count ),
+                   Compressed ? "c: " : "",
+                   Instruction_To_Assembly(
+                     Compressed ? Expand_Compressed( H.Word ) : H.Word )
+                     .c_str() );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+uint32_t call_graph_profile::Find_Child( uint32_t Parent, uint32_t Function ) {
+   uint32_t Child    = this->Nodes[Parent].First_Child;
+   uint32_t Previous = 0;
+
+   while ( Child != 0 and this->Nodes[Child].Function != Function ) {
+      Previous = Child;
+      Child    = this->Nodes[Child].Next_Sibling;
+   }
+
+   if ( Child == 0 ) {
+      Child = uint32_t( this->Nodes.size() );
+      this->Nodes.emplace_back( Function, Parent );
+   } else if ( Previous != 0 ) {
+      this->Nodes[Previous].Next_Sibling = this->Nodes[Child].Next_Sibling;
+   }
+
+   // To the front, if it isn't already there.
+   if ( this->Nodes[Parent].First_Child != Child ) {
+      this->Nodes[Child].Next_Sibling = this->Nodes[Parent].First_Child;
+      this->Nodes[Parent].First_Child = Child;
+   }
+
+   return Child;
+}
+
+inline uint32_t call_graph_profile::Child_Of( uint32_t Parent,
+                                              uint32_t Function ) {
+   recent_call &Recent =
+     this->Recent_Calls[( Parent ^ Function >> 1 ) % RECENT_CALLS];
+
+   if ( Recent.Child == 0 or Recent.Parent != Parent or
+        Recent.Function != Function ) {
+      Recent =
+        recent_call{ Parent, Function, this->Find_Child( Parent, Function ) };
+   }
+
+   return Recent.Child;
+}
+
+uint32_t call_graph_profile::Unwind( uint32_t Depth,
+                                     uint32_t Return_Address ) const {
+   // longjmp() and the like can unwind several calls at once. A return to
+   // nowhere on the stack leaves it be.
+   for ( uint32_t Frame = Depth - 1; Frame > 0; --Frame ) {
+      if ( this->Stack[Frame].Return_Address == Return_Address ) {
+         return Frame;
+      }
+   }
+
+   return Depth;
+}
+
+// Calls and returns are followed in the loop, on copies of the top of the
+// stack, because code that calls a lot makes one every few instructions.
+void call_graph_profile::ran( const block_run *Runs, size_t Count ) {
+   if ( Count == 0 ) {
+      return;
+   }
+
+   if ( this->Nodes.empty() ) {
+      this->Nodes.emplace_back( Runs[0].Block->Start_PC, 0 );
+      this->Stack.assign( MAX_DEPTH, frame{ 0, 0 } );
+      this->Depth = 1;
+   }
+
+   frame *const Frames = this->Stack.data();
+   uint32_t Depth      = this->Depth;
+   uint32_t Current    = Frames[Depth - 1].Node;
+
+   // Counted against the current node when it changes, rather than block by
+   // block.
+   uint64_t Self = 0;
+
+   for ( const block_run *Run = Runs; Run != Runs + Count; ++Run ) {
+      const basic_block &Block = *Run->Block;
+      Self += Run->Retired;
+
+      // Only the last instruction can call or return, and only if it retired.
+      if ( not( Block.Calls or Block.Returns ) or
+           Run->Retired != Block.Instructions.size() ) {
+         continue;
+      }
+
+      this->Nodes[Current].Self += Self;
+      Self = 0;
+
+      // A return is usually to the innermost caller.
+      if ( Block.Returns ) {
+         if ( this->Overflow != 0 ) {
+            this->Overflow -= 1;
+         } else if ( Depth > 1 and
+                     Frames[Depth - 1].Return_Address == Run->Next_PC ) {
+            Depth -= 1;
+         } else {
+            Depth = this->Unwind( Depth, Run->Next_PC );
+         }
+
+         Current = Frames[Depth - 1].Node;
+      }
+
+      if ( Block.Calls ) {
+         if ( Depth == MAX_DEPTH ) {
+            this->Overflow += 1;
+         } else {
+            Current = this->Child_Of( Current, Run->Next_PC );
+            this->Nodes[Current].Calls += 1;
+            Frames[Depth++] = frame{ Current, Block.End_PC() };
+         }
+      }
+   }
+
+   this->Nodes[Current].Self += Self;
+   this->Depth = Depth;
+}
+
+// ----------------------------------------------------------------------------
+
+string call_graph_profile::Name( uint32_t Function ) const {
+   const symbol *Symbol = this->Symbols.find( Function );
+   if ( Symbol != nullptr and Symbol->Address == Function ) {
+      return Symbol->Name;
+   }
+
+   ostringstream Name;
+   if ( Symbol != nullptr ) {
+      util::Print( Name,
+                   "%s+0x%x",
+                   Symbol->Name.c_str(),
+                   Function - Symbol->Address );
+   } else {
+      util::Print( Name, "0x%08x", Function );
+   }
+   return Name.str();
+}
+
+void call_graph_profile::write_folded( ostream &Output ) const {
+   unordered_map<uint32_t, string> Names;
+   for ( const node &Node : this->Nodes ) {
+      if ( Names.find( Node.Function ) == Names.end() ) {
+         Names.emplace( Node.Function, this->Name( Node.Function ) );
+      }
+   }
+
+   vector<uint32_t> Path;
+   for ( uint32_t N = 0; N < this->Nodes.size(); ++N ) {
+      if ( this->Nodes[N].Self == 0 ) {
+         continue;
+      }
+
+      Path.clear();
+      for ( uint32_t P = N; P != 0; P = this->Nodes[P].Parent ) {
+         Path.push_back( P );
+      }
+      Path.push_back( 0 );
+
+      for ( size_t I = Path.size(); I-- > 0; ) {
+         Output << Names[this->Nodes[Path[I]].Function]
+                << ( I == 0 ? " " : ";" );
+      }
+      Output << this->Nodes[N].Self << '\n';
+   }
+}
+
+void call_graph_profile::report( ostream &Output,
+                                 uint64_t Instructions ) const {
+   const auto Percent = [Instructions]( uint64_t Count ) {
+      return ( Instructions == 0
+                 ? 0.0
+                 : 100.0 * double( Count ) / double( Instructions ) );
+   };
+
+   const size_t Num_Nodes = this->Nodes.size();
+
+   // Parents come before their children, so one pass backwards totals each
+   // node's subtree.
+   vector<uint64_t> Inclusive( Num_Nodes );
+   for ( size_t N = Num_Nodes; N-- > 0; ) {
+      Inclusive[N] += this->Nodes[N].Self;
+      if ( N != 0 ) {
+         Inclusive[this->Nodes[N].Parent] += Inclusive[N];
+      }
+   }
+
+   struct function {
+      uint32_t Entry;
+      uint64_t Inclusive;
+      uint64_t Exclusive;
+      uint64_t Calls;
+   };
+
+   vector<function> Functions;
+   unordered_map<uint32_t, size_t> Index;
+   uint64_t Calls = 0;
+
+   for ( size_t N = 0; N < Num_Nodes; ++N ) {
+      const node &Node = this->Nodes[N];
+
+      auto Found = Index.find( Node.Function );
+      if ( Found == Index.end() ) {
+         Found = Index.emplace( Node.Function, Functions.size() ).first;
+         Functions.push_back( function{ Node.Function, 0, 0, 0 } );
+      }
+
+      function &F = Functions[Found->second];
+      F.Exclusive += Node.Self;
+      F.Calls += Node.Calls;
+      Calls += Node.Calls;
+
+      // A recursive call's subtree is already in its outermost caller's.
+      bool Outermost = true;
+      for ( size_t P = N; P != 0 and Outermost; ) {
+         P         = this->Nodes[P].Parent;
+         Outermost = ( this->Nodes[P].Function != Node.Function );
+      }
+      if ( Outermost ) {
+         F.Inclusive += Inclusive[N];
+      }
+   }
+
+   const size_t Shown = min<size_t>( this->Hot_Count, Functions.size() );
+   partial_sort( Functions.begin(),
+                 Functions.begin() + Shown,
+                 Functions.end(),
+                 []( const function &A, const function &B ) {
+                    return ( A.Inclusive != B.Inclusive
+                               ? A.Inclusive > B.Inclusive
+                               : A.Entry < B.Entry );
+                 } );
+
+   ofstream Folded( this->File_Name );
+   this->write_folded( Folded );
+   Folded.close();
+
+   util::Print( Output,
+                "Call graph: %llu calls, %zu functions, %zu call paths%s%s\n",
+                (unsigned long long) Calls,
+                Functions.size(),
+                Num_Nodes,
+                Folded ? ", folded into " : ", couldn't write ",
+                this->File_Name.c_str() );
+   util::Print( Output,
+                "  %14s %7s %14s %7s %10s  function\n",
+                "inclusive",
+                "",
+                "exclusive",
+                "",
+                "calls" );
+   for ( size_t I = 0; I < Shown; ++I ) {
+      const function &F = Functions[I];
+      util::Print( Output,
+                   "  %14llu %6.2f%% %14llu %6.2f%% %10llu  %s\n",
+                   (unsigned long long) F.Inclusive,
+                   Percent( F.Inclusive ),
+                   (unsigned long long) F.Exclusive,
+                   Percent( F.Exclusive ),
+                   (unsigned long long) F.Calls,
+                   this->Name( F.Entry ).c_str() );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+bool sampling_profile::config::parse( const string &Spec, string &Error ) {
+   return util::Parse_Settings(
+     Spec,
+     Error,
+     [this]( const string &Key, const string &Value, string &Why ) {
+        if ( Key == "stacks" and Value.empty() ) {
+           this->Stacks = true;
+           return true;
+        }
+
+        if ( Key == "file" and not Value.empty() ) {
+           this->File_Name = Value;
+           return true;
+        }
+
+        if ( Key == "period" ) {
+           if ( not util::Parse_Size( Value, this->Period ) or
+                this->Period == 0 ) {
+              Why = "bad number for period: \"" + Value + "\"";
+              return false;
+           }
+           return true;
+        }
+
+        Why = "unknown setting " + Key;
+        return false;
+     } );
+}
+
+sampling_profile::sampling_profile( const config &Config,
+                                    const symbol_table &Symbols )
+  : Config( Config ), Countdown( Config.Period ), Symbols( Symbols ) {
+   if ( Config.Stacks ) {
+      this->Calls.reset( new call_graph_profile( Symbols, "" ) );
+   }
+}
+
+void sampling_profile::ran( const block_run *Runs, size_t Count ) {
+   for ( const block_run *Run = Runs; Run != Runs + Count; ++Run ) {
+      this->Countdown -= Run->Retired;
+      if ( this->Countdown <= 0 ) {
+         this->Sample( *Run->Block, Run->Retired );
+      }
+
+      if ( this->Calls ) {
+         this->Calls->ran( Run, 1 );
+      }
+   }
+}
+
+void sampling_profile::Sample( const basic_block &Block, uint32_t Retired ) {
+   // The block went -Countdown instructions past the one to sample, and past
+   // more if it's longer than the period.
+   do {
+      const decoded_instr &Sampled =
+        Block.Instructions[Retired - 1 + this->Countdown];
+      size_t Depth = 0;
+
+      const size_t Start = this->Samples.size();
+      this->Samples.push_back( 0 );
+      this->Samples.push_back( Sampled.PC );
+
+      if ( this->Calls ) {
+         const call_graph_profile::frame *Stack = this->Calls->stack();
+         for ( size_t F = this->Calls->depth(); F-- > 1; ++Depth ) {
+            this->Samples.push_back( Stack[F].Return_Address );
+         }
+      }
+
+      this->Samples[Start] = uint32_t( Depth );
+      this->Num_Samples += 1;
+      this->Countdown += this->Config.Period;
+   } while ( this->Countdown <= 0 );
+}
+
+// ----------------------------------------------------------------------------
+
+void sampling_profile::write_script( ostream &Output ) const {
+   const auto Frame = [this, &Output]( uint32_t PC ) {
+      const symbol *Symbol = this->Symbols.find( PC );
+      if ( Symbol != nullptr ) {
+         util::Print( Output,
+                      "\t%16x %s+0x%x (guest)\n",
+                      PC,
+                      Symbol->Name.c_str(),
+                      PC - Symbol->Address );
+      } else {
+         util::Print( Output, "\t%16x [unknown] (guest)\n", PC );
+      }
+   };
+
+   // There's no clock to speak of, so a sample's time is the instructions
+   // retired before it, in millions.
+   uint64_t Time = 0;
+
+   for ( size_t I = 0; I < this->Samples.size(); ) {
+      const uint32_t Depth = this->Samples[I++];
+      Time += this->Config.Period;
+
+      util::Print( Output,
+                   "rv32sim 1 [000] %llu.%06llu: %u instructions:\n",
+                   (unsigned long long) ( Time / 1000000 ),
+                   (unsigned long long) ( Time % 1000000 ),
+                   this->Config.Period );
+      for ( uint32_t F = 0; F <= Depth; ++F ) {
+         Frame( this->Samples[I++] );
+      }
+      Output << '\n';
+   }
+}
+
+void sampling_profile::report( ostream &Output, uint64_t ) const {
+   ofstream Script( this->Config.File_Name );
+   this->write_script( Script );
+   Script.close();
+
+   util::Print( Output,
+                "Samples: %llu, one every %u instructions%s%s\n",
+                (unsigned long long) this->Num_Samples,
+                this->Config.Period,
+                Script ? ", written to " : ", couldn't write ",
+                this->Config.File_Name.c_str() );
+}
@@ -0,0 +1,262 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Guest profiling
+
+**************************************************************** */
+
+/*
+   Profilers find out where a guest program spends its time, without -v's
+   cost. They're told about each basic block as it finishes running -- how
+   many of its instructions retired, which are always the first so many --
+   rather than each instruction, so a processor without any (the usual case)
+   pays one check per block, and compiled blocks can be profiled too. The
+   processor saves the blocks up and tells its profilers a batch at a time,
+   so one that's running costs a block a few stores rather than a virtual
+   call for each.
+
+   instruction_profile counts how often each kind of instruction, and each
+   instruction, ran. Given to rv32sim as -profile, it reports the mix of
+   instructions and the hottest of them at exit.
+
+   call_graph_profile keeps a shadow of the guest's call stack, from the
+   calls (JAL and JALR linking through ra or t0) and returns (JALR through
+   them) that end blocks, and counts each block's instructions against the
+   chain of calls it ran under: a calling-context tree. Functions are named
+   from a symbol table if it has them, by address if not. Given to rv32sim as
+   -callgraph FILE, it writes the tree as folded stacks ("main;f;g 1234" a
+   line, what flamegraph.pl and speedscope read) and reports each function's
+   inclusive and exclusive counts at exit.
+
+   sampling_profile is for runs too long to want either: every so many
+   instructions it notes the PC, and if asked the return addresses on a
+   call_graph_profile's shadow stack. Between samples it costs a block a
+   subtraction and a branch, plus following calls if it's been asked to.
+   Given to rv32sim as -sample SPEC, it writes the samples out as perf script
+   would, which speedscope and the flame graph scripts read.
+*/
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "block_cache.h"
+#include "symbols.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+/// The first Retired instructions of Block ran to completion, leaving the PC
+/// at Next_PC.
+struct block_run {
+   const basic_block *Block;
+   uint32_t Retired;
+   uint32_t Next_PC;
+};
+
+class profiler {
+public:
+   virtual ~profiler() {}
+
+   /// Count blocks' runs, in the order they ran. The processor hands them
+   /// over before it frees any of the blocks, and before execute() returns.
+   virtual void ran( const block_run *Runs, size_t Count ) = 0;
+
+   /// Describe the run so far, out of Instructions retired in all.
+   virtual void report( ostream &Output, uint64_t Instructions ) const = 0;
+};
+
+// ----------------------------------------------------------------------------
+
+class instruction_profile : public profiler {
+public:
+   /// How many of the hottest instructions report() shows.
+   enum : unsigned { DEFAULT_HOT_COUNT = 20 };
+
+private:
+   /// Counts for a 4 KiB page of code, one for each halfword an instruction
+   /// could start at.
+   struct page_counts {
+      uint64_t Counts[2048] = { 0 };
+      uint32_t Words[2048]  = { 0 }; // The first instruction counted there.
+   };
+
+   /// The same shape as memory's page table: the top 10 bits of an address
+   /// pick a table, the next 10 a page in it.
+   unique_ptr<unique_ptr<page_counts>[]> Tables[1024];
+
+   /// Indexed by instr_id, which is a byte.
+   uint64_t Mix[256] = { 0 };
+
+   unsigned Hot_Count;
+
+   page_counts &Page( uint32_t PC );
+
+public:
+   explicit instruction_profile( unsigned Hot_Count = DEFAULT_HOT_COUNT )
+     : Hot_Count( Hot_Count ) {}
+
+   void ran( const block_run *Runs, size_t Count ) override;
+   void report( ostream &Output, uint64_t Instructions ) const override;
+};
+
+// ----------------------------------------------------------------------------
+
+class call_graph_profile : public profiler {
+public:
+   /// How many functions report() shows.
+   enum : unsigned { DEFAULT_HOT_COUNT = 20 };
+
+   /// Calls deeper than this are counted against the deepest, so runaway
+   /// recursion can't grow the tree without end.
+   enum : uint32_t { MAX_DEPTH = 1024 };
+
+   struct frame {
+      uint32_t Node;
+      uint32_t Return_Address;
+   };
+
+private:
+   /// A function, as called along one path from the first.
+   struct node {
+      uint32_t Function; // Its entry point.
+      uint32_t Parent;
+      uint32_t First_Child  = 0; // Most recently called from here, if not 0.
+      uint32_t Next_Sibling = 0; // The parent's next child, if not 0.
+      uint64_t Self         = 0; // Instructions run in it, not its callees.
+      uint64_t Calls        = 0;
+
+      node( uint32_t Function, uint32_t Parent )
+        : Function( Function ), Parent( Parent ) {}
+   };
+
+   /// Node 0 is the function the run started in, once there's been a block.
+   /// Each node's children are a list through Next_Sibling, kept in the
+   /// order they were last called, so finding the callee is usually one
+   /// step: a loop making the same calls over and over finds each of them
+   /// about as far down as the number of different calls it makes.
+   vector<node> Nodes;
+
+   /// The child found for a few recent callers and callees, so a loop making
+   /// several calls finds each callee straight off, without going down the
+   /// list or reordering it. Child is 0 if there isn't one: node 0 is nobody's
+   /// child.
+   struct recent_call {
+      uint32_t Parent;
+      uint32_t Function;
+      uint32_t Child;
+   };
+
+   enum : uint32_t { RECENT_CALLS = 256 };
+   recent_call Recent_Calls[RECENT_CALLS] = {};
+
+   /// The shadow call stack: the first Depth frames are the calls being
+   /// made. It's made MAX_DEPTH long to start with, so a call is a store
+   /// rather than a push_back(). The top frame's node is the one the
+   /// instructions running count against.
+   vector<frame> Stack;
+   uint32_t Depth = 0;
+
+   /// Calls made past MAX_DEPTH and not yet returned from.
+   uint32_t Overflow = 0;
+
+   const symbol_table &Symbols;
+   string File_Name;
+   unsigned Hot_Count;
+
+   /// The child of Parent for calls to Function, made if there isn't one.
+   /// Child_Of() looks in Recent_Calls, and Find_Child() down the list,
+   /// moving what it finds to the front.
+   uint32_t Child_Of( uint32_t Parent, uint32_t Function );
+   uint32_t Find_Child( uint32_t Parent, uint32_t Function );
+
+   /// How deep the stack is after a return to Return_Address that isn't to
+   /// the innermost caller.
+   uint32_t Unwind( uint32_t Depth, uint32_t Return_Address ) const;
+
+   string Name( uint32_t Function ) const;
+
+public:
+   /// The folded stacks go to File_Name. Symbols is only looked at by
+   /// report(), so it can be filled in after the run starts.
+   call_graph_profile( const symbol_table &Symbols,
+                       const string &File_Name,
+                       unsigned Hot_Count = DEFAULT_HOT_COUNT )
+     : Symbols( Symbols ), File_Name( File_Name ), Hot_Count( Hot_Count ) {}
+
+   void ran( const block_run *Runs, size_t Count ) override;
+   void report( ostream &Output, uint64_t Instructions ) const override;
+
+   /// The folded stacks: each path through the tree with a count of its own,
+   /// outermost function first.
+   void write_folded( ostream &Output ) const;
+
+   /// The calls being made, outermost first, depth() of them. The first
+   /// frame is the function the run started in, and has no return address.
+   const frame *stack( void ) const {
+      return this->Stack.data();
+   }
+
+   uint32_t depth( void ) const {
+      return this->Depth;
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+class sampling_profile : public profiler {
+public:
+   struct config {
+      /// Instructions between samples. Prime, so that loops of a round
+      /// number of instructions aren't always caught at the same point.
+      uint32_t Period = 10007;
+
+      /// Whether to note the shadow call stack with each PC.
+      bool Stacks = false;
+
+      string File_Name = "rv32sim.samples";
+
+      /// Set whichever of the above are given as period=N, stacks and
+      /// file=NAME. False, saying why in Error, if they're wrong.
+      bool parse( const string &Spec, string &Error );
+   };
+
+private:
+   config Config;
+
+   /// Instructions until the next sample, less those retired since the
+   /// block that went past the last one.
+   int64_t Countdown;
+
+   /// Each sample: its number of return addresses, the PC, then those,
+   /// innermost first.
+   vector<uint32_t> Samples;
+   uint64_t Num_Samples = 0;
+
+   /// Following the calls and returns, if Config.Stacks.
+   unique_ptr<call_graph_profile> Calls;
+
+   const symbol_table &Symbols;
+
+   void Sample( const basic_block &Block, uint32_t Retired );
+
+public:
+   /// Symbols is only looked at by report(), as for call_graph_profile.
+   sampling_profile( const config &Config, const symbol_table &Symbols );
+
+   void ran( const block_run *Runs, size_t Count ) override;
+
+   void report( ostream &Output, uint64_t Instructions ) const override;
+
+   /// The samples, in the text perf script prints: a header line for each,
+   /// the PC and return addresses a line each below it, then a blank line.
+   void write_script( ostream &Output ) const;
+};
+
+#endif
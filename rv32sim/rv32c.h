@@ -0,0 +1,257 @@
+#ifndef RV32C_H
+#define RV32C_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   The C extension: 16-bit instructions
+
+**************************************************************** */
+
+/*
+   Every RV32C instruction is a shorter encoding of some RV32I one, so rather
+   than executing them itself, the simulator expands each into the 32-bit
+   instruction it stands for and decodes that. Expansion happens once, when a
+   basic block is built, and the block cache keeps the result -- a compressed
+   instruction costs nothing more to run than the one it expands to.
+
+   The decoded_instr keeps the 16-bit encoding in Word, and has a Length of 2.
+   Its fields, and so everything that executes it, come from the expansion.
+
+   Only the integer subset exists here: C.FLW and friends need F, which isn't
+   implemented, so they're illegal instructions like every reserved encoding.
+*/
+
+#include <cstdint>
+
+#include "rv32i.h"
+
+// ----------------------------------------------------------------------------
+
+/// True if an instruction starting with this halfword (or word) is 16 bits.
+inline bool Is_Compressed( uint32_t Parcel ) {
+   return ( ( Parcel & 0b11 ) != 0b11 );
+}
+
+namespace rvc {
+   /// Bits Hi to Lo of a parcel, shifted down.
+   inline uint32_t Bits( uint32_t Parcel, unsigned Hi, unsigned Lo ) {
+      return ( ( Parcel >> Lo ) & ( ( 1u << ( Hi - Lo + 1 ) ) - 1 ) );
+   }
+
+   /// Bit N of a parcel, moved to bit To.
+   inline uint32_t Bit( uint32_t Parcel, unsigned N, unsigned To ) {
+      return ( ( ( Parcel >> N ) & 1 ) << To );
+   }
+
+   /// The 3-bit register fields name x8 to x15.
+   inline uint32_t Short_Reg( uint32_t Parcel, unsigned Lo ) {
+      return ( 8 + Bits( Parcel, Lo + 2, Lo ) );
+   }
+
+   // The 32-bit encodings the expansions are built from.
+
+   inline uint32_t R_Type( uint32_t F7, uint32_t F3, uint32_t RD,
+                           uint32_t RS1, uint32_t RS2, uint32_t Op ) {
+      return ( F7 << 25 | RS2 << 20 | RS1 << 15 | F3 << 12 | RD << 7 | Op );
+   }
+
+   inline uint32_t I_Type( uint32_t F3, uint32_t RD, uint32_t RS1,
+                           uint32_t Imm, uint32_t Op ) {
+      return ( ( Imm & 0xFFF ) << 20 | RS1 << 15 | F3 << 12 | RD << 7 | Op );
+   }
+
+   inline uint32_t S_Type( uint32_t RS1, uint32_t RS2, uint32_t Imm ) {
+      return ( ( Imm >> 5 & 0x7F ) << 25 | RS2 << 20 | RS1 << 15 | 2 << 12 |
+               ( Imm & 0x1F ) << 7 | 0b0100011 );
+   }
+
+   inline uint32_t B_Type( uint32_t F3, uint32_t RS1, uint32_t Imm ) {
+      return ( ( Imm >> 12 & 1 ) << 31 | ( Imm >> 5 & 0x3F ) << 25 |
+               RS1 << 15 | F3 << 12 | ( Imm >> 1 & 0xF ) << 8 |
+               ( Imm >> 11 & 1 ) << 7 | 0b1100011 );
+   }
+
+   inline uint32_t J_Type( uint32_t RD, uint32_t Imm ) {
+      return ( ( Imm >> 20 & 1 ) << 31 | ( Imm >> 1 & 0x3FF ) << 21 |
+               ( Imm >> 11 & 1 ) << 20 | ( Imm >> 12 & 0xFF ) << 12 |
+               RD << 7 | 0b1101111 );
+   }
+
+   enum : uint32_t {
+      OP_LOAD   = 0b0000011,
+      OP_IMM    = 0b0010011,
+      OP_OP     = 0b0110011,
+      OP_LUI    = 0b0110111,
+      OP_JALR   = 0b1100111,
+      OP_SYSTEM = 0b1110011,
+   };
+
+   /// Reserved and unimplemented encodings expand to this, which isn't a
+   /// valid instruction either.
+   constexpr uint32_t ILLEGAL = 0;
+
+   /// The offset in C.J and C.JAL.
+   inline uint32_t Jump_Offset( uint32_t P ) {
+      return util::Sign_Extend( Bit( P, 12, 11 ) | Bit( P, 11, 4 ) |
+                                  Bits( P, 10, 9 ) << 8 | Bit( P, 8, 10 ) |
+                                  Bit( P, 7, 6 ) | Bit( P, 6, 7 ) |
+                                  Bits( P, 5, 3 ) << 1 | Bit( P, 2, 5 ),
+                                12 );
+   }
+
+   /// The offset in C.BEQZ and C.BNEZ.
+   inline uint32_t Branch_Offset( uint32_t P ) {
+      return util::Sign_Extend( Bit( P, 12, 8 ) | Bits( P, 11, 10 ) << 3 |
+                                  Bits( P, 6, 5 ) << 6 | Bits( P, 4, 3 ) << 1 |
+                                  Bit( P, 2, 5 ),
+                                9 );
+   }
+
+   /// The 6-bit immediate most of quadrant 1 uses: bit 12, then bits 6 to 2.
+   inline uint32_t Imm6( uint32_t P ) {
+      return util::Sign_Extend( Bit( P, 12, 5 ) | Bits( P, 6, 2 ), 6 );
+   }
+
+   /// The word offset in C.LW and C.SW.
+   inline uint32_t Word_Offset( uint32_t P ) {
+      return ( Bits( P, 12, 10 ) << 3 | Bit( P, 6, 2 ) | Bit( P, 5, 6 ) );
+   }
+
+   inline uint32_t Expand_Quadrant_0( uint32_t P ) {
+      const uint32_t Low_Reg = Short_Reg( P, 2 );
+
+      switch ( Bits( P, 15, 13 ) ) {
+         case 0b000: { // C.ADDI4SPN
+            const uint32_t Imm = ( Bits( P, 12, 11 ) << 4 |
+                                   Bits( P, 10, 7 ) << 6 | Bit( P, 6, 2 ) |
+                                   Bit( P, 5, 3 ) );
+            return ( Imm == 0 ? ILLEGAL
+                              : I_Type( 0, Low_Reg, 2, Imm, OP_IMM ) );
+         }
+         case 0b010: // C.LW
+            return I_Type( 2, Low_Reg, Short_Reg( P, 7 ), Word_Offset( P ),
+                           OP_LOAD );
+         case 0b110: // C.SW
+            return S_Type( Short_Reg( P, 7 ), Low_Reg, Word_Offset( P ) );
+         default: return ILLEGAL;
+      }
+   }
+
+   inline uint32_t Expand_Quadrant_1( uint32_t P ) {
+      const uint32_t RD       = Bits( P, 11, 7 );
+      const uint32_t High_Reg = Short_Reg( P, 7 );
+
+      switch ( Bits( P, 15, 13 ) ) {
+         case 0b000: return I_Type( 0, RD, RD, Imm6( P ), OP_IMM ); // C.ADDI
+         case 0b001: return J_Type( 1, Jump_Offset( P ) );         // C.JAL
+         case 0b010: return I_Type( 0, RD, 0, Imm6( P ), OP_IMM ); // C.LI
+         case 0b011: {
+            if ( RD == 2 ) { // C.ADDI16SP
+               const uint32_t Imm = util::Sign_Extend(
+                 Bit( P, 12, 9 ) | Bit( P, 6, 4 ) | Bit( P, 5, 6 ) |
+                   Bits( P, 4, 3 ) << 7 | Bit( P, 2, 5 ),
+                 10 );
+               return ( Imm == 0 ? ILLEGAL : I_Type( 0, 2, 2, Imm, OP_IMM ) );
+            }
+
+            // C.LUI
+            const uint32_t Imm = Imm6( P );
+            return ( Imm == 0 ? ILLEGAL : ( Imm << 12 | RD << 7 | OP_LUI ) );
+         }
+         case 0b100: {
+            switch ( Bits( P, 11, 10 ) ) {
+               case 0b00: // C.SRLI. Shift amounts of 32 or more are RV64.
+                  return ( Bit( P, 12, 0 )
+                             ? ILLEGAL
+                             : I_Type( 5, High_Reg, High_Reg, Bits( P, 6, 2 ),
+                                       OP_IMM ) );
+               case 0b01: // C.SRAI
+                  return ( Bit( P, 12, 0 )
+                             ? ILLEGAL
+                             : I_Type( 5, High_Reg, High_Reg,
+                                       0x400 | Bits( P, 6, 2 ), OP_IMM ) );
+               case 0b10: // C.ANDI
+                  return I_Type( 7, High_Reg, High_Reg, Imm6( P ), OP_IMM );
+               default: break;
+            }
+
+            // C.SUB, C.XOR, C.OR and C.AND. Bit 12 set is C.SUBW and C.ADDW.
+            if ( Bit( P, 12, 0 ) ) {
+               return ILLEGAL;
+            }
+
+            static const uint32_t Funct3[] = { 0b000, 0b100, 0b110, 0b111 };
+            const uint32_t Which           = Bits( P, 6, 5 );
+            return R_Type( ( Which == 0 ? 0b0100000 : 0 ), Funct3[Which],
+                           High_Reg, High_Reg, Short_Reg( P, 2 ), OP_OP );
+         }
+         case 0b101: return J_Type( 0, Jump_Offset( P ) );                // C.J
+         case 0b110: return B_Type( 0, High_Reg, Branch_Offset( P ) ); // C.BEQZ
+         default: return B_Type( 1, High_Reg, Branch_Offset( P ) );    // C.BNEZ
+      }
+   }
+
+   inline uint32_t Expand_Quadrant_2( uint32_t P ) {
+      const uint32_t RD  = Bits( P, 11, 7 );
+      const uint32_t RS2 = Bits( P, 6, 2 );
+
+      switch ( Bits( P, 15, 13 ) ) {
+         case 0b000: // C.SLLI
+            return ( Bit( P, 12, 0 ) ? ILLEGAL
+                                     : I_Type( 1, RD, RD, RS2, OP_IMM ) );
+         case 0b010: { // C.LWSP
+            const uint32_t Imm =
+              ( Bit( P, 12, 5 ) | Bits( P, 6, 4 ) << 2 | Bits( P, 3, 2 ) << 6 );
+            return ( RD == 0 ? ILLEGAL : I_Type( 2, RD, 2, Imm, OP_LOAD ) );
+         }
+         case 0b100: {
+            if ( not Bit( P, 12, 0 ) ) {
+               if ( RS2 != 0 ) { // C.MV
+                  return R_Type( 0, 0, RD, 0, RS2, OP_OP );
+               }
+               // C.JR
+               return ( RD == 0 ? ILLEGAL : I_Type( 0, 0, RD, 0, OP_JALR ) );
+            }
+
+            if ( RS2 != 0 ) { // C.ADD
+               return R_Type( 0, 0, RD, RD, RS2, OP_OP );
+            }
+            if ( RD == 0 ) { // C.EBREAK
+               return I_Type( 0, 0, 0, 1, OP_SYSTEM );
+            }
+            return I_Type( 0, 1, RD, 0, OP_JALR ); // C.JALR
+         }
+         case 0b110: { // C.SWSP
+            const uint32_t Imm =
+              ( Bits( P, 12, 9 ) << 2 | Bits( P, 8, 7 ) << 6 );
+            return S_Type( 2, RS2, Imm );
+         }
+         default: return ILLEGAL;
+      }
+   }
+} // namespace rvc
+
+// ----------------------------------------------------------------------------
+
+/// The 32-bit instruction a 16-bit one stands for. Anything reserved, or not
+/// implemented, expands to an illegal instruction.
+inline uint32_t Expand_Compressed( uint32_t Parcel ) {
+   assert( Is_Compressed( Parcel ) );
+
+   switch ( Parcel & 0b11 ) {
+      case 0b00: return rvc::Expand_Quadrant_0( Parcel );
+      case 0b01: return rvc::Expand_Quadrant_1( Parcel );
+      default: return rvc::Expand_Quadrant_2( Parcel );
+   }
+}
+
+/// Decode_Instruction(), for a 16-bit instruction.
+inline decoded_instr Decode_Compressed( uint32_t Parcel, uint32_t PC ) {
+   decoded_instr D = Decode_Instruction( Expand_Compressed( Parcel ), PC );
+   D.Word          = ( Parcel & 0xFFFF );
+   D.Length        = 2;
+   return D;
+}
+
+#endif
@@ -6,6 +6,8 @@
 #include <cassert>
 #include <cstdint>
 #include <cstdio>
+#include <string>
+#include <tuple>
 
 /*
 
@@ -15,32 +17,28 @@
 
    General structure is that each instruction type (e.g. R type) is given an
    associated struct with bitfield members corresponding to Opcode, RS1, etc.,
-   and an Execute() function which takes a CPU to execute on, and an instruction
-   ID indicating what should be done with the struct's fields.
+   and an Execute() function which takes a CPU to execute on, and a decoded
+   instruction indicating what should be done.
 
    This organisation is a bit more copy-pastey than I'd like... I suppose
    inheritance would clean things up a bit, but I'm not aware of a way to add
    members to an inherited union.
 
    An instruction type (instr, I think it's called) is a union of all the
-   different types, and provides an Execute() which just takes an instruction
-   ID. All these structs/unions should be the same size as a uint32_t, which is
-   enforced by static assertions.
+   different types. All these structs/unions should be the same size as a
+   uint32_t, which is enforced by static assertions.
 
-*/
-
-// -----------------------------------------------------------------------------
+   Instructions are decoded once into a decoded_instr (see block_cache.h),
+   which has the register numbers and sign-extended immediate already pulled
+   out. Execute_Instruction() takes one of those and hands it to the right
+   type's Execute(). The processor keeps runs of them as basic blocks, which
+   end wherever Ends_Basic_Block() says.
 
-/// To make DEBUG_LOG() work.
-static bool Be_Verbose = true;
-
-static void Set_RV32I_Verbosity( bool Verbose ) {
-   Be_Verbose = Verbose;
-}
+*/
 
 // -----------------------------------------------------------------------------
 
-enum instr_id {
+enum instr_id : uint8_t {
    FIRST_INSTR = 0,
    LUI         = 0,
    AUIPC,
@@ -79,6 +77,25 @@ enum instr_id {
    SRA,
    OR,
    AND,
+   MUL,
+   MULH,
+   MULHSU,
+   MULHU,
+   DIV,
+   DIVU,
+   REM,
+   REMU,
+   LR_W,
+   SC_W,
+   AMOSWAP_W,
+   AMOADD_W,
+   AMOXOR_W,
+   AMOAND_W,
+   AMOOR_W,
+   AMOMIN_W,
+   AMOMAX_W,
+   AMOMINU_W,
+   AMOMAXU_W,
    FENCE,
    ECALL,
    EBREAK,
@@ -110,6 +127,7 @@ enum instr_type {
    INSTR_TYPE_U,
    INSTR_TYPE_J,
    INSTR_TYPE_CSR,
+   INSTR_TYPE_A,
    INSTR_TYPE_UNIMPLEMENTED,
    NUM_INSTR_TYPES = INSTR_TYPE_UNIMPLEMENTED
 };
@@ -122,6 +140,7 @@ constexpr uint32_t Instr_Type_Mask[NUM_INSTR_TYPES] = {
   [INSTR_TYPE_U]   = 0b00000000000000000000000001111111, // op
   [INSTR_TYPE_J]   = 0b00000000000000000000000001111111,
   [INSTR_TYPE_CSR] = 0b11111111111100000111000001111111, // funct12, funct3, op
+  [INSTR_TYPE_A]   = 0b11111000000000000111000001111111, // funct5, funct3, op
 };
 
 constexpr instr_type Instr_Type_Mapping[NUM_RV32I_INSTRUCTIONS] = {
@@ -162,6 +181,25 @@ constexpr instr_type Instr_Type_Mapping[NUM_RV32I_INSTRUCTIONS] = {
   [instr_id::SRA]    = INSTR_TYPE_R,
   [instr_id::OR]     = INSTR_TYPE_R,
   [instr_id::AND]    = INSTR_TYPE_R,
+  [instr_id::MUL]    = INSTR_TYPE_R,
+  [instr_id::MULH]   = INSTR_TYPE_R,
+  [instr_id::MULHSU] = INSTR_TYPE_R,
+  [instr_id::MULHU]  = INSTR_TYPE_R,
+  [instr_id::DIV]    = INSTR_TYPE_R,
+  [instr_id::DIVU]   = INSTR_TYPE_R,
+  [instr_id::REM]    = INSTR_TYPE_R,
+  [instr_id::REMU]   = INSTR_TYPE_R,
+  [instr_id::LR_W]      = INSTR_TYPE_A, // A with rs2 = 0
+  [instr_id::SC_W]      = INSTR_TYPE_A,
+  [instr_id::AMOSWAP_W] = INSTR_TYPE_A,
+  [instr_id::AMOADD_W]  = INSTR_TYPE_A,
+  [instr_id::AMOXOR_W]  = INSTR_TYPE_A,
+  [instr_id::AMOAND_W]  = INSTR_TYPE_A,
+  [instr_id::AMOOR_W]   = INSTR_TYPE_A,
+  [instr_id::AMOMIN_W]  = INSTR_TYPE_A,
+  [instr_id::AMOMAX_W]  = INSTR_TYPE_A,
+  [instr_id::AMOMINU_W] = INSTR_TYPE_A,
+  [instr_id::AMOMAXU_W] = INSTR_TYPE_A,
   [instr_id::FENCE]  = INSTR_TYPE_UNIMPLEMENTED,
   [instr_id::ECALL]  = INSTR_TYPE_I,
   [instr_id::EBREAK] = INSTR_TYPE_I,
@@ -175,7 +213,7 @@ constexpr instr_type Instr_Type_Mapping[NUM_RV32I_INSTRUCTIONS] = {
   [instr_id::UNKNOWN_INSTR] = INSTR_TYPE_UNIMPLEMENTED,
 };
 
-const char *Instr_String_Mapping[NUM_RV32I_INSTRUCTIONS] = {
+const char *const Instr_String_Mapping[NUM_RV32I_INSTRUCTIONS] = {
   [instr_id::LUI] = "lui",       [instr_id::AUIPC] = "auipc",
   [instr_id::JAL] = "jal",       [instr_id::JALR] = "jalr",
   [instr_id::BEQ] = "beq",       [instr_id::BNE] = "bne",
@@ -194,7 +232,21 @@ const char *Instr_String_Mapping[NUM_RV32I_INSTRUCTIONS] = {
   [instr_id::SLT] = "slt",       [instr_id::SLTU] = "sltu",
   [instr_id::XOR] = "xor",       [instr_id::SRL] = "srl",
   [instr_id::SRA] = "sra",       [instr_id::OR] = "or",
-  [instr_id::AND] = "and",       [instr_id::FENCE] = "fence",
+  [instr_id::AND] = "and",       [instr_id::MUL] = "mul",
+  [instr_id::MULH] = "mulh",     [instr_id::MULHSU] = "mulhsu",
+  [instr_id::MULHU] = "mulhu",   [instr_id::DIV] = "div",
+  [instr_id::DIVU] = "divu",     [instr_id::REM] = "rem",
+  [instr_id::REMU] = "remu",     [instr_id::LR_W] = "lr.w",
+  [instr_id::SC_W] = "sc.w",     [instr_id::AMOSWAP_W] = "amoswap.w",
+  [instr_id::AMOADD_W] = "amoadd.w",
+  [instr_id::AMOXOR_W] = "amoxor.w",
+  [instr_id::AMOAND_W] = "amoand.w",
+  [instr_id::AMOOR_W] = "amoor.w",
+  [instr_id::AMOMIN_W] = "amomin.w",
+  [instr_id::AMOMAX_W] = "amomax.w",
+  [instr_id::AMOMINU_W] = "amominu.w",
+  [instr_id::AMOMAXU_W] = "amomaxu.w",
+  [instr_id::FENCE] = "fence",
   [instr_id::ECALL] = "ecall",   [instr_id::EBREAK] = "ebreak",
   [instr_id::CSRRW] = "csrrw",   [instr_id::CSRRS] = "csrrs",
   [instr_id::CSRRC] = "csrrc",   [instr_id::CSRRWI] = "csrrwi",
@@ -244,6 +296,26 @@ constexpr uint32_t Unique_Mask[NUM_RV32I_INSTRUCTIONS] = {
    [SRA]    = 0b01000000000000000101000000110011,
    [OR]     = 0b00000000000000000110000000110011,
    [AND]    = 0b00000000000000000111000000110011,
+   [MUL]    = 0b00000010000000000000000000110011,
+   [MULH]   = 0b00000010000000000001000000110011,
+   [MULHSU] = 0b00000010000000000010000000110011,
+   [MULHU]  = 0b00000010000000000011000000110011,
+   [DIV]    = 0b00000010000000000100000000110011,
+   [DIVU]   = 0b00000010000000000101000000110011,
+   [REM]    = 0b00000010000000000110000000110011,
+   [REMU]   = 0b00000010000000000111000000110011,
+   //        funct5            funct3      opcode
+   [LR_W]      = 0b00010000000000000010000000101111,
+   [SC_W]      = 0b00011000000000000010000000101111,
+   [AMOSWAP_W] = 0b00001000000000000010000000101111,
+   [AMOADD_W]  = 0b00000000000000000010000000101111,
+   [AMOXOR_W]  = 0b00100000000000000010000000101111,
+   [AMOAND_W]  = 0b01100000000000000010000000101111,
+   [AMOOR_W]   = 0b01000000000000000010000000101111,
+   [AMOMIN_W]  = 0b10000000000000000010000000101111,
+   [AMOMAX_W]  = 0b10100000000000000010000000101111,
+   [AMOMINU_W] = 0b11000000000000000010000000101111,
+   [AMOMAXU_W] = 0b11100000000000000010000000101111,
    [FENCE]  = 0b00000000000000000000000000001111,
    // NOTE: ECALL and EBREAK will *only ever* be these exact numbers. There are
    // no fields. So these aren't like the others -- just check for equality. 
@@ -275,18 +347,24 @@ struct r_type {
    unsigned RS2 : 5;    // 24..20
    unsigned Funct7 : 7; // 31..25
 
-   execution_result Execute( processor *CPU, instr_id ID ) const {
+   /// The one signed division whose quotient doesn't fit in 32 bits.
+   static constexpr bool Is_Division_Overflow( uint32_t A, uint32_t B ) {
+      return ( A == 0x80000000 and B == UINT32_MAX );
+   }
+
+   template <bool Verbose, bool Stage2>
+   static execution_result Execute( processor *CPU, const decoded_instr &D ) {
       assert( CPU );
-      assert( ID != UNKNOWN_INSTR );
-      assert( Instr_Type_Mapping[ID] == INSTR_TYPE_R );
+      assert( D.ID != UNKNOWN_INSTR );
+      assert( Instr_Type_Mapping[D.ID] == INSTR_TYPE_R );
 
-      const uint32_t A       = CPU->get_reg( RS1 );
-      const uint32_t B       = CPU->get_reg( RS2 );
+      const uint32_t A       = CPU->get_reg( D.RS1 );
+      const uint32_t B       = CPU->get_reg( D.RS2 );
       const int32_t A_Signed = int32_t( A );
       const int32_t B_Signed = int32_t( B );
       uint32_t Result        = 0;
 
-      switch ( ID ) {
+      switch ( D.ID ) {
          case instr_id::ADD: Result = A + B; break;
          case instr_id::SUB: Result = A - B; break;
          case instr_id::XOR: Result = A ^ B; break;
@@ -297,14 +375,43 @@ struct r_type {
          case instr_id::SLL: Result = A << ( B & 0b11111 ); break;
          case instr_id::SRL: Result = A >> ( B & 0b11111 ); break;
          case instr_id::SRA: Result = A_Signed >> ( B & 0b11111 ); break;
+         // M extension. The high halves come from the full 64-bit product.
+         case instr_id::MUL: Result = A * B; break;
+         case instr_id::MULH:
+            Result = uint32_t( ( int64_t( A_Signed ) * B_Signed ) >> 32 );
+            break;
+         case instr_id::MULHSU:
+            Result = uint32_t( ( int64_t( A_Signed ) * int64_t( B ) ) >> 32 );
+            break;
+         case instr_id::MULHU:
+            Result = uint32_t( ( uint64_t( A ) * B ) >> 32 );
+            break;
+         // Division never traps: dividing by zero gives all ones (quotient)
+         // or the dividend (remainder), and INT32_MIN / -1 overflows back to
+         // INT32_MIN with a remainder of 0. C++ leaves both undefined, so
+         // they're done by hand.
+         case instr_id::DIV:
+            Result = ( B == 0                        ? UINT32_MAX
+                       : Is_Division_Overflow( A, B ) ? A
+                                                     : uint32_t( A_Signed /
+                                                                 B_Signed ) );
+            break;
+         case instr_id::DIVU: Result = ( B == 0 ? UINT32_MAX : A / B ); break;
+         case instr_id::REM:
+            Result = ( B == 0                        ? A
+                       : Is_Division_Overflow( A, B ) ? 0
+                                                     : uint32_t( A_Signed %
+                                                                 B_Signed ) );
+            break;
+         case instr_id::REMU: Result = ( B == 0 ? A : A % B ); break;
          // These ones use RS2 as shift amount, rather than a register number.
-         case instr_id::SLLI: Result = A << ( RS2 ); break;
-         case instr_id::SRLI: Result = A >> ( RS2 ); break;
-         case instr_id::SRAI: Result = A_Signed >> ( RS2 ); break;
+         case instr_id::SLLI: Result = A << ( D.RS2 ); break;
+         case instr_id::SRLI: Result = A >> ( D.RS2 ); break;
+         case instr_id::SRAI: Result = A_Signed >> ( D.RS2 ); break;
          default: assert( util::Unreachable );
       }
 
-      CPU->set_reg( RD, Result );
+      CPU->set_reg<Verbose>( D.RD, Result );
 
       return Successful_Execution;
    }
@@ -323,16 +430,19 @@ struct i_type {
       return Immediate_11_To_0;
    }
 
-   execution_result Execute( processor *CPU, instr_id ID ) const {
+   template <bool Verbose, bool Stage2>
+   static execution_result Execute( processor *CPU, const decoded_instr &D ) {
+      constexpr bool Be_Verbose = Verbose; // For DEBUG_LOG().
       assert( CPU );
-      assert( Instr_Type_Mapping[ID] == INSTR_TYPE_I );
+      assert( Instr_Type_Mapping[D.ID] == INSTR_TYPE_I );
 
-      const uint32_t A         = CPU->get_reg( RS1 );
+      const instr_id ID        = D.ID;
+      const uint32_t A         = CPU->get_reg( D.RS1 );
       const int32_t A_Signed   = int32_t( A );
-      const uint32_t Imm       = util::Sign_Extend( Immediate_11_To_0, 12 );
+      const uint32_t Imm       = D.Imm;
       const int32_t Imm_Signed = int32_t( Imm );
 
-      const auto Load_Address = ( Imm + CPU->get_reg( RS1 ) );
+      const auto Load_Address = ( Imm + A );
 
       constexpr uint32_t Default_Result = 0xfeedbeef;
       uint32_t Result                   = Default_Result;
@@ -380,48 +490,29 @@ struct i_type {
             */
 
          case instr_id::LB: {
-            Result            = CPU->Main_Memory->read_word( Load_Address );
-            const auto Offset = ( Load_Address % 4 );
-            const auto Mask   = 0xFF << ( 8 * Offset );
-            Result            = ( Result & Mask );
-            Result >>= ( 8 * Offset );
+            Result = CPU->Main_Memory->load8( Load_Address );
             Result = util::Sign_Extend( Result, 8 );
             break;
          }
 
          case instr_id::LH: {
-            Result            = CPU->Main_Memory->read_word( Load_Address );
-            const auto Offset = ( Load_Address % 4 );
-            const auto Mask   = 0xFFFF << ( 8 * Offset );
-            Result            = ( Result & Mask );
-            Result >>= ( 8 * Offset );
+            Result = CPU->Main_Memory->load16( Load_Address );
             Result = util::Sign_Extend( Result, 16 );
             break;
          }
 
          case instr_id::LW: {
-            Result = CPU->Main_Memory->read_word( Load_Address );
-            Result = util::Sign_Extend( Result, 32 );
+            Result = CPU->Main_Memory->load32( Load_Address );
             break;
          }
 
          case instr_id::LBU: {
-            Result            = CPU->Main_Memory->read_word( Load_Address );
-            const auto Offset = ( Load_Address % 4 );
-            const auto Mask   = 0xFF << ( 8 * Offset );
-            Result            = ( Result & Mask );
-            Result >>= ( 8 * Offset );
-            Result = util::Zero_Extend( Result, 8 );
+            Result = CPU->Main_Memory->load8( Load_Address );
             break;
          }
 
          case instr_id::LHU: {
-            Result            = CPU->Main_Memory->read_word( Load_Address );
-            const auto Offset = ( Load_Address % 4 );
-            const auto Mask   = 0xFFFF << ( 8 * Offset );
-            Result            = ( Result & Mask );
-            Result >>= ( 8 * Offset );
-            Result = util::Zero_Extend( Result, 16 );
+            Result = CPU->Main_Memory->load16( Load_Address );
             break;
          }
 
@@ -441,7 +532,7 @@ struct i_type {
 
             */
 
-            auto Jump_Target = ( CPU->get_reg( RS1 ) + Imm - 4 );
+            auto Jump_Target = ( A + Imm );
             Jump_Target      = util::Set_Bit( Jump_Target, 1, 0 );
 
             DEBUG_LOG( "JALR jumping to %08x", Jump_Target );
@@ -450,14 +541,14 @@ struct i_type {
                DEBUG_LOG( RED( "Jump target isn't word aligned!" ) );
             }
 
-            Result = ( CPU->get_pc() + 4 );
-            CPU->set_pc( Jump_Target );
+            Result = ( D.PC + D.Length );
+            CPU->set_pc<Verbose>( Jump_Target );
             break;
          }
 
          case instr_id::ECALL: {
-            if ( not CPU->Stage2 ) {
-               puts( "ecall: not implemented" );
+            if ( not Stage2 ) {
+               CPU->print( "ecall: not implemented\n" );
                return Successful_Execution;
             }
 
@@ -467,8 +558,8 @@ struct i_type {
          }
 
          case instr_id::EBREAK: {
-            if ( not CPU->Stage2 ) {
-               puts( "ebreak: not implemented" );
+            if ( not Stage2 ) {
+               CPU->print( "ebreak: not implemented\n" );
                return Successful_Execution;
             }
 
@@ -487,7 +578,7 @@ struct i_type {
          DEBUG_LOG( RED( "This had better be a freak occurrence!" ) );
       }
 
-      CPU->set_reg( RD, Result );
+      CPU->set_reg<Verbose>( D.RD, Result );
 
       return Successful_Execution;
    }
@@ -507,9 +598,13 @@ struct s_type {
       return ( Immediate_11_To_5 << 5 | Immediate_4_To_0 << 0 );
    }
 
-   execution_result Execute( processor *CPU, instr_id ID ) const {
+   template <bool Verbose, bool Stage2>
+   static execution_result Execute( processor *CPU, const decoded_instr &D ) {
+      constexpr bool Be_Verbose = Verbose; // For DEBUG_LOG().
       assert( CPU );
-      assert( Instr_Type_Mapping[ID] == INSTR_TYPE_S );
+      assert( Instr_Type_Mapping[D.ID] == INSTR_TYPE_S );
+
+      const instr_id ID = D.ID;
 
       /*
          Per the spec, page 21:
@@ -523,14 +618,12 @@ struct s_type {
          ----
 
          Note: "Effective byte address". This means the byte address doesn't
-         have to be word-aligned, and we should extract the corresponding byte,
-         not just the least-significant byte in the given word.
+         have to be word-aligned, and we should store to the corresponding
+         byte, not just the least-significant byte in the given word.
       */
 
-      const uint32_t Imm = util::Sign_Extend( Decipher_Immediate(), 12 );
-
-      const uint32_t Address = ( CPU->get_reg( this->RS1 ) + Imm );
-      uint32_t Data          = ( CPU->get_reg( this->RS2 ) );
+      const uint32_t Address = ( CPU->get_reg( D.RS1 ) + D.Imm );
+      const uint32_t Data    = ( CPU->get_reg( D.RS2 ) );
 
       // Stage 2:
       if ( ( ( ID == instr_id::SW ) and ( Address % 4 != 0 ) ) or
@@ -541,21 +634,15 @@ struct s_type {
 
       switch ( ID ) {
          case instr_id::SB: {
-            const auto Byte_Offset = ( 8 * ( Address % 4 ) );
-            const auto Mask        = 0xFF << Byte_Offset;
-            Data                   = ( Data & 0xFF ) << Byte_Offset;
-            CPU->Main_Memory->write_word( Address, Data, Mask );
+            CPU->Main_Memory->store8( Address, uint8_t( Data ) );
             break;
          }
          case instr_id::SH: {
-            const auto Byte_Offset = ( 8 * ( Address % 4 ) );
-            const auto Mask        = 0xFFFF << Byte_Offset;
-            Data                   = ( Data & 0xFFFF ) << Byte_Offset;
-            CPU->Main_Memory->write_word( Address, Data, Mask );
+            CPU->Main_Memory->store16( Address, uint16_t( Data ) );
             break;
          }
          case instr_id::SW: {
-            CPU->Main_Memory->write_word( Address, Data, 0xFFFFFFFF );
+            CPU->Main_Memory->store32( Address, Data );
             break;
          }
          default: assert( util::Unreachable );
@@ -586,9 +673,11 @@ struct b_type {
                Immediate_10_To_5 << 4 | Immediate_4_To_1 << 0 );
    }
 
-   execution_result Execute( processor *CPU, instr_id ID ) const {
+   template <bool Verbose, bool Stage2>
+   static execution_result Execute( processor *CPU, const decoded_instr &D ) {
+      constexpr bool Be_Verbose = Verbose; // For DEBUG_LOG().
       assert( CPU );
-      assert( Instr_Type_Mapping[ID] == INSTR_TYPE_B );
+      assert( Instr_Type_Mapping[D.ID] == INSTR_TYPE_B );
 
       /*
          Per the spec, page 19:
@@ -600,25 +689,22 @@ struct b_type {
          ----
       */
 
-      const uint32_t Offset = 2 * util::Sign_Extend( Decipher_Immediate(), 12 );
-
-      const uint32_t Branch_Target = ( CPU->get_pc() + Offset - 4 );
-      // Subtract 4 from Branch_Target to account for processor::execute()
-      // adding 4 every time an instruction is executed. Hacky, but it'll do.
+      const uint32_t Branch_Target = ( D.PC + D.Imm );
 
-      // We're just setting PC here, and not adding +4. The textbook diagrams
-      // had a branch control line fed into a multiplexor to either set PC =
-      // PC+4 or a branch target. So we're *not* adding 4 here, we're just
-      // setting PC. Which I'm pretty sure is correct.
+      // The PC already points at the next instruction (see
+      // processor::Execute_Blocks()), so a branch not taken leaves it alone.
+      // The textbook diagrams have a branch control line feeding a
+      // multiplexor that picks either PC+4 or the branch target, and this is
+      // that multiplexor.
 
-      const int32_t A   = CPU->get_reg( this->RS1 );
-      const int32_t B   = CPU->get_reg( this->RS2 );
+      const int32_t A   = CPU->get_reg( D.RS1 );
+      const int32_t B   = CPU->get_reg( D.RS2 );
       const uint32_t AU = uint32_t( A );
       const uint32_t BU = uint32_t( B );
 
       bool Should_Branch = false;
 
-      switch ( ID ) {
+      switch ( D.ID ) {
          case instr_id::BEQ: Should_Branch = ( A == B ); break;
          case instr_id::BNE: Should_Branch = ( A != B ); break;
          case instr_id::BLT: Should_Branch = ( A < B ); break;
@@ -630,7 +716,7 @@ struct b_type {
 
       if ( Should_Branch ) {
          DEBUG_LOG( GREEN( "Taking branch." ) );
-         CPU->set_pc( Branch_Target );
+         CPU->set_pc<Verbose>( Branch_Target );
       } else {
          DEBUG_LOG( YELLOW( "NOT taking branch." ) );
       }
@@ -662,9 +748,10 @@ struct u_type {
       return Immediate_31_To_12;
    }
 
-   execution_result Execute( processor *CPU, instr_id ID ) const {
+   template <bool Verbose, bool Stage2>
+   static execution_result Execute( processor *CPU, const decoded_instr &D ) {
       assert( CPU );
-      assert( Instr_Type_Mapping[ID] == INSTR_TYPE_U );
+      assert( Instr_Type_Mapping[D.ID] == INSTR_TYPE_U );
 
       /*
          Per the spec, page 16:
@@ -684,14 +771,11 @@ struct u_type {
 
       */
 
-      uint32_t Imm = ( Immediate_31_To_12 << 12 );
+      const uint32_t Imm = D.Imm;
 
-      assert( util::Get_Bit( Imm, 32 ) ==
-              util::Get_Bit( Immediate_31_To_12, 20 ) );
-
-      switch ( ID ) {
-         case instr_id::LUI: CPU->set_reg( RD, Imm ); break;
-         case instr_id::AUIPC: CPU->set_reg( RD, Imm + CPU->get_pc() ); break;
+      switch ( D.ID ) {
+         case instr_id::LUI: CPU->set_reg<Verbose>( D.RD, Imm ); break;
+         case instr_id::AUIPC: CPU->set_reg<Verbose>( D.RD, Imm + D.PC ); break;
          default: assert( util::Unreachable );
       }
 
@@ -754,10 +838,11 @@ struct j_type {
       return ( 0 | Bit_20 | Bit_19_To_12 | Bit_11 | Bit_10_To_1 );
    }
 
-   execution_result Execute( processor *CPU, instr_id ID ) const {
+   template <bool Verbose, bool Stage2>
+   static execution_result Execute( processor *CPU, const decoded_instr &D ) {
       assert( CPU );
-      assert( Instr_Type_Mapping[ID] == INSTR_TYPE_J );
-      assert( ID == instr_id::JAL );
+      assert( Instr_Type_Mapping[D.ID] == INSTR_TYPE_J );
+      assert( D.ID == instr_id::JAL );
 
       /*
 
@@ -774,13 +859,8 @@ struct j_type {
          So this instruction is guaranteed to be JAL.
       */
 
-      const uint32_t Imm =
-        ( util::Sign_Extend( 2 * this->Decipher_Immediate(), 20 ) );
-
-      CPU->set_reg( this->RD, CPU->get_pc() + 4 );
-      CPU->set_pc( CPU->get_pc() + Imm - 4 );
-      // Subtract 4 to account for processor::execute() adding 4 when it
-      // executes an instruction.
+      CPU->set_reg<Verbose>( D.RD, D.PC + D.Length );
+      CPU->set_pc<Verbose>( D.PC + D.Imm );
 
       return Successful_Execution;
    }
@@ -795,12 +875,18 @@ struct csr_type {
    unsigned RS1 : 5;
    unsigned CSR : 12;
 
-   execution_result Execute( processor *CPU, instr_id ID ) const {
+   template <bool Verbose, bool Stage2>
+   static execution_result Execute( processor *CPU, const decoded_instr &D ) {
+      constexpr bool Be_Verbose = Verbose; // For DEBUG_LOG().
       assert( CPU );
-      assert( Instr_Type_Mapping[ID] == INSTR_TYPE_CSR );
-      // TODO: csr_type::Execute().
+      assert( Instr_Type_Mapping[D.ID] == INSTR_TYPE_CSR );
 
-      if ( not CPU->Stage2 ) {
+      const instr_id ID  = D.ID;
+      const unsigned CSR = D.Imm;
+      const unsigned RD  = D.RD;
+      const unsigned RS1 = D.RS1;
+
+      if ( not Stage2 ) {
          return Successful_Execution; // @Required for stage 1
       }
 
@@ -824,14 +910,14 @@ struct csr_type {
 
             if ( RD != 0 ) {
                // Only read the CSR if RD isn't x0
-               uint32_t Old_CSR = CPU->get_csr( this->CSR );
+               uint32_t Old_CSR = CPU->get_csr( CSR );
                Old_CSR          = util::Zero_Extend( Old_CSR, 32 );
-               CPU->set_reg( this->RD, Old_CSR );
+               CPU->set_reg<Verbose>( RD, Old_CSR );
             }
 
-            CPU->set_csr( this->CSR,
-                          ( ID == CSRRWI ? util::Zero_Extend( this->RS1, 32 )
-                                         : CPU->get_reg( this->RS1 ) ) );
+            CPU->set_csr( CSR,
+                          ( ID == CSRRWI ? util::Zero_Extend( RS1, 32 )
+                                         : CPU->get_reg( RS1 ) ) );
             break;
          }
 
@@ -841,17 +927,17 @@ struct csr_type {
                return execution_result::EXC_ILLEGAL_INSTRUCTION;
             }
 
-            uint32_t Old_CSR = CPU->get_csr( this->CSR );
+            uint32_t Old_CSR = CPU->get_csr( CSR );
             Old_CSR          = util::Zero_Extend( Old_CSR, 32 );
 
             const uint32_t Mask =
-              ( ID == CSRRSI ? util::Zero_Extend( this->RS1, 32 )
-                             : CPU->get_reg( this->RS1 ) );
+              ( ID == CSRRSI ? util::Zero_Extend( RS1, 32 )
+                             : CPU->get_reg( RS1 ) );
 
-            CPU->set_reg( this->RD, Old_CSR );
+            CPU->set_reg<Verbose>( RD, Old_CSR );
 
-            if ( this->RS1 != 0 ) {
-               CPU->set_csr( this->CSR, Old_CSR | Mask, from_instr( true ) );
+            if ( RS1 != 0 ) {
+               CPU->set_csr( CSR, Old_CSR | Mask, from_instr( true ) );
             }
             break;
          }
@@ -862,17 +948,17 @@ struct csr_type {
                return execution_result::EXC_ILLEGAL_INSTRUCTION;
             }
 
-            uint32_t Old_CSR = CPU->get_csr( this->CSR );
+            uint32_t Old_CSR = CPU->get_csr( CSR );
             Old_CSR          = util::Zero_Extend( Old_CSR, 32 );
 
             const uint32_t Mask =
-              ( ID == CSRRCI ? util::Zero_Extend( this->RS1, 32 )
-                             : CPU->get_reg( this->RS1 ) );
+              ( ID == CSRRCI ? util::Zero_Extend( RS1, 32 )
+                             : CPU->get_reg( RS1 ) );
 
-            CPU->set_reg( this->RD, Old_CSR );
+            CPU->set_reg<Verbose>( RD, Old_CSR );
 
-            if ( this->RS1 != 0 ) {
-               CPU->set_csr( this->CSR, Old_CSR & ~Mask );
+            if ( RS1 != 0 ) {
+               CPU->set_csr( CSR, Old_CSR & ~Mask );
             }
             break;
          }
@@ -884,7 +970,7 @@ struct csr_type {
             }
 
             DEBUG_LOG( "MRET instruction. Setting PC to MEPC." );
-            CPU->set_pc( CPU->get_csr( CSR_MEPC ) - 4 );
+            CPU->set_pc<Verbose>( CPU->get_csr( CSR_MEPC ) );
 
             /*
                From the spec, with x substituted for M:
@@ -895,12 +981,12 @@ struct csr_type {
              */
 
             DEBUG_LOG( "MRET popping privelige stack." );
-            csr CSR         = CPU->get_csr( CSR_MSTATUS );
-            CSR.MSTATUS.MIE = CSR.MSTATUS.MPIE;
-            CPU->set_prv( CSR.MSTATUS.MPP );
-            CSR.MSTATUS.MPIE = 1;
-            CSR.MSTATUS.MPP  = PRIV_USER;
-            CPU->set_csr( CSR_MSTATUS, CSR );
+            csr Mstatus         = CPU->get_csr( CSR_MSTATUS );
+            Mstatus.MSTATUS.MIE = Mstatus.MSTATUS.MPIE;
+            CPU->set_prv( Mstatus.MSTATUS.MPP );
+            Mstatus.MSTATUS.MPIE = 1;
+            Mstatus.MSTATUS.MPP  = PRIV_USER;
+            CPU->set_csr( CSR_MSTATUS, Mstatus );
             break;
          }
          default: assert( util::Unreachable );
@@ -912,6 +998,135 @@ struct csr_type {
 
 // ----------------------------------------------------------------------------
 
+/*
+   The A extension. Guest memory is shared between harts on different host
+   threads (see harts.h), so these are done with host atomics straight on the
+   page holding the word. Every one is sequentially consistent, which is at
+   least as strong as any combination of the aq and rl bits asks for, so they
+   aren't looked at.
+
+   LR.W remembers the address and the value it loaded. SC.W succeeds if that
+   reservation is still held and the word still holds that value, checked and
+   stored in one compare-and-swap. A store of the same value in between (the
+   "ABA" case) goes unnoticed, which the spec allows, since it can't be told
+   apart from the SC.W happening first.
+*/
+struct a_type {
+   unsigned Opcode : 7; // 06..00
+   unsigned RD : 5;     // 11..07
+   unsigned Funct3 : 3; // 14..12
+   unsigned RS1 : 5;    // 19..15
+   unsigned RS2 : 5;    // 24..20
+   unsigned RL : 1;     // 25
+   unsigned AQ : 1;     // 26
+   unsigned Funct5 : 5; // 31..27
+
+   /// Atomically replace the word with Pick(old value, B), and return the old
+   /// value. For the AMOs the host has no single instruction for.
+   template <typename Pick>
+   static uint32_t Fetch_And_Pick( uint32_t *Word, uint32_t B, Pick P ) {
+      uint32_t Old = __atomic_load_n( Word, __ATOMIC_RELAXED );
+      while ( not __atomic_compare_exchange_n(
+        Word, &Old, P( Old, B ), true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) ) {
+      }
+      return Old;
+   }
+
+   template <bool Verbose, bool Stage2>
+   static execution_result Execute( processor *CPU, const decoded_instr &D ) {
+      constexpr bool Be_Verbose = Verbose; // For DEBUG_LOG().
+      assert( CPU );
+      assert( Instr_Type_Mapping[D.ID] == INSTR_TYPE_A );
+
+      const instr_id ID      = D.ID;
+      const uint32_t Address = CPU->get_reg( D.RS1 );
+      const uint32_t B       = CPU->get_reg( D.RS2 );
+      memory *const Memory   = CPU->Main_Memory;
+
+      if ( Address % 4 != 0 ) {
+         DEBUG_LOG( "Misaligned atomic access to address %08x", Address );
+         return ( ID == LR_W ? execution_result::EXC_LOAD_ADDRESS_MISALIGNED
+                             : execution_result::EXC_STORE_ADDRESS_MISALIGNED );
+      }
+
+      if ( ID == LR_W ) {
+         const uint32_t Value = __atomic_load_n(
+           Memory->word_for_reading( Address ), __ATOMIC_SEQ_CST );
+         CPU->set_reservation( Address, Value );
+         CPU->set_reg<Verbose>( D.RD, Value );
+         return Successful_Execution;
+      }
+
+      if ( ID == SC_W ) {
+         uint32_t Expected;
+         bool Stored = false;
+         if ( CPU->take_reservation( Address, Expected ) ) {
+            Memory->update_word( Address, [&]( uint32_t *Word ) {
+               Stored = __atomic_compare_exchange_n( Word,
+                                                     &Expected,
+                                                     B,
+                                                     false,
+                                                     __ATOMIC_SEQ_CST,
+                                                     __ATOMIC_SEQ_CST );
+            } );
+         }
+         DEBUG_LOG( "SC.W to %08x %s", Address, Stored ? "stored" : "failed" );
+         CPU->set_reg<Verbose>( D.RD, Stored ? 0 : 1 );
+         return Successful_Execution;
+      }
+
+      uint32_t Old = 0;
+
+      Memory->update_word( Address, [&]( uint32_t *Word ) {
+         switch ( ID ) {
+            case AMOSWAP_W:
+               Old = __atomic_exchange_n( Word, B, __ATOMIC_SEQ_CST );
+               break;
+            case AMOADD_W:
+               Old = __atomic_fetch_add( Word, B, __ATOMIC_SEQ_CST );
+               break;
+            case AMOXOR_W:
+               Old = __atomic_fetch_xor( Word, B, __ATOMIC_SEQ_CST );
+               break;
+            case AMOAND_W:
+               Old = __atomic_fetch_and( Word, B, __ATOMIC_SEQ_CST );
+               break;
+            case AMOOR_W:
+               Old = __atomic_fetch_or( Word, B, __ATOMIC_SEQ_CST );
+               break;
+            case AMOMIN_W:
+               Old = Fetch_And_Pick( Word, B, []( uint32_t X, uint32_t Y ) {
+                  return ( int32_t( X ) < int32_t( Y ) ? X : Y );
+               } );
+               break;
+            case AMOMAX_W:
+               Old = Fetch_And_Pick( Word, B, []( uint32_t X, uint32_t Y ) {
+                  return ( int32_t( X ) > int32_t( Y ) ? X : Y );
+               } );
+               break;
+            case AMOMINU_W:
+               Old = Fetch_And_Pick( Word, B, []( uint32_t X, uint32_t Y ) {
+                  return ( X < Y ? X : Y );
+               } );
+               break;
+            case AMOMAXU_W:
+               Old = Fetch_And_Pick( Word, B, []( uint32_t X, uint32_t Y ) {
+                  return ( X > Y ? X : Y );
+               } );
+               break;
+            default: assert( util::Unreachable );
+         }
+      } );
+
+      DEBUG_LOG( "%s at %08x: was %08x", Instr_String_Mapping[ID], Address, Old );
+      CPU->set_reg<Verbose>( D.RD, Old );
+
+      return Successful_Execution;
+   }
+};
+
+// ----------------------------------------------------------------------------
+
 struct instr {
    union {
       uint32_t As_Integer;
@@ -922,6 +1137,7 @@ struct instr {
       u_type U_Type;
       j_type J_Type;
       csr_type CSR_Type;
+      a_type A_Type;
    };
 
    instr()
@@ -935,51 +1151,6 @@ struct instr {
    operator uint32_t() {
       return As_Integer;
    }
-
-   execution_result Execute( processor *CPU, instr_id ID ) const {
-      assert( CPU );
-
-      switch ( Instr_Type_Mapping[ID] ) {
-         case INSTR_TYPE_R: return this->R_Type.Execute( CPU, ID );
-         case INSTR_TYPE_I: return this->I_Type.Execute( CPU, ID );
-         case INSTR_TYPE_S: return this->S_Type.Execute( CPU, ID );
-         case INSTR_TYPE_B: return this->B_Type.Execute( CPU, ID );
-         case INSTR_TYPE_U: return this->U_Type.Execute( CPU, ID );
-         case INSTR_TYPE_J: return this->J_Type.Execute( CPU, ID );
-
-         case INSTR_TYPE_CSR: {
-            if ( not CPU->Stage2 ) {
-               puts( "Error: illegal instruction" );
-               DEBUG_LOG(
-                 BLUE( "(This is a CSR instruction. "
-                       "It's illegal because Stage2 isn't enabled.)" ) );
-               break;
-            }
-
-            return this->CSR_Type.Execute( CPU, ID );
-         }
-
-         default: {
-            if ( ID == FENCE ) {
-               // @Required: Do nothing.
-               DEBUG_LOG( "Fence instruction. Do nothing." );
-               return Successful_Execution;
-            }
-
-            if ( CPU->Stage2 ) {
-               return execution_result::EXC_ILLEGAL_INSTRUCTION;
-            } else {
-               // @Required
-               puts( "Error: illegal instruction" );
-               DEBUG_LOG( "Illegal (unknown) instruction, but not crashing." );
-               return Successful_Execution;
-            }
-         }
-      }
-
-      assert( util::Unreachable );
-      return Successful_Execution;
-   }
 };
 
 static_assert( sizeof( r_type ) == sizeof( uint32_t ), "r_type is busted." );
@@ -990,110 +1161,459 @@ static_assert( sizeof( u_type ) == sizeof( uint32_t ), "u_type is busted." );
 static_assert( sizeof( j_type ) == sizeof( uint32_t ), "j_type is busted." );
 static_assert( sizeof( csr_type ) == sizeof( uint32_t ),
                "csr_type is busted." );
+static_assert( sizeof( a_type ) == sizeof( uint32_t ), "a_type is busted." );
 static_assert( sizeof( instr ) == sizeof( uint32_t ), "instr  is busted." );
 
 // ----------------------------------------------------------------------------
 
-inline instr_id Determine_Instruction_ID( uint32_t Integer ) {
-   for ( int I = FIRST_INSTR; I <= LAST_INSTR; ++I ) {
-      const auto ID   = instr_id( I );
-      const auto Type = Instr_Type_Mapping[ID];
-
-      if ( Type == INSTR_TYPE_UNIMPLEMENTED ) {
-         break;
-      }
-
-      // Zero out the unimportant fields
-      const auto Masked = ( Integer & Instr_Type_Mask[size_t( Type )] );
+/*
+   Decoding.
+
+   This used to be a loop over every entry in Unique_Mask, then a handful of
+   special cases. Now it's a table lookup: the opcode and funct3 pick an entry
+   in Primary_Decode_Table, which is either the answer, or says to look at
+   funct7 (R-type arithmetic and the immediate shifts), funct5 (the A
+   extension) or the whole funct12 field (ECALL, EBREAK and MRET).
+
+   The tables are built at compile time by running the old search over every
+   opcode/funct3/funct7 combination, so Unique_Mask and friends above are still
+   the single source of truth. This is C++11, so everything constexpr here has
+   to be a single return statement. Hence the recursion and the ternaries.
+*/
 
-      if ( Masked == Unique_Mask[ID] ) {
-         return ID;
-      }
-   }
+namespace decode {
 
-   // At this point, it might still be FENCE or ECALL, EBREAK, etc.
+   constexpr uint32_t OPCODE_SYSTEM = 0b1110011;
+   constexpr uint32_t OPCODE_AMO    = 0b0101111;
 
    constexpr uint32_t ECALL_Integer  = 0b00000000000000000000000001110011;
    constexpr uint32_t EBREAK_Integer = 0b00000000000100000000000001110011;
    constexpr uint32_t MRET_Integer   = 0b00110000001000000000000001110011;
 
-   if ( Integer == ECALL_Integer ) {
-      return ECALL;
+   constexpr uint32_t Opcode_Of( uint32_t Integer ) {
+      return ( Integer & 0b1111111 );
+   }
+
+   constexpr uint32_t Funct3_Of( uint32_t Integer ) {
+      return ( ( Integer >> 12 ) & 0b111 );
    }
 
-   if ( Integer == EBREAK_Integer ) {
-      return EBREAK;
+   constexpr uint32_t Funct7_Of( uint32_t Integer ) {
+      return ( Integer >> 25 );
    }
 
-   if ( Integer == MRET_Integer ) {
-      return MRET;
+   /// The first instruction, from ID onwards, whose Unique_Mask matches once
+   /// Integer is masked with its type's mask. Like the old loop, this stops at
+   /// the first unimplemented type (FENCE), so ECALL onwards are never tried.
+   constexpr instr_id Match_Unique_Mask( uint32_t Integer, int ID = FIRST_INSTR ) {
+      return ( Instr_Type_Mapping[ID] == INSTR_TYPE_UNIMPLEMENTED )
+               ? UNKNOWN_INSTR
+               : ( ( Integer & Instr_Type_Mask[Instr_Type_Mapping[ID]] ) ==
+                   Unique_Mask[ID] )
+                   ? instr_id( ID )
+                   : Match_Unique_Mask( Integer, ID + 1 );
    }
 
-   // Check if it's a CSR instruction
+   /// The CSR instruction with the given funct3, if there is one.
+   constexpr instr_id Match_CSR_Funct3( uint32_t Funct3, int ID = CSRRW ) {
+      return ( ID > CSRRCI )
+               ? UNKNOWN_INSTR
+               : ( Funct3_Of( Unique_Mask[ID] ) == Funct3 )
+                   ? instr_id( ID )
+                   : Match_CSR_Funct3( Funct3, ID + 1 );
+   }
 
-   {
-      const auto Instr = instr( Integer ).CSR_Type;
+   /// What the special cases after the Unique_Mask search decide.
+   constexpr instr_id Match_Special_Cases( uint32_t Integer ) {
+      return ( Integer == ECALL_Integer )
+               ? ECALL
+               : ( Integer == EBREAK_Integer )
+                   ? EBREAK
+                   : ( Integer == MRET_Integer )
+                       ? MRET
+                       : ( Opcode_Of( Integer ) == OPCODE_SYSTEM and
+                           Funct3_Of( Integer ) != 0b000 and
+                           Funct3_Of( Integer ) != 0b100 )
+                           ? Match_CSR_Funct3( Funct3_Of( Integer ) )
+                           : ( ( Integer & Unique_Mask[FENCE] ) ==
+                               Unique_Mask[FENCE] )
+                               ? FENCE
+                               : UNKNOWN_INSTR;
+   }
 
-      if ( Instr.Opcode == 0b1110011 and Instr.Funct3 != 0b100 ) {
-         switch ( Instr.Funct3 ) {
-            case 0b001: return CSRRW;
-            case 0b010: return CSRRS;
-            case 0b011: return CSRRC;
-            case 0b101: return CSRRWI;
-            case 0b110: return CSRRSI;
-            case 0b111: return CSRRCI;
-            default: assert( util::Unreachable );
-         }
-      }
+   /// The old linear decoder, as a constexpr. Only used to fill the tables.
+   constexpr instr_id Linear_Decode( uint32_t Integer ) {
+      return ( Match_Unique_Mask( Integer ) != UNKNOWN_INSTR )
+               ? Match_Unique_Mask( Integer )
+               : Match_Special_Cases( Integer );
    }
 
-   // Check if it's FENCE
+   // -------------------------------------------------------------------------
 
-   if ( ( ( Integer & Unique_Mask[FENCE] ) == Unique_Mask[FENCE] ) ) {
-      return FENCE;
+   /// Entries in Primary_Decode_Table that aren't an instr_id.
+   enum decode_step : uint8_t {
+      DECODE_BY_FUNCT5  = 0xFD,
+      DECODE_BY_FUNCT7  = 0xFE,
+      DECODE_BY_FUNCT12 = 0xFF,
+   };
+
+   static_assert( int( NUM_RV32I_INSTRUCTIONS ) < int( DECODE_BY_FUNCT5 ),
+                  "instr_id no longer fits in a decode table entry." );
+
+   constexpr size_t PRIMARY_TABLE_SIZE = ( 8 * 128 ); // funct3, opcode
+   constexpr size_t FUNCT7_TABLE_SIZE  = ( 2 * 8 * 128 ); // op bit 5, funct3, funct7
+   constexpr size_t FUNCT5_TABLE_SIZE  = 32;
+
+   constexpr uint32_t Primary_Index( uint32_t Integer ) {
+      return ( Funct3_Of( Integer ) << 7 | Opcode_Of( Integer ) );
    }
 
-   return UNKNOWN_INSTR;
-}
+   constexpr uint32_t Funct7_Index( uint32_t Integer ) {
+      return ( ( ( Integer >> 5 ) & 1 ) << 10 | Funct3_Of( Integer ) << 7 |
+               Funct7_Of( Integer ) );
+   }
+
+   /// The only opcodes with instructions distinguished by funct7 are OP and
+   /// OP-IMM, which differ only in bit 5. That's what lets Funct7_Index() get
+   /// away with using just that bit of the opcode.
+   constexpr uint32_t Funct7_Opcode( uint32_t Funct7_Key ) {
+      return ( ( Funct7_Key >> 10 ) ? 0b0110011 : 0b0010011 );
+   }
+
+   /// True if some R-type instruction has this opcode and funct3, meaning
+   /// funct7 is needed to tell instructions apart.
+   constexpr bool Depends_On_Funct7( uint32_t Integer, int ID = FIRST_INSTR ) {
+      return ( Instr_Type_Mapping[ID] == INSTR_TYPE_UNIMPLEMENTED )
+               ? false
+               : ( Instr_Type_Mapping[ID] == INSTR_TYPE_R and
+                   ( Unique_Mask[ID] & Instr_Type_Mask[INSTR_TYPE_I] ) ==
+                     Integer )
+                   ? true
+                   : Depends_On_Funct7( Integer, ID + 1 );
+   }
+
+   /// The A extension's instructions all share an opcode and funct3, and the
+   /// bits of funct7 below funct5 are aq and rl, so they get their own table.
+   constexpr bool Depends_On_Funct5( uint32_t Key ) {
+      return ( ( Key & 0b1111111 ) == OPCODE_AMO and
+               ( Key >> 7 ) == Funct3_Of( Unique_Mask[LR_W] ) );
+   }
+
+   constexpr uint8_t Primary_Entry( uint32_t Key ) {
+      // Key is laid out as funct3:opcode. Put the fields back where they go.
+      return ( ( Key & 0b1111111 ) == OPCODE_SYSTEM and ( Key >> 7 ) == 0 )
+               ? uint8_t( DECODE_BY_FUNCT12 )
+               : Depends_On_Funct5( Key )
+               ? uint8_t( DECODE_BY_FUNCT5 )
+               : Depends_On_Funct7( ( Key >> 7 ) << 12 | ( Key & 0b1111111 ) )
+                   ? uint8_t( DECODE_BY_FUNCT7 )
+                   : uint8_t( Linear_Decode( ( Key >> 7 ) << 12 |
+                                             ( Key & 0b1111111 ) ) );
+   }
+
+   constexpr uint8_t Funct7_Entry( uint32_t Key ) {
+      return uint8_t( Linear_Decode( ( Key & 0b1111111 ) << 25 |
+                                     ( ( Key >> 7 ) & 0b111 ) << 12 |
+                                     Funct7_Opcode( Key ) ) );
+   }
+
+   constexpr uint8_t Funct5_Entry( uint32_t Key ) {
+      return uint8_t( Linear_Decode( Key << 27 | ( Unique_Mask[LR_W] &
+                                                   Instr_Type_Mask[INSTR_TYPE_I] ) ) );
+   }
+
+   constexpr bool Funct7_Opcode_Is_Right( uint32_t Key ) {
+      return ( Primary_Entry( Key ) != DECODE_BY_FUNCT7 or
+               Funct7_Opcode( ( ( Key >> 5 ) & 1 ) << 10 ) ==
+                 ( Key & 0b1111111 ) );
+   }
+
+   /// Funct7_Opcode_Is_Right() for every key in [Low, High). Split in halves to
+   /// keep the constexpr recursion shallow.
+   constexpr bool Funct7_Opcodes_Are_Right( uint32_t Low, uint32_t High ) {
+      return ( High - Low == 1 )
+               ? Funct7_Opcode_Is_Right( Low )
+               : Funct7_Opcodes_Are_Right( Low, ( Low + High ) / 2 ) and
+                   Funct7_Opcodes_Are_Right( ( Low + High ) / 2, High );
+   }
+
+   static_assert( Funct7_Opcodes_Are_Right( 0, PRIMARY_TABLE_SIZE ),
+                  "A new opcode needs funct7 to decode. Widen Funct7_Index()." );
+
+   // -------------------------------------------------------------------------
+
+   /*
+      C++11 has no std::index_sequence, so here's one. It's built by halves so
+      the template recursion depth is logarithmic in the table size.
+   */
+
+   template <size_t... I> struct index_list {};
+
+   template <typename A, typename B> struct concat_index_lists;
+
+   template <size_t... I, size_t... J>
+   struct concat_index_lists<index_list<I...>, index_list<J...>> {
+      using type = index_list<I..., ( sizeof...( I ) + J )...>;
+   };
+
+   template <size_t N>
+   struct make_index_list
+     : concat_index_lists<typename make_index_list<N / 2>::type,
+                          typename make_index_list<N - N / 2>::type> {};
+
+   template <> struct make_index_list<0> { using type = index_list<>; };
+   template <> struct make_index_list<1> { using type = index_list<0>; };
+
+   template <size_t N> struct decode_table { uint8_t Entries[N]; };
+
+   template <size_t... I>
+   constexpr decode_table<sizeof...( I )> Build_Primary( index_list<I...> ) {
+      return decode_table<sizeof...( I )>{ { Primary_Entry( I )... } };
+   }
+
+   template <size_t... I>
+   constexpr decode_table<sizeof...( I )> Build_Funct7( index_list<I...> ) {
+      return decode_table<sizeof...( I )>{ { Funct7_Entry( I )... } };
+   }
+
+   template <size_t... I>
+   constexpr decode_table<sizeof...( I )> Build_Funct5( index_list<I...> ) {
+      return decode_table<sizeof...( I )>{ { Funct5_Entry( I )... } };
+   }
+
+   constexpr decode_table<PRIMARY_TABLE_SIZE> Primary_Decode_Table =
+     Build_Primary( make_index_list<PRIMARY_TABLE_SIZE>::type() );
+
+   constexpr decode_table<FUNCT7_TABLE_SIZE> Funct7_Decode_Table =
+     Build_Funct7( make_index_list<FUNCT7_TABLE_SIZE>::type() );
+
+   constexpr decode_table<FUNCT5_TABLE_SIZE> Funct5_Decode_Table =
+     Build_Funct5( make_index_list<FUNCT5_TABLE_SIZE>::type() );
+
+   // -------------------------------------------------------------------------
+
+   /// ECALL, EBREAK and MRET have no fields -- they're only ever these exact
+   /// numbers. Anything else under SYSTEM with funct3 = 0 is illegal.
+   constexpr instr_id Decode_By_Funct12( uint32_t Integer ) {
+      return ( Integer == ECALL_Integer )
+               ? ECALL
+               : ( Integer == EBREAK_Integer )
+                   ? EBREAK
+                   : ( Integer == MRET_Integer ) ? MRET : UNKNOWN_INSTR;
+   }
+
+   constexpr uint32_t RS2_Of( uint32_t Integer ) {
+      return ( ( Integer >> 20 ) & 0b11111 );
+   }
+
+   /// LR.W has no rs2, and it's only LR.W if that field is 0. The rest of the
+   /// A extension is told apart by funct5 alone.
+   constexpr instr_id Decode_By_Funct5( uint32_t Integer ) {
+      return ( Funct5_Decode_Table.Entries[Integer >> 27] == LR_W and
+               RS2_Of( Integer ) != 0 )
+               ? UNKNOWN_INSTR
+               : instr_id( Funct5_Decode_Table.Entries[Integer >> 27] );
+   }
 
-// clang-format off
-static_assert( (    0xa5a58593 
-                 &  0b00000000000000000111000000000000 ) 
-                 == 0b00000000000000000000000000000000, "" );
+   constexpr instr_id Decode_Entry( uint32_t Integer, uint8_t Entry ) {
+      return ( Entry == DECODE_BY_FUNCT7 )
+               ? instr_id( Funct7_Decode_Table.Entries[Funct7_Index( Integer )] )
+               : ( Entry == DECODE_BY_FUNCT5 )
+                   ? Decode_By_Funct5( Integer )
+                   : ( Entry == DECODE_BY_FUNCT12 ) ? Decode_By_Funct12( Integer )
+                                                    : instr_id( Entry );
+   }
+
+} // namespace decode
 
-static_assert( (    0xa5a58593 
-                 &  0b00000000000000000000000001111111 ) 
-                 == 0b00000000000000000000000000010011, "" );
-// clang-format on
+/// Work out which instruction the given integer is. At most two table lookups.
+constexpr instr_id Determine_Instruction_ID( uint32_t Integer ) {
+   return decode::Decode_Entry(
+     Integer,
+     decode::Primary_Decode_Table.Entries[decode::Primary_Index( Integer )] );
+}
 
-// static_assert( Determine_Instruction_ID( 0xa5a58593 ) != instr_id::LB );
-// static_assert( Determine_Instruction_ID( 0xa5a58593 ) == instr_id::ADDI );
-// static_assert( Determine_Instruction_ID( 0x0051e933 ) == instr_id::OR );
+static_assert( Determine_Instruction_ID( 0xa5a58593 ) != instr_id::LB, "" );
+static_assert( Determine_Instruction_ID( 0xa5a58593 ) == instr_id::ADDI, "" );
+static_assert( Determine_Instruction_ID( 0x0051e933 ) == instr_id::OR, "" );
+static_assert( Determine_Instruction_ID( 0x30200073 ) == instr_id::MRET, "" );
+static_assert( Determine_Instruction_ID( 0x40c5d593 ) == instr_id::SRAI, "" );
+static_assert( Determine_Instruction_ID( 0x100527af ) == instr_id::LR_W, "" );
+static_assert( Determine_Instruction_ID( 0x101527af ) == UNKNOWN_INSTR, "" );
+static_assert( Determine_Instruction_ID( 0x02c58533 ) == instr_id::MUL, "" );
+static_assert( Determine_Instruction_ID( 0x02c5c533 ) == instr_id::DIV, "" );
+static_assert( Determine_Instruction_ID( 0x06c5272f ) == instr_id::AMOADD_W, "" );
 
 // ----------------------------------------------------------------------------
 
-tuple<instr, instr_id> Integer_To_Instruction( uint32_t Integer ) {
+inline tuple<instr, instr_id> Integer_To_Instruction( uint32_t Integer ) {
    const instr Instruction = instr( Integer );
    const auto ID           = Determine_Instruction_ID( Integer );
+   return make_tuple( Instruction, ID );
+}
+
+// ----------------------------------------------------------------------------
+
+/// Decode the instruction at the given PC once, pulling out its fields and
+/// sign-extending its immediate so executing it doesn't have to.
+inline decoded_instr Decode_Instruction( uint32_t Integer, uint32_t PC ) {
+   const instr Instr = instr( Integer );
+
+   decoded_instr D;
+   D.PC         = PC;
+   D.Word       = Integer;
+   D.ID         = Determine_Instruction_ID( Integer );
+   D.RD         = 0;
+   D.RS1        = 0;
+   D.RS2        = 0;
+   D.Imm        = 0;
+   D.Length     = 4;
+   D.Breakpoint = false;
+
+   switch ( Instr_Type_Mapping[D.ID] ) {
+      case INSTR_TYPE_R:
+         D.RD  = Instr.R_Type.RD;
+         D.RS1 = Instr.R_Type.RS1;
+         D.RS2 = Instr.R_Type.RS2; // Shift amount for SLLI, SRLI, SRAI.
+         break;
+      case INSTR_TYPE_I:
+         D.RD  = Instr.I_Type.RD;
+         D.RS1 = Instr.I_Type.RS1;
+         D.Imm = util::Sign_Extend( Instr.I_Type.Immediate_11_To_0, 12 );
+         break;
+      case INSTR_TYPE_S:
+         D.RS1 = Instr.S_Type.RS1;
+         D.RS2 = Instr.S_Type.RS2;
+         D.Imm = util::Sign_Extend( Instr.S_Type.Decipher_Immediate(), 12 );
+         break;
+      case INSTR_TYPE_B:
+         D.RS1 = Instr.B_Type.RS1;
+         D.RS2 = Instr.B_Type.RS2;
+         D.Imm = 2 * util::Sign_Extend( Instr.B_Type.Decipher_Immediate(), 12 );
+         break;
+      case INSTR_TYPE_U:
+         D.RD  = Instr.U_Type.RD;
+         D.Imm = ( Instr.U_Type.Immediate_31_To_12 << 12 );
+         break;
+      case INSTR_TYPE_J:
+         D.RD  = Instr.J_Type.RD;
+         D.Imm = util::Sign_Extend( 2 * Instr.J_Type.Decipher_Immediate(), 20 );
+         break;
+      case INSTR_TYPE_CSR:
+         D.RD  = Instr.CSR_Type.RD;
+         D.RS1 = Instr.CSR_Type.RS1; // zimm for the immediate variants.
+         D.Imm = Instr.CSR_Type.CSR;
+         break;
+      case INSTR_TYPE_A:
+         D.RD  = Instr.A_Type.RD;
+         D.RS1 = Instr.A_Type.RS1;
+         D.RS2 = Instr.A_Type.RS2;
+         break;
+      default: break;
+   }
+
+   return D;
+}
+
+// ----------------------------------------------------------------------------
 
-   if ( ID == UNKNOWN_INSTR ) {
-      DEBUG_LOG( "Unrecognised instruction: %08x", Integer );
+/// True if the given instruction has to be the last in its basic block:
+/// branches, jumps, MRET, ECALL/EBREAK and unknown instructions, which change
+/// the PC, and CSR accesses, which may make an interrupt pending. Interrupts
+/// are only looked for between blocks, so nothing after one of these may run
+/// in the same block. Loads and stores can trap too, but don't end a block;
+/// the trap unwinds the rest of it instead.
+inline bool Ends_Basic_Block( instr_id ID ) {
+   switch ( Instr_Type_Mapping[ID] ) {
+      case INSTR_TYPE_B:
+      case INSTR_TYPE_J:
+      case INSTR_TYPE_CSR: return true;
+      default: break;
    }
 
-   return make_tuple( Instruction, ID );
+   switch ( ID ) {
+      case JALR:
+      case ECALL:
+      case EBREAK:
+      case MRET:
+      case UNKNOWN_INSTR: return true;
+      default: return false;
+   }
+}
+
+/// The hints from the table in the ISA manual's description of JALR, which say
+/// a jump links through ra or t0 when it calls, and jumps back through one of
+/// them when it returns. A JALR can do both, to call a coroutine.
+inline bool Is_Link_Register( unsigned Reg ) {
+   return ( Reg == 1 or Reg == 5 );
+}
+
+inline bool Is_Call( const decoded_instr &Instruction ) {
+   return ( ( Instruction.ID == JAL or Instruction.ID == JALR ) and
+            Is_Link_Register( Instruction.RD ) );
+}
+
+inline bool Is_Return( const decoded_instr &Instruction ) {
+   return ( Instruction.ID == JALR and Is_Link_Register( Instruction.RS1 ) and
+            not( Is_Link_Register( Instruction.RD ) and
+                 Instruction.RD == Instruction.RS1 ) );
+}
+
+// ----------------------------------------------------------------------------
+
+template <bool Verbose, bool Stage2>
+inline execution_result Execute_Instruction( processor *CPU,
+                                             const decoded_instr &D ) {
+   constexpr bool Be_Verbose = Verbose; // For DEBUG_LOG().
+   assert( CPU );
+
+   switch ( Instr_Type_Mapping[D.ID] ) {
+      case INSTR_TYPE_R: return r_type::Execute<Verbose, Stage2>( CPU, D );
+      case INSTR_TYPE_I: return i_type::Execute<Verbose, Stage2>( CPU, D );
+      case INSTR_TYPE_S: return s_type::Execute<Verbose, Stage2>( CPU, D );
+      case INSTR_TYPE_B: return b_type::Execute<Verbose, Stage2>( CPU, D );
+      case INSTR_TYPE_U: return u_type::Execute<Verbose, Stage2>( CPU, D );
+      case INSTR_TYPE_J: return j_type::Execute<Verbose, Stage2>( CPU, D );
+      case INSTR_TYPE_A: return a_type::Execute<Verbose, Stage2>( CPU, D );
+
+      case INSTR_TYPE_CSR: {
+         if ( not Stage2 ) {
+            CPU->print( "Error: illegal instruction\n" );
+            DEBUG_LOG(
+              BLUE( "(This is a CSR instruction. "
+                    "It's illegal because Stage2 isn't enabled.)" ) );
+            return Successful_Execution;
+         }
+
+         return csr_type::Execute<Verbose, Stage2>( CPU, D );
+      }
+
+      default: {
+         if ( D.ID == FENCE ) {
+            // @Required: Do nothing.
+            DEBUG_LOG( "Fence instruction. Do nothing." );
+            return Successful_Execution;
+         }
+
+         if ( Stage2 ) {
+            return execution_result::EXC_ILLEGAL_INSTRUCTION;
+         } else {
+            // @Required
+            CPU->print( "Error: illegal instruction\n" );
+            DEBUG_LOG( "Illegal (unknown) instruction, but not crashing." );
+            return Successful_Execution;
+         }
+      }
+   }
 }
 
 // ----------------------------------------------------------------------------
 
-string Instruction_To_Assembly( uint32_t Integer ) {
+inline string Instruction_To_Assembly( uint32_t Integer ) {
    instr Instr;
    instr_id ID;
    std::tie( Instr, ID ) = Integer_To_Instruction( Integer );
 
-   if ( ID == UNKNOWN_INSTR ) {
-      DEBUG_LOG( "called on an unknown instruction." );
-   }
-
    const auto Name = Instr_String_Mapping[ID];
 
    const auto R   = Instr.R_Type;
@@ -1103,6 +1623,7 @@ string Instruction_To_Assembly( uint32_t Integer ) {
    const auto U   = Instr.U_Type;
    const auto J   = Instr.J_Type;
    const auto CSR = Instr.CSR_Type;
+   const auto A   = Instr.A_Type;
 
    using namespace util;
 
@@ -1194,6 +1715,14 @@ string Instruction_To_Assembly( uint32_t Integer ) {
       case SRA:
       case OR:
       case AND:
+      case MUL:
+      case MULH:
+      case MULHSU:
+      case MULHU:
+      case DIV:
+      case DIVU:
+      case REM:
+      case REMU:
          snprintf( Temp_String, Length, "%-6s x%u, x%u, x%u",
                    Name, R.RD, R.RS1, R.RS2 );
          break;
@@ -1216,6 +1745,27 @@ string Instruction_To_Assembly( uint32_t Integer ) {
       case MRET: 
          snprintf( Temp_String, Length, "%s", Name ); 
          break;
+
+      // A-type, with .aq/.rl if they're set:
+      case LR_W:
+         snprintf( Temp_String, Length, "%s%s%s x%u, (x%u)",
+                   Name, A.AQ ? ".aq" : "", A.RL ? ".rl" : "",
+                   A.RD, A.RS1 );
+         break;
+      case SC_W: [[fallthrough]];
+      case AMOSWAP_W:
+      case AMOADD_W:
+      case AMOXOR_W:
+      case AMOAND_W:
+      case AMOOR_W:
+      case AMOMIN_W:
+      case AMOMAX_W:
+      case AMOMINU_W:
+      case AMOMAXU_W:
+         snprintf( Temp_String, Length, "%s%s%s x%u, x%u, (x%u)",
+                   Name, A.AQ ? ".aq" : "", A.RL ? ".rl" : "",
+                   A.RD, A.RS2, A.RS1 );
+         break;
  
       case UNKNOWN_INSTR: return "[unknown instruction]";
       default: assert( util::Unreachable );
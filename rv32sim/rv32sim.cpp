@@ -13,6 +13,7 @@
 
 #include "memory.h"
 #include "processor.h"
+#include "harts.h"
 #include "commands.h"
 
 using namespace std;
@@ -23,10 +24,27 @@ int main(int argc, char* argv[]) {
     string arg;
     bool verbose = false;
     bool cycle_reporting = false;
+    bool pipelined = false;
+    pipeline::config pipeline_config;
+    bool icache = false, dcache = false;
+    cache::config icache_config, dcache_config;
+    bool bpred = false;
+    branch_unit::config bpred_config;
+    bool profiling = false;
+    string callgraph_file;
+    bool sampling = false;
+    sampling_profile::config sampling_config;
+    symbol_table symbol_map;
+    bool symbols_given = false;
     bool stage2 = false;
+    bool use_jit = false;
+    bool compressed = false;
+    unsigned long int hart_count = 1;
+    harts::schedule schedule = harts::schedule::QUANTUM;
+    unsigned long int quantum = harts::DEFAULT_QUANTUM;
 
     memory* main_memory;
-    processor* cpu;
+    harts* all_harts;
 
     unsigned long int cpu_instruction_count;
     
@@ -36,30 +54,140 @@ int main(int argc, char* argv[]) {
 	if (arg == "-v")  // Verbose output
 	    verbose = true;
 	else if (arg == "-c")  // Cycle and instruction reporting enabled
+	    cycle_reporting = pipelined = true;
+	else if (arg == "-pipeline" && i + 1 < argc) {  // Pipeline timing, see timing.h
+	    string error;
+	    if (!pipeline_config.parse(argv[++i], error)) {
+		cout << "Bad -pipeline: " << error << endl;
+		return 1;
+	    }
+	    cycle_reporting = pipelined = true;
+	}
+	else if ((arg == "-icache" || arg == "-dcache") && i + 1 < argc) {  // L1 caches, see cache.h
+	    bool instruction = (arg == "-icache");
+	    string error;
+	    if (!(instruction ? icache_config : dcache_config).parse(argv[++i], error)) {
+		cout << "Bad " << arg << ": " << error << endl;
+		return 1;
+	    }
+	    (instruction ? icache : dcache) = true;
 	    cycle_reporting = true;
+	}
+	else if (arg == "-bpred" && i + 1 < argc) {  // Branch predictors, see branch_predictor.h
+	    string error;
+	    if (!bpred_config.parse(argv[++i], error)) {
+		cout << "Bad -bpred: " << error << endl;
+		return 1;
+	    }
+	    bpred = true;
+	    cycle_reporting = pipelined = true;
+	}
+	else if (arg == "-profile")  // Instruction mix and hot spots, see profile.h
+	    profiling = true;
+	else if (arg == "-callgraph" && i + 1 < argc)  // Folded call stacks, see profile.h
+	    callgraph_file = argv[++i];
+	else if (arg == "-sample" && i + 1 < argc) {  // PC samples, see profile.h
+	    string error;
+	    if (!sampling_config.parse(argv[++i], error)) {
+		cout << "Bad -sample: " << error << endl;
+		return 1;
+	    }
+	    sampling = true;
+	}
+	else if (arg == "-symbols" && i + 1 < argc) {  // Function names for hex images
+	    string error;
+	    if (!symbol_map.load_map(argv[++i], error)) {
+		cout << "Bad -symbols: " << error << endl;
+		return 1;
+	    }
+	    symbols_given = true;
+	}
 	else if (arg == "-s2")  // Stage 2 functionality enabled
 	    stage2 = true;
+	else if (arg == "-j")  // Compile hot code to native code
+	    use_jit = true;
+	else if (arg == "-rvc")  // 16-bit instructions (the C extension) allowed
+	    compressed = true;
+	else if (arg == "-harts" && i + 1 < argc)  // Number of harts
+	    hart_count = strtoul(argv[++i], NULL, 10);
+	else if (arg == "-quantum" && i + 1 < argc)  // Harts take turns
+	    quantum = strtoul(argv[++i], NULL, 10);
+	else if (arg == "-free")  // Harts all run at once
+	    schedule = harts::schedule::FREE_RUNNING;
 	else {
 	    cout << "Unknown option: " << arg << endl;
 	}
     }
 
+    if (hart_count < 1 || hart_count > harts::MAX_HARTS) {
+	cout << "Number of harts must be 1 to " << harts::MAX_HARTS << endl;
+	return 1;
+    }
+    if (quantum < 1 || quantum > 0xffffffffUL) {
+	cout << "Quantum must be at least 1" << endl;
+	return 1;
+    }
+
     main_memory = new memory (verbose);
-    cpu = new processor (main_memory, verbose, stage2);
+    all_harts = new harts (main_memory, hart_count, verbose, stage2, use_jit,
+			   schedule, quantum);
+    for (unsigned h = 0; h < all_harts->size(); h++) {
+	(*all_harts)[h].set_compressed(compressed);
+	// Caches on their own don't need the pipeline, which costs more than
+	// they do. See timing.h.
+	if (pipelined)
+	    (*all_harts)[h].set_timing_model(
+		new pipeline(pipeline_config,
+			     icache ? new cache(icache_config) : nullptr,
+			     dcache ? new cache(dcache_config) : nullptr,
+			     bpred ? new branch_unit(bpred_config) : nullptr));
+	else if (cycle_reporting)
+	    (*all_harts)[h].set_timing_model(
+		new cache_timing(icache ? new cache(icache_config) : nullptr,
+				 dcache ? new cache(dcache_config) : nullptr));
+	if (profiling)
+	    (*all_harts)[h].add_profiler(new instruction_profile());
+	if (!callgraph_file.empty())
+	    (*all_harts)[h].add_profiler(new call_graph_profile(
+		symbols_given ? symbol_map : main_memory->Symbols,
+		all_harts->size() > 1 ? callgraph_file + "." + to_string(h)
+				      : callgraph_file));
+	if (sampling) {
+	    sampling_profile::config config = sampling_config;
+	    if (all_harts->size() > 1)
+		config.File_Name += "." + to_string(h);
+	    (*all_harts)[h].add_profiler(new sampling_profile(
+		config, symbols_given ? symbol_map : main_memory->Symbols));
+	}
+    }
 
-    interpret_commands(main_memory, cpu, verbose);
+    interpret_commands(main_memory, all_harts, verbose);
 
     // Report final statistics
 
-    cpu_instruction_count = cpu->get_instruction_count();
+    cpu_instruction_count = all_harts->get_instruction_count();
     cout << "Instructions executed: " << dec << cpu_instruction_count << endl;
 
-    if (cycle_reporting) {
-	// Required for postgraduate Computer Architecture course
-	unsigned long int cpu_cycle_count;
-
-	cpu_cycle_count = cpu->get_cycle_count();
-
-	cout << "CPU cycle count: " << dec << cpu_cycle_count << endl;
+    // Each hart has its own pipeline, caches and profilers, so with more
+    // than one, each reports under its own heading.
+    for (unsigned h = 0; h < all_harts->size(); h++) {
+	const processor &hart = (*all_harts)[h];
+	if (all_harts->size() > 1 &&
+	    (cycle_reporting || !hart.get_profilers().empty()))
+	    cout << "Hart " << h << ":" << endl;
+	if (cycle_reporting) {
+	    // Required for postgraduate Computer Architecture course
+	    unsigned long int cpu_cycle_count;
+
+	    cpu_cycle_count = hart.get_cycle_count();
+
+	    if (all_harts->size() > 1)
+		cout << "Instructions executed: " << dec
+		     << hart.get_instruction_count() << endl;
+	    cout << "CPU cycle count: " << dec << cpu_cycle_count << endl;
+	    hart.get_timing_model()->report(cout);
+	}
+	for (const auto &profiler : hart.get_profilers())
+	    profiler->report(cout, hart.get_instruction_count());
     }
 }
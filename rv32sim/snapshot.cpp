@@ -0,0 +1,118 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Whole-machine snapshots
+
+**************************************************************** */
+
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+#include "snapshot.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+const char Magic[8]    = { 'R', 'V', '3', '2', 'S', 'N', 'A', 'P' };
+const uint32_t Version = 2;
+
+static_assert( is_trivially_copyable<processor::state>::value and
+                 sizeof( processor::state ) % sizeof( uint32_t ) == 0,
+               "processor::state is written out as it is." );
+
+/// Closes the file when it goes out of scope.
+struct file_closer {
+   FILE *File;
+
+   ~file_closer() {
+      if ( this->File ) {
+         fclose( this->File );
+      }
+   }
+};
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+
+void snapshot::take( memory &Memory, const processor &Processor ) {
+   Memory.take_snapshot( this->Memory );
+   this->Processors.assign( 1, Processor.get_state() );
+}
+
+void snapshot::restore( memory &Memory, processor &Processor ) const {
+   assert( this->hart_count() == 1 );
+   Memory.restore( this->Memory );
+   Processor.set_state( this->Processors[0] );
+}
+
+void snapshot::take( memory &Memory, const harts &Harts ) {
+   Memory.take_snapshot( this->Memory );
+   this->Processors.clear();
+   for ( unsigned Hart_ID = 0; Hart_ID < Harts.size(); ++Hart_ID ) {
+      this->Processors.push_back( Harts[Hart_ID].get_state() );
+   }
+}
+
+void snapshot::restore( memory &Memory, harts &Harts ) const {
+   assert( this->hart_count() == Harts.size() );
+   Memory.restore( this->Memory );
+   for ( unsigned Hart_ID = 0; Hart_ID < Harts.size(); ++Hart_ID ) {
+      Harts[Hart_ID].set_state( this->Processors[Hart_ID] );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+bool snapshot::save( const string &File_Name ) const {
+   const file_closer Closer = { fopen( File_Name.c_str(), "wb" ) };
+   FILE *File               = Closer.File;
+
+   const uint32_t Count = this->hart_count();
+
+   return File and fwrite( Magic, sizeof( Magic ), 1, File ) == 1 and
+          fwrite( &Version, sizeof( Version ), 1, File ) == 1 and
+          fwrite( &Count, sizeof( Count ), 1, File ) == 1 and
+          fwrite( this->Processors.data(), sizeof( processor::state ), Count,
+                  File ) == Count and
+          this->Memory.write( File ) and fflush( File ) == 0;
+}
+
+bool snapshot::load( const string &File_Name ) {
+   const file_closer Closer = { fopen( File_Name.c_str(), "rb" ) };
+   FILE *File               = Closer.File;
+
+   char File_Magic[sizeof( Magic )];
+   uint32_t File_Version;
+   uint32_t Count = 0;
+
+   const bool Good_Header =
+     File and fread( File_Magic, sizeof( File_Magic ), 1, File ) == 1 and
+     memcmp( File_Magic, Magic, sizeof( Magic ) ) == 0 and
+     fread( &File_Version, sizeof( File_Version ), 1, File ) == 1 and
+     File_Version == Version and
+     fread( &Count, sizeof( Count ), 1, File ) == 1 and Count >= 1 and
+     Count <= harts::MAX_HARTS;
+
+   if ( not Good_Header ) {
+      return false;
+   }
+
+   vector<processor::state> States( Count );
+
+   const bool Good =
+     fread( States.data(), sizeof( processor::state ), Count, File ) ==
+       Count and
+     this->Memory.read( File );
+
+   // Only take the processors' half if the memory's half came too.
+   if ( Good ) {
+      this->Processors.swap( States );
+   }
+
+   return Good;
+}
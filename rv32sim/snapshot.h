@@ -0,0 +1,65 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Whole-machine snapshots
+
+**************************************************************** */
+
+/*
+   A snapshot is each hart's processor state plus a memory::snapshot, which shares
+   pages with memory until one side writes them. Taking one is cheap after
+   the first time, and restoring the one most recently taken or restored only
+   costs as much as the pages written since -- so running the same image over
+   and over is load once, snapshot, then run and restore as often as needed.
+
+   Snapshots can be saved to a file and loaded back. The format is:
+
+      "RV32SNAP"            8 bytes
+      version               4 bytes, currently 2
+      hart count            4 bytes
+      processor::state      per hart: its fields, in order, 4 bytes each
+      memory pages          see memory::snapshot::write()
+
+   with every number little-endian.
+*/
+
+#include <string>
+#include <vector>
+
+#include "harts.h"
+#include "memory.h"
+#include "processor.h"
+
+using namespace std;
+
+class snapshot {
+private:
+   memory::snapshot Memory;
+   vector<processor::state> Processors;
+
+public:
+   /// False once something has been taken or loaded.
+   bool empty( void ) const {
+      return this->Memory.empty();
+   }
+
+   void take( memory &Memory, const processor &Processor );
+   void restore( memory &Memory, processor &Processor ) const;
+
+   /// The same, for every hart. Restoring needs as many harts as there were.
+   void take( memory &Memory, const harts &Harts );
+   void restore( memory &Memory, harts &Harts ) const;
+
+   unsigned hart_count( void ) const {
+      return unsigned( this->Processors.size() );
+   }
+
+   /// Write to, or read from, the given file. Return false if that fails.
+   bool save( const string &File_Name ) const;
+   bool load( const string &File_Name );
+};
+
+#endif
@@ -0,0 +1,101 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Symbol table
+
+**************************************************************** */
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "symbols.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+void symbol_table::finish( void ) {
+   auto &Symbols = this->Symbols;
+
+   // By address, and sized symbols first among those at the same address.
+   sort( Symbols.begin(), Symbols.end(), []( const symbol &A, const symbol &B ) {
+      return ( A.Address != B.Address ? A.Address < B.Address
+                                      : A.Size > B.Size );
+   } );
+
+   Symbols.erase( unique( Symbols.begin(),
+                          Symbols.end(),
+                          []( const symbol &A, const symbol &B ) {
+                             return A.Address == B.Address;
+                          } ),
+                  Symbols.end() );
+}
+
+// ----------------------------------------------------------------------------
+
+const symbol *symbol_table::find( uint32_t Address ) const {
+   // The first symbol past the address. The one before it is the candidate.
+   const auto Next = upper_bound(
+     this->Symbols.begin(),
+     this->Symbols.end(),
+     Address,
+     []( uint32_t A, const symbol &S ) { return A < S.Address; } );
+
+   if ( Next == this->Symbols.begin() ) {
+      return nullptr;
+   }
+
+   const symbol &Candidate = *( Next - 1 );
+
+   if ( Candidate.Size != 0 and Address - Candidate.Address >= Candidate.Size ) {
+      return nullptr;
+   }
+
+   return &Candidate;
+}
+
+// ----------------------------------------------------------------------------
+
+bool symbol_table::load_map( const string &File_Name, string &Error ) {
+   ifstream File( File_Name );
+   if ( not File ) {
+      Error = "can't read " + File_Name;
+      return false;
+   }
+
+   const size_t Old_Size = this->Symbols.size();
+
+   string Line;
+   for ( unsigned Line_Number = 1; getline( File, Line ); ++Line_Number ) {
+      istringstream Fields( Line );
+      string Address, Type, Name;
+
+      if ( not( Fields >> Address ) or Address[0] == '#' ) {
+         continue;
+      }
+      Fields >> Type >> Name;
+      if ( Name.empty() ) {
+         swap( Type, Name );
+      }
+
+      char *End;
+      const unsigned long Value = strtoul( Address.c_str(), &End, 16 );
+
+      if ( *End != '\0' or Value > 0xFFFFFFFFUL or Name.empty() or
+           Type.size() > 1 ) {
+         Error = File_Name + ":" + to_string( Line_Number ) + ": not a symbol";
+         this->Symbols.resize( Old_Size );
+         return false;
+      }
+
+      if ( Type.empty() or Type == "T" or Type == "t" or Type == "W" or
+           Type == "w" ) {
+         this->add( uint32_t( Value ), 0, Name );
+      }
+   }
+
+   this->finish();
+   return true;
+}
@@ -0,0 +1,86 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Symbol table, for turning PCs back into function names
+
+**************************************************************** */
+
+/*
+   Filled in when an ELF file is loaded (see memory::load_file()), and kept by
+   memory alongside what was loaded, so that anything reporting PCs -- the
+   profilers, mostly -- can say which function they're in. Hex images carry no
+   symbols, so after loading one the table is empty and lookups just fail.
+*/
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct symbol {
+   uint32_t Address;
+
+   /// Size in bytes, from the ELF symbol. Zero for hand-written labels, which
+   /// are taken to run up to the next symbol.
+   uint32_t Size;
+
+   string Name;
+};
+
+// ----------------------------------------------------------------------------
+
+class symbol_table {
+private:
+   /// Sorted by address, one symbol per address, once finish() is called.
+   vector<symbol> Symbols;
+
+public:
+   void clear( void ) {
+      this->Symbols.clear();
+   }
+
+   /// Add a symbol. Call finish() once they've all been added.
+   void add( uint32_t Address, uint32_t Size, const string &Name ) {
+      this->Symbols.push_back( symbol{ Address, Size, Name } );
+   }
+
+   /// Sort the symbols for find(). Where several share an address, the one
+   /// with a size (a real function, rather than a label) is kept.
+   void finish( void );
+
+   /// Add the symbols in a map file, and finish(). Each line is nm's
+   /// `ADDR [TYPE] NAME`: a hex address (0x optional), then an optional
+   /// one-letter type, then the name; anything after that is ignored. Of
+   /// nm's types only code (T, t, W and w) is taken, and a line with no type
+   /// is taken too. Blank lines and ones starting with # are skipped. A line
+   /// that's none of these -- a bad address, no name, a longer type -- stops
+   /// the load: none of the file's symbols are added, Error names the line,
+   /// and it's false. So is a file that can't be read.
+   bool load_map( const string &File_Name, string &Error );
+
+   /// The symbol whose code holds the given address, or null if there's none.
+   const symbol *find( uint32_t Address ) const;
+
+   bool empty( void ) const {
+      return this->Symbols.empty();
+   }
+
+   size_t size( void ) const {
+      return this->Symbols.size();
+   }
+
+   /// Every symbol, by address.
+   vector<symbol>::const_iterator begin( void ) const {
+      return this->Symbols.begin();
+   }
+
+   vector<symbol>::const_iterator end( void ) const {
+      return this->Symbols.end();
+   }
+};
+
+#endif
@@ -0,0 +1,325 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Timing models
+
+**************************************************************** */
+
+#include <algorithm>
+
+#include "rv32i.h"
+#include "timing.h"
+#include "util.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+bool pipeline::config::parse( const string &Spec, string &Error ) {
+   return util::Parse_Settings(
+     Spec,
+     Error,
+     [this]( const string &Key, const string &Value, string &Why ) {
+        uint32_t Number;
+        if ( not util::Parse_Size( Value, Number ) ) {
+           Why = "bad number for " + Key + ": \"" + Value + "\"";
+           return false;
+        }
+
+        if ( Key == "forwarding" ) {
+           this->Forwarding = ( Number != 0 );
+        } else if ( Key == "load" ) {
+           this->Load_Use_Cycles = Number;
+        } else if ( Key == "branch" ) {
+           this->Branch_Penalty = Number;
+        } else if ( Key == "jump" ) {
+           this->Jump_Penalty = Number;
+        } else if ( Key == "mul" or Key == "div" ) {
+           if ( Number == 0 ) {
+              Why = Key + " has to take at least a cycle";
+              return false;
+           }
+           ( Key == "mul" ? this->Mul_Cycles : this->Div_Cycles ) = Number;
+        } else if ( Key == "trap" ) {
+           this->Trap_Penalty = Number;
+        } else if ( Key == "predict" ) {
+           this->Predicted = ( Number != 0 );
+        } else {
+           Why = "no pipeline setting " + Key;
+           return false;
+        }
+
+        return true;
+     } );
+}
+
+// ----------------------------------------------------------------------------
+
+/// How many bytes an instruction loads or stores, if any, and which. The AMOs
+/// do both, and LR.W counts as a load.
+static void
+Find_Access( unsigned ID, uint8_t &Length, bool &Load, bool &Store ) {
+   const bool Atomic = ( Instr_Type_Mapping[ID] == INSTR_TYPE_A );
+
+   Length = ( Atomic ? 4 : 0 );
+   Load   = Atomic;
+   Store  = ( Atomic and ID != LR_W );
+
+   switch ( ID ) {
+      case LB:
+      case LBU: Length = 1, Load = true; break;
+      case LH:
+      case LHU: Length = 2, Load = true; break;
+      case LW: Length = 4, Load = true; break;
+      case SB: Length = 1, Store = true; break;
+      case SH: Length = 2, Store = true; break;
+      case SW: Length = 4, Store = true; break;
+      default: break;
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+pipeline::pipeline( const config &Config,
+                    cache *Instruction_Cache,
+                    cache *Data_Cache,
+                    branch_unit *Branches ) {
+   this->Config = Config;
+   this->Instruction_Cache.reset( Instruction_Cache );
+   this->Data_Cache.reset( Data_Cache );
+   this->Branches.reset( Branches );
+
+   static_assert( NUM_RV32I_INSTRUCTIONS <= 256, "Timings is too small." );
+
+   for ( unsigned ID = FIRST_INSTR; ID < NUM_RV32I_INSTRUCTIONS; ++ID ) {
+      instr_timing &T = this->Timings[ID];
+
+      T.Execute_Cycles = 1;
+      Find_Access( ID, T.Access_Length, T.Load, T.Store );
+
+      // Decode leaves the register fields an instruction doesn't have at 0,
+      // which never holds anything up, except for these, which hold
+      // immediates.
+      T.Reads_RS1 = ( ID != CSRRWI and ID != CSRRSI and ID != CSRRCI );
+      T.Reads_RS2 = ( ID != SLLI and ID != SRLI and ID != SRAI );
+      T.Transfers = ( Instr_Type_Mapping[ID] == INSTR_TYPE_B or ID == JAL or
+                      ID == JALR );
+
+      switch ( ID ) {
+         case MUL:
+         case MULH:
+         case MULHSU:
+         case MULHU: T.Execute_Cycles = Config.Mul_Cycles; break;
+         case DIV:
+         case DIVU:
+         case REM:
+         case REMU: T.Execute_Cycles = Config.Div_Cycles; break;
+         default: break;
+      }
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void pipeline::retire( const decoded_instr &Instruction,
+                       uint32_t Next_PC,
+                       uint32_t Data_Address ) {
+   const instr_timing &T = this->Timings[Instruction.ID];
+   uint64_t EX           = this->Next_EX;
+
+   if ( this->Instruction_Cache ) {
+      const uint32_t Stall =
+        ( this->Instruction_Cache->access( Instruction.PC,
+                                           Instruction.Length,
+                                           false ) *
+          this->Instruction_Cache->get_config().Miss_Penalty );
+      this->Fetch_Stalls += Stall;
+      EX += Stall;
+   }
+
+   uint64_t Operands_Ready = EX;
+   bool Waiting_On_Load    = false;
+
+   const auto Wait_For = [&]( unsigned Reg ) {
+      if ( Reg != 0 and this->Ready[Reg] > Operands_Ready ) {
+         Operands_Ready  = this->Ready[Reg];
+         Waiting_On_Load = this->From_Load[Reg];
+      }
+   };
+
+   if ( T.Reads_RS1 ) {
+      Wait_For( Instruction.RS1 );
+   }
+   if ( T.Reads_RS2 ) {
+      Wait_For( Instruction.RS2 );
+   }
+
+   if ( Operands_Ready > EX ) {
+      this->Data_Stalls += ( Operands_Ready - EX );
+      if ( Waiting_On_Load ) {
+         this->Load_Use_Stalls += ( Operands_Ready - EX );
+      }
+      EX = Operands_Ready;
+   }
+
+   // A multi-cycle EX holds everything behind it where it is.
+   this->Execute_Stalls += ( T.Execute_Cycles - 1 );
+   this->Last_EX = ( EX + T.Execute_Cycles - 1 );
+
+   // Likewise a long MEM. Stores that go straight through to memory are left
+   // in a write buffer.
+   uint32_t Memory_Stall = 0;
+   if ( this->Data_Cache and T.Access_Length != 0 ) {
+      const cache::config &Cache_Config = this->Data_Cache->get_config();
+      const uint32_t Misses =
+        this->Data_Cache->access( Data_Address, T.Access_Length, T.Store );
+
+      if ( not T.Store or Cache_Config.Write_Back ) {
+         Memory_Stall = ( Misses * Cache_Config.Miss_Penalty );
+      }
+   }
+   this->Memory_Stalls += Memory_Stall;
+   this->Next_EX = ( this->Last_EX + 1 + Memory_Stall );
+   this->Last_WB = ( this->Last_EX + 2 + Memory_Stall );
+
+   if ( Instruction.RD != 0 ) {
+      // Forwarded from the end of EX, or MEM for a load. Otherwise it's
+      // written back two cycles after EX, and read in ID that same cycle.
+      this->Ready[Instruction.RD] =
+        ( this->Config.Forwarding
+            ? this->Last_EX + 1 + ( T.Load ? this->Config.Load_Use_Cycles : 0 )
+            : this->Last_EX + 3 ) +
+        Memory_Stall;
+      this->From_Load[Instruction.RD] = T.Load;
+   }
+
+   // Fetch carried on from the next instruction along, or from wherever the
+   // predictor said, so anything else has to be fetched afresh.
+   const bool Taken = ( Next_PC != Instruction.PC + Instruction.Length );
+   branch_unit::verdict Verdict = branch_unit::UNPREDICTED;
+
+   if ( T.Transfers and this->Branches ) {
+      Verdict = this->Branches->observe( Instruction, Next_PC );
+   }
+
+   uint32_t Penalty = 0;
+   if ( this->Config.Predicted and Verdict != branch_unit::UNPREDICTED ) {
+      Penalty = ( Verdict == branch_unit::WRONG ? this->Config.Branch_Penalty
+                  : Taken                       ? this->Config.Jump_Penalty
+                                                : 0 );
+   } else if ( Taken ) {
+      Penalty = ( Instruction.ID == JAL ? this->Config.Jump_Penalty
+                                        : this->Config.Branch_Penalty );
+   }
+   this->Next_EX += Penalty;
+   this->Control_Stalls += Penalty;
+
+   this->Instructions += 1;
+}
+
+void pipeline::trap( void ) {
+   this->Next_EX += this->Config.Trap_Penalty;
+   this->Trap_Stalls += this->Config.Trap_Penalty;
+}
+
+// ----------------------------------------------------------------------------
+
+uint64_t pipeline::get_cycle_count( void ) const {
+   return this->Last_WB;
+}
+
+void pipeline::report( ostream &Output ) const {
+   const double CPI =
+     ( this->Instructions == 0
+         ? 0.0
+         : double( this->get_cycle_count() ) / double( this->Instructions ) );
+
+   util::Print( Output, "CPI: %.3f\n", CPI );
+   util::Print( Output,
+                "Stall cycles: %llu data (%llu load-use), %llu control, "
+                "%llu execute, %llu fetch, %llu memory, %llu trap\n",
+                (unsigned long long) this->Data_Stalls,
+                (unsigned long long) this->Load_Use_Stalls,
+                (unsigned long long) this->Control_Stalls,
+                (unsigned long long) this->Execute_Stalls,
+                (unsigned long long) this->Fetch_Stalls,
+                (unsigned long long) this->Memory_Stalls,
+                (unsigned long long) this->Trap_Stalls );
+
+   if ( this->Instruction_Cache ) {
+      this->Instruction_Cache->report( Output, "I-cache" );
+   }
+   if ( this->Data_Cache ) {
+      this->Data_Cache->report( Output, "D-cache" );
+   }
+   if ( this->Branches ) {
+      this->Branches->report( Output, this->Instructions );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+cache_timing::cache_timing( cache *Instruction_Cache, cache *Data_Cache ) {
+   this->Instruction_Cache.reset( Instruction_Cache );
+   this->Data_Cache.reset( Data_Cache );
+
+   static_assert( NUM_RV32I_INSTRUCTIONS <= 256, "Accesses is too small." );
+
+   for ( unsigned ID = FIRST_INSTR; ID < NUM_RV32I_INSTRUCTIONS; ++ID ) {
+      instr_access &A = this->Accesses[ID];
+      bool Load;
+      Find_Access( ID, A.Length, Load, A.Store );
+   }
+}
+
+void cache_timing::retire( const decoded_instr &Instruction,
+                           uint32_t,
+                           uint32_t Data_Address ) {
+   if ( this->Instruction_Cache ) {
+      this->Fetch_Stalls +=
+        ( this->Instruction_Cache->access( Instruction.PC,
+                                           Instruction.Length,
+                                           false ) *
+          this->Instruction_Cache->get_config().Miss_Penalty );
+   }
+
+   const instr_access &A = this->Accesses[Instruction.ID];
+
+   // Stores that go straight through to memory are left in a write buffer,
+   // as in the pipeline.
+   if ( this->Data_Cache and A.Length != 0 ) {
+      const cache::config &Cache_Config = this->Data_Cache->get_config();
+      const uint32_t Misses =
+        this->Data_Cache->access( Data_Address, A.Length, A.Store );
+
+      if ( not A.Store or Cache_Config.Write_Back ) {
+         this->Memory_Stalls += ( Misses * Cache_Config.Miss_Penalty );
+      }
+   }
+
+   this->Instructions += 1;
+}
+
+uint64_t cache_timing::get_cycle_count( void ) const {
+   return ( this->Instructions + this->Fetch_Stalls + this->Memory_Stalls );
+}
+
+void cache_timing::report( ostream &Output ) const {
+   const double CPI =
+     ( this->Instructions == 0
+         ? 0.0
+         : double( this->get_cycle_count() ) / double( this->Instructions ) );
+
+   util::Print( Output, "CPI: %.3f\n", CPI );
+   util::Print( Output,
+                "Stall cycles: %llu fetch, %llu memory\n",
+                (unsigned long long) this->Fetch_Stalls,
+                (unsigned long long) this->Memory_Stalls );
+
+   if ( this->Instruction_Cache ) {
+      this->Instruction_Cache->report( Output, "I-cache" );
+   }
+   if ( this->Data_Cache ) {
+      this->Data_Cache->report( Output, "D-cache" );
+   }
+}
@@ -0,0 +1,218 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+
+   Timing models
+
+**************************************************************** */
+
+/*
+   The simulator itself only cares what instructions do. How long they'd take
+   on some particular core is worked out on the side, by a timing model the
+   processor tells about every instruction it retires and every trap it
+   takes. A processor without one (the usual case) runs a loop with no calls
+   to it at all; see processor::Execute_Blocks().
+
+   Timed processors are always interpreted, since compiled blocks don't say
+   what they did one instruction at a time.
+
+   pipeline is the classic five-stage in-order RISC pipeline -- IF, ID, EX,
+   MEM, WB, one instruction per stage -- with everything that can hold it up
+   configurable:
+
+   forwarding=1  Results go straight from EX or MEM to the next instruction's
+                 EX. Off, an instruction has to wait in ID until whatever it
+                 reads has been written back.
+   load=1        Extra cycles before a load's result can be used, with
+                 forwarding: the load-use stall.
+   branch=2      Cycles lost to a taken branch, a JALR or an MRET, which
+                 aren't known until EX. Branches are predicted not taken.
+   jump=1        Cycles lost to a JAL, whose target is known in ID.
+   mul=1         Cycles a multiply spends in EX, holding up everything behind.
+   div=32        Likewise for a divide or remainder.
+   trap=3        Cycles lost flushing the pipeline for a trap or interrupt.
+   predict=0     Off, branches are predicted not taken. On, they go whichever
+                 way the first -bpred predictor says, and returns go where its
+                 return address stack says, for jump= cycles if taken; it's
+                 only the wrong guesses that cost branch= cycles.
+
+   Given to rv32sim as -pipeline key=value,... (which implies -c).
+
+   It can also have L1 instruction and data caches (see cache.h), given as
+   -icache and -dcache along with -c or -pipeline. A fetch that misses holds
+   its instruction up in IF, and a load or store that misses holds everything
+   up in MEM, for the cache's miss penalty -- except for stores to a
+   write-through cache, which are taken to go into a write buffer. And it can
+   have branch predictors watching it (see branch_predictor.h), given as
+   -bpred, which implies -c.
+
+   cache_timing is just the caches, for when the pipeline's hazards aren't
+   wanted, and it costs noticeably less to run. Each instruction takes a
+   cycle, and misses add their penalty as they would in the pipeline. It's
+   what -icache and -dcache get on their own, without -c or -pipeline.
+*/
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "block_cache.h"
+#include "branch_predictor.h"
+#include "cache.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+class timing_model {
+public:
+   virtual ~timing_model() {}
+
+   /// An instruction ran to completion, and the one after it is at Next_PC --
+   /// so a jump, or a branch that was taken, is one whose Next_PC isn't just
+   /// past it. Data_Address is where a load, store or AMO went, and means
+   /// nothing for anything else.
+   virtual void retire( const decoded_instr &Instruction,
+                        uint32_t Next_PC,
+                        uint32_t Data_Address ) = 0;
+
+   /// A trap or interrupt was taken, and the pipeline (or whatever the model
+   /// has) was flushed.
+   virtual void trap( void ) = 0;
+
+   virtual uint64_t get_cycle_count( void ) const = 0;
+
+   /// Describe the run so far, after the cycle count.
+   virtual void report( ostream &Output ) const = 0;
+};
+
+// ----------------------------------------------------------------------------
+
+class pipeline : public timing_model {
+public:
+   struct config {
+      bool Forwarding          = true;
+      uint32_t Load_Use_Cycles = 1;
+      uint32_t Branch_Penalty  = 2;
+      uint32_t Jump_Penalty    = 1;
+      uint32_t Mul_Cycles      = 1;
+      uint32_t Div_Cycles      = 32;
+      uint32_t Trap_Penalty    = 3;
+      bool Predicted           = false;
+
+      /// Set whichever of the above are given as key=value,... (see the top
+      /// of the file). False, saying why in Error, if any of it doesn't make
+      /// sense.
+      bool parse( const string &Spec, string &Error );
+   };
+
+private:
+   config Config;
+
+   // Cycles are numbered from 1, when the first instruction is fetched, so
+   // that's in EX at cycle 3 and finished at cycle 5. Everything is tracked by
+   // when instructions get to EX.
+
+   /// The last cycle the latest instruction spent in EX.
+   uint64_t Last_EX = 2;
+
+   /// The cycle the latest instruction finished WB.
+   uint64_t Last_WB = 0;
+
+   /// The soonest the next instruction can get to EX, as far as fetching it
+   /// goes: straight after the last one, or later after a jump or trap.
+   uint64_t Next_EX = 3;
+
+   /// The soonest an instruction reading each register can get to EX.
+   uint64_t Ready[32] = { 0 };
+
+   /// Whether each register's pending value is coming from a load, to tell
+   /// load-use stalls from other hazards.
+   bool From_Load[32] = { false };
+
+   uint64_t Instructions    = 0;
+   uint64_t Data_Stalls     = 0; // Load-use ones included.
+   uint64_t Load_Use_Stalls = 0;
+   uint64_t Control_Stalls  = 0;
+   uint64_t Execute_Stalls  = 0;
+   uint64_t Fetch_Stalls    = 0;
+   uint64_t Memory_Stalls   = 0;
+   uint64_t Trap_Stalls     = 0;
+
+   /// Either can be missing, in which case every access hits.
+   unique_ptr<cache> Instruction_Cache;
+   unique_ptr<cache> Data_Cache;
+
+   unique_ptr<branch_unit> Branches;
+
+   /// What retire() needs to know about each kind of instruction, worked out
+   /// once up front rather than by switching on it every time.
+   struct instr_timing {
+      uint32_t Execute_Cycles; // Time in EX.
+      uint8_t Access_Length;   // Bytes loaded or stored, or 0.
+      bool Store;              // Including SC.W and the AMOs.
+      bool Load;               // Result only ready after MEM.
+      bool Reads_RS1;
+      bool Reads_RS2;
+      bool Transfers; // Branch, JAL or JALR: one for the predictors.
+   };
+
+   /// Indexed by instr_id, which is a byte.
+   instr_timing Timings[256] = {};
+
+public:
+   /// Takes ownership of the caches and predictors.
+   explicit pipeline( const config &Config,
+                      cache *Instruction_Cache = nullptr,
+                      cache *Data_Cache        = nullptr,
+                      branch_unit *Branches    = nullptr );
+
+   void retire( const decoded_instr &Instruction,
+                uint32_t Next_PC,
+                uint32_t Data_Address ) override;
+   void trap( void ) override;
+
+   uint64_t get_cycle_count( void ) const override;
+   void report( ostream &Output ) const override;
+};
+
+// ----------------------------------------------------------------------------
+
+class cache_timing : public timing_model {
+private:
+   /// Either can be missing, in which case every access hits.
+   unique_ptr<cache> Instruction_Cache;
+   unique_ptr<cache> Data_Cache;
+
+   uint64_t Instructions  = 0;
+   uint64_t Fetch_Stalls  = 0;
+   uint64_t Memory_Stalls = 0;
+
+   /// Bytes each kind of instruction loads or stores, or 0, and whether it
+   /// stores. Indexed by instr_id.
+   struct instr_access {
+      uint8_t Length;
+      bool Store;
+   };
+
+   instr_access Accesses[256] = {};
+
+public:
+   /// Takes ownership of the caches.
+   cache_timing( cache *Instruction_Cache, cache *Data_Cache );
+
+   void retire( const decoded_instr &Instruction,
+                uint32_t Next_PC,
+                uint32_t Data_Address ) override;
+
+   /// Traps cost nothing, there being no pipeline to flush.
+   void trap( void ) override {}
+
+   uint64_t get_cycle_count( void ) const override;
+   void report( ostream &Output ) const override;
+};
+
+#endif
@@ -0,0 +1,458 @@
+/*
+   In-process test runner. Does what Run_Tests.py does -- runs every .cmd
+   script in tests/{category}_tests and compares its output with the log of
+   the same name in expected/ -- but without starting a process per test. Each
+   test gets its own memory and processor, with their output going to a
+   string, and the tests are shared out between a few threads.
+
+   Results are reported in the same order every time, with the same Pass,
+   Fail, Assert and Crash categories. A test that trips an assert() or
+   crashes is stopped with a signal handler that jumps back into the runner,
+   and its memory and processor are left to leak, since they may be in any
+   state. A crash that corrupts the runner itself will still take the whole
+   thing down; Run_Tests.py is the fallback for chasing those.
+
+   Build with `make run_tests`, and run ./run_tests next to the tests
+   directory. --help lists the options, which are Run_Tests.py's plus --jobs
+   and --tests. Unlike Run_Tests.py, it exits with 1 if anything failed.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <csetjmp>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#include "commands.h"
+#include "harts.h"
+#include "memory.h"
+#include "processor.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+struct options {
+   string Test_Root = "./tests";
+   string Specific_Test;
+   bool Run_All       = false;
+   bool Be_Silent     = false;
+   bool Be_Noisy      = false;
+   bool Be_Verbose    = false;
+   bool Show_Commands = false;
+   bool Stage2_Only   = false;
+   bool Show_Bytes    = false;
+   bool Use_JIT       = false;
+   unsigned Jobs      = max( 1u, thread::hardware_concurrency() );
+};
+
+enum test_result { TEST_PASS, TEST_FAIL, TEST_ASSERT, TEST_CRASH };
+
+struct test_case {
+   string Name;
+   string Directory; // The category's, which file names are relative to.
+   bool Stage2;
+
+   // Filled in when it's run.
+   test_result Result = TEST_FAIL;
+   int Signal         = 0;
+   string Input, Output, Expected;
+};
+
+// ----------------------------------------------------------------------------
+
+/*
+   Recovering from asserts and crashes. Each worker points Recovery at a jump
+   buffer while it runs a test; the handler jumps back there, or, if it's not
+   set, puts the default action back and lets the signal happen again.
+*/
+
+static thread_local sigjmp_buf *Recovery = nullptr;
+
+static void Recover( int Signal ) {
+   if ( Recovery ) {
+      siglongjmp( *Recovery, Signal );
+   }
+
+   signal( Signal, SIG_DFL );
+   raise( Signal );
+}
+
+static const int Recoverable_Signals[] = { SIGABRT, SIGSEGV, SIGBUS, SIGFPE,
+                                           SIGILL };
+
+static void Install_Signal_Handlers( void ) {
+   struct sigaction Action;
+   memset( &Action, 0, sizeof( Action ) );
+   Action.sa_handler = Recover;
+   Action.sa_flags   = SA_ONSTACK | SA_NODEFER;
+   sigemptyset( &Action.sa_mask );
+
+   for ( const int Signal : Recoverable_Signals ) {
+      sigaction( Signal, &Action, nullptr );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+static bool Read_File( const string &File_Name, string &Contents ) {
+   ifstream File( File_Name, ios::binary );
+   if ( not File ) {
+      return false;
+   }
+
+   ostringstream Buffer;
+   Buffer << File.rdbuf();
+   Contents = Buffer.str();
+   return true;
+}
+
+/// What Run_Tests.py compares: CRLFs made LFs, and trimmed.
+static string Sanitise( string S ) {
+   string Result;
+   for ( size_t I = 0; I < S.size(); ++I ) {
+      if ( not( S[I] == '\r' and I + 1 < S.size() and S[I + 1] == '\n' ) ) {
+         Result += S[I];
+      }
+   }
+
+   const char *Space = " \t\r\n\f\v";
+   const size_t First = Result.find_first_not_of( Space );
+   if ( First == string::npos ) {
+      return "";
+   }
+   return Result.substr( First, Result.find_last_not_of( Space ) - First + 1 );
+}
+
+static bool Is_Directory( const string &Path ) {
+   struct stat Info;
+   return stat( Path.c_str(), &Info ) == 0 and S_ISDIR( Info.st_mode );
+}
+
+/// Names in the given directory, sorted.
+static vector<string> List_Directory( const string &Path ) {
+   vector<string> Names;
+
+   if ( DIR *Directory = opendir( Path.c_str() ) ) {
+      while ( const dirent *Entry = readdir( Directory ) ) {
+         if ( Entry->d_name[0] != '.' ) {
+            Names.push_back( Entry->d_name );
+         }
+      }
+      closedir( Directory );
+   }
+
+   sort( Names.begin(), Names.end() );
+   return Names;
+}
+
+static vector<test_case> Find_Tests( const options &Options ) {
+   vector<test_case> Tests;
+
+   for ( const auto &Category : List_Directory( Options.Test_Root ) ) {
+      const string Directory = Options.Test_Root + "/" + Category;
+
+      if ( not Is_Directory( Directory ) or
+           ( Options.Stage2_Only and Category != "stage_2_tests" ) ) {
+         continue;
+      }
+
+      for ( const auto &File : List_Directory( Directory ) ) {
+         const size_t Suffix = File.rfind( ".cmd" );
+         if ( Suffix == string::npos or Suffix + 4 != File.size() ) {
+            continue;
+         }
+
+         test_case Test;
+         Test.Name      = File.substr( 0, Suffix );
+         Test.Directory = Directory;
+         Test.Stage2    = ( Category == "stage_2_tests" );
+
+         if ( Options.Specific_Test.empty() or
+              Test.Name == Options.Specific_Test ) {
+            Tests.push_back( Test );
+         }
+      }
+   }
+
+   return Tests;
+}
+
+// ----------------------------------------------------------------------------
+
+static void Run_Test( test_case &Test, const options &Options ) {
+   if ( not Read_File( Test.Directory + "/" + Test.Name + ".cmd",
+                       Test.Input ) or
+        not Read_File( Test.Directory + "/expected/" + Test.Name + ".log",
+                       Test.Expected ) ) {
+      Test.Output = "(couldn't read the test or its expected log)";
+      Test.Result = TEST_FAIL;
+      return;
+   }
+
+   istringstream Input( Test.Input );
+   ostringstream Output;
+
+   // Heap-allocated, so they can be abandoned if the test crashes.
+   unique_ptr<memory> Memory( new memory( Options.Be_Verbose ) );
+   unique_ptr<harts> CPU( new harts(
+     Memory.get(), 1, Options.Be_Verbose, Test.Stage2, Options.Use_JIT ) );
+
+   Memory->set_output( Output );
+   ( *CPU )[0].set_output( Output );
+
+   sigjmp_buf Jump;
+   const int Signal = sigsetjmp( Jump, 1 );
+
+   if ( Signal == 0 ) {
+      Recovery = &Jump;
+      interpret_commands( Memory.get(),
+                          CPU.get(),
+                          Options.Be_Verbose,
+                          Input,
+                          Output,
+                          Test.Directory );
+
+      // As main() does.
+      Output << "Instructions executed: " << dec << CPU->get_instruction_count()
+             << endl;
+   }
+
+   Recovery    = nullptr;
+   Test.Output = Output.str();
+   Test.Signal = Signal;
+
+   if ( Signal != 0 ) {
+      Memory.release();
+      CPU.release();
+      Test.Result = ( Signal == SIGABRT ? TEST_ASSERT : TEST_CRASH );
+   } else {
+      Test.Result = ( Sanitise( Test.Output ) == Sanitise( Test.Expected )
+                        ? TEST_PASS
+                        : TEST_FAIL );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+static string Escape( const string &Bytes ) {
+   string Result;
+   char Hex[8];
+   for ( const char C : Bytes ) {
+      if ( C == '\n' ) {
+         Result += "\\n";
+      } else if ( C == '\r' ) {
+         Result += "\\r";
+      } else if ( C < ' ' or C > '~' ) {
+         snprintf( Hex, sizeof( Hex ), "\\x%02x", uint8_t( C ) );
+         Result += Hex;
+      } else {
+         Result += C;
+      }
+   }
+   return Result;
+}
+
+static void Show_Logs( const test_case &Test, const options &Options ) {
+   printf( YELLOW( "Received Stdout" ) ":\n%s\n" YELLOW( "End" ) "\n",
+           Test.Output.c_str() );
+   printf( GREEN( "Expected Stdout" ) ":\n%s\n" GREEN( "End" ) "\n",
+           Test.Expected.c_str() );
+
+   if ( Options.Show_Bytes ) {
+      printf( BLUE( "Stdout Bytes" ) ":\n%s\n" BLUE( "End" ) "\n",
+              Escape( Test.Output ).c_str() );
+      printf( BLUE( "Expected Stdout Bytes" ) ":\n%s\n" BLUE( "End" ) "\n",
+              Escape( Test.Expected ).c_str() );
+   }
+
+   if ( Options.Show_Commands ) {
+      printf( YELLOW( "Commands" ) ":\n%s\n" YELLOW( "End" ) "\n",
+              Test.Input.c_str() );
+   }
+
+   if ( Test.Signal != 0 ) {
+      printf( "Note: rv32sim was stopped by signal %d (%s)\n",
+              Test.Signal,
+              strsignal( Test.Signal ) );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+static bool Parse_Options( int argc, char **argv, options &Options ) {
+   for ( int I = 1; I < argc; ++I ) {
+      const string Arg       = argv[I];
+      const bool Has_Value   = ( I + 1 < argc );
+
+      if ( Arg == "--test" and Has_Value ) {
+         Options.Specific_Test = argv[++I];
+      } else if ( Arg == "--tests" and Has_Value ) {
+         Options.Test_Root = argv[++I];
+      } else if ( Arg == "--jobs" and Has_Value ) {
+         Options.Jobs = max( 1, atoi( argv[++I] ) );
+      } else if ( Arg == "--all" ) {
+         Options.Run_All = true;
+      } else if ( Arg == "--silent" ) {
+         Options.Be_Silent = true;
+      } else if ( Arg == "--noisy" ) {
+         Options.Be_Noisy = true;
+      } else if ( Arg == "--verbose" ) {
+         Options.Be_Verbose = true;
+      } else if ( Arg == "--commands" ) {
+         Options.Show_Commands = true;
+      } else if ( Arg == "--stage2" ) {
+         Options.Stage2_Only = true;
+      } else if ( Arg == "--bytes" ) {
+         Options.Show_Bytes = true;
+      } else if ( Arg == "--jit" ) {
+         Options.Use_JIT = true;
+      } else {
+         printf( "usage: %s [--test NAME] [--tests DIR] [--jobs N] [--all]\n"
+                 "       [--silent | --noisy] [--verbose] [--commands]\n"
+                 "       [--stage2] [--bytes] [--jit]\n",
+                 argv[0] );
+         return false;
+      }
+   }
+
+   if ( Options.Be_Silent and Options.Be_Noisy ) {
+      printf( "You've set --silent and --noisy at the same time. Pick one.\n" );
+      return false;
+   }
+
+   // Verbose logs all go to stderr, so don't interleave them.
+   if ( Options.Be_Verbose ) {
+      Options.Jobs = 1;
+   }
+
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+
+int main( int argc, char **argv ) {
+   options Options;
+   if ( not Parse_Options( argc, argv, Options ) ) {
+      return 1;
+   }
+
+   if ( not Is_Directory( Options.Test_Root ) ) {
+      printf( "Can't find the test directory! Please place it at '%s'\n",
+              Options.Test_Root.c_str() );
+      return 1;
+   }
+
+   vector<test_case> Tests = Find_Tests( Options );
+
+   if ( Tests.empty() ) {
+      printf( RED( "No tests run." ) "\n" );
+      if ( not Options.Specific_Test.empty() ) {
+         printf( "Couldn't find test '%s'\n", Options.Specific_Test.c_str() );
+      }
+      return 1;
+   }
+
+   Install_Signal_Handlers();
+
+   // Workers take the next test in line and mark it done; the main thread
+   // reports them in order as they finish.
+   atomic<size_t> Next_Test( 0 );
+   atomic<bool> Stop( false );
+   vector<char> Done( Tests.size(), false );
+   mutex Done_Mutex;
+   condition_variable Test_Done;
+
+   const auto Worker = [&]() {
+      // Somewhere for the signal handler to run if the stack overflows.
+      vector<char> Signal_Stack( 1 << 16 );
+      stack_t Stack;
+      Stack.ss_sp    = Signal_Stack.data();
+      Stack.ss_size  = Signal_Stack.size();
+      Stack.ss_flags = 0;
+      sigaltstack( &Stack, nullptr );
+
+      while ( not Stop ) {
+         const size_t I = Next_Test++;
+         if ( I >= Tests.size() ) {
+            break;
+         }
+
+         Run_Test( Tests[I], Options );
+
+         lock_guard<mutex> Lock( Done_Mutex );
+         Done[I] = true;
+         Test_Done.notify_one();
+      }
+
+      Stack.ss_flags = SS_DISABLE;
+      sigaltstack( &Stack, nullptr );
+   };
+
+   vector<thread> Workers;
+   for ( unsigned J = 0; J < min<size_t>( Options.Jobs, Tests.size() ); ++J ) {
+      Workers.emplace_back( Worker );
+   }
+
+   unsigned Num_Passes = 0, Num_Failures = 0;
+   bool First_Failure  = true;
+
+   for ( size_t I = 0; I < Tests.size(); ++I ) {
+      {
+         unique_lock<mutex> Lock( Done_Mutex );
+         Test_Done.wait( Lock, [&]() { return Done[I] != 0; } );
+      }
+
+      const test_case &Test = Tests[I];
+      const bool Passed     = ( Test.Result == TEST_PASS );
+
+      const char *Prefix = GREEN( " Pass " );
+      switch ( Test.Result ) {
+         case TEST_PASS: break;
+         case TEST_FAIL: Prefix = RED( " Fail " ); break;
+         case TEST_ASSERT: Prefix = RED( "Assert" ); break;
+         case TEST_CRASH: Prefix = YELLOW( "Crash " ); break;
+      }
+
+      printf( "[%s]:  %s\n", Prefix, Test.Name.c_str() );
+      ( Passed ? Num_Passes : Num_Failures ) += 1;
+
+      if ( Options.Be_Noisy or
+           ( not Passed and not Options.Be_Silent and First_Failure ) ) {
+         Show_Logs( Test, Options );
+      }
+
+      if ( not Passed ) {
+         First_Failure = false;
+
+         if ( not Options.Run_All ) {
+            printf( RED( "Quitting on first test failure." ) "\n" );
+            Stop = true;
+            break;
+         }
+      }
+   }
+
+   for ( auto &Worker_Thread : Workers ) {
+      Worker_Thread.join();
+   }
+
+   const unsigned Num_Runs = Num_Passes + Num_Failures;
+   printf( "%u/%u tests passed (%.1f%%).\n",
+           Num_Passes,
+           Num_Runs,
+           100.0 * Num_Passes / Num_Runs );
+
+   return ( Num_Failures == 0 ? 0 : 1 );
+}
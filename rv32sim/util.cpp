@@ -4,8 +4,10 @@
   header to be usable. So only the unit tests live in here.
  */
 
+#include <cstdio>
 #include <cstdlib>
 #include <string>
+#include <vector>
 
 #include "csr.h"
 #include "util.h"
@@ -159,3 +161,92 @@ std::string util::Mstatus_To_String( mstatus M ) {
 
    return std::string( Base_Str );
 }
+
+// ----------------------------------------------------------------------------
+
+void util::Print( ostream &Output, const char *Format, ... ) {
+   va_list Arguments;
+   va_start( Arguments, Format );
+   VPrint( Output, Format, Arguments );
+   va_end( Arguments );
+}
+
+void util::VPrint( ostream &Output, const char *Format, va_list Arguments ) {
+   // Everything printed is a line or so, so this is almost always enough.
+   char Buffer[256];
+
+   va_list Copy;
+   va_copy( Copy, Arguments );
+   const int Length = vsnprintf( Buffer, sizeof( Buffer ), Format, Arguments );
+
+   if ( Length < 0 ) {
+      va_end( Copy );
+      return;
+   }
+
+   if ( size_t( Length ) < sizeof( Buffer ) ) {
+      Output.write( Buffer, Length );
+   } else {
+      vector<char> Longer( size_t( Length ) + 1 );
+      vsnprintf( Longer.data(), Longer.size(), Format, Copy );
+      Output.write( Longer.data(), Length );
+   }
+
+   va_end( Copy );
+}
+
+// ----------------------------------------------------------------------------
+
+bool util::Parse_Settings( const string &Spec,
+                           string &Error,
+                           const setter &Set ) {
+   size_t Start = 0;
+
+   while ( Start < Spec.size() ) {
+      size_t End = Spec.find( ',', Start );
+      if ( End == string::npos ) {
+         End = Spec.size();
+      }
+
+      const string Setting = Spec.substr( Start, End - Start );
+      Start                = End + 1;
+
+      // A key on its own has an empty value.
+      const size_t Equals = min( Setting.find( '=' ), Setting.size() );
+      const string Value  = Setting.substr( min( Equals + 1, Setting.size() ) );
+
+      Error.clear();
+      if ( not Set( Setting.substr( 0, Equals ), Value, Error ) ) {
+         if ( Error.empty() ) {
+            Error = "don't understand \"" + Setting + "\"";
+         }
+         return false;
+      }
+   }
+
+   return true;
+}
+
+bool util::Parse_Size( const string &Text, uint32_t &Value ) {
+   char *Rest;
+   unsigned long long Number = strtoull( Text.c_str(), &Rest, 10 );
+
+   if ( Rest == Text.c_str() or Text[0] == '-' or Number > 0xFFFFFFFFull ) {
+      return false;
+   }
+
+   switch ( *Rest ) {
+      case 'k':
+      case 'K': Number *= 1024; ++Rest; break;
+      case 'm':
+      case 'M': Number *= 1024 * 1024; ++Rest; break;
+      default: break;
+   }
+
+   if ( *Rest != '\0' or Number > 0xFFFFFFFFull ) {
+      return false;
+   }
+
+   Value = uint32_t( Number );
+   return true;
+}
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <cassert>
+#include <cstdarg>
 #include <cstdint>
+#include <functional>
+#include <ostream>
 #include <string>
 
 #include "csr.h"
@@ -192,6 +195,25 @@ namespace util {
    /// Return a readable description of the contents of the given Mstatus.
    string Mstatus_To_String( mstatus M );
 
+   /// printf() to the given stream. Output that used to go to stdout goes
+   /// through this, so each processor can have its own. See processor::print().
+   void Print( ostream &Output, const char *Format, ... )
+     __attribute__( ( format( printf, 2, 3 ) ) );
+
+   void VPrint( ostream &Output, const char *Format, va_list Arguments );
+
+   /// Go through a comma-separated list of key=value settings, like the ones
+   /// -pipeline and -icache take, handing each to Set (with an empty Value for
+   /// a key on its own). Set returns false, and may say why in Error, if it
+   /// doesn't like one. Returns false if anything was wrong.
+   using setter =
+     function<bool( const string &Key, const string &Value, string &Error )>;
+   bool Parse_Settings( const string &Spec, string &Error, const setter &Set );
+
+   /// A decimal number, optionally followed by k (times 1024) or m (times 1024
+   /// squared). False if it isn't one, or won't fit in 32 bits.
+   bool Parse_Size( const string &Text, uint32_t &Value );
+
    // Some useful things to assert
 
    constexpr bool Unreachable = false;